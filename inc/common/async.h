@@ -18,23 +18,37 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
-#if USE_CLIENT
+#include "shared/list.h"
+
+#define ASYNC_MAX_WORKERS   64
+
+typedef enum {
+    ASYNC_PRIO_LOW = -1,
+    ASYNC_PRIO_NORMAL,
+    ASYNC_PRIO_HIGH,
+} asyncprio_t;
+
+// 0 is never a valid handle
+typedef unsigned asynchandle_t;
 
 typedef struct asyncwork_s {
-    void (*work_cb)(void *);
-    void (*done_cb)(void *);
+    void (*work_cb)(void *);        // called from worker thread
+    void (*done_cb)(void *);        // called from main thread
+    void (*cancel_cb)(void *);      // called from main thread if cancelled
     void *cb_arg;
-    struct asyncwork_s *next;
+    asyncprio_t priority;
+
+    // private
+    asynchandle_t handle;
+    int queue;
+    bool batch;
+    list_t entry;
 } asyncwork_t;
 
-void Com_QueueAsyncWork(asyncwork_t *work);
+void Com_InitAsyncWork(void);
+asynchandle_t Com_QueueAsyncWork(asyncwork_t *work);
+bool Com_CancelAsyncWork(asynchandle_t handle);
 void Com_CompleteAsyncWork(void);
+int Com_AsyncWorkers(void);
+void Com_ParallelFor(int count, void (*func)(void *, int), void *arg);
 void Com_ShutdownAsyncWork(void);
-
-#else
-
-#define Com_QueueAsyncWork(work)    (void)0
-#define Com_CompleteAsyncWork()     (void)0
-#define Com_ShutdownAsyncWork()     (void)0
-
-#endif
@@ -157,10 +157,21 @@ typedef struct {
     mtexinfo_t          *texinfo;
 } mbrushside_t;
 
+// brush side planes are also stored in groups of BRUSH_GROUP_SIDES sides,
+// as normal[0][4], normal[1][4], normal[2][4] and dist[4] arrays. unused
+// sides of the last group have zero normal and distance.
+#define BRUSH_GROUP_SIDES   4
+#define BRUSH_GROUP_FLOATS  (BRUSH_GROUP_SIDES * 4)
+
+// component 0-2 is normal, 3 is dist
+#define BRUSH_SIDE_PLANE(planes, side, comp) \
+    (planes)[(side) / BRUSH_GROUP_SIDES * BRUSH_GROUP_FLOATS + (comp) * BRUSH_GROUP_SIDES + (side) % BRUSH_GROUP_SIDES]
+
 typedef struct {
     int                 contents;
     int                 numsides;
     mbrushside_t        *firstbrushside;
+    float               *sideplanes;        // NULL if brush has no sides
     unsigned            checkcount;         // to avoid repeated testings
 } mbrush_t;
 
@@ -254,6 +265,7 @@ typedef struct bsp_s {
 
     int             numvisibility;
     int             visrowsize;
+    unsigned        vischecksum;    // of the original vis lump
     dvis_t          *vis;
 
     int             numentitychars;
@@ -296,8 +308,11 @@ typedef struct bsp_s {
 
 	byte            *pvs_matrix;
 	byte            *pvs2_matrix;
+	byte            *phs_matrix;
 	bool            pvs_patched;
 
+    float           *brushplanes;   // sideplanes of all brushes
+
     bool            extended;
 
 	// WARNING: the 'name' string is actually longer than this, and the bsp_t structure is allocated larger than sizeof(bsp_t) in BSP_Load
@@ -331,6 +346,7 @@ mmodel_t *BSP_InlineModel(bsp_t *bsp, const char *name);
 
 byte* BSP_GetPvs(bsp_t *bsp, int cluster);
 byte* BSP_GetPvs2(bsp_t *bsp, int cluster);
+byte* BSP_GetPhs(bsp_t *bsp, int cluster);
 
 bool BSP_SavePatchedPVS(bsp_t *bsp);
 
@@ -0,0 +1,47 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "common/files.h"
+#include "common/zone.h"
+
+//
+// Demo index is appended after the end of DM2 or MVD2 demo stream, where
+// players not aware of it stop reading. It holds snapshots in the same form
+// players build them while seeking: a fake demo packet restoring the state
+// at given frame, and position of the following message.
+//
+// Layout, all little endian:
+//
+// snapshot[count]  int32 framenum, int64 filepos, uint32 msglen, data
+// footer           uint32 count, uint32 size of snapshots, uint32 magic
+//
+
+#define DEMO_INDEX_MAGIC    MakeRawLong('D','I','D','X')
+#define DEMO_INDEX_FOOTER   12
+#define DEMO_INDEX_HEADER   16      // per snapshot
+
+typedef struct {
+    int         framenum;
+    int64_t     filepos;
+    size_t      msglen;
+    byte        data[1];
+} demosnap_t;
+
+int Demo_ReadIndex(qhandle_t f, demosnap_t ***snapshots, int64_t *end, memtag_t tag);
+int Demo_WriteIndex(qhandle_t f, demosnap_t **snapshots, int count);
+void Demo_FreeSnapshots(demosnap_t ***snapshots, int *count);
@@ -42,7 +42,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define FS_LoadFile(path, buf)  FS_LoadFileEx(path, buf, 0, TAG_FILESYSTEM)
 #define FS_LoadFileFlags(path, buf, flags)  \
                                 FS_LoadFileEx(path, buf, (flags), TAG_FILESYSTEM)
-#define FS_FreeFile(buf)        Z_Free(buf)
 
 // just regular malloc for now
 #define FS_AllocTempMem(size)   FS_Malloc(size)
@@ -82,6 +81,16 @@ int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
 // a NULL buffer will just return the file length without loading
 // length < 0 indicates error
 
+int FS_LoadFileView(const char *path, const void **buffer, unsigned flags);
+// buffer may point into mapped pack and is not NUL terminated then
+
+void FS_FreeFile(const void *buffer);
+// frees buffer returned by either of the above
+
+void FS_PrefetchFiles(const char **names, int count);
+void FS_FreePrefetched(void);
+// inflates files on worker threads ahead of loading them
+
 int FS_WriteFile(const char *path, const void *data, size_t len);
 
 bool FS_EasyWriteFile(char *buf, size_t size, unsigned mode,
@@ -87,10 +87,12 @@ typedef enum {
     MSG_ES_REMOVE       = BIT(8),   // entity is removed (MVD stream only)
 } msgEsFlags_t;
 
-extern sizebuf_t    msg_write;
+// each thread has its own writing and reading buffers, worker threads must
+// initialize theirs before use
+extern q_thread_local sizebuf_t msg_write;
 extern byte         msg_write_buffer[MAX_MSGLEN];
 
-extern sizebuf_t    msg_read;
+extern q_thread_local sizebuf_t msg_read;
 extern byte         msg_read_buffer[MAX_MSGLEN];
 
 extern const entity_packed_t    nullEntityState;
@@ -98,6 +100,7 @@ extern const player_packed_t    nullPlayerState;
 extern const usercmd_t          nullUserCmd;
 
 void    MSG_Init(void);
+void    MSG_RegisterCommands(void);
 
 void    MSG_BeginWriting(void);
 void    MSG_WriteChar(int c);
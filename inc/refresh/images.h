@@ -46,6 +46,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define U32_ALPHA   MakeColor(  0,   0,   0, 255)
 #define U32_RGB     MakeColor(255, 255, 255,   0)
 
+#define IMG_CACHE_KEY   16
+
 // absolute limit for OpenGL renderer
 #define MAX_TEXTURE_SIZE    4096
 
@@ -77,6 +79,7 @@ typedef struct image_s {
 	char            filepath[MAX_QPATH]; // actual path loaded, with correct format extension
 	int             is_srgb;
 	uint64_t        last_modified;
+    byte            cache_key[IMG_CACHE_KEY]; // source data hash, zero if not cached
 #if REF_GL
     unsigned        texnum; // gl texture binding
     float           sl, sh, tl, th;
@@ -121,10 +124,18 @@ image_t *IMG_ForHandle(qhandle_t h);
 
 int IMG_GetDimensions(const char* name, int16_t* width, int16_t* height);
 
+int IMG_Unpack8(uint32_t *out, const uint8_t *in, int width, int height);
 void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
                          byte *out, int outwidth, int outheight);
 void IMG_MipMap(byte *out, byte *in, int width, int height);
 
+// disables SIMD versions of the above, for comparing results
+extern bool img_force_scalar;
+
+void IMG_DeriveCacheKey(byte *key, const byte *base, uint32_t param);
+bool IMG_ReadCache(const byte *key, image_t *image, byte **pic);
+void IMG_WriteCache(const byte *key, const image_t *image, const byte *pic);
+
 // these are implemented in src/refresh/[gl,sw]/images.c
 extern void (*IMG_Unload)(image_t *image);
 extern void (*IMG_Load)(image_t *image, byte *pic);
@@ -277,7 +277,15 @@ typedef game_export_t *(*game_entry_t)(game_import_t *);
  * game_export_ex_t structures, provided GAME_API_VERSION_EX is also bumped.
  */
 
-#define GAME_API_VERSION_EX     1
+#define GAME_API_VERSION_EX     2
+
+// single trace in a batch, same arguments as gi.trace()
+typedef struct {
+    vec3_t      start, end;
+    vec3_t      mins, maxs;
+    edict_t     *passent;
+    int         contentmask;
+} trace_request_t;
 
 typedef struct {
     int     apiversion;
@@ -298,6 +306,12 @@ typedef struct {
 
     const char *(*ErrorString)(int error);
     void    *(*TagRealloc)(void *ptr, size_t size);
+
+    // API version 2
+
+    // runs independent traces, possibly in different order. results are
+    // identical to calling gi.trace() for each request.
+    void    (*TraceBatch)(const trace_request_t *requests, trace_t *results, int count);
 } game_import_ex_t;
 
 typedef struct {
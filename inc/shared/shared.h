@@ -432,6 +432,21 @@ static inline uint16_t Q_clip_uint16(int a)
 #define Q_SetBit(data, bit)     ((data)[(bit) >> 3] |= (1 << ((bit) & 7)))
 #define Q_ClearBit(data, bit)   ((data)[(bit) >> 3] &= ~(1 << ((bit) & 7)))
 
+// returns index of the lowest set bit, v must be non-zero
+static inline int Q_ctz64(uint64_t v)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(v);
+#else
+    int i = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
 //=============================================
 
 // fast "C" macros
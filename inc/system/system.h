@@ -34,7 +34,9 @@ void    Sys_FreeLibrary(void *handle);
 void    *Sys_GetProcAddress(void *handle, const char *sym);
 
 unsigned Sys_Milliseconds(void);
+uint64_t Sys_Microseconds(void);
 void     Sys_Sleep(int msec);
+int      Sys_GetNumCPUs(void);
 
 void    Sys_Init(void);
 void    Sys_AddDefaultConfig(void);
@@ -62,6 +64,10 @@ void    Sys_ListFiles_r(listfiles_t *list, const char *path, int depth);
 bool    Sys_IsDir(const char *path);
 bool    Sys_IsFile(const char *path);
 
+// maps first `size' bytes of open file read-only, returns NULL on failure
+void    *Sys_MapFile(FILE *fp, size_t size);
+void    Sys_UnmapFile(void *data, size_t size);
+
 void    Sys_DebugBreak(void);
 
 #if USE_AC_CLIENT
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmd.h"
 #include "common/cmodel.h"
 #include "common/common.h"
+#include "common/demoindex.h"
 #include "common/cvar.h"
 #include "common/field.h"
 #include "common/files.h"
@@ -393,13 +394,6 @@ typedef struct {
     char        path[1];
 } dlqueue_t;
 
-typedef struct {
-    int         framenum;
-    int64_t     filepos;
-    size_t      msglen;
-    byte        data[1];
-} demosnap_t;
-
 typedef struct client_static_s {
     connstate_t state;
     keydest_t   key_dest;
@@ -498,6 +492,12 @@ typedef struct client_static_s {
         sizebuf_t   buffer;
         demosnap_t  **snapshots;
         int         numsnapshots;
+        demosnap_t  **keyframes;        // snapshots of recorded demo for index
+        int         numkeyframes;
+        int         last_keyframe;      // number of demo frame the last keyframe was saved
+        configstring_t  *keyframe_cs;   // configstrings as of first recorded frame
+        char        path[MAX_OSPATH];   // of demo being played
+        bool        indexed;
         bool        paused;
         bool        seeking;
         bool        eof;
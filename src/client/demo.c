@@ -22,9 +22,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "client.h"
 
+#define MIN_SNAPSHOTS   64
+#define MAX_SNAPSHOTS   250000000
+
 static byte     demo_buffer[MAX_MSGLEN];
 
 static cvar_t   *cl_demosnaps;
+static cvar_t   *cl_demoindex;
 static cvar_t   *cl_demomsglen;
 static cvar_t   *cl_demowait;
 static cvar_t   *cl_demosuspendtoggle;
@@ -39,6 +43,8 @@ Dumps the current demo message, prefixed by the length.
 Stops demo recording and returns false on write error.
 ====================
 */
+static void emit_demo_keyframe(void);
+
 bool CL_WriteDemoMessage(sizebuf_t *buf)
 {
     uint32_t msglen;
@@ -64,6 +70,10 @@ bool CL_WriteDemoMessage(sizebuf_t *buf)
     Com_DDPrintf("%s: wrote %zu bytes\n", __func__, buf->cursize);
 
     SZ_Clear(buf);
+
+    if (buf == &cls.demo.buffer)
+        emit_demo_keyframe();
+
     return true;
 
 fail:
@@ -226,9 +236,79 @@ void CL_EmitDemoFrame(void)
         SZ_Write(&cls.demo.buffer, msg_write.data, msg_write.cursize);
         cls.demo.last_server_frame = cl.frame.number;
         cls.demo.frames_written++;
+
+        // player saves base configstrings at the same point
+        if (cls.demo.frames_written == 1 && cls.demo.keyframe_cs)
+            memcpy(cls.demo.keyframe_cs, cl.configstrings, sizeof(cl.configstrings[0]) * cl.csr.end);
+    }
+
+    SZ_Clear(&msg_write);
+}
+
+/*
+====================
+emit_demo_keyframe
+
+Saves a snapshot for demo index once the frame is written, in the same form
+player builds it while seeking. Frame is sent uncompressed, next frame in
+demo file is delta compressed from it.
+====================
+*/
+static void emit_demo_keyframe(void)
+{
+    demosnap_t *snap;
+    int64_t pos;
+    char *s;
+    size_t len;
+    int i;
+
+    if (!cls.demo.keyframe_cs || cls.demo.frames_written < 1)
+        return;
+
+    if (cls.demo.last_server_frame != cl.frame.number)
+        return;
+
+    if (cls.demo.frames_written < cls.demo.last_keyframe + cl_demoindex->integer * 10)
+        return;
+
+    if (msg_write.cursize)
+        return;
+
+    pos = FS_Tell(cls.demo.recording);
+    if (pos < 0)
+        return;
+
+    emit_delta_frame(NULL, &cl.frame, -1, cls.demo.frames_written);
+
+    // write configstrings
+    for (i = 0; i < cl.csr.end; i++) {
+        s = cl.configstrings[i];
+        if (!strcmp(s, cls.demo.keyframe_cs[i]))
+            continue;
+
+        len = Q_strnlen(s, MAX_QPATH);
+        MSG_WriteByte(svc_configstring);
+        MSG_WriteShort(i);
+        MSG_WriteData(s, len);
+        MSG_WriteByte(0);
     }
 
+    // write layout
+    MSG_WriteByte(svc_layout);
+    MSG_WriteString(cl.layout);
+
+    snap = Z_Malloc(sizeof(*snap) + msg_write.cursize - 1);
+    snap->framenum = cls.demo.frames_written;
+    snap->filepos = pos;
+    snap->msglen = msg_write.cursize;
+    memcpy(snap->data, msg_write.data, msg_write.cursize);
+
+    cls.demo.keyframes = Z_Realloc(cls.demo.keyframes, sizeof(snap) * ALIGN(cls.demo.numkeyframes + 1, MIN_SNAPSHOTS));
+    cls.demo.keyframes[cls.demo.numkeyframes++] = snap;
+
     SZ_Clear(&msg_write);
+
+    cls.demo.last_keyframe = cls.demo.frames_written;
 }
 
 static size_t format_demo_size(char *buffer, size_t size)
@@ -273,6 +353,7 @@ void CL_Stop_f(void)
 {
     uint32_t msglen;
     char buffer[MAX_QPATH];
+    int ret;
 
     if (!cls.demo.recording) {
         Com_Printf("Not recording a demo.\n");
@@ -283,6 +364,13 @@ void CL_Stop_f(void)
     msglen = (uint32_t)-1;
     FS_Write(&msglen, 4, cls.demo.recording);
 
+// append index
+    if (cls.demo.numkeyframes) {
+        ret = Demo_WriteIndex(cls.demo.recording, cls.demo.keyframes, cls.demo.numkeyframes);
+        if (ret)
+            Com_EPrintf("Couldn't write demo index: %s\n", Q_ErrorString(ret));
+    }
+
     format_demo_size(buffer, sizeof(buffer));
 
 // close demofile
@@ -292,6 +380,8 @@ void CL_Stop_f(void)
     cls.demo.frames_written = 0;
     cls.demo.frames_dropped = 0;
     cls.demo.others_dropped = 0;
+    Demo_FreeSnapshots(&cls.demo.keyframes, &cls.demo.numkeyframes);
+    Z_Freep((void **)&cls.demo.keyframe_cs);
 
 // print some statistics
     Com_Printf("Stopped demo (%s).\n", buffer);
@@ -326,7 +416,7 @@ static void CL_Record_f(void)
     entity_packed_t pack;
     char            *s;
     qhandle_t       f;
-    unsigned        mode = FS_MODE_WRITE;
+    unsigned        mode = FS_MODE_WRITE | FS_FLAG_ASYNC;
     size_t          size = Cvar_ClampInteger(
                                cl_demomsglen,
                                MIN_PACKETLEN,
@@ -387,6 +477,12 @@ static void CL_Record_f(void)
     // the first frame will be delta uncompressed
     cls.demo.last_server_frame = -1;
 
+    // compressed demos are not seekable anyway
+    if (cl_demoindex->integer > 0 && !(mode & FS_FLAG_GZIP)) {
+        cls.demo.keyframe_cs = Z_Malloc(sizeof(cl.configstrings[0]) * cl.csr.end);
+        cls.demo.last_keyframe = INT_MIN;
+    }
+
     if (cl.csr.extended)
         size = MAX_MSGLEN;
 
@@ -744,6 +840,7 @@ static void CL_PlayDemo_f(void)
     CL_Disconnect(ERR_RECONNECT);
 
     cls.demo.playback = f;
+    Q_strlcpy(cls.demo.path, name, sizeof(cls.demo.path));
     cls.state = ca_connected;
     Q_strlcpy(cls.servername, COM_SkipPath(name), sizeof(cls.servername));
     cls.serverAddress.type = NA_LOOPBACK;
@@ -768,9 +865,6 @@ static void CL_Demo_c(genctx_t *ctx, int argnum)
     }
 }
 
-#define MIN_SNAPSHOTS   64
-#define MAX_SNAPSHOTS   250000000
-
 /*
 ====================
 CL_EmitDemoSnapshot
@@ -882,6 +976,41 @@ static demosnap_t *find_snapshot(int64_t dest, bool byte_seek)
     return cls.demo.snapshots[max(r, 0)];
 }
 
+// loads snapshots saved by recorder, if any
+static void load_demo_index(void)
+{
+    demosnap_t **snapshots;
+    int64_t end;
+    int ret;
+
+    // finding index in compressed demo would need to inflate it all
+    if (!COM_CompareExtension(cls.demo.path, ".gz"))
+        return;
+
+    ret = Demo_ReadIndex(cls.demo.playback, &snapshots, &end, TAG_GENERAL);
+    if (ret < 0) {
+        Com_WPrintf("Couldn't read demo index: %s\n", Q_ErrorString(ret));
+        return;
+    }
+    if (!ret)
+        return;
+    if (end <= cls.demo.file_offset) {
+        Demo_FreeSnapshots(&snapshots, &ret);
+        return;
+    }
+
+    CL_FreeDemoSnapshots();
+    cls.demo.snapshots = snapshots;
+    cls.demo.numsnapshots = ret;
+    cls.demo.last_snapshot = snapshots[ret - 1]->framenum;
+
+    // don't count index in progress
+    cls.demo.file_size = end - cls.demo.file_offset;
+    cls.demo.indexed = true;
+
+    Com_DPrintf("Loaded %d snapshots from demo index\n", ret);
+}
+
 /*
 ====================
 CL_FirstDemoFrame
@@ -920,6 +1049,10 @@ void CL_FirstDemoFrame(void)
 
     // force initial snapshot
     cls.demo.last_snapshot = INT_MIN;
+
+    // index is only valid for the first map
+    if (cls.demo.frames_read == 1 && cls.demo.file_size)
+        load_demo_index();
 }
 
 /*
@@ -929,11 +1062,7 @@ CL_FreeDemoSnapshots
 */
 void CL_FreeDemoSnapshots(void)
 {
-    for (int i = 0; i < cls.demo.numsnapshots; i++)
-        Z_Free(cls.demo.snapshots[i]);
-    cls.demo.numsnapshots = 0;
-
-    Z_Freep((void**)&cls.demo.snapshots);
+    Demo_FreeSnapshots(&cls.demo.snapshots, &cls.demo.numsnapshots);
 }
 
 /*
@@ -1131,6 +1260,123 @@ done:
     cls.demo.seeking = false;
 }
 
+/*
+====================
+CL_IndexDemo_f
+
+Reads the rest of demo, saving snapshots as usual, and appends them to demo
+file. Then seeks back to where playback was.
+====================
+*/
+static void CL_IndexDemo_f(void)
+{
+    qhandle_t f;
+    int64_t pos, start;
+    int ret, frames;
+
+#if USE_MVD_CLIENT
+    if (sv_running->integer == ss_broadcast) {
+        Cbuf_InsertText(&cmd_buffer, "mvdindex @@\n");
+        return;
+    }
+#endif
+
+    if (!cls.demo.playback) {
+        Com_Printf("Not playing a demo.\n");
+        return;
+    }
+
+    if (cls.demo.recording) {
+        Com_Printf("Indexing is not supported during demo recording.\n");
+        return;
+    }
+
+    if (cl_demosnaps->integer <= 0) {
+        Com_Printf("Snapshots are disabled.\n");
+        return;
+    }
+
+    if (!cls.demo.file_size) {
+        Com_Printf("Unknown file size, can't index.\n");
+        return;
+    }
+
+    if (!COM_CompareExtension(cls.demo.path, ".gz")) {
+        Com_Printf("Can't index compressed demo.\n");
+        return;
+    }
+
+    if (cls.demo.indexed) {
+        Com_Printf("Demo is already indexed.\n");
+        return;
+    }
+
+    if (!cls.demo.numsnapshots || cls.demo.snapshots[0]->framenum != 1) {
+        Com_Printf("Demo must be indexed while playing its first map.\n");
+        return;
+    }
+
+    frames = cls.demo.frames_read;
+    start = FS_Tell(cls.demo.playback);
+
+    // disable effects processing
+    cls.demo.seeking = true;
+
+    while (1) {
+        ret = read_next_message(cls.demo.playback);
+        if (ret < 0) {
+            finish_demo(ret);
+            return;
+        }
+        if (!ret)
+            break;
+
+        // stop before next gamestate
+        if (msg_read.data[0] == svc_serverdata)
+            break;
+
+        if (CL_SeekDemoMessage()) {
+            Com_EPrintf("Unexpected gamestate while indexing.\n");
+            cls.demo.seeking = false;
+            return;
+        }
+        CL_EmitDemoSnapshot();
+    }
+
+    cls.demo.seeking = false;
+
+    // index goes right after the end of demo
+    pos = FS_OpenFile(cls.demo.path, &f, FS_MODE_RDWR);
+    if (!f) {
+        Com_EPrintf("Couldn't open %s for writing: %s\n", cls.demo.path, Q_ErrorString(pos));
+    } else if (pos != FS_Length(cls.demo.playback)) {
+        Com_EPrintf("Couldn't index %s: file is not in writable directory\n", cls.demo.path);
+        FS_CloseFile(f);
+    } else {
+        ret = Demo_WriteIndex(f, cls.demo.snapshots, cls.demo.numsnapshots);
+        if (!ret)
+            ret = FS_CloseFile(f);
+        else
+            FS_CloseFile(f);
+        if (ret) {
+            Com_EPrintf("Couldn't index %s: %s\n", cls.demo.path, Q_ErrorString(ret));
+        } else {
+            Com_Printf("Indexed %d snapshots.\n", cls.demo.numsnapshots);
+            cls.demo.indexed = true;
+        }
+    }
+
+    // no frames left, don't read past the end
+    if (cls.demo.frames_read == frames) {
+        FS_Seek(cls.demo.playback, start, SEEK_SET);
+        return;
+    }
+
+    // configstrings will be the same after seeking back, so dirty
+    // ones need not be updated
+    Cbuf_InsertText(&cmd_buffer, va("seek 0.%d\n", frames));
+}
+
 static void parse_info_string(demoInfo_t *info, int clientNum, int index, const cs_remap_t *csr)
 {
     char string[MAX_QPATH], *p;
@@ -1332,6 +1578,7 @@ static const cmdreg_t c_demo[] = {
     { "suspend", CL_Suspend_f },
     { "resume", CL_Resume_f },
     { "seek", CL_Seek_f },
+    { "demo_index", CL_IndexDemo_f },
 
     { NULL }
 };
@@ -1344,6 +1591,7 @@ CL_InitDemos
 void CL_InitDemos(void)
 {
     cl_demosnaps = Cvar_Get("cl_demosnaps", "10", 0);
+    cl_demoindex = Cvar_Get("cl_demoindex", "10", 0);
     cl_demomsglen = Cvar_Get("cl_demomsglen", va("%d", MAX_PACKETLEN_WRITABLE_DEFAULT), 0);
     cl_demowait = Cvar_Get("cl_demowait", "0", 0);
     cl_demosuspendtoggle = Cvar_Get("cl_demosuspendtoggle", "1", 0);
@@ -334,6 +334,56 @@ static qhandle_t CL_RegisterImage(const char *s)
     return R_RegisterPic2(s);
 }
 
+/*
+=================
+CL_PrefetchMedia
+
+Inflates models and pics referenced by configstrings on worker threads,
+so that registering them one by one doesn't wait for decompression.
+Pics are prefetched in the format the renderer is going to pick.
+=================
+*/
+static void CL_PrefetchMedia(void)
+{
+    char        (*paths)[MAX_QPATH];
+    const char  **names;
+    char        *name;
+    int         i, count = 0;
+
+    paths = Z_Malloc(sizeof(paths[0]) * (cl.csr.max_models + cl.csr.max_images));
+
+    for (i = 2; i < cl.csr.max_models; i++) {
+        name = cl.configstrings[cl.csr.models + i];
+        if (!name[0] && i != MODELINDEX_PLAYER) {
+            break;
+        }
+        if (!name[0] || name[0] == '#' || name[0] == '*') {
+            continue;
+        }
+        Q_strlcpy(paths[count++], name, MAX_QPATH);
+    }
+
+    for (i = 1; i < cl.csr.max_images; i++) {
+        name = cl.configstrings[cl.csr.images + i];
+        if (!name[0]) {
+            break;
+        }
+        if (R_ResolveImagePath(name, IT_PIC, IF_SRGB, paths[count])) {
+            count++;
+        }
+    }
+
+    names = Z_Malloc(sizeof(names[0]) * (count + 1));
+    for (i = 0; i < count; i++) {
+        names[i] = paths[i];
+    }
+
+    FS_PrefetchFiles(names, count);
+
+    Z_Free(names);
+    Z_Free(paths);
+}
+
 /*
 =================
 CL_PrepRefresh
@@ -351,6 +401,8 @@ void CL_PrepRefresh(void)
     if (!cl.mapname[0])
         return;     // no map loaded
 
+    CL_PrefetchMedia();
+
     // register models, pics, and skins
     R_BeginRegistration(cl.mapname);
 
@@ -406,6 +458,9 @@ void CL_PrepRefresh(void)
     // the renderer can now free unneeded stuff
     R_EndRegistration();
 
+    // drop whatever was prefetched but not loaded
+    FS_FreePrefetched();
+
     // clear any lines of console text
     Con_ClearNotify_f();
 
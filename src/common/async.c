@@ -16,103 +16,438 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+//
+// async.c -- pool of worker threads with per-worker work stealing queues
+//
+// Each worker owns a queue per priority level. New work is distributed
+// round-robin. Workers take work from the head of their own queue and
+// steal from the tail of other queues when idle, always preferring higher
+// priority work. Completion callbacks are run on the main thread from
+// Com_CompleteAsyncWork().
+//
+
 #include "shared/shared.h"
 #include "common/async.h"
+#include "common/common.h"
+#include "common/cvar.h"
 #include "common/zone.h"
 #include "system/pthread.h"
+#include "system/system.h"
+
+#define NUM_PRIOS   (ASYNC_PRIO_HIGH - ASYNC_PRIO_LOW + 1)
+
+// higher priority queues come first
+#define PRIO_INDEX(prio) \
+    (ASYNC_PRIO_HIGH - Q_clip(prio, ASYNC_PRIO_LOW, ASYNC_PRIO_HIGH))
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_t thread;
+    list_t pend[NUM_PRIOS];
+} workqueue_t;
+
+static cvar_t *com_workers;
 
 static bool work_initialized;
 static bool work_terminate;
-static pthread_mutex_t work_lock;
+static pthread_mutex_t work_lock;       // protects everything below
 static pthread_cond_t work_cond;
-static pthread_t work_thread;
-static asyncwork_t *pend_head;
-static asyncwork_t *done_head;
+static unsigned work_pending;
+static unsigned work_next_queue;
+static asynchandle_t work_next_handle;
+
+static workqueue_t work_queues[ASYNC_MAX_WORKERS];
+static int work_num_queues;
+
+static pthread_mutex_t done_lock;
+static LIST_DECL(done_list);
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    void (*func)(void *, int);
+    void *arg;
+    int next, count;
+    int helpers;
+    asyncwork_t work[ASYNC_MAX_WORKERS];
+} asyncbatch_t;
 
-static void append_work(asyncwork_t **head, asyncwork_t *work)
+static asyncwork_t *pop_work(workqueue_t *self)
 {
-    asyncwork_t *c, **p;
-    for (p = head, c = *head; c; p = &c->next, c = c->next)
-        ;
-    work->next = NULL;
-    *p = work;
+    asyncwork_t *work = NULL;
+    workqueue_t *q;
+    list_t *list;
+    int i, j;
+
+    for (i = 0; i < NUM_PRIOS; i++) {
+        // try own queue first, take the oldest work
+        pthread_mutex_lock(&self->lock);
+        list = &self->pend[i];
+        if (!LIST_EMPTY(list)) {
+            work = LIST_FIRST(asyncwork_t, list, entry);
+            List_Remove(&work->entry);
+        }
+        pthread_mutex_unlock(&self->lock);
+        if (work)
+            return work;
+
+        // steal the newest work from other queues
+        for (j = 1; j < work_num_queues; j++) {
+            q = &work_queues[(self - work_queues + j) % work_num_queues];
+            pthread_mutex_lock(&q->lock);
+            list = &q->pend[i];
+            if (!LIST_EMPTY(list)) {
+                work = LIST_LAST(asyncwork_t, list, entry);
+                List_Remove(&work->entry);
+            }
+            pthread_mutex_unlock(&q->lock);
+            if (work)
+                return work;
+        }
+    }
+
+    return NULL;
 }
 
-static void *work_func(void *arg)
+static asyncwork_t *get_work(workqueue_t *self)
 {
+    asyncwork_t *work = NULL;
+
     pthread_mutex_lock(&work_lock);
     while (1) {
-        while (!pend_head && !work_terminate)
-            pthread_cond_wait(&work_cond, &work_lock);
-
-        asyncwork_t *work = pend_head;
-        if (!work)
+        if (work_pending) {
+            pthread_mutex_unlock(&work_lock);
+            work = pop_work(self);
+            pthread_mutex_lock(&work_lock);
+            if (work) {
+                work_pending--;
+                break;
+            }
+            // lost the race to another worker
+            continue;
+        }
+        if (work_terminate)
             break;
-        pend_head = work->next;
+        pthread_cond_wait(&work_cond, &work_lock);
+    }
+    pthread_mutex_unlock(&work_lock);
+
+    return work;
+}
+
+static void *work_func(void *arg)
+{
+    workqueue_t *self = arg;
+    asyncwork_t *work;
+
+    while ((work = get_work(self))) {
+        // batch work is owned by the waiting thread, don't touch it after
+        // calling work_cb
+        if (work->batch) {
+            work->work_cb(work->cb_arg);
+            continue;
+        }
 
-        pthread_mutex_unlock(&work_lock);
         work->work_cb(work->cb_arg);
-        pthread_mutex_lock(&work_lock);
 
-        append_work(&done_head, work);
+        pthread_mutex_lock(&done_lock);
+        List_Append(&done_list, &work->entry);
+        pthread_mutex_unlock(&done_lock);
     }
-    pthread_mutex_unlock(&work_lock);
 
     return NULL;
 }
 
-void Com_QueueAsyncWork(asyncwork_t *work)
+static int num_workers(void)
 {
-    if (!work_initialized) {
-        pthread_mutex_init(&work_lock, NULL);
-        pthread_cond_init(&work_cond, NULL);
-        if (pthread_create(&work_thread, NULL, work_func, NULL))
+    int n = com_workers ? com_workers->integer : 0;
+
+    if (n <= 0)
+        n = Sys_GetNumCPUs();
+
+    return Q_clip(n, 1, ASYNC_MAX_WORKERS);
+}
+
+static void start_workers(void)
+{
+    int i, j;
+
+    pthread_mutex_init(&work_lock, NULL);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_mutex_init(&done_lock, NULL);
+
+    work_terminate = false;
+    work_pending = 0;
+    work_num_queues = num_workers();
+
+    for (i = 0; i < work_num_queues; i++) {
+        workqueue_t *q = &work_queues[i];
+        pthread_mutex_init(&q->lock, NULL);
+        for (j = 0; j < NUM_PRIOS; j++)
+            List_Init(&q->pend[j]);
+    }
+
+    for (i = 0; i < work_num_queues; i++)
+        if (pthread_create(&work_queues[i].thread, NULL, work_func, &work_queues[i]))
             Com_Error(ERR_FATAL, "Couldn't create async work thread");
-        work_initialized = true;
+
+    Com_DPrintf("Started %d async worker threads\n", work_num_queues);
+    work_initialized = true;
+}
+
+static void queue_work(asyncwork_t *work)
+{
+    workqueue_t *q;
+
+    pthread_mutex_lock(&work_lock);
+    if (!++work_next_handle)
+        work_next_handle++;
+    work->handle = work_next_handle;
+    work->queue = work_next_queue++ % work_num_queues;
+
+    q = &work_queues[work->queue];
+    pthread_mutex_lock(&q->lock);
+    List_Append(&q->pend[PRIO_INDEX(work->priority)], &work->entry);
+    pthread_mutex_unlock(&q->lock);
+
+    work_pending++;
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&work_lock);
+}
+
+// removes work from its queue if it hasn't been started yet
+static bool dequeue_work(asyncwork_t *work)
+{
+    workqueue_t *q = &work_queues[work->queue];
+    asyncwork_t *cursor;
+    bool found = false;
+
+    pthread_mutex_lock(&work_lock);
+    pthread_mutex_lock(&q->lock);
+    LIST_FOR_EACH(asyncwork_t, cursor, &q->pend[PRIO_INDEX(work->priority)], entry) {
+        if (cursor == work) {
+            List_Remove(&work->entry);
+            found = true;
+            break;
+        }
     }
+    pthread_mutex_unlock(&q->lock);
+    if (found)
+        work_pending--;
+    pthread_mutex_unlock(&work_lock);
+
+    return found;
+}
+
+asynchandle_t Com_QueueAsyncWork(asyncwork_t *work)
+{
+    asyncwork_t *copy;
+
+    if (!work_initialized)
+        start_workers();
+
+    copy = Z_CopyStruct(work);
+    copy->batch = false;
+    queue_work(copy);
+
+    return copy->handle;
+}
+
+/*
+=================
+Com_CancelAsyncWork
+
+Removes work from the queue if it hasn't been started yet and calls its
+cancel callback. Work that is already running or finished can't be
+cancelled. Must be called from the main thread.
+=================
+*/
+bool Com_CancelAsyncWork(asynchandle_t handle)
+{
+    asyncwork_t *work, *found = NULL;
+    int i, j;
+
+    if (!work_initialized || !handle)
+        return false;
 
     pthread_mutex_lock(&work_lock);
-    append_work(&pend_head, Z_CopyStruct(work));
+    for (i = 0; i < work_num_queues && !found; i++) {
+        workqueue_t *q = &work_queues[i];
+        pthread_mutex_lock(&q->lock);
+        for (j = 0; j < NUM_PRIOS && !found; j++) {
+            LIST_FOR_EACH(asyncwork_t, work, &q->pend[j], entry) {
+                if (work->handle == handle) {
+                    List_Remove(&work->entry);
+                    found = work;
+                    break;
+                }
+            }
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    if (found)
+        work_pending--;
     pthread_mutex_unlock(&work_lock);
 
-    pthread_cond_signal(&work_cond);
+    if (!found)
+        return false;
+
+    if (found->cancel_cb)
+        found->cancel_cb(found->cb_arg);
+    Z_Free(found);
+    return true;
+}
+
+static void run_batch(asyncbatch_t *b)
+{
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&b->lock);
+        i = b->next < b->count ? b->next++ : -1;
+        pthread_mutex_unlock(&b->lock);
+        if (i < 0)
+            break;
+        b->func(b->arg, i);
+    }
+}
+
+static void batch_work_cb(void *arg)
+{
+    asyncbatch_t *b = arg;
+
+    run_batch(b);
+
+    pthread_mutex_lock(&b->lock);
+    b->helpers--;
+    pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+int Com_AsyncWorkers(void)
+{
+    return work_initialized ? work_num_queues : num_workers();
+}
+
+/*
+=================
+Com_ParallelFor
+
+Calls func(arg, i) for each i in [0, count) on worker threads and returns
+when all calls have finished. Calling thread takes part in the work, so this
+doesn't deadlock when called from a worker thread or when all workers are
+busy. Order of calls is not defined. Doesn't allocate memory.
+=================
+*/
+void Com_ParallelFor(int count, void (*func)(void *, int), void *arg)
+{
+    asyncbatch_t b;
+    int i, n;
+
+    if (count <= 0)
+        return;
+
+    if (!work_initialized)
+        start_workers();
+
+    n = min(count, work_num_queues + 1) - 1;
+    if (!n) {
+        for (i = 0; i < count; i++)
+            func(arg, i);
+        return;
+    }
+
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.cond, NULL);
+    b.func = func;
+    b.arg = arg;
+    b.next = 0;
+    b.count = count;
+    b.helpers = n;
+
+    for (i = 0; i < n; i++) {
+        asyncwork_t *work = &b.work[i];
+        work->work_cb = batch_work_cb;
+        work->cb_arg = &b;
+        work->priority = ASYNC_PRIO_HIGH;
+        work->batch = true;
+        queue_work(work);
+    }
+
+    run_batch(&b);
+
+    // nothing left to do, take back helpers that haven't started
+    for (i = 0; i < n; i++) {
+        if (dequeue_work(&b.work[i])) {
+            pthread_mutex_lock(&b.lock);
+            b.helpers--;
+            pthread_mutex_unlock(&b.lock);
+        }
+    }
+
+    // wait for running helpers to finish
+    pthread_mutex_lock(&b.lock);
+    while (b.helpers)
+        pthread_cond_wait(&b.cond, &b.lock);
+    pthread_mutex_unlock(&b.lock);
+
+    pthread_mutex_destroy(&b.lock);
+    pthread_cond_destroy(&b.cond);
 }
 
 void Com_CompleteAsyncWork(void)
 {
     asyncwork_t *work, *next;
+    list_t list;
 
     if (!work_initialized)
         return;
-    if (pthread_mutex_trylock(&work_lock))
+    if (pthread_mutex_trylock(&done_lock))
+        return;
+    if (q_likely(LIST_EMPTY(&done_list))) {
+        pthread_mutex_unlock(&done_lock);
         return;
-    if (q_unlikely(done_head)) {
-        for (work = done_head; work; work = next) {
-            next = work->next;
-            if (work->done_cb)
-                work->done_cb(work->cb_arg);
-            Z_Free(work);
-        }
-        done_head = NULL;
     }
-    pthread_mutex_unlock(&work_lock);
+
+    // detach completed work so that callbacks run unlocked
+    list = done_list;
+    List_Relink(&list);
+    List_Init(&done_list);
+    pthread_mutex_unlock(&done_lock);
+
+    LIST_FOR_EACH_SAFE(asyncwork_t, work, next, &list, entry) {
+        if (work->done_cb)
+            work->done_cb(work->cb_arg);
+        Z_Free(work);
+    }
 }
 
 void Com_ShutdownAsyncWork(void)
 {
+    int i;
+
     if (!work_initialized)
         return;
 
+    // pending work is still finished before workers exit
     pthread_mutex_lock(&work_lock);
     work_terminate = true;
+    pthread_cond_broadcast(&work_cond);
     pthread_mutex_unlock(&work_lock);
 
-    pthread_cond_signal(&work_cond);
-
-    Q_assert(!pthread_join(work_thread, NULL));
+    for (i = 0; i < work_num_queues; i++)
+        Q_assert(!pthread_join(work_queues[i].thread, NULL));
     Com_CompleteAsyncWork();
 
+    for (i = 0; i < work_num_queues; i++)
+        pthread_mutex_destroy(&work_queues[i].lock);
     pthread_mutex_destroy(&work_lock);
     pthread_cond_destroy(&work_cond);
+    pthread_mutex_destroy(&done_lock);
     work_initialized = false;
 }
+
+void Com_InitAsyncWork(void)
+{
+    com_workers = Cvar_Get("com_workers", "0", 0);
+}
@@ -88,6 +88,9 @@ LOAD(Visibility)
         return Q_ERR_INVALID_FORMAT;
     }
 
+    // used to validate cached vis matrices
+    bsp->vischecksum = Com_BlockChecksum(in - 4, count);
+
     bsp->numvisibility = count;
     bsp->vis = ALLOC(count);
     bsp->vis->numclusters = numclusters;
@@ -972,6 +975,44 @@ static int BSP_ValidateTree(bsp_t *bsp)
     return Q_ERR_SUCCESS;
 }
 
+// copies brush side planes into groups for CM_ClipBoxToBrush
+static void BSP_BuildBrushPlanes(bsp_t *bsp)
+{
+    mbrush_t *brush;
+    mbrushside_t *side;
+    float *out;
+    size_t numgroups;
+    int i, j, k;
+
+    numgroups = 0;
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++)
+        numgroups += (brush->numsides + BRUSH_GROUP_SIDES - 1) / BRUSH_GROUP_SIDES;
+
+    if (!numgroups)
+        return;
+
+    out = bsp->brushplanes = Z_Mallocz(numgroups * BRUSH_GROUP_FLOATS * sizeof(float));
+
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++) {
+        if (!brush->numsides)
+            continue;
+
+        brush->sideplanes = out;
+        side = brush->firstbrushside;
+        for (j = 0; j < brush->numsides; j++, side++) {
+            k = j % BRUSH_GROUP_SIDES;
+            BRUSH_SIDE_PLANE(out, k, 0) = side->plane->normal[0];
+            BRUSH_SIDE_PLANE(out, k, 1) = side->plane->normal[1];
+            BRUSH_SIDE_PLANE(out, k, 2) = side->plane->normal[2];
+            BRUSH_SIDE_PLANE(out, k, 3) = side->plane->dist;
+            if (k == BRUSH_GROUP_SIDES - 1)
+                out += BRUSH_GROUP_FLOATS;
+        }
+        if (j % BRUSH_GROUP_SIDES)
+            out += BRUSH_GROUP_FLOATS;
+    }
+}
+
 // also calculates the last portal number used
 // by CM code to allocate portalopen[] array
 static int BSP_ValidateAreaPortals(bsp_t *bsp)
@@ -1002,12 +1043,11 @@ void BSP_Free(bsp_t *bsp)
     }
     Q_assert(bsp->refcount > 0);
     if (--bsp->refcount == 0) {
-		if (bsp->pvs2_matrix)
-		{
-			// free the PVS2 matrix separately - it's not part of the hunk
-			Z_Free(bsp->pvs2_matrix);
-			bsp->pvs2_matrix = NULL;
-		}
+		// free the vis matrices separately - they are not part of the hunk
+		Z_Free(bsp->pvs_matrix);
+		Z_Free(bsp->pvs2_matrix);
+		Z_Free(bsp->phs_matrix);
+        Z_Free(bsp->brushplanes);
 
         Hunk_Free(&bsp->hunk);
         List_Remove(&bsp->entry);
@@ -1015,24 +1055,38 @@ void BSP_Free(bsp_t *bsp)
     }
 }
 
-static void BSP_BuildPvsMatrix(bsp_t *bsp)
+static byte *BSP_BuildVisMatrix(bsp_t *bsp, int vis)
 {
-	if (!bsp->vis)
-		return;
-
 	// a typical map with 2K clusters will take half a megabyte of memory for the matrix
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
 
 	// allocate the matrix but don't set it in the BSP structure yet: 
 	// we want BSP_CluterVis to use the old PVS data here, and not the new empty matrix
-	byte* pvs_matrix = Z_Mallocz(matrix_size);
+	byte* matrix = Z_Mallocz(matrix_size);
 	
 	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
 	{
-		BSP_ClusterVis(bsp, pvs_matrix + bsp->visrowsize * cluster, cluster, DVIS_PVS);
+		BSP_ClusterVis(bsp, matrix + bsp->visrowsize * cluster, cluster, vis);
 	}
 
-	bsp->pvs_matrix = pvs_matrix;
+	return matrix;
+}
+
+static void BSP_BuildPvsMatrix(bsp_t *bsp)
+{
+	if (!bsp->vis)
+		return;
+
+	bsp->pvs_matrix = BSP_BuildVisMatrix(bsp, DVIS_PVS);
+}
+
+// PHS is decompressed once here so that the server never has to do it per frame
+static void BSP_BuildPhsMatrix(bsp_t *bsp)
+{
+	if (!bsp->vis)
+		return;
+
+	bsp->phs_matrix = BSP_BuildVisMatrix(bsp, DVIS_PHS);
 }
 
 byte* BSP_GetPvs(bsp_t *bsp, int cluster)
@@ -1057,6 +1111,17 @@ byte* BSP_GetPvs2(bsp_t *bsp, int cluster)
 	return bsp->pvs2_matrix + bsp->visrowsize * cluster;
 }
 
+byte* BSP_GetPhs(bsp_t *bsp, int cluster)
+{
+	if (!bsp->vis || !bsp->phs_matrix)
+		return NULL;
+
+	if (cluster < 0 || cluster >= bsp->vis->numclusters)
+		return NULL;
+
+	return bsp->phs_matrix + bsp->visrowsize * cluster;
+}
+
 // Converts `maps/<name>.bsp` into `maps/pvs/<name>.bin`
 static bool BSP_GetPatchedPVSFileName(const char* map_path, char pvs_path[MAX_QPATH])
 {
@@ -1079,7 +1144,46 @@ static bool BSP_GetPatchedPVSFileName(const char* map_path, char pvs_path[MAX_QP
 	return true;
 }
 
-// Loads the first- and second-order PVS matrices from a file called `maps/pvs/<mapname>.bin`
+// Header of the vis matrix cache. Files without header are the old format,
+// holding only PVS and PVS2 matrices.
+#define PVS_CACHE_IDENT     MakeLittleLong('P','V','S','C')
+#define PVS_CACHE_VERSION   1
+
+typedef struct {
+	uint32_t	ident;
+	uint32_t	version;
+	uint32_t	numclusters;
+	uint32_t	rowsize;
+	uint32_t	vischecksum;	// checksum of the BSP vis lump
+} dpvscache_t;
+
+// Old format files carry no checksum. Patching only ever adds visibility, so
+// each cached PVS row must contain the row decompressed from the vis lump, and
+// each PVS2 row must contain the PVS row.
+static bool BSP_ValidateLegacyPVS(bsp_t *bsp, const byte *pvs, const byte *pvs2)
+{
+	byte row[VIS_MAX_BYTES];
+
+	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
+	{
+		BSP_ClusterVis(bsp, row, cluster, DVIS_PVS);
+
+		for (int i = 0; i < bsp->visrowsize; i++)
+		{
+			if (row[i] & ~pvs[i])
+				return false;
+			if (pvs[i] & ~pvs2[i])
+				return false;
+		}
+
+		pvs += bsp->visrowsize;
+		pvs2 += bsp->visrowsize;
+	}
+
+	return true;
+}
+
+// Loads the first- and second-order PVS matrices and the PHS matrix from a file called `maps/pvs/<mapname>.bin`
 static bool BSP_LoadPatchedPVS(bsp_t *bsp)
 {
 	char pvs_path[MAX_QPATH];
@@ -1095,23 +1199,60 @@ static bool BSP_LoadPatchedPVS(bsp_t *bsp)
 		return false;
 
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
-	if (filelen != matrix_size * 2)
+	const dpvscache_t* header = (const dpvscache_t*)filebuf;
+	const unsigned char* data = filebuf;
+	bool has_phs = false;
+
+	if (filelen >= sizeof(*header) && LittleLong(header->ident) == PVS_CACHE_IDENT)
+	{
+		if (LittleLong(header->version) != PVS_CACHE_VERSION ||
+			LittleLong(header->numclusters) != bsp->vis->numclusters ||
+			LittleLong(header->rowsize) != bsp->visrowsize ||
+			LittleLong(header->vischecksum) != bsp->vischecksum ||
+			filelen != sizeof(*header) + matrix_size * 3)
+		{
+			Com_WPrintf("Ignoring stale PVS cache %s\n", pvs_path);
+			FS_FreeFile(filebuf);
+			return false;
+		}
+
+		data += sizeof(*header);
+		has_phs = true;
+	}
+	else if (filelen != matrix_size * 2 ||
+		!BSP_ValidateLegacyPVS(bsp, data, data + matrix_size))
 	{
+		Com_WPrintf("Ignoring invalid PVS cache %s\n", pvs_path);
 		FS_FreeFile(filebuf);
 		return false;
 	}
 
 	bsp->pvs_matrix = Z_Malloc(matrix_size);
-	memcpy(bsp->pvs_matrix, filebuf, matrix_size);
+	memcpy(bsp->pvs_matrix, data, matrix_size);
 
 	bsp->pvs2_matrix = Z_Malloc(matrix_size);
-	memcpy(bsp->pvs2_matrix, filebuf + matrix_size, matrix_size);
+	memcpy(bsp->pvs2_matrix, data + matrix_size, matrix_size);
+
+	if (has_phs)
+	{
+		bsp->phs_matrix = Z_Malloc(matrix_size);
+		memcpy(bsp->phs_matrix, data + matrix_size * 2, matrix_size);
+	}
 
 	FS_FreeFile(filebuf);
+
+	// upgrade old format file so that it is checked against the BSP next time
+	if (!has_phs)
+	{
+		BSP_BuildPhsMatrix(bsp);
+		if (!BSP_SavePatchedPVS(bsp))
+			Com_WPrintf("Couldn't upgrade PVS cache %s\n", pvs_path);
+	}
+
 	return true;
 }
 
-// Saves the first- and second-order PVS matrices to a file called `maps/pvs/<mapname>.bin`
+// Saves the first- and second-order PVS matrices and the PHS matrix to a file called `maps/pvs/<mapname>.bin`
 bool BSP_SavePatchedPVS(bsp_t *bsp)
 {
 	char pvs_path[MAX_QPATH];
@@ -1125,13 +1266,26 @@ bool BSP_SavePatchedPVS(bsp_t *bsp)
 	if (!bsp->pvs2_matrix)
 		return false;
 
+	if (!bsp->phs_matrix)
+		return false;
+
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
-	unsigned char* filebuf = Z_Malloc(matrix_size * 2);
+	size_t file_size = sizeof(dpvscache_t) + matrix_size * 3;
+	unsigned char* filebuf = Z_Malloc(file_size);
+	dpvscache_t* header = (dpvscache_t*)filebuf;
 
-	memcpy(filebuf, bsp->pvs_matrix, matrix_size);
-	memcpy(filebuf + matrix_size, bsp->pvs2_matrix, matrix_size);
+	header->ident = LittleLong(PVS_CACHE_IDENT);
+	header->version = LittleLong(PVS_CACHE_VERSION);
+	header->numclusters = LittleLong(bsp->vis->numclusters);
+	header->rowsize = LittleLong(bsp->visrowsize);
+	header->vischecksum = LittleLong(bsp->vischecksum);
 
-	int err = FS_WriteFile(pvs_path, filebuf, matrix_size * 2);
+	unsigned char* data = filebuf + sizeof(*header);
+	memcpy(data, bsp->pvs_matrix, matrix_size);
+	memcpy(data + matrix_size, bsp->pvs2_matrix, matrix_size);
+	memcpy(data + matrix_size * 2, bsp->phs_matrix, matrix_size);
+
+	int err = FS_WriteFile(pvs_path, filebuf, file_size);
 
 	Z_Free(filebuf);
 
@@ -1471,6 +1625,8 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
         goto fail1;
     }
 
+    BSP_BuildBrushPlanes(bsp);
+
 	if (!BSP_LoadPatchedPVS(bsp))
 	{
 		BSP_BuildPvsMatrix(bsp);
@@ -1480,6 +1636,11 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
 		bsp->pvs_patched = true;
 	}
 
+	if (!bsp->phs_matrix)
+	{
+		BSP_BuildPhsMatrix(bsp);
+	}
+
 #if USE_REF
     // load extension lumps
     for (i = 0; i < q_countof(bspx_lumps); i++) {
@@ -1666,6 +1827,13 @@ byte *BSP_ClusterVis(bsp_t *bsp, byte *mask, int cluster, int vis)
 		return mask;
 	}
 
+	if (vis == DVIS_PHS && bsp->phs_matrix)
+	{
+		byte* row = BSP_GetPhs(bsp, cluster);
+		memcpy(mask, row, bsp->visrowsize);
+		return mask;
+	}
+
     // decompress vis
     in_end = (byte *)bsp->vis + bsp->numvisibility;
     in = (byte *)bsp->vis + bsp->vis->bitofs[cluster][vis];
@@ -28,6 +28,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/sizebuf.h"
 #include "common/zone.h"
 #include "system/hunk.h"
+#include "system/system.h"
+
+#if (defined __SSE2__) || (defined _M_X64)
+#include <emmintrin.h>
+#define USE_BRUSH_SSE   1
+#else
+#define USE_BRUSH_SSE   0
+#endif
 
 mtexinfo_t nulltexinfo;
 
@@ -248,6 +256,7 @@ static mbrush_t *box_leafbrush;
 static mbrushside_t box_brushsides[6];
 static mleaf_t  box_leaf;
 static mleaf_t  box_emptyleaf;
+static float    box_sideplanes[BRUSH_GROUP_FLOATS * 2];
 
 /*
 ===================
@@ -269,6 +278,7 @@ static void CM_InitBoxHull(void)
 
     box_brush.numsides = 6;
     box_brush.firstbrushside = &box_brushsides[0];
+    box_brush.sideplanes = box_sideplanes;
     box_brush.contents = CONTENTS_MONSTER;
 
     box_leaf.contents = CONTENTS_MONSTER;
@@ -304,6 +314,10 @@ static void CM_InitBoxHull(void)
         p->signbits = 1 << (i >> 1);
         p->normal[i >> 1] = -1;
     }
+
+    for (i = 0; i < 6; i++)
+        for (side = 0; side < 3; side++)
+            BRUSH_SIDE_PLANE(box_sideplanes, i, side) = box_brushsides[i].plane->normal[side];
 }
 
 /*
@@ -329,6 +343,13 @@ mnode_t *CM_HeadnodeForBox(const vec3_t mins, const vec3_t maxs)
     box_planes[10].dist = mins[2];
     box_planes[11].dist = -mins[2];
 
+    BRUSH_SIDE_PLANE(box_sideplanes, 0, 3) = maxs[0];
+    BRUSH_SIDE_PLANE(box_sideplanes, 1, 3) = -mins[0];
+    BRUSH_SIDE_PLANE(box_sideplanes, 2, 3) = maxs[1];
+    BRUSH_SIDE_PLANE(box_sideplanes, 3, 3) = -mins[1];
+    BRUSH_SIDE_PLANE(box_sideplanes, 4, 3) = maxs[2];
+    BRUSH_SIDE_PLANE(box_sideplanes, 5, 3) = -mins[2];
+
     return box_headnode;
 }
 
@@ -465,32 +486,29 @@ static trace_t  *trace_trace;
 static int      trace_contents;
 static bool     trace_ispoint;      // optimized case
 
+typedef struct {
+    float           enterfrac, leavefrac;
+    mbrushside_t    *leadside;
+    bool            getout, startout;
+} brushclip_t;
+
+static bool     trace_nosimd;       // for CM_TraceTest_f
+
 /*
 ================
-CM_ClipBoxToBrush
+CM_ClipBrushSides
+
+Returns false if the move is completely in front of any brush side.
 ================
 */
-static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace, mbrush_t *brush)
+static bool CM_ClipBrushSides(const vec3_t p1, const vec3_t p2, const mbrush_t *brush, brushclip_t *clip)
 {
     int         i;
-    cplane_t    *plane, *clipplane;
+    cplane_t    *plane;
     float       dist;
-    float       enterfrac, leavefrac;
     float       d1, d2;
-    bool        getout, startout;
     float       f;
-    mbrushside_t    *side, *leadside;
-
-    if (!brush->numsides)
-        return;
-
-    enterfrac = -1;
-    leavefrac = 1;
-    clipplane = NULL;
-
-    getout = false;
-    startout = false;
-    leadside = NULL;
+    mbrushside_t    *side;
 
     side = brush->firstbrushside;
     for (i = 0; i < brush->numsides; i++, side++) {
@@ -511,13 +529,13 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
         d2 = DotProduct(p2, plane->normal) - dist;
 
         if (d2 > 0)
-            getout = true; // endpoint is not in solid
+            clip->getout = true; // endpoint is not in solid
         if (d1 > 0)
-            startout = true;
+            clip->startout = true;
 
         // if completely in front of face, no intersection
         if (d1 > 0 && d2 >= d1)
-            return;
+            return false;
 
         if (d1 <= 0 && d2 <= 0)
             continue;
@@ -526,23 +544,160 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
         if (d1 > d2) {
             // enter
             f = (d1 - DIST_EPSILON) / (d1 - d2);
-            if (f > enterfrac) {
-                enterfrac = f;
-                clipplane = plane;
-                leadside = side;
+            if (f > clip->enterfrac) {
+                clip->enterfrac = f;
+                clip->leadside = side;
             }
         } else {
             // leave
             f = (d1 + DIST_EPSILON) / (d1 - d2);
-            if (f < leavefrac)
-                leavefrac = f;
+            if (f < clip->leavefrac)
+                clip->leavefrac = f;
+        }
+    }
+
+    return true;
+}
+
+#if USE_BRUSH_SSE
+
+/*
+================
+CM_ClipBrushSides_SSE
+
+Same as CM_ClipBrushSides, but evaluates a group of sides at once. Each lane
+keeps the first side with greatest enter fraction, lanes are then merged
+preferring lower side numbers, so the result is identical.
+================
+*/
+static bool CM_ClipBrushSides_SSE(const vec3_t p1, const vec3_t p2, const mbrush_t *brush, brushclip_t *clip)
+{
+    const float *planes = brush->sideplanes;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 epsilon = _mm_set1_ps(DIST_EPSILON);
+    const __m128 p1x = _mm_set1_ps(p1[0]), p1y = _mm_set1_ps(p1[1]), p1z = _mm_set1_ps(p1[2]);
+    const __m128 p2x = _mm_set1_ps(p2[0]), p2y = _mm_set1_ps(p2[1]), p2z = _mm_set1_ps(p2[2]);
+    const __m128 minx = _mm_set1_ps(trace_offsets[0][0]), maxx = _mm_set1_ps(trace_offsets[7][0]);
+    const __m128 miny = _mm_set1_ps(trace_offsets[0][1]), maxy = _mm_set1_ps(trace_offsets[7][1]);
+    const __m128 minz = _mm_set1_ps(trace_offsets[0][2]), maxz = _mm_set1_ps(trace_offsets[7][2]);
+    __m128 nx, ny, nz, dist, ox, oy, oz, d1, d2, f, mask, front;
+    __m128 enterfrac = _mm_set1_ps(clip->enterfrac);
+    __m128 leavefrac = _mm_set1_ps(clip->leavefrac);
+    __m128 getout = zero, startout = zero;
+    __m128i enterside = _mm_set1_epi32(-1);
+    __m128i sidenum = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i step = _mm_set1_epi32(BRUSH_GROUP_SIDES);
+    float frac[4];
+    int side[4];
+    int i;
+
+    for (i = 0; i < brush->numsides; i += BRUSH_GROUP_SIDES, planes += BRUSH_GROUP_FLOATS) {
+        nx = _mm_loadu_ps(planes + 0);
+        ny = _mm_loadu_ps(planes + 4);
+        nz = _mm_loadu_ps(planes + 8);
+        dist = _mm_loadu_ps(planes + 12);
+
+        if (!trace_ispoint) {
+            // push the plane out apropriately for mins/maxs
+            mask = _mm_cmplt_ps(nx, zero);
+            ox = _mm_or_ps(_mm_and_ps(mask, maxx), _mm_andnot_ps(mask, minx));
+            mask = _mm_cmplt_ps(ny, zero);
+            oy = _mm_or_ps(_mm_and_ps(mask, maxy), _mm_andnot_ps(mask, miny));
+            mask = _mm_cmplt_ps(nz, zero);
+            oz = _mm_or_ps(_mm_and_ps(mask, maxz), _mm_andnot_ps(mask, minz));
+            dist = _mm_sub_ps(dist, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, nx), _mm_mul_ps(oy, ny)), _mm_mul_ps(oz, nz)));
+        }
+
+        d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p1x, nx), _mm_mul_ps(p1y, ny)), _mm_mul_ps(p1z, nz));
+        d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p2x, nx), _mm_mul_ps(p2y, ny)), _mm_mul_ps(p2z, nz));
+        d1 = _mm_sub_ps(d1, dist);
+        d2 = _mm_sub_ps(d2, dist);
+
+        // if completely in front of any face, no intersection
+        front = _mm_cmpgt_ps(d1, zero);
+        if (_mm_movemask_ps(_mm_and_ps(front, _mm_cmpge_ps(d2, d1))))
+            return false;
+
+        startout = _mm_or_ps(startout, front);
+        mask = _mm_cmpgt_ps(d2, zero);
+        getout = _mm_or_ps(getout, mask);
+
+        // sides crossed while entering
+        front = _mm_or_ps(front, mask);
+        mask = _mm_and_ps(front, _mm_cmpgt_ps(d1, d2));
+        f = _mm_div_ps(_mm_sub_ps(d1, epsilon), _mm_sub_ps(d1, d2));
+        mask = _mm_and_ps(mask, _mm_cmpgt_ps(f, enterfrac));
+        enterfrac = _mm_or_ps(_mm_and_ps(mask, f), _mm_andnot_ps(mask, enterfrac));
+        enterside = _mm_or_si128(_mm_and_si128(_mm_castps_si128(mask), sidenum),
+                                 _mm_andnot_si128(_mm_castps_si128(mask), enterside));
+
+        // sides crossed while leaving
+        mask = _mm_andnot_ps(_mm_cmpgt_ps(d1, d2), front);
+        f = _mm_div_ps(_mm_add_ps(d1, epsilon), _mm_sub_ps(d1, d2));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(f, leavefrac));
+        leavefrac = _mm_or_ps(_mm_and_ps(mask, f), _mm_andnot_ps(mask, leavefrac));
+
+        sidenum = _mm_add_epi32(sidenum, step);
+    }
+
+    if (_mm_movemask_ps(getout))
+        clip->getout = true;
+    if (_mm_movemask_ps(startout))
+        clip->startout = true;
+
+    _mm_storeu_ps(frac, leavefrac);
+    for (i = 0; i < 4; i++)
+        if (frac[i] < clip->leavefrac)
+            clip->leavefrac = frac[i];
+
+    _mm_storeu_ps(frac, enterfrac);
+    _mm_storeu_si128((__m128i *)side, enterside);
+    for (i = 0; i < 4; i++) {
+        if (side[i] == -1)
+            continue;
+        if (frac[i] > clip->enterfrac || (frac[i] == clip->enterfrac && clip->leadside &&
+            side[i] < clip->leadside - brush->firstbrushside)) {
+            clip->enterfrac = frac[i];
+            clip->leadside = brush->firstbrushside + side[i];
         }
     }
 
-    if (!startout) {
+    return true;
+}
+
+#endif // USE_BRUSH_SSE
+
+/*
+================
+CM_ClipBoxToBrush
+================
+*/
+static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace, mbrush_t *brush)
+{
+    brushclip_t clip;
+
+    if (!brush->numsides)
+        return;
+
+    clip.enterfrac = -1;
+    clip.leavefrac = 1;
+    clip.leadside = NULL;
+    clip.getout = false;
+    clip.startout = false;
+
+#if USE_BRUSH_SSE
+    if (!trace_nosimd) {
+        if (!CM_ClipBrushSides_SSE(p1, p2, brush, &clip))
+            return;
+    } else
+#endif
+    if (!CM_ClipBrushSides(p1, p2, brush, &clip))
+        return;
+
+    if (!clip.startout) {
         // original point was inside brush
         trace->startsolid = true;
-        if (!getout) {
+        if (!clip.getout) {
             trace->allsolid = true;
             if (!map_allsolid_bug->integer) {
                 // original Q2 didn't set these
@@ -552,13 +707,13 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
         }
         return;
     }
-    if (enterfrac < leavefrac) {
-        if (enterfrac > -1 && enterfrac < trace->fraction) {
-            if (enterfrac < 0)
-                enterfrac = 0;
-            trace->fraction = enterfrac;
-            trace->plane = *clipplane;
-            trace->surface = &(leadside->texinfo->c);
+    if (clip.enterfrac < clip.leavefrac) {
+        if (clip.enterfrac > -1 && clip.enterfrac < trace->fraction) {
+            if (clip.enterfrac < 0)
+                clip.enterfrac = 0;
+            trace->fraction = clip.enterfrac;
+            trace->plane = *clip.leadside->plane;
+            trace->surface = &(clip.leadside->texinfo->c);
             trace->contents = brush->contents;
         }
     }
@@ -580,21 +735,55 @@ static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, mbrush_t *brush)
     if (!brush->numsides)
         return;
 
-    side = brush->firstbrushside;
-    for (i = 0; i < brush->numsides; i++, side++) {
-        plane = side->plane;
-
-        // FIXME: special case for axial
-        // general box case
-        // push the plane out apropriately for mins/maxs
-        dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
-        dist = plane->dist - dist;
+#if USE_BRUSH_SSE
+    if (!trace_nosimd) {
+        const float *planes = brush->sideplanes;
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 px = _mm_set1_ps(p1[0]), py = _mm_set1_ps(p1[1]), pz = _mm_set1_ps(p1[2]);
+        const __m128 minx = _mm_set1_ps(trace_offsets[0][0]), maxx = _mm_set1_ps(trace_offsets[7][0]);
+        const __m128 miny = _mm_set1_ps(trace_offsets[0][1]), maxy = _mm_set1_ps(trace_offsets[7][1]);
+        const __m128 minz = _mm_set1_ps(trace_offsets[0][2]), maxz = _mm_set1_ps(trace_offsets[7][2]);
+        __m128 nx, ny, nz, ox, oy, oz, mask, d;
+
+        for (i = 0; i < brush->numsides; i += BRUSH_GROUP_SIDES, planes += BRUSH_GROUP_FLOATS) {
+            nx = _mm_loadu_ps(planes + 0);
+            ny = _mm_loadu_ps(planes + 4);
+            nz = _mm_loadu_ps(planes + 8);
+
+            mask = _mm_cmplt_ps(nx, zero);
+            ox = _mm_or_ps(_mm_and_ps(mask, maxx), _mm_andnot_ps(mask, minx));
+            mask = _mm_cmplt_ps(ny, zero);
+            oy = _mm_or_ps(_mm_and_ps(mask, maxy), _mm_andnot_ps(mask, miny));
+            mask = _mm_cmplt_ps(nz, zero);
+            oz = _mm_or_ps(_mm_and_ps(mask, maxz), _mm_andnot_ps(mask, minz));
+
+            d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, nx), _mm_mul_ps(oy, ny)), _mm_mul_ps(oz, nz));
+            d = _mm_sub_ps(_mm_loadu_ps(planes + 12), d);
+            d = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, nx), _mm_mul_ps(py, ny)), _mm_mul_ps(pz, nz)), d);
+
+            // if completely in front of any face, no intersection
+            if (_mm_movemask_ps(_mm_cmpgt_ps(d, zero)))
+                return;
+        }
+    } else
+#endif
+    {
+        side = brush->firstbrushside;
+        for (i = 0; i < brush->numsides; i++, side++) {
+            plane = side->plane;
+
+            // FIXME: special case for axial
+            // general box case
+            // push the plane out apropriately for mins/maxs
+            dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
+            dist = plane->dist - dist;
 
-        d1 = DotProduct(p1, plane->normal) - dist;
+            d1 = DotProduct(p1, plane->normal) - dist;
 
-        // if completely in front of face, no intersection
-        if (d1 > 0)
-            return;
+            // if completely in front of face, no intersection
+            if (d1 > 0)
+                return;
+        }
     }
 
     // inside this brush
@@ -1146,6 +1335,168 @@ nextleaf:;
     return mask;
 }
 
+/*
+==================
+CM_TraceTest_f
+
+Runs random traces through the map using both scalar and SIMD brush clipping
+and checks that results are identical.
+==================
+*/
+typedef struct {
+    vec3_t      start, end, mins, maxs;
+    vec3_t      boxmins, boxmaxs;
+    int         contentmask;
+    bool        box;
+} tracetest_t;
+
+#define TRACETEST_CHUNK 4096
+
+static void CM_RandomTrace(const mmodel_t *world, tracetest_t *t)
+{
+    static const vec3_t hulls[][2] = {
+        { {   0,   0,   0 }, {  0,  0,  0 } },
+        { { -16, -16, -24 }, { 16, 16, 32 } },
+        { { -16, -16, -24 }, { 16, 16,  4 } },
+        { {  -4,  -4,  -4 }, {  4,  4,  4 } },
+    };
+    static const int masks[] = { MASK_PLAYERSOLID, MASK_SHOT, MASK_MONSTERSOLID, MASK_ALL };
+    uint32_t r = Q_rand();
+    int i;
+
+    for (i = 0; i < 3; i++)
+        t->start[i] = world->mins[i] + (world->maxs[i] - world->mins[i]) * frand();
+
+    switch (r & 3) {
+    case 0:     // position test
+        VectorCopy(t->start, t->end);
+        break;
+    case 1:     // long move
+        for (i = 0; i < 3; i++)
+            t->end[i] = world->mins[i] + (world->maxs[i] - world->mins[i]) * frand();
+        break;
+    default:    // short move, most likely to touch brushes at grazing angles
+        for (i = 0; i < 3; i++)
+            t->end[i] = t->start[i] + crand() * 64;
+        break;
+    }
+
+    i = (r >> 2) & 3;
+    VectorCopy(hulls[i][0], t->mins);
+    VectorCopy(hulls[i][1], t->maxs);
+
+    t->contentmask = masks[(r >> 4) & 3];
+
+    // also check box hulls used for entity clipping
+    t->box = !((r >> 6) & 7);
+    if (t->box) {
+        for (i = 0; i < 3; i++) {
+            t->boxmins[i] = t->start[i] + crand() * 64 - 16;
+            t->boxmaxs[i] = t->boxmins[i] + 32;
+        }
+    }
+}
+
+static void CM_RunTraces(const cm_t *cm, const tracetest_t *tests, trace_t *results, int count)
+{
+    mnode_t *headnode;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        const tracetest_t *t = &tests[i];
+
+        if (t->box)
+            headnode = CM_HeadnodeForBox(t->boxmins, t->boxmaxs);
+        else
+            headnode = cm->cache->nodes;
+
+        CM_BoxTrace(&results[i], t->start, t->end, t->mins, t->maxs, headnode, t->contentmask);
+    }
+}
+
+static bool CM_TracesEqual(const trace_t *a, const trace_t *b)
+{
+    return a->allsolid == b->allsolid && a->startsolid == b->startsolid &&
+        a->fraction == b->fraction && VectorCompare(a->endpos, b->endpos) &&
+        VectorCompare(a->plane.normal, b->plane.normal) && a->plane.dist == b->plane.dist &&
+        a->surface == b->surface && a->contents == b->contents;
+}
+
+static void CM_TraceTest_f(void)
+{
+    char        name[MAX_QPATH];
+    cm_t        cm;
+    tracetest_t *tests;
+    trace_t     *results[2];
+    unsigned    time[2], start;
+    int         i, j, n, count, mismatches;
+    int         ret;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <map> [count]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (Q_concat(name, sizeof(name), "maps/", Cmd_Argv(1), ".bsp") >= sizeof(name)) {
+        Com_Printf("Oversize map name\n");
+        return;
+    }
+
+    count = Cmd_Argc() > 2 ? Q_atoi(Cmd_Argv(2)) : 1000000;
+    count = max(count, 1);
+
+    memset(&cm, 0, sizeof(cm));
+    ret = CM_LoadMap(&cm, name);
+    if (ret) {
+        Com_Printf("Couldn't load %s: %s\n", name, BSP_ErrorString(ret));
+        return;
+    }
+
+    tests = Z_Malloc(sizeof(tests[0]) * TRACETEST_CHUNK);
+    results[0] = Z_Malloc(sizeof(trace_t) * TRACETEST_CHUNK);
+    results[1] = Z_Malloc(sizeof(trace_t) * TRACETEST_CHUNK);
+
+    time[0] = time[1] = 0;
+    mismatches = 0;
+    for (i = 0; i < count; i += n) {
+        n = min(count - i, TRACETEST_CHUNK);
+        for (j = 0; j < n; j++)
+            CM_RandomTrace(&cm.cache->models[0], &tests[j]);
+
+        trace_nosimd = true;
+        start = Sys_Milliseconds();
+        CM_RunTraces(&cm, tests, results[0], n);
+        time[0] += Sys_Milliseconds() - start;
+
+        trace_nosimd = false;
+        start = Sys_Milliseconds();
+        CM_RunTraces(&cm, tests, results[1], n);
+        time[1] += Sys_Milliseconds() - start;
+
+        for (j = 0; j < n; j++) {
+            if (CM_TracesEqual(&results[0][j], &results[1][j]))
+                continue;
+            if (mismatches++ < 10) {
+                const tracetest_t *t = &tests[j];
+                Com_Printf("Mismatch: %s -> %s box %s %s fraction %f vs %f\n",
+                           vtos(t->start), vtos(t->end), vtos(t->mins), vtos(t->maxs),
+                           results[0][j].fraction, results[1][j].fraction);
+            }
+        }
+    }
+
+    Com_Printf("%d traces: scalar %u ms, SIMD %u ms, %d mismatches\n",
+               count, time[0], time[1], mismatches);
+#if !USE_BRUSH_SSE
+    Com_Printf("SIMD brush clipping is not available on this platform.\n");
+#endif
+
+    Z_Free(tests);
+    Z_Free(results[0]);
+    Z_Free(results[1]);
+    CM_FreeMap(&cm);
+}
+
 /*
 =============
 CM_Init
@@ -1160,5 +1511,7 @@ void CM_Init(void)
     map_noareas = Cvar_Get("map_noareas", "0", 0);
     map_allsolid_bug = Cvar_Get("map_allsolid_bug", "1", 0);
     map_override_path = Cvar_Get("map_override_path", "", 0);
+
+    Cmd_AddCommand("cmtracetest", CM_TraceTest_f);
 }
 
@@ -523,6 +523,9 @@ void Com_Error(error_type_t code, const char *fmt, ...)
     // abort any console redirects
     Com_AbortRedirect();
 
+    // stop queueing packets if error interrupted a batch
+    NET_EndBatch();
+
     // call custom cleanup function if set
     if (com_abort_func) {
         com_abort_func(com_abort_arg);
@@ -929,6 +932,8 @@ void Qcommon_Init(int argc, char **argv)
 
     Cmd_AddCommand("z_stats", Z_Stats_f);
 
+    Com_InitAsyncWork();
+
     //Cmd_AddCommand("setenv", Com_Setenv_f);
 
     Cmd_AddMacro("com_date", Com_Date_m);
@@ -984,6 +989,7 @@ void Qcommon_Init(int argc, char **argv)
     NET_Init();
     BSP_Init();
     CM_Init();
+    MSG_RegisterCommands();
     SV_Init();
     CL_Init();
     TST_Init();
@@ -0,0 +1,189 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// demoindex.c -- snapshot index appended to demo files
+//
+
+#include "shared/shared.h"
+#include "common/demoindex.h"
+#include "common/intreadwrite.h"
+#include "common/protocol.h"
+
+static int read_snapshots(qhandle_t f, demosnap_t ***snapshots, int64_t *end, memtag_t tag)
+{
+    byte        footer[DEMO_INDEX_FOOTER];
+    byte        *data, *p;
+    demosnap_t  **snaps, *snap;
+    uint32_t    count, size, msglen, left;
+    int64_t     len, start, filepos;
+    int         i, ret, framenum;
+
+    len = FS_Length(f);
+    if (len < DEMO_INDEX_FOOTER)
+        return 0;
+
+    ret = FS_Seek(f, len - DEMO_INDEX_FOOTER, SEEK_SET);
+    if (ret < 0)
+        return ret;
+
+    ret = FS_Read(footer, DEMO_INDEX_FOOTER, f);
+    if (ret != DEMO_INDEX_FOOTER)
+        return ret < 0 ? ret : Q_ERR_UNEXPECTED_EOF;
+
+    if (RL32(footer + 8) != DEMO_INDEX_MAGIC)
+        return 0;   // not indexed
+
+    count = RL32(footer);
+    size = RL32(footer + 4);
+    if (!count || count > size / DEMO_INDEX_HEADER || size > len - DEMO_INDEX_FOOTER)
+        return Q_ERR_INVALID_FORMAT;
+
+    start = len - DEMO_INDEX_FOOTER - size;
+    ret = FS_Seek(f, start, SEEK_SET);
+    if (ret < 0)
+        return ret;
+
+    data = Z_Malloc(size);
+    ret = FS_Read(data, size, f);
+    if (ret != size) {
+        Z_Free(data);
+        return ret < 0 ? ret : Q_ERR_UNEXPECTED_EOF;
+    }
+
+    snaps = Z_TagMalloc(sizeof(snaps[0]) * count, tag);
+    p = data;
+    left = size;
+    for (i = 0; i < count; i++) {
+        if (left < DEMO_INDEX_HEADER)
+            goto fail;
+
+        framenum = RL32(p);
+        filepos = RL64(p + 4);
+        msglen = RL32(p + 12);
+        p += DEMO_INDEX_HEADER;
+        left -= DEMO_INDEX_HEADER;
+
+        // snapshots must be in order and point into demo stream
+        if (msglen > MAX_MSGLEN || msglen > left || filepos < 0 || filepos > start)
+            goto fail;
+        if (i && (framenum < snaps[i - 1]->framenum || filepos < snaps[i - 1]->filepos))
+            goto fail;
+
+        snap = Z_TagMalloc(sizeof(*snap) + msglen - 1, tag);
+        snap->framenum = framenum;
+        snap->filepos = filepos;
+        snap->msglen = msglen;
+        memcpy(snap->data, p, msglen);
+        snaps[i] = snap;
+
+        p += msglen;
+        left -= msglen;
+    }
+
+    Z_Free(data);
+    *snapshots = snaps;
+    *end = start;
+    return count;
+
+fail:
+    Demo_FreeSnapshots(&snaps, &i);
+    Z_Free(data);
+    return Q_ERR_INVALID_FORMAT;
+}
+
+/*
+==================
+Demo_ReadIndex
+
+Loads snapshots from index at the end of demo file. Returns number of
+snapshots, 0 if demo is not indexed, or error code. Offset of the index,
+which is the end of demo stream, is returned in `end'. File position is
+preserved.
+==================
+*/
+int Demo_ReadIndex(qhandle_t f, demosnap_t ***snapshots, int64_t *end, memtag_t tag)
+{
+    int64_t pos;
+    int ret, ret2;
+
+    pos = FS_Tell(f);
+    if (pos < 0)
+        return pos;
+
+    ret = read_snapshots(f, snapshots, end, tag);
+
+    ret2 = FS_Seek(f, pos, SEEK_SET);
+    if (ret2 < 0) {
+        if (ret > 0)
+            Demo_FreeSnapshots(snapshots, &ret);
+        return ret2;
+    }
+
+    return ret;
+}
+
+/*
+==================
+Demo_WriteIndex
+
+Appends index of snapshots at current position, which should be right
+after the end of demo stream. Returns error code.
+==================
+*/
+int Demo_WriteIndex(qhandle_t f, demosnap_t **snapshots, int count)
+{
+    byte        header[DEMO_INDEX_HEADER];
+    byte        footer[DEMO_INDEX_FOOTER];
+    demosnap_t  *snap;
+    uint32_t    size = 0;
+    int         i, ret;
+
+    for (i = 0; i < count; i++) {
+        snap = snapshots[i];
+        WL32(header, snap->framenum);
+        WL64(header + 4, snap->filepos);
+        WL32(header + 12, snap->msglen);
+
+        ret = FS_Write(header, sizeof(header), f);
+        if (ret != sizeof(header))
+            return ret < 0 ? ret : Q_ERR_FAILURE;
+        ret = FS_Write(snap->data, snap->msglen, f);
+        if (ret != snap->msglen)
+            return ret < 0 ? ret : Q_ERR_FAILURE;
+
+        size += sizeof(header) + snap->msglen;
+    }
+
+    WL32(footer, count);
+    WL32(footer + 4, size);
+    WL32(footer + 8, DEMO_INDEX_MAGIC);
+
+    ret = FS_Write(footer, sizeof(footer), f);
+    if (ret != sizeof(footer))
+        return ret < 0 ? ret : Q_ERR_FAILURE;
+
+    return Q_ERR_SUCCESS;
+}
+
+void Demo_FreeSnapshots(demosnap_t ***snapshots, int *count)
+{
+    for (int i = 0; i < *count; i++)
+        Z_Free((*snapshots)[i]);
+
+    Z_Freep((void **)snapshots);
+    *count = 0;
+}
@@ -19,13 +19,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "shared/shared.h"
 #include "shared/list.h"
+#include "common/async.h"
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/error.h"
 #include "common/files.h"
 #include "common/prompt.h"
 #include "common/intreadwrite.h"
+#include "system/pthread.h"
 #include "system/system.h"
+#include "shared/atomic.h"
 #include "client/client.h"
 #include "server/server.h"
 #include "format/pak.h"
@@ -139,6 +142,8 @@ typedef struct {
     filetype_t  type;       // FS_PAK or FS_ZIP
     unsigned    refcount;   // for tracking pack users
     FILE        *fp;
+    byte        *map;       // whole pack mapped into memory, if not NULL
+    size_t      mapsize;
     unsigned    num_files;
     unsigned    hash_size;
     packfile_t  *files;
@@ -163,9 +168,11 @@ typedef struct {
 #endif
     packfile_t  *entry;     // pack entry this handle is tied to
     pack_t      *pack;      // points to the pack entry is from
+    const byte  *map;       // mapped entry data, read instead of fp
     int         error;      // stream error indicator from read/write operation
     int64_t     position;   // reading position for FS_PAK/FS_ZIP
     int64_t     length;     // total cached file length
+    struct fswriter_s   *writer;    // for FS_FLAG_ASYNC
 } file_t;
 
 typedef struct {
@@ -176,6 +183,22 @@ typedef struct {
     char        name[1];
 } symlink_t;
 
+// read-only view of stored pack entry handed out by FS_LoadFileView
+typedef struct {
+    list_t      entry;
+    const void  *data;
+    pack_t      *pack;
+} fsview_t;
+
+// deflated pack entry inflated by FS_PrefetchFiles ahead of loading
+typedef struct {
+    list_t      entry;
+    pack_t      *pack;
+    packfile_t  *file;
+    byte        *data;
+    int         error;
+} fsprefetch_t;
+
 // these point to user home directory
 char                fs_gamedir[MAX_OSPATH];
 //static char       fs_basedir[MAX_OSPATH];
@@ -186,6 +209,11 @@ static searchpath_t *fs_base_searchpaths;
 static list_t       fs_hard_links;
 static list_t       fs_soft_links;
 
+static LIST_DECL(fs_views);
+
+static LIST_DECL(fs_prefetched);
+static size_t       fs_prefetched_bytes;
+
 static file_t       fs_files[MAX_FILE_HANDLES];
 static int          fs_num_files;
 
@@ -208,6 +236,12 @@ static int          fs_count_strlwr;
 #endif
 
 static cvar_t       *fs_autoexec;
+static cvar_t       *fs_writebuffer;
+static cvar_t       *fs_mmap;
+static cvar_t       *fs_prefetch;
+
+// for benchmarking stdio against mapped packs
+static bool         fs_ignore_map;
 
 #if USE_DEBUG
 static cvar_t       *fs_debug;
@@ -431,6 +465,195 @@ static file_t *file_for_handle(qhandle_t f)
     return file;
 }
 
+/*
+=============================================================================
+
+ASYNC WRITES
+
+Files opened with FS_FLAG_ASYNC are written by a background thread, so that
+slow disks and gzip compression don't stall the frame. FS_Write copies data
+into a bounded ring buffer, which the writer thread drains. There is single
+producer and single consumer, so ring offsets are simply atomic. Each side
+signals the other under the lock after publishing its offset, so that wakeups
+can't be lost. Producer blocks only if the ring is full, which is counted as
+a stall. The ring is drained when file is flushed or closed.
+
+=============================================================================
+*/
+
+typedef struct fswriter_s {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       // signaled when ring is filled or drained
+    atomic_int      head;       // written by producer
+    atomic_int      tail;       // written by consumer
+    atomic_int      error;
+    bool            terminate;
+    int64_t         position;   // logical position for FS_Tell
+    size_t          peak;
+    unsigned        stalls;
+    uint64_t        stall_usec;
+    unsigned        mask;
+    byte            data[1];
+} fswriter_t;
+
+static struct {
+    uint64_t    bytes;
+    unsigned    files;
+    unsigned    stalls;
+    uint64_t    stall_usec;
+    size_t      peak;
+} fs_write_stats;
+
+static int write_file(file_t *file, const void *buf, size_t len);
+
+static void *writer_func(void *arg)
+{
+    file_t *file = arg;
+    fswriter_t *w = file->writer;
+    int head, tail, len, ret;
+
+    while (1) {
+        head = atomic_load(&w->head);
+        tail = atomic_load(&w->tail);
+
+        if (head == tail) {
+            pthread_mutex_lock(&w->lock);
+            while (atomic_load(&w->head) == tail && !w->terminate)
+                pthread_cond_wait(&w->cond, &w->lock);
+            if (atomic_load(&w->head) == tail) {
+                pthread_mutex_unlock(&w->lock);
+                break;  // terminated and drained
+            }
+            pthread_mutex_unlock(&w->lock);
+            continue;
+        }
+
+        // write contiguous part, keep draining after error
+        len = head > tail ? head - tail : w->mask + 1 - tail;
+        if (!atomic_load(&w->error)) {
+            ret = write_file(file, w->data + tail, len);
+            if (ret < 0)
+                atomic_store(&w->error, ret);
+        }
+
+        atomic_store(&w->tail, (tail + len) & w->mask);
+
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    return NULL;
+}
+
+static void start_writer(file_t *file, int64_t pos)
+{
+    fswriter_t *w;
+    size_t size;
+
+    // round up to power of two, at least 64 KiB
+    size = Q_npot32(Cvar_ClampInteger(fs_writebuffer, 64, 65536) << 10);
+
+    w = FS_Mallocz(sizeof(*w) + size - 1);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->mask = size - 1;
+    w->position = pos;
+    file->writer = w;
+
+    if (pthread_create(&w->thread, NULL, writer_func, file)) {
+        Com_WPrintf("Couldn't create writer thread, writing synchronously\n");
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        Z_Freep((void **)&file->writer);
+    }
+}
+
+// copies data into the ring, waiting for space if needed
+static int write_async(fswriter_t *w, const byte *buf, size_t len)
+{
+    int head, tail, space, ret;
+    size_t n, total = len;
+    uint64_t start;
+
+    while (len) {
+        if ((ret = atomic_load(&w->error)))
+            return ret;
+
+        head = atomic_load(&w->head);
+        tail = atomic_load(&w->tail);
+        space = (tail - head - 1) & w->mask;
+
+        if (!space) {
+            start = Sys_Microseconds();
+            pthread_mutex_lock(&w->lock);
+            while (atomic_load(&w->tail) == tail && !atomic_load(&w->error))
+                pthread_cond_wait(&w->cond, &w->lock);
+            pthread_mutex_unlock(&w->lock);
+            w->stalls++;
+            w->stall_usec += Sys_Microseconds() - start;
+            continue;
+        }
+
+        n = min(len, min(space, w->mask + 1 - head));
+        memcpy(w->data + head, buf, n);
+        atomic_store(&w->head, (head + n) & w->mask);
+        buf += n;
+        len -= n;
+
+        w->peak = max(w->peak, (head + n - tail) & w->mask);
+
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    w->position += total;
+    return total;
+}
+
+// waits until writer thread has written everything
+static int drain_writer(fswriter_t *w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (atomic_load(&w->tail) != atomic_load(&w->head))
+        pthread_cond_wait(&w->cond, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+
+    return atomic_load(&w->error);
+}
+
+static int stop_writer(file_t *file)
+{
+    fswriter_t *w = file->writer;
+    int ret;
+
+    pthread_mutex_lock(&w->lock);
+    w->terminate = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    Q_assert(!pthread_join(w->thread, NULL));
+    ret = atomic_load(&w->error);
+
+    fs_write_stats.bytes += w->position;
+    fs_write_stats.files++;
+    fs_write_stats.stalls += w->stalls;
+    fs_write_stats.stall_usec += w->stall_usec;
+    fs_write_stats.peak = max(fs_write_stats.peak, w->peak);
+
+    if (w->stalls)
+        Com_DPrintf("%s: %u stalls, %"PRIu64" ms total\n", __func__,
+                    w->stalls, w->stall_usec / 1000);
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    Z_Freep((void **)&file->writer);
+
+    return ret;
+}
+
 // expects a buffer of at least MAX_OSPATH bytes!
 static symlink_t *expand_links(list_t *list, char *buffer, size_t *len_p)
 {
@@ -489,6 +712,10 @@ int64_t FS_Tell(qhandle_t f)
     if (!file)
         return Q_ERR(EBADF);
 
+    // count data not yet written
+    if (file->writer)
+        return file->writer->position;
+
     switch (file->type) {
     case FS_REAL:
         ret = os_ftell(file->fp);
@@ -543,7 +770,7 @@ static int seek_pak_file(file_t *file, int64_t offset, int whence)
     if (entry->filepos > INT64_MAX - offset)
         return Q_ERR(EOVERFLOW);
 
-    if (os_fseek(file->fp, entry->filepos + offset, SEEK_SET))
+    if (!file->map && os_fseek(file->fp, entry->filepos + offset, SEEK_SET))
         return Q_ERRNO;
 
     file->position = offset;
@@ -564,6 +791,10 @@ int FS_Seek(qhandle_t f, int64_t offset, int whence)
     if (!file)
         return Q_ERR(EBADF);
 
+    // async file is a stream
+    if (file->writer)
+        return Q_ERR(ESPIPE);
+
     switch (file->type) {
     case FS_REAL:
         if (os_fseek(file->fp, offset, whence)) {
@@ -654,6 +885,13 @@ int FS_CloseFile(qhandle_t f)
         return Q_ERR(EBADF);
 
     ret = file->error;
+    if (file->writer) {
+        // write everything queued before closing
+        int err = stop_writer(file);
+        if (!ret)
+            ret = err;
+    }
+
     switch (file->type) {
     case FS_REAL:
         if (fclose(file->fp))
@@ -1050,19 +1288,27 @@ static int read_zip_file(file_t *file, void *buf, size_t len)
                 break;
             }
 
-            // fill in the temp buffer
-            block = min(s->rest_in, ZIP_BUFSIZE);
-            result = fread(s->buffer, 1, block, file->fp);
-            if (result != block) {
-                file->error = FS_ERR_READ(file->fp);
-                if (!result) {
-                    break;
+            if (file->map) {
+                // inflate straight from mapped pack
+                block = min(s->rest_in, UINT_MAX);
+                z->next_in = (byte *)file->map + file->entry->complen - s->rest_in;
+                z->avail_in = block;
+                s->rest_in -= block;
+            } else {
+                // fill in the temp buffer
+                block = min(s->rest_in, ZIP_BUFSIZE);
+                result = fread(s->buffer, 1, block, file->fp);
+                if (result != block) {
+                    file->error = FS_ERR_READ(file->fp);
+                    if (!result) {
+                        break;
+                    }
                 }
-            }
 
-            s->rest_in -= result;
-            z->next_in = s->buffer;
-            z->avail_in = result;
+                s->rest_in -= result;
+                z->next_in = s->buffer;
+                z->avail_in = result;
+            }
         }
 
         ret = inflate(z, Z_SYNC_FLUSH);
@@ -1099,7 +1345,7 @@ static int seek_zip_file(file_t *file, int64_t offset, int whence)
         return offset;
 
     if (offset < file->position) {
-        if (os_fseek(file->fp, entry->filepos, SEEK_SET))
+        if (!file->map && os_fseek(file->fp, entry->filepos, SEEK_SET))
             return Q_ERRNO;
 
         inflateReset(z);
@@ -1126,8 +1372,10 @@ static int seek_zip_file(file_t *file, int64_t offset, int whence)
 }
 
 #define entry_compmtd(entry)  ((entry)->compmtd)
+#define entry_complen(entry)  ((entry)->complen)
 #else
 #define entry_compmtd(entry)  0
+#define entry_complen(entry)  ((entry)->filelen)
 #endif
 
 // open a new file on the pakfile
@@ -1174,10 +1422,17 @@ static int64_t open_from_pack(file_t *file, pack_t *pack, packfile_t *entry)
     file->fp = fp;
     file->entry = entry;
     file->pack = pack;
+    file->map = NULL;
     file->error = Q_ERR_SUCCESS;
     file->position = 0;
     file->length = entry->filelen;
 
+    // read from mapped pack if entry is within it
+    if (pack->map && !fs_ignore_map && entry->filepos <= pack->mapsize &&
+        max(entry->filelen, entry_complen(entry)) <= pack->mapsize - entry->filepos) {
+        file->map = pack->map + entry->filepos;
+    }
+
 #if USE_ZLIB
     if (pack->type == FS_ZIP) {
         if (file->mode & FS_FLAG_DEFLATE) {
@@ -1499,6 +1754,12 @@ static int read_pak_file(file_t *file, void *buf, size_t len)
         return 0;
     }
 
+    if (file->map) {
+        memcpy(buf, file->map + file->position, len);
+        file->position += len;
+        return len;
+    }
+
     result = fread(buf, 1, len, file->fp);
     if (result != len) {
         file->error = FS_ERR_READ(file->fp);
@@ -1622,6 +1883,10 @@ int FS_Flush(qhandle_t f)
     if ((file->mode & FS_MODE_MASK) == FS_MODE_READ)
         return Q_ERR(EBADF);
 
+    // writer thread is idle after this
+    if (file->writer && (ret = drain_writer(file->writer)))
+        return ret;
+
     switch (file->type) {
     case FS_REAL:
         if (fflush(file->fp))
@@ -1645,9 +1910,31 @@ int FS_Flush(qhandle_t f)
 FS_Write
 =================
 */
+// may be called from writer thread
+static int write_file(file_t *file, const void *buf, size_t len)
+{
+    switch (file->type) {
+    case FS_REAL:
+        if (fwrite(buf, 1, len, file->fp) != len)
+            return Q_ERR_FAILURE;
+        break;
+#if USE_ZLIB
+    case FS_GZ:
+        if (gzwrite(file->zfp, buf, len) != len)
+            return Q_ERR_LIBRARY_ERROR;
+        break;
+#endif
+    default:
+        Q_assert(!"bad file type");
+    }
+
+    return len;
+}
+
 int FS_Write(const void *buf, size_t len, qhandle_t f)
 {
     file_t  *file = file_for_handle(f);
+    int     ret;
 
     if (!file)
         return Q_ERR(EBADF);
@@ -1665,26 +1952,14 @@ int FS_Write(const void *buf, size_t len, qhandle_t f)
     if (len == 0)
         return 0;
 
-    switch (file->type) {
-    case FS_REAL:
-        if (fwrite(buf, 1, len, file->fp) != len) {
-            file->error = Q_ERR_FAILURE;
-            return file->error;
-        }
-        break;
-#if USE_ZLIB
-    case FS_GZ:
-        if (gzwrite(file->zfp, buf, len) != len) {
-            file->error = Q_ERR_LIBRARY_ERROR;
-            return file->error;
-        }
-        break;
-#endif
-    default:
-        Q_assert(!"bad file type");
-    }
+    if (file->writer)
+        return write_async(file->writer, buf, len);
 
-    return len;
+    ret = write_file(file, buf, len);
+    if (ret < 0)
+        file->error = ret;
+
+    return ret;
 }
 
 /*
@@ -1719,6 +1994,8 @@ int64_t FS_OpenFile(const char *name, qhandle_t *f, unsigned mode)
         ret = expand_open_file_read(file, name);
     } else {
         ret = open_file_write(file, name);
+        if (ret >= 0 && (mode & FS_FLAG_ASYNC) && fs_writebuffer->integer > 0)
+            start_writer(file, ret);
     }
 
     if (ret >= 0) {
@@ -1844,6 +2121,68 @@ qhandle_t FS_EasyOpenFile(char *buf, size_t size, unsigned mode,
     return easy_open_write(buf, size, mode, dir, name, ext);
 }
 
+#if USE_ZLIB
+static fsprefetch_t *take_prefetched(packfile_t *file)
+{
+    fsprefetch_t *p;
+
+    LIST_FOR_EACH(fsprefetch_t, p, &fs_prefetched, entry) {
+        if (p->file == file) {
+            List_Remove(&p->entry);
+            fs_prefetched_bytes -= file->filelen;
+            pack_put(p->pack);
+            return p;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+// reads entire file into new buffer, +1 for NUL
+static int64_t read_whole_file(qhandle_t f, int64_t len, void **buffer, memtag_t tag)
+{
+    byte *buf;
+    int read;
+
+#if USE_ZLIB
+    file_t *file = file_for_handle(f);
+    fsprefetch_t *p;
+
+    // use data inflated by FS_PrefetchFiles
+    if (file->type == FS_ZIP && (p = take_prefetched(file->entry))) {
+        buf = p->data;
+        read = p->error;
+        Z_Free(p);
+
+        if (!read && tag != TAG_FILESYSTEM) {
+            *buffer = memcpy(Z_TagMalloc(len + 1, tag), buf, len + 1);
+            Z_Free(buf);
+            return len;
+        }
+        if (!read) {
+            *buffer = buf;
+            return len;
+        }
+
+        // failed, try reading normally to get the error
+        Z_Free(buf);
+    }
+#endif
+
+    buf = Z_TagMalloc(len + 1, tag);
+
+    read = FS_Read(buf, len, f);
+    if (read != len) {
+        Z_Free(buf);
+        return read < 0 ? read : Q_ERR_UNEXPECTED_EOF;
+    }
+
+    *buffer = buf;
+    buf[len] = 0;
+    return len;
+}
+
 /*
 ============
 FS_LoadFile
@@ -1856,9 +2195,7 @@ int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
 {
     file_t *file;
     qhandle_t f;
-    byte *buf;
     int64_t len;
-    int read;
 
     Q_assert(path);
 
@@ -1891,29 +2228,225 @@ int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
     }
 
     // NULL buffer just checks for file existence
-    if (!buffer) {
-        goto done;
+    if (buffer) {
+        len = read_whole_file(f, len, buffer, tag);
     }
 
-    // allocate chunk of memory, +1 for NUL
-    buf = Z_TagMalloc(len + 1, tag);
+done:
+    FS_CloseFile(f);
+    return len;
+}
 
-    // read entire file
-    read = FS_Read(buf, len, f);
-    if (read != len) {
-        len = read < 0 ? read : Q_ERR_UNEXPECTED_EOF;
-        Z_Free(buf);
+/*
+============
+FS_LoadFileView
+
+Like FS_LoadFile, but if file is stored uncompressed in a mapped pack,
+returns read-only view of pack data instead of a copy. Such buffer is not
+NUL terminated. Buffer must be released with FS_FreeFile, which keeps the
+pack alive until then.
+============
+*/
+int FS_LoadFileView(const char *path, const void **buffer, unsigned flags)
+{
+    file_t *file;
+    qhandle_t f;
+    fsview_t *view;
+    int64_t len;
+
+    Q_assert(path && buffer);
+
+    *buffer = NULL;
+
+    if (!fs_searchpaths) {
+        return Q_ERR(EAGAIN); // not yet initialized
+    }
+
+    // allocate new file handle
+    file = alloc_handle(&f);
+    if (!file) {
+        return Q_ERR(EMFILE);
+    }
+
+    file->mode = (flags & ~FS_MODE_MASK) | FS_MODE_READ | FS_FLAG_LOADFILE;
+
+    // look for it in the filesystem or pack files
+    len = expand_open_file_read(file, path);
+    if (len < 0) {
+        return len;
+    }
+
+    // sanity check file size
+    if (len > MAX_LOADFILE) {
+        len = Q_ERR(EFBIG);
         goto done;
     }
 
-    *buffer = buf;
-    buf[len] = 0;
+    if (file->type == FS_PAK && file->map) {
+        view = FS_Malloc(sizeof(*view));
+        view->data = file->map;
+        view->pack = pack_get(file->pack);
+        List_Append(&fs_views, &view->entry);
+        *buffer = view->data;
+    } else {
+        len = read_whole_file(f, len, (void **)buffer, TAG_FILESYSTEM);
+    }
 
 done:
     FS_CloseFile(f);
     return len;
 }
 
+/*
+============
+FS_FreeFile
+
+Releases buffer returned by FS_LoadFile or FS_LoadFileView.
+============
+*/
+void FS_FreeFile(const void *buffer)
+{
+    fsview_t *view;
+
+    if (!buffer) {
+        return;
+    }
+
+    LIST_FOR_EACH(fsview_t, view, &fs_views, entry) {
+        if (view->data == buffer) {
+            List_Remove(&view->entry);
+            pack_put(view->pack);
+            Z_Free(view);
+            return;
+        }
+    }
+
+    Z_Free((void *)buffer);
+}
+
+#if USE_ZLIB
+// zone allocator is not thread safe, default zlib allocators are used
+static void prefetch_work(void *arg, int i)
+{
+    fsprefetch_t *p = ((fsprefetch_t **)arg)[i];
+    packfile_t *file = p->file;
+    z_stream z = { 0 };
+    int ret;
+
+    if (inflateInit2(&z, -MAX_WBITS) != Z_OK) {
+        p->error = Q_ERR_INFLATE_FAILED;
+        return;
+    }
+
+    z.next_in = p->pack->map + file->filepos;
+    z.avail_in = (uInt)file->complen;
+    z.next_out = p->data;
+    z.avail_out = (uInt)file->filelen;
+
+    ret = inflate(&z, Z_FINISH);
+    if (z.avail_out || (ret != Z_STREAM_END && ret != Z_BUF_ERROR && ret != Z_OK))
+        p->error = Q_ERR_INFLATE_FAILED;
+    else
+        p->data[file->filelen] = 0;
+
+    inflateEnd(&z);
+}
+#endif
+
+/*
+============
+FS_FreePrefetched
+
+Drops files prefetched and not loaded since.
+============
+*/
+void FS_FreePrefetched(void)
+{
+    fsprefetch_t *p, *next;
+
+    LIST_FOR_EACH_SAFE(fsprefetch_t, p, next, &fs_prefetched, entry) {
+        pack_put(p->pack);
+        Z_Free(p->data);
+        Z_Free(p);
+    }
+
+    List_Init(&fs_prefetched);
+    fs_prefetched_bytes = 0;
+}
+
+/*
+============
+FS_PrefetchFiles
+
+Inflates deflated files from mapped packs on worker threads, so that
+following FS_LoadFile calls for them return immediately. Files stored
+uncompressed or outside of packs are skipped, as loading them is cheap.
+Total size of prefetched files is limited by fs_prefetch. Prefetched
+files stay cached until loaded or until FS_FreePrefetched is called.
+============
+*/
+void FS_PrefetchFiles(const char **names, int count)
+{
+#if USE_ZLIB
+    fsprefetch_t **jobs, *p;
+    size_t limit;
+    file_t *file;
+    qhandle_t f;
+    int64_t len;
+    int i, numjobs = 0;
+
+    limit = (size_t)Cvar_ClampInteger(fs_prefetch, 0, 4096) << 20;
+    if (!fs_searchpaths || !limit || count <= 0) {
+        return;
+    }
+
+    jobs = FS_AllocTempMem(sizeof(jobs[0]) * count);
+
+    // find pack entries on main thread
+    for (i = 0; i < count; i++) {
+        file = alloc_handle(&f);
+        if (!file) {
+            break;
+        }
+
+        file->mode = FS_MODE_READ | FS_FLAG_LOADFILE;
+
+        len = expand_open_file_read(file, names[i]);
+        if (len < 0) {
+            continue;
+        }
+
+        if (file->type == FS_ZIP && file->map && len <= MAX_LOADFILE &&
+            file->entry->complen <= UINT_MAX && fs_prefetched_bytes + len <= limit) {
+            LIST_FOR_EACH(fsprefetch_t, p, &fs_prefetched, entry) {
+                if (p->file == file->entry) {
+                    break;
+                }
+            }
+            if (LIST_TERM(p, &fs_prefetched, entry)) {
+                p = FS_Malloc(sizeof(*p));
+                p->pack = pack_get(file->pack);
+                p->file = file->entry;
+                p->data = FS_Malloc(len + 1);
+                p->error = Q_ERR_SUCCESS;
+                List_Append(&fs_prefetched, &p->entry);
+                fs_prefetched_bytes += len;
+                jobs[numjobs++] = p;
+            }
+        }
+
+        FS_CloseFile(f);
+    }
+
+    Com_ParallelFor(numjobs, prefetch_work, jobs);
+
+    FS_FreeTempMem(jobs);
+
+    Com_DPrintf("Prefetched %d of %d files, %zu bytes cached\n",
+                numjobs, count, fs_prefetched_bytes);
+#endif
+}
+
 static int write_and_close(const void *data, size_t len, qhandle_t f)
 {
     int ret1 = FS_Write(data, len, f);
@@ -2035,6 +2568,9 @@ int FS_FPrintf(qhandle_t f, const char *format, ...)
 
 static void pack_free(pack_t *pack)
 {
+    if (pack->map) {
+        Sys_UnmapFile(pack->map, pack->mapsize);
+    }
     fclose(pack->fp);
     Z_Free(pack->names);
     Z_Free(pack->file_hash);
@@ -2077,8 +2613,24 @@ static pack_t *pack_alloc(FILE *fp, filetype_t type, const char *name,
     pack->hash_size = 0;
     pack->file_hash = NULL;
     pack->names = FS_Malloc(names_len);
+    pack->map = NULL;
+    pack->mapsize = 0;
     strcpy(pack->filename, name);
 
+    // reading from mapped pack avoids stdio copies and seeks
+    if (fs_mmap->integer) {
+        file_info_t info;
+
+        if (!get_fp_info(fp, &info) && info.size > 0 && info.size <= SIZE_MAX) {
+            pack->map = Sys_MapFile(fp, info.size);
+            if (pack->map) {
+                pack->mapsize = info.size;
+            } else {
+                Com_WPrintf("Couldn't map %s, reading through stdio\n", name);
+            }
+        }
+    }
+
     return pack;
 }
 
@@ -3568,6 +4120,8 @@ void FS_Restart(bool total)
 {
     Com_Printf("----- FS_Restart -----\n");
 
+    FS_FreePrefetched();
+
     if (total) {
         // perform full reset
         free_all_paths();
@@ -3599,6 +4153,87 @@ static void FS_Restart_f(void)
     CL_RestartFilesystem(true);
 }
 
+static void FS_WriteStats_f(void)
+{
+    Com_Printf("%u files written asynchronously, %"PRIu64" bytes\n",
+               fs_write_stats.files, fs_write_stats.bytes);
+    Com_Printf("%u stalls on full buffer, %"PRIu64" ms total\n",
+               fs_write_stats.stalls, fs_write_stats.stall_usec / 1000);
+    Com_Printf("Peak buffer usage: %zu bytes\n", fs_write_stats.peak);
+}
+
+/*
+============
+FS_LoadBench_f
+
+Loads files matching filter from mapped packs through stdio, by copying
+from mapping, and as views of mapping. One byte of each page of views is
+read, so that page faults are counted.
+============
+*/
+static void FS_LoadBench_f(void)
+{
+    static const char *const names[3] = { "stdio", "mmap copy", "mmap view" };
+    const char *filter = Cmd_Argc() > 1 ? Cmd_Argv(1) : "*";
+    uint64_t start, usec[3], bytes[3];
+    unsigned stored = 0, deflated = 0, checksum = 0;
+    searchpath_t *search;
+    packfile_t *entry;
+    const void *view;
+    void *data;
+    char *name;
+    int pass, i, len, j;
+
+    for (pass = 0; pass < 3; pass++) {
+        fs_ignore_map = pass == 0;
+        bytes[pass] = 0;
+        start = Sys_Microseconds();
+
+        for (search = fs_searchpaths; search; search = search->next) {
+            if (!search->pack || !search->pack->map)
+                continue;
+
+            for (i = 0, entry = search->pack->files; i < search->pack->num_files; i++, entry++) {
+                name = search->pack->names + entry->nameofs;
+                if (!FS_WildCmp(filter, name))
+                    continue;
+
+                if (pass == 2) {
+                    len = FS_LoadFileView(name, &view, 0);
+                    for (j = 0; j < len; j += 4096)
+                        checksum += ((const byte *)view)[j];
+                    FS_FreeFile(view);
+                } else {
+                    len = FS_LoadFile(name, &data);
+                    FS_FreeFile(data);
+                }
+
+                if (len > 0)
+                    bytes[pass] += len;
+                if (pass == 0 && entry_compmtd(entry))
+                    deflated++;
+                else if (pass == 0)
+                    stored++;
+            }
+        }
+
+        usec[pass] = max(Sys_Microseconds() - start, 1);
+    }
+
+    fs_ignore_map = false;
+
+    if (!stored && !deflated) {
+        Com_Printf("No files in mapped packs match %s\n", filter);
+        return;
+    }
+
+    Com_Printf("%u stored and %u deflated files, %"PRIu64" bytes (checksum %u)\n",
+               stored, deflated, bytes[0], checksum);
+    for (pass = 0; pass < 3; pass++)
+        Com_Printf("%-9s %8"PRIu64" ms %8.1f MB/s\n", names[pass], usec[pass] / 1000,
+                   bytes[pass] / (double)usec[pass]);
+}
+
 static const cmdreg_t c_fs[] = {
     { "path", FS_Path_f },
     { "fdir", FS_FDir_f },
@@ -3612,6 +4247,8 @@ static const cmdreg_t c_fs[] = {
     { "softlink", FS_Link_f, FS_Link_c },
     { "softunlink", FS_UnLink_f, FS_Link_c },
     { "fs_restart", FS_Restart_f },
+    { "fs_writestats", FS_WriteStats_f },
+    { "fs_loadbench", FS_LoadBench_f },
 
     { NULL }
 };
@@ -3643,6 +4280,8 @@ void FS_Shutdown(void)
     free_all_links(&fs_hard_links);
     free_all_links(&fs_soft_links);
 
+    FS_FreePrefetched();
+
     // free search paths
     free_all_paths();
 
@@ -3781,6 +4420,9 @@ void FS_Init(void)
     Cmd_Register(c_fs);
 
     fs_autoexec = Cvar_Get("fs_autoexec", "1", 0);
+    fs_writebuffer = Cvar_Get("fs_writebuffer", "1024", 0);
+    fs_mmap = Cvar_Get("fs_mmap", "1", 0);
+    fs_prefetch = Cvar_Get("fs_prefetch", "256", 0);
 
 #if USE_DEBUG
     fs_debug = Cvar_Get("fs_debug", "0", 0);
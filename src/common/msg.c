@@ -22,6 +22,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/sizebuf.h"
 #include "common/math.h"
 #include "common/intreadwrite.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/zone.h"
+#include "system/system.h"
+
+#if (defined __SSE2__) || (defined _M_X64)
+#include <emmintrin.h>
+#define USE_DELTA_SSE   1
+#else
+#define USE_DELTA_SSE   0
+#endif
 
 /*
 ==============================================================================
@@ -32,24 +43,26 @@ Handles byte ordering and avoids alignment errors
 ==============================================================================
 */
 
-sizebuf_t   msg_write;
+q_thread_local sizebuf_t msg_write;
 byte        msg_write_buffer[MAX_MSGLEN];
 
-sizebuf_t   msg_read;
+q_thread_local sizebuf_t msg_read;
 byte        msg_read_buffer[MAX_MSGLEN];
 
 const entity_packed_t   nullEntityState;
 const player_packed_t   nullPlayerState;
 const usercmd_t         nullUserCmd;
 
+static void MSG_InitDeltaFields(void);
+
 /*
 =============
 MSG_Init
 
 Initialize default buffers, clearing allow overflow/underflow flags.
 
-This is the only place where writing buffer is initialized. Writing buffer is
-never allowed to overflow.
+This is the only place where main thread writing buffer is initialized.
+Writing buffer is never allowed to overflow.
 
 Reading buffer is reinitialized in many other places. Reinitializing will set
 the allow underflow flag as appropriate.
@@ -59,6 +72,8 @@ void MSG_Init(void)
 {
     SZ_TagInit(&msg_read, msg_read_buffer, MAX_MSGLEN, "msg_read");
     SZ_TagInit(&msg_write, msg_write_buffer, MAX_MSGLEN, "msg_write");
+
+    MSG_InitDeltaFields();
 }
 
 
@@ -495,40 +510,25 @@ void MSG_PackEntity(entity_packed_t *out, const entity_state_t *in, const entity
     }
 }
 
-void MSG_WriteDeltaEntity(const entity_packed_t *from,
-                          const entity_packed_t *to,
-                          msgEsFlags_t          flags)
-{
-    uint64_t    bits;
-    uint32_t    mask;
-
-    if (!to) {
-        Q_assert(from);
-        Q_assert(from->number > 0 && from->number < MAX_EDICTS);
-
-        bits = U_REMOVE;
-        if (from->number & 0xff00)
-            bits |= U_NUMBER16 | U_MOREBITS1;
-
-        MSG_WriteByte(bits & 255);
-        if (bits & 0x0000ff00)
-            MSG_WriteByte((bits >> 8) & 255);
-
-        if (bits & U_NUMBER16)
-            MSG_WriteShort(from->number);
-        else
-            MSG_WriteByte(from->number);
-
-        return; // remove entity
-    }
+/*
+==============================================================================
 
-    Q_assert(to->number > 0 && to->number < MAX_EDICTS);
+            DELTA ENTITY BITS
 
-    if (!from)
-        from = &nullEntityState;
+U_* bits of an entity update are found either by comparing each field in
+turn, or by diffing the whole packed state at once into a mask of changed
+bytes, which is mapped into a mask of changed fields through a table. The
+latter lets unchanged entities be skipped right away. Both must always give
+identical results, which is checked by `deltatest` command.
+==============================================================================
+*/
 
-// send an update
-    bits = 0;
+static uint64_t MSG_DeltaEntityBits_Scalar(const entity_packed_t *from,
+                                           const entity_packed_t *to,
+                                           msgEsFlags_t          flags)
+{
+    uint64_t    bits = 0;
+    uint32_t    mask;
 
     if (!(flags & MSG_ES_FIRSTPERSON)) {
         if (to->origin[0] != from->origin[0])
@@ -644,6 +644,356 @@ void MSG_WriteDeltaEntity(const entity_packed_t *from,
             bits |= U_OLDORIGIN;
     }
 
+    return bits;
+}
+
+// entity fields in changed field mask
+enum {
+    EF_ORIGIN1,
+    EF_ORIGIN2,
+    EF_ORIGIN3,
+    EF_ANGLE1,
+    EF_ANGLE2,
+    EF_ANGLE3,
+    EF_ANGLE1_HI,   // only high byte of angle
+    EF_ANGLE2_HI,
+    EF_ANGLE3_HI,
+    EF_MODEL,
+    EF_MODEL2,
+    EF_MODEL3,
+    EF_MODEL4,
+    EF_SKIN,
+    EF_EFFECTS,
+    EF_RENDERFX,
+    EF_SOLID,
+    EF_MOREFX,
+    EF_FRAME,
+    EF_SOUND,
+    EF_ALPHA,
+    EF_SCALE,
+    EF_LOOP_VOLUME,
+    EF_LOOP_ATTENUATION,
+};
+
+// bytes of entity_packed_t that are diffed, everything but padding
+#define DELTA_BYTES     57
+
+#if USE_BIG_ENDIAN
+#define HIBYTE_OFS      0
+#else
+#define HIBYTE_OFS      1
+#endif
+
+// changed fields for each byte of changed bytes mask
+static uint32_t delta_fields[8][256];
+
+static void MSG_InitDeltaFields(void)
+{
+    static const struct {
+        uint8_t ofs, size, field;
+    } fields[] = {
+#define F(name, field) { q_offsetof(entity_packed_t, name), sizeof(((entity_packed_t *)0)->name), field }
+        F(origin[0], EF_ORIGIN1),
+        F(origin[1], EF_ORIGIN2),
+        F(origin[2], EF_ORIGIN3),
+        F(angles[0], EF_ANGLE1),
+        F(angles[1], EF_ANGLE2),
+        F(angles[2], EF_ANGLE3),
+        { q_offsetof(entity_packed_t, angles[0]) + HIBYTE_OFS, 1, EF_ANGLE1_HI },
+        { q_offsetof(entity_packed_t, angles[1]) + HIBYTE_OFS, 1, EF_ANGLE2_HI },
+        { q_offsetof(entity_packed_t, angles[2]) + HIBYTE_OFS, 1, EF_ANGLE3_HI },
+        F(modelindex, EF_MODEL),
+        F(modelindex2, EF_MODEL2),
+        F(modelindex3, EF_MODEL3),
+        F(modelindex4, EF_MODEL4),
+        F(skinnum, EF_SKIN),
+        F(effects, EF_EFFECTS),
+        F(renderfx, EF_RENDERFX),
+        F(solid, EF_SOLID),
+        F(morefx, EF_MOREFX),
+        F(frame, EF_FRAME),
+        F(sound, EF_SOUND),
+        F(alpha, EF_ALPHA),
+        F(scale, EF_SCALE),
+        F(loop_volume, EF_LOOP_VOLUME),
+        F(loop_attenuation, EF_LOOP_ATTENUATION),
+#undef F
+    };
+    static bool initialized;
+    uint32_t bytes[64] = { 0 };
+    int i, j, k;
+
+    if (initialized)
+        return;
+    initialized = true;
+
+    Q_assert(q_offsetof(entity_packed_t, loop_attenuation) + 1 == DELTA_BYTES);
+    Q_assert(sizeof(entity_packed_t) >= DELTA_BYTES);
+
+    for (i = 0; i < q_countof(fields); i++)
+        for (j = 0; j < fields[i].size; j++)
+            bytes[fields[i].ofs + j] |= BIT(fields[i].field);
+
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 256; j++) {
+            delta_fields[i][j] = 0;
+            for (k = 0; k < 8; k++)
+                if (j & BIT(k))
+                    delta_fields[i][j] |= bytes[i * 8 + k];
+        }
+    }
+}
+
+// returns mask of bytes that differ
+static uint64_t MSG_DiffEntities(const entity_packed_t *from, const entity_packed_t *to)
+{
+    const byte *a = (const byte *)from;
+    const byte *b = (const byte *)to;
+    uint64_t diff;
+
+#if USE_DELTA_SSE
+    __m128i a0 = _mm_loadu_si128((const __m128i *)a + 0);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)a + 1);
+    __m128i a2 = _mm_loadu_si128((const __m128i *)a + 2);
+    __m128i a3 = _mm_loadl_epi64((const __m128i *)(a + 48));
+    __m128i b0 = _mm_loadu_si128((const __m128i *)b + 0);
+    __m128i b1 = _mm_loadu_si128((const __m128i *)b + 1);
+    __m128i b2 = _mm_loadu_si128((const __m128i *)b + 2);
+    __m128i b3 = _mm_loadl_epi64((const __m128i *)(b + 48));
+
+    diff  = (uint64_t)(uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(a0, b0));
+    diff |= (uint64_t)(uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(a1, b1)) << 16;
+    diff |= (uint64_t)(uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(a2, b2)) << 32;
+    diff |= (uint64_t)(uint8_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(a3, b3)) << 48;
+#else
+    int i;
+
+    // set lowest bit of each differing byte, then gather them
+    diff = 0;
+    for (i = 0; i < 7; i++) {
+        uint64_t x = RL64(a + i * 8) ^ RL64(b + i * 8);
+        x |= x >> 4;
+        x |= x >> 2;
+        x |= x >> 1;
+        x &= 0x0101010101010101ULL;
+        x = (x * 0x0102040810204080ULL) >> 56;
+        diff |= x << (i * 8);
+    }
+#endif
+
+    diff |= (uint64_t)(a[56] != b[56]) << 56;
+
+    return diff;
+}
+
+static uint64_t MSG_DeltaEntityBits(const entity_packed_t *from,
+                                    const entity_packed_t *to,
+                                    msgEsFlags_t          flags)
+{
+    uint64_t    bits, diff;
+    uint32_t    mask, f;
+    int         i;
+
+    diff = MSG_DiffEntities(from, to);
+
+    f = 0;
+    for (i = 0; diff; i++, diff >>= 8)
+        f |= delta_fields[i][diff & 255];
+
+    // skip unchanged entities right away
+    if (!f && !to->event && !(flags & MSG_ES_NEWENTITY) &&
+        !(to->renderfx & (RF_FRAMELERP | RF_BEAM)))
+        return 0;
+
+    bits = 0;
+
+    if (!(flags & MSG_ES_FIRSTPERSON)) {
+        if (f & BIT(EF_ORIGIN1))
+            bits |= U_ORIGIN1;
+        if (f & BIT(EF_ORIGIN2))
+            bits |= U_ORIGIN2;
+        if (f & BIT(EF_ORIGIN3))
+            bits |= U_ORIGIN3;
+
+        if (flags & MSG_ES_SHORTANGLES) {
+            if (f & BIT(EF_ANGLE1))
+                bits |= U_ANGLE1 | U_ANGLE16;
+            if (f & BIT(EF_ANGLE2))
+                bits |= U_ANGLE2 | U_ANGLE16;
+            if (f & BIT(EF_ANGLE3))
+                bits |= U_ANGLE3 | U_ANGLE16;
+        } else {
+            if (f & BIT(EF_ANGLE1_HI))
+                bits |= U_ANGLE1;
+            if (f & BIT(EF_ANGLE2_HI))
+                bits |= U_ANGLE2;
+            if (f & BIT(EF_ANGLE3_HI))
+                bits |= U_ANGLE3;
+        }
+
+        if ((flags & MSG_ES_NEWENTITY) && !VectorCompare(to->old_origin, from->origin))
+            bits |= U_OLDORIGIN;
+    }
+
+    if (flags & MSG_ES_UMASK)
+        mask = 0xffff0000;
+    else
+        mask = 0xffff8000;  // don't confuse old clients
+
+    if (f & BIT(EF_SKIN)) {
+        if (to->skinnum & mask)
+            bits |= U_SKIN32;
+        else if (to->skinnum & 0x0000ff00)
+            bits |= U_SKIN16;
+        else
+            bits |= U_SKIN8;
+    }
+
+    if (f & BIT(EF_FRAME)) {
+        if (to->frame & 0xff00)
+            bits |= U_FRAME16;
+        else
+            bits |= U_FRAME8;
+    }
+
+    if (f & BIT(EF_EFFECTS)) {
+        if (to->effects & mask)
+            bits |= U_EFFECTS32;
+        else if (to->effects & 0x0000ff00)
+            bits |= U_EFFECTS16;
+        else
+            bits |= U_EFFECTS8;
+    }
+
+    if (f & BIT(EF_RENDERFX)) {
+        if (to->renderfx & mask)
+            bits |= U_RENDERFX32;
+        else if (to->renderfx & 0x0000ff00)
+            bits |= U_RENDERFX16;
+        else
+            bits |= U_RENDERFX8;
+    }
+
+    if (f & BIT(EF_SOLID))
+        bits |= U_SOLID;
+
+    // event is not delta compressed, just 0 compressed
+    if (to->event)
+        bits |= U_EVENT;
+
+    if (f & BIT(EF_MODEL))
+        bits |= U_MODEL;
+    if (f & BIT(EF_MODEL2))
+        bits |= U_MODEL2;
+    if (f & BIT(EF_MODEL3))
+        bits |= U_MODEL3;
+    if (f & BIT(EF_MODEL4))
+        bits |= U_MODEL4;
+
+    if (flags & MSG_ES_EXTENSIONS) {
+        if (bits & (U_MODEL | U_MODEL2 | U_MODEL3 | U_MODEL4) &&
+            (to->modelindex | to->modelindex2 | to->modelindex3 | to->modelindex4) & 0xff00)
+            bits |= U_MODEL16;
+        if (f & (BIT(EF_LOOP_VOLUME) | BIT(EF_LOOP_ATTENUATION)))
+            bits |= U_SOUND;
+        if (f & BIT(EF_MOREFX)) {
+            if (to->morefx & mask)
+                bits |= U_MOREFX32;
+            else if (to->morefx & 0x0000ff00)
+                bits |= U_MOREFX16;
+            else
+                bits |= U_MOREFX8;
+        }
+        if (f & BIT(EF_ALPHA))
+            bits |= U_ALPHA;
+        if (f & BIT(EF_SCALE))
+            bits |= U_SCALE;
+    }
+
+    if (f & BIT(EF_SOUND))
+        bits |= U_SOUND;
+
+    if (to->renderfx & RF_FRAMELERP) {
+        if (!VectorCompare(to->old_origin, from->origin))
+            bits |= U_OLDORIGIN;
+    } else if (to->renderfx & RF_BEAM) {
+        if (!(flags & MSG_ES_BEAMORIGIN) || !VectorCompare(to->old_origin, from->old_origin))
+            bits |= U_OLDORIGIN;
+    }
+
+    return bits;
+}
+
+static bool     delta_scalar;   // for MSG_DeltaTest_f
+
+// entity deltas recorded for MSG_DeltaBench_f
+typedef struct {
+    entity_packed_t from, to;
+    msgEsFlags_t    flags;
+} deltarecord_t;
+
+static deltarecord_t    *delta_records;
+static int              delta_numrecords;
+static int              delta_maxrecords;
+
+static void MSG_RecordDelta(const entity_packed_t *from,
+                            const entity_packed_t *to,
+                            msgEsFlags_t          flags)
+{
+    deltarecord_t *r;
+
+    // only record from main thread
+    if (msg_write.data != msg_write_buffer)
+        return;
+
+    r = &delta_records[delta_numrecords++];
+    r->from = *from;
+    r->to = *to;
+    r->flags = flags;
+
+    if (delta_numrecords == delta_maxrecords)
+        Com_Printf("Recorded %d entity deltas.\n", delta_numrecords);
+}
+
+void MSG_WriteDeltaEntity(const entity_packed_t *from,
+                          const entity_packed_t *to,
+                          msgEsFlags_t          flags)
+{
+    uint64_t    bits;
+
+    if (!to) {
+        Q_assert(from);
+        Q_assert(from->number > 0 && from->number < MAX_EDICTS);
+
+        bits = U_REMOVE;
+        if (from->number & 0xff00)
+            bits |= U_NUMBER16 | U_MOREBITS1;
+
+        MSG_WriteByte(bits & 255);
+        if (bits & 0x0000ff00)
+            MSG_WriteByte((bits >> 8) & 255);
+
+        if (bits & U_NUMBER16)
+            MSG_WriteShort(from->number);
+        else
+            MSG_WriteByte(from->number);
+
+        return; // remove entity
+    }
+
+    Q_assert(to->number > 0 && to->number < MAX_EDICTS);
+
+    if (!from)
+        from = &nullEntityState;
+
+    if (delta_numrecords < delta_maxrecords)
+        MSG_RecordDelta(from, to, flags);
+
+    if (delta_scalar)
+        bits = MSG_DeltaEntityBits_Scalar(from, to, flags);
+    else
+        bits = MSG_DeltaEntityBits(from, to, flags);
+
     //
     // write the message
     //
@@ -781,6 +1131,187 @@ void MSG_WriteDeltaEntity(const entity_packed_t *from,
         MSG_WriteByte(to->scale);
 }
 
+/*
+==============================================================================
+
+            DELTA ENTITY TESTS
+
+==============================================================================
+*/
+
+static void MSG_DeltaRecord_f(void)
+{
+    int count;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <count>\n"
+                   "%d of %d entity deltas recorded.\n",
+                   Cmd_Argv(0), delta_numrecords, delta_maxrecords);
+        return;
+    }
+
+    count = Q_atoi(Cmd_Argv(1));
+    Z_Freep((void **)&delta_records);
+    delta_numrecords = delta_maxrecords = 0;
+    if (count > 0) {
+        delta_records = Z_Malloc(sizeof(delta_records[0]) * count);
+        delta_maxrecords = count;
+        Com_Printf("Recording %d entity deltas.\n", count);
+    }
+}
+
+// writes delta using both paths, returns false if bitstreams differ
+static bool MSG_CompareDelta(const entity_packed_t *from,
+                             const entity_packed_t *to,
+                             msgEsFlags_t          flags)
+{
+    byte    buffer[2][MAX_PACKETENTITY_BYTES * 2];
+    size_t  size[2];
+    int     i;
+
+    for (i = 0; i < 2; i++) {
+        SZ_Init(&msg_write, buffer[i], sizeof(buffer[i]));
+        delta_scalar = !i;
+        MSG_WriteDeltaEntity(from, to, flags);
+        size[i] = msg_write.cursize;
+    }
+
+    return size[0] == size[1] && !memcmp(buffer[0], buffer[1], size[0]);
+}
+
+static void MSG_DeltaBench_f(void)
+{
+    byte        buffer[MAX_MSGLEN];
+    sizebuf_t   saved = msg_write;
+    unsigned    start, time[2];
+    int         i, j, pass, repeat, mismatches;
+
+    if (!delta_numrecords) {
+        Com_Printf("No entity deltas recorded.\n");
+        return;
+    }
+
+    repeat = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 100;
+    repeat = max(repeat, 1);
+
+    for (pass = 0; pass < 2; pass++) {
+        delta_scalar = !pass;
+        start = Sys_Milliseconds();
+        for (j = 0; j < repeat; j++) {
+            SZ_Init(&msg_write, buffer, sizeof(buffer));
+            for (i = 0; i < delta_numrecords; i++) {
+                const deltarecord_t *r = &delta_records[i];
+                if (msg_write.cursize > sizeof(buffer) - MAX_PACKETENTITY_BYTES * 2)
+                    msg_write.cursize = 0;
+                MSG_WriteDeltaEntity(&r->from, &r->to, r->flags);
+            }
+        }
+        time[pass] = Sys_Milliseconds() - start;
+    }
+
+    mismatches = 0;
+    for (i = 0; i < delta_numrecords; i++) {
+        const deltarecord_t *r = &delta_records[i];
+        if (!MSG_CompareDelta(&r->from, &r->to, r->flags))
+            mismatches++;
+    }
+
+    delta_scalar = false;
+    msg_write = saved;
+
+    Com_Printf("%d entity deltas x %d: scalar %u ms, fast %u ms, %d mismatches\n",
+               delta_numrecords, repeat, time[0], time[1], mismatches);
+}
+
+static uint32_t MSG_RandomValue(uint32_t old)
+{
+    switch (Q_rand() & 7) {
+    case 0:
+        return 0;
+    case 1:
+        return Q_rand() & 0xff;
+    case 2:
+        return Q_rand() & 0xffff;
+    case 3:
+        return Q_rand();
+    case 4:
+        return old ^ BIT(Q_rand() & 31);
+    default:
+        return old;     // mostly unchanged
+    }
+}
+
+static void MSG_RandomEntity(entity_packed_t *to, const entity_packed_t *from)
+{
+    int i;
+
+    *to = *from;
+    to->number = 1 + Q_rand_uniform(MAX_EDICTS - 1);
+    for (i = 0; i < 3; i++) {
+        to->origin[i] = MSG_RandomValue(from->origin[i]);
+        to->angles[i] = MSG_RandomValue(from->angles[i]);
+        to->old_origin[i] = (Q_rand() & 1) ? from->origin[i] : MSG_RandomValue(from->old_origin[i]);
+    }
+    to->modelindex = MSG_RandomValue(from->modelindex);
+    to->modelindex2 = MSG_RandomValue(from->modelindex2);
+    to->modelindex3 = MSG_RandomValue(from->modelindex3);
+    to->modelindex4 = MSG_RandomValue(from->modelindex4);
+    to->skinnum = MSG_RandomValue(from->skinnum);
+    to->effects = MSG_RandomValue(from->effects);
+    to->renderfx = MSG_RandomValue(from->renderfx);
+    to->solid = MSG_RandomValue(from->solid);
+    to->morefx = MSG_RandomValue(from->morefx);
+    to->frame = MSG_RandomValue(from->frame);
+    to->sound = MSG_RandomValue(from->sound);
+    to->event = (Q_rand() & 3) ? 0 : MSG_RandomValue(from->event);
+    to->alpha = MSG_RandomValue(from->alpha);
+    to->scale = MSG_RandomValue(from->scale);
+    to->loop_volume = MSG_RandomValue(from->loop_volume);
+    to->loop_attenuation = MSG_RandomValue(from->loop_attenuation);
+}
+
+static void MSG_DeltaTest_f(void)
+{
+    entity_packed_t from, to;
+    sizebuf_t       saved = msg_write;
+    int             i, count, mismatches;
+    msgEsFlags_t    flags;
+
+    count = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 1000000;
+    count = max(count, 1);
+
+    memset(&from, 0, sizeof(from));
+    mismatches = 0;
+    for (i = 0; i < count; i++) {
+        // random walk through entity states, sometimes from scratch
+        if (!(Q_rand() & 15))
+            memset(&from, 0, sizeof(from));
+        MSG_RandomEntity(&to, &from);
+        flags = Q_rand() & (MSG_ES_REMOVE * 2 - 1);
+
+        if (!MSG_CompareDelta((Q_rand() & 15) ? &from : NULL, &to, flags)) {
+            if (mismatches++ < 10)
+                Com_Printf("Mismatch on entity %d flags %#x\n", to.number, flags);
+        }
+        from = to;
+    }
+
+    delta_scalar = false;
+    msg_write = saved;
+
+    Com_Printf("%d random entity deltas: %d mismatches\n", count, mismatches);
+#if !USE_DELTA_SSE
+    Com_Printf("SIMD delta diffing is not available on this platform.\n");
+#endif
+}
+
+void MSG_RegisterCommands(void)
+{
+    Cmd_AddCommand("deltarecord", MSG_DeltaRecord_f);
+    Cmd_AddCommand("deltabench", MSG_DeltaBench_f);
+    Cmd_AddCommand("deltatest", MSG_DeltaTest_f);
+}
+
 #define OFFSET2CHAR(x)  Q_clip_int8((x) * 4)
 
 void MSG_PackPlayer(player_packed_t *out, const player_state_t *in)
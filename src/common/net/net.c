@@ -62,6 +62,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #undef IP_RECVERR
 #undef IPV6_RECVERR
 #endif
+#ifdef MSG_WAITFORONE
+#define USE_MMSG    1
+#endif
 #endif // __linux__
 #endif // !_WIN32
 
@@ -110,6 +113,10 @@ static cvar_t   *net_enable_ipv6;
 static cvar_t   *net_ignore_icmp;
 #endif
 
+#if USE_MMSG
+static cvar_t   *net_batch;
+#endif
+
 static netflag_t    net_active;
 static int          net_error;
 
@@ -145,6 +152,8 @@ static uint64_t     net_bytes_rcvd;
 static uint64_t     net_bytes_sent;
 static uint64_t     net_packets_rcvd;
 static uint64_t     net_packets_sent;
+static uint64_t     net_recv_calls;
+static uint64_t     net_send_calls;
 
 //=============================================================================
 
@@ -511,6 +520,11 @@ static void NET_Stats_f(void)
                net_packets_sent, net_packets_sent / diff);
     Com_Printf("Packets rcvd: %"PRIu64" (%"PRIu64" packets/sec)\n",
                net_packets_rcvd, net_packets_rcvd / diff);
+    Com_Printf("Syscalls: %"PRIu64"/%"PRIu64" (send/recv), "
+               "%.2f/%.2f packets per call\n",
+               net_send_calls, net_recv_calls,
+               net_send_calls ? (double)net_packets_sent / net_send_calls : 0.0,
+               net_recv_calls ? (double)net_packets_rcvd / net_recv_calls : 0.0);
 #if USE_ICMP
     Com_Printf("Total errors: %"PRIu64"/%"PRIu64"/%"PRIu64" (send/recv/icmp)\n",
                net_send_errors, net_recv_errors, net_icmp_errors);
@@ -746,6 +760,65 @@ int NET_Sleep1(int msec, struct pollfd *e)
 
 //=============================================================================
 
+static void NET_UdpPacketReceived(size_t len, void (*packet_cb)(void))
+{
+    NET_LogPacket(&net_from, "UDP recv", msg_read_buffer, len);
+
+    net_rate_rcvd += len;
+    net_bytes_rcvd += len;
+    net_packets_rcvd++;
+
+    SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+    msg_read.cursize = len;
+
+    (*packet_cb)();
+}
+
+#if USE_MMSG
+
+#define NET_BATCH_PACKETS   32
+
+static struct {
+    struct mmsghdr          hdrs[NET_BATCH_PACKETS];
+    struct iovec            iovs[NET_BATCH_PACKETS];
+    struct sockaddr_storage addrs[NET_BATCH_PACKETS];
+    byte                    data[NET_BATCH_PACKETS][MAX_PACKETLEN];
+} net_recv_batch;
+
+// drains up to NET_BATCH_PACKETS datagrams with one recvmmsg call
+static int NET_GetUdpBatch(struct pollfd *sock, void (*packet_cb)(void))
+{
+    struct mmsghdr *hdr;
+    int i, ret;
+
+    for (i = 0; i < NET_BATCH_PACKETS; i++) {
+        hdr = &net_recv_batch.hdrs[i];
+        memset(hdr, 0, sizeof(*hdr));
+        net_recv_batch.iovs[i].iov_base = net_recv_batch.data[i];
+        net_recv_batch.iovs[i].iov_len = MAX_PACKETLEN;
+        hdr->msg_hdr.msg_iov = &net_recv_batch.iovs[i];
+        hdr->msg_hdr.msg_iovlen = 1;
+        hdr->msg_hdr.msg_name = &net_recv_batch.addrs[i];
+        hdr->msg_hdr.msg_namelen = sizeof(net_recv_batch.addrs[i]);
+    }
+
+    ret = os_udp_recv_batch(sock->fd, net_recv_batch.hdrs, NET_BATCH_PACKETS);
+    net_recv_calls++;
+    if (ret <= 0)
+        return ret;
+
+    for (i = 0; i < ret; i++) {
+        hdr = &net_recv_batch.hdrs[i];
+        NET_SockadrToNetadr(&net_recv_batch.addrs[i], &net_from);
+        memcpy(msg_read_buffer, net_recv_batch.data[i], hdr->msg_len);
+        NET_UdpPacketReceived(hdr->msg_len, packet_cb);
+    }
+
+    return ret;
+}
+
+#endif // USE_MMSG
+
 static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
 {
     int ret;
@@ -759,7 +832,22 @@ static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
         return;
 
     while (1) {
+#if USE_MMSG
+        if (net_batch->integer) {
+            ret = NET_GetUdpBatch(sock, packet_cb);
+            if (ret == NET_AGAIN || (ret > 0 && ret < NET_BATCH_PACKETS)) {
+                // partial batch means socket has been drained
+                sock->revents = 0;
+                break;
+            }
+            if (ret > 0)
+                continue;
+            // let the single packet path handle the error queue
+        }
+#endif
+
         ret = os_udp_recv(sock->fd, msg_read_buffer, MAX_PACKETLEN, &net_from);
+        net_recv_calls++;
         if (ret == NET_AGAIN) {
             sock->revents = 0;
             break;
@@ -772,16 +860,7 @@ static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
             break;
         }
 
-        NET_LogPacket(&net_from, "UDP recv", msg_read_buffer, ret);
-
-        net_rate_rcvd += ret;
-        net_bytes_rcvd += ret;
-        net_packets_rcvd++;
-
-        SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
-        msg_read.cursize = ret;
-
-        (*packet_cb)();
+        NET_UdpPacketReceived(ret, packet_cb);
     }
 }
 
@@ -810,6 +889,157 @@ void NET_GetPackets(netsrc_t sock, void (*packet_cb)(void))
     NET_GetUdpPackets(udp6_sockets[sock], packet_cb);
 }
 
+static void NET_UdpPacketSent(const netadr_t *to, const void *data,
+                              size_t len, size_t ret)
+{
+    if (ret < len)
+        Com_WPrintf("%s: short send to %s\n", __func__,
+                    NET_AdrToString(to));
+
+    NET_LogPacket(to, "UDP send", data, ret);
+
+    net_rate_sent += ret;
+    net_bytes_sent += ret;
+    net_packets_sent++;
+}
+
+static bool NET_SendUdpPacket(struct pollfd *s, const void *data,
+                              size_t len, const netadr_t *to)
+{
+    int ret;
+
+    ret = os_udp_send(s->fd, data, len, to);
+    net_send_calls++;
+    if (ret == NET_AGAIN)
+        return false;
+
+    if (ret == NET_ERROR) {
+        Com_DPrintf("%s: %s to %s\n", __func__,
+                    NET_ErrorString(), NET_AdrToString(to));
+        net_send_errors++;
+        return false;
+    }
+
+    NET_UdpPacketSent(to, data, len, ret);
+    return true;
+}
+
+#if USE_MMSG
+
+#define NET_QUEUE_PACKETS   128
+#define NET_QUEUE_BYTES     0x20000
+
+typedef struct {
+    struct pollfd   *sock;
+    netadr_t        to;
+    size_t          ofs, len;
+} netqueued_t;
+
+static struct {
+    bool            active;
+    int             count;
+    size_t          bytes;
+    netqueued_t     packets[NET_QUEUE_PACKETS];
+    byte            data[NET_QUEUE_BYTES];
+} net_send_queue;
+
+static void NET_FlushSendQueue(void)
+{
+    struct mmsghdr          hdrs[NET_QUEUE_PACKETS];
+    struct iovec            iovs[NET_QUEUE_PACKETS];
+    struct sockaddr_storage addrs[NET_QUEUE_PACKETS];
+    netqueued_t *p;
+    int i, j, n, ret;
+
+    for (i = 0; i < net_send_queue.count; i++) {
+        p = &net_send_queue.packets[i];
+        memset(&hdrs[i], 0, sizeof(hdrs[i]));
+        iovs[i].iov_base = net_send_queue.data + p->ofs;
+        iovs[i].iov_len = p->len;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = &addrs[i];
+        hdrs[i].msg_hdr.msg_namelen = NET_NetadrToSockadr(&p->to, &addrs[i]);
+    }
+
+    for (i = 0; i < net_send_queue.count; i += n) {
+        p = &net_send_queue.packets[i];
+
+        // packets for the same socket go out with one syscall
+        for (n = 1; i + n < net_send_queue.count; n++)
+            if (p[n].sock != p->sock)
+                break;
+
+        ret = os_udp_send_batch(p->sock->fd, &hdrs[i], n);
+        net_send_calls++;
+        if (ret > 0) {
+            for (j = 0; j < ret; j++)
+                NET_UdpPacketSent(&p[j].to, iovs[i + j].iov_base,
+                                  p[j].len, hdrs[i + j].msg_len);
+            n = ret;
+            continue;
+        }
+
+        // resend failed packet the usual way to process the error queue
+        NET_SendUdpPacket(p->sock, iovs[i].iov_base, p->len, &p->to);
+        n = 1;
+    }
+
+    net_send_queue.count = 0;
+    net_send_queue.bytes = 0;
+}
+
+static void NET_QueueUdpPacket(struct pollfd *s, const void *data,
+                               size_t len, const netadr_t *to)
+{
+    netqueued_t *p;
+
+    if (net_send_queue.count == NET_QUEUE_PACKETS ||
+        net_send_queue.bytes + len > NET_QUEUE_BYTES)
+        NET_FlushSendQueue();
+
+    p = &net_send_queue.packets[net_send_queue.count++];
+    p->sock = s;
+    p->to = *to;
+    p->ofs = net_send_queue.bytes;
+    p->len = len;
+
+    memcpy(net_send_queue.data + p->ofs, data, len);
+    net_send_queue.bytes += len;
+}
+
+#endif // USE_MMSG
+
+/*
+=============
+NET_BeginBatch
+
+Starts queueing UDP packets instead of sending them immediately.
+=============
+*/
+void NET_BeginBatch(void)
+{
+#if USE_MMSG
+    net_send_queue.active = net_batch->integer;
+#endif
+}
+
+/*
+=============
+NET_EndBatch
+
+Flushes queued UDP packets with as few syscalls as possible. Also called
+from Com_Error and NET_Shutdown to close a batch interrupted by an error.
+=============
+*/
+void NET_EndBatch(void)
+{
+#if USE_MMSG
+    net_send_queue.active = false;
+    NET_FlushSendQueue();
+#endif
+}
+
 /*
 =============
 NET_SendPacket
@@ -819,7 +1049,6 @@ NET_SendPacket
 bool NET_SendPacket(netsrc_t sock, const void *data,
                     size_t len, const netadr_t *to)
 {
-    int ret;
     struct pollfd *s;
 
     if (len == 0)
@@ -852,34 +1081,24 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
     if (!s)
         return false;
 
-    ret = os_udp_send(s->fd, data, len, to);
-    if (ret == NET_AGAIN)
-        return false;
-
-    if (ret == NET_ERROR) {
-        Com_DPrintf("%s: %s to %s\n", __func__,
-                    NET_ErrorString(), NET_AdrToString(to));
-        net_send_errors++;
-        return false;
+#if USE_MMSG
+    if (net_send_queue.active) {
+        NET_QueueUdpPacket(s, data, len, to);
+        return true;
     }
+#endif
 
-    if (ret < len)
-        Com_WPrintf("%s: short send to %s\n", __func__,
-                    NET_AdrToString(to));
-
-    NET_LogPacket(to, "UDP send", data, ret);
-
-    net_rate_sent += ret;
-    net_bytes_sent += ret;
-    net_packets_sent++;
-
-    return true;
+    return NET_SendUdpPacket(s, data, len, to);
 }
 
 //=============================================================================
 
 static void NET_CloseSocket(struct pollfd *s)
 {
+#if USE_MMSG
+    // don't leave queued packets pointing to closed socket
+    NET_FlushSendQueue();
+#endif
     os_closesocket(s->fd);
     NET_FreePollFd(s);
 }
@@ -1854,6 +2073,10 @@ void NET_Init(void)
     net_ignore_icmp = Cvar_Get("net_ignore_icmp", "0", 0);
 #endif
 
+#if USE_MMSG
+    net_batch = Cvar_Get("net_batch", "1", 0);
+#endif
+
 #if USE_DEBUG
     net_log_enable_changed(net_log_enable);
 #endif
@@ -1880,6 +2103,7 @@ void NET_Shutdown(void)
     logfile_close();
 #endif
 
+    NET_EndBatch();
     NET_Listen(false);
     NET_Config(NET_NONE);
     os_net_shutdown();
@@ -163,6 +163,42 @@ static int os_udp_send(qsocket_t sock, const void *data,
     return NET_ERROR;
 }
 
+#if USE_MMSG
+
+// receives up to count packets with a single syscall. errors are only
+// reported here, caller should fall back to os_udp_recv to process them.
+static int os_udp_recv_batch(qsocket_t sock, struct mmsghdr *msgs, int count)
+{
+    int ret = recvmmsg(sock, msgs, count, 0, NULL);
+
+    if (ret > 0)
+        return ret;
+
+    net_error = ret ? errno : EWOULDBLOCK;
+    if (net_error == EWOULDBLOCK)
+        return NET_AGAIN;
+
+    return NET_ERROR;
+}
+
+// sends up to count packets with a single syscall. returns number of
+// packets sent, which can be less than count if some packet failed.
+static int os_udp_send_batch(qsocket_t sock, struct mmsghdr *msgs, int count)
+{
+    int ret = sendmmsg(sock, msgs, count, 0);
+
+    if (ret > 0)
+        return ret;
+
+    net_error = ret ? errno : EWOULDBLOCK;
+    if (net_error == EWOULDBLOCK)
+        return NET_AGAIN;
+
+    return NET_ERROR;
+}
+
+#endif // USE_MMSG
+
 static neterr_t os_get_error(void)
 {
     net_error = errno;
@@ -488,6 +488,8 @@ static void Com_TestSnprintf_f(void)
 }
 
 #if USE_REF
+#include "refresh/images.h"
+
 static void Com_TestModels_f(void)
 {
     void **list;
@@ -517,6 +519,111 @@ static void Com_TestModels_f(void)
 
     FS_FreeList(list);
 }
+
+typedef struct {
+    const char *name;
+    size_t (*func)(byte *out, const byte *in, int w, int h); // returns output size
+} imgbench_t;
+
+static size_t bench_unpack8(byte *out, const byte *in, int w, int h)
+{
+    IMG_Unpack8((uint32_t *)out, in, w, h);
+    return (size_t)w * h * 4;
+}
+
+static size_t bench_resample(byte *out, const byte *in, int w, int h)
+{
+    IMG_ResampleTexture(in, w, h, out, w * 3 / 4, h * 3 / 4);
+    return (size_t)(w * 3 / 4) * (h * 3 / 4) * 4;
+}
+
+static size_t bench_mipmap(byte *out, const byte *in, int w, int h)
+{
+    IMG_MipMap(out, (byte *)in, w, h);
+    return (size_t)(w / 2) * (h / 2) * 4;
+}
+
+static const imgbench_t imgbenches[] = {
+    { "unpack8", bench_unpack8 },
+    { "resample", bench_resample },
+    { "mipmap", bench_mipmap },
+};
+
+// returns true if SIMD and scalar versions of the kernel give identical output
+static bool imgbench_compare(const imgbench_t *b, byte *ref, byte *out, const byte *in, int w, int h)
+{
+    size_t outsize;
+
+    img_force_scalar = true;
+    outsize = b->func(ref, in, w, h);
+    img_force_scalar = false;
+    b->func(out, in, w, h);
+
+    return !memcmp(ref, out, outsize);
+}
+
+// runs image processing kernels with and without SIMD, comparing results
+static void Com_ImgBench_f(void)
+{
+    int w = 1024, h = 1024, passes = 16;
+    int tw, th, sizes = 256, errors = 0;
+    size_t size;
+    byte *in, *ref, *out;
+    uint64_t start, usec[2];
+    int i, j, pass;
+
+    if (Cmd_Argc() > 1)
+        w = h = Q_clip(Q_atoi(Cmd_Argv(1)), 16, MAX_TEXTURE_SIZE) & ~15;
+    if (Cmd_Argc() > 2)
+        passes = Q_clip(Q_atoi(Cmd_Argv(2)), 1, 1000);
+
+    size = w * h * 4;
+    in = Z_Malloc(size);
+    ref = Z_Malloc(size);
+    out = Z_Malloc(size);
+
+    // 8-bit kernels use first quarter, with some transparent pixels
+    for (i = 0; i < size; i++)
+        in[i] = Q_rand() & 255;
+    for (i = 0; i < w * h; i += 1 + Q_rand_uniform(64))
+        in[i] = 255;
+
+    // check parity on random even sizes first, to cover SIMD loop tails
+    for (i = 0; i < sizes; i++) {
+        tw = 2 + Q_rand_uniform(min(w, 256) / 2) * 2;
+        th = 2 + Q_rand_uniform(min(h, 256) / 2) * 2;
+        for (j = 0; j < q_countof(imgbenches); j++) {
+            if (!imgbench_compare(&imgbenches[j], ref, out, in, tw, th)) {
+                Com_EPrintf("%s: %dx%d MISMATCH\n", imgbenches[j].name, tw, th);
+                errors++;
+            }
+        }
+    }
+    Com_Printf("%d sizes checked, %d mismatches\n", sizes, errors);
+
+    Com_Printf("kernel      scalar    simd (Mpx/s)\n"
+               "--------- ------- -------\n");
+    for (i = 0; i < q_countof(imgbenches); i++) {
+        const imgbench_t *b = &imgbenches[i];
+
+        for (pass = 0; pass < 2; pass++) {
+            img_force_scalar = !pass;
+            start = Sys_Microseconds();
+            for (j = 0; j < passes; j++)
+                b->func(pass ? out : ref, in, w, h);
+            usec[pass] = max(Sys_Microseconds() - start, 1);
+        }
+        img_force_scalar = false;
+
+        Com_Printf("%-9s %7.1f %7.1f%s\n", b->name,
+                   (double)w * h * passes / usec[0], (double)w * h * passes / usec[1],
+                   imgbench_compare(b, ref, out, in, w, h) ? "" : " MISMATCH");
+    }
+
+    Z_Free(in);
+    Z_Free(ref);
+    Z_Free(out);
+}
 #endif
 
 #if USE_CLIENT
@@ -693,6 +800,7 @@ void TST_Init(void)
     Cmd_AddCommand("snprintftest", Com_TestSnprintf_f);
 #if USE_REF
     Cmd_AddCommand("modeltest", Com_TestModels_f);
+    Cmd_AddCommand("imgbench", Com_ImgBench_f);
 #endif
 #if USE_CLIENT
     Cmd_AddCommand("soundtest", Com_TestSounds_f);
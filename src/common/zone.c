@@ -38,6 +38,7 @@ typedef struct {
 typedef struct {
     size_t      count;
     size_t      bytes;
+    size_t      allocs;     // since last reset
 } zstats_t;
 
 static list_t       z_chain;
@@ -81,6 +82,7 @@ static inline void Z_CountAlloc(const zhead_t *z)
     zstats_t *s = &z_stats[TAG_INDEX(z->tag)];
     s->count++;
     s->bytes += z->size;
+    s->allocs++;
 }
 
 #define Z_Validate(z) \
@@ -202,25 +204,33 @@ Z_Stats_f
 */
 void Z_Stats_f(void)
 {
-    size_t bytes = 0, count = 0;
+    size_t bytes = 0, count = 0, allocs = 0;
     zstats_t *s;
     int i;
 
-    Com_Printf("    bytes blocks name\n"
-               "--------- ------ -------\n");
+    Com_Printf("    bytes blocks   allocs name\n"
+               "--------- ------ -------- -------\n");
 
     for (i = 0, s = z_stats; i < TAG_MAX; i++, s++) {
-        if (!s->count) {
+        if (!s->count && !s->allocs) {
             continue;
         }
-        Com_Printf("%9zu %6zu %s\n", s->bytes, s->count, z_tagnames[i]);
+        Com_Printf("%9zu %6zu %8zu %s\n", s->bytes, s->count, s->allocs, z_tagnames[i]);
         bytes += s->bytes;
         count += s->count;
+        allocs += s->allocs;
     }
 
-    Com_Printf("--------- ------ -------\n"
-               "%9zu %6zu total\n",
-               bytes, count);
+    Com_Printf("--------- ------ -------- -------\n"
+               "%9zu %6zu %8zu total\n",
+               bytes, count, allocs);
+
+    // allocation counts show allocator pressure over a period of time
+    if (!strcmp(Cmd_Argv(1), "reset")) {
+        for (i = 0; i < TAG_MAX; i++) {
+            z_stats[i].allocs = 0;
+        }
+    }
 }
 
 /*
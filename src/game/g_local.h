@@ -323,6 +323,8 @@ typedef struct {
     int         body_que;           // dead bodies
 
     int         power_cubes;        // ugly necessity for coop
+
+    int         spawncount;         // bumped by G_InitEdict
 } level_locals_t;
 
 // spawn_temp_t is only used to hold entity field values that
@@ -429,6 +431,7 @@ typedef struct {
 extern  game_locals_t   game;
 extern  level_locals_t  level;
 extern  game_import_t   gi;
+extern  const game_import_ex_t  *gix;
 extern  game_export_t   globals;
 extern  spawn_temp_t    st;
 
@@ -616,6 +619,8 @@ void    G_FreeEdict(edict_t *e);
 void    G_TouchTriggers(edict_t *ent);
 void    G_TouchSolids(edict_t *ent);
 
+void    G_TraceBatch(const trace_request_t *requests, trace_t *results, int count);
+
 char    *G_CopyString(char *in);
 
 float vectoyaw(vec3_t vec);
@@ -976,6 +981,7 @@ struct edict_s {
 
     char        *model;
     float       freetime;           // sv.time when the object was freed
+    int         spawncount;         // level.spawncount when the object was spawned
 
     //
     // only used locally in game, not by server
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 game_locals_t   game;
 level_locals_t  level;
 game_import_t   gi;
+const game_import_ex_t  *gix;
 game_export_t   globals;
 spawn_temp_t    st;
 
@@ -250,6 +251,24 @@ q_exported game_export_t *GetGameAPI(game_import_t *import)
     return &globals;
 }
 
+/*
+=================
+GetExtendedGameAPI
+
+Extended entry points are optional, old servers don't call this
+=================
+*/
+q_exported const game_export_ex_t *GetExtendedGameAPI(const game_import_ex_t *import)
+{
+    static const game_export_ex_t globals_ex = {
+        .apiversion = GAME_API_VERSION_EX,
+    };
+
+    gix = import;
+
+    return &globals_ex;
+}
+
 #ifndef GAME_HARD_LINKED
 // this is only here so the functions in q_shared.c can link
 void Com_LPrintf(print_type_t type, const char *fmt, ...)
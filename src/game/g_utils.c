@@ -313,6 +313,7 @@ void G_InitEdict(edict_t *e)
     e->classname = "noclass";
     e->gravity = 1.0f;
     e->s.number = e - g_edicts;
+    e->spawncount = ++level.spawncount;
 }
 
 /*
@@ -428,6 +429,27 @@ void G_TouchSolids(edict_t *ent)
     }
 }
 
+/*
+============
+G_TraceBatch
+
+Runs independent traces, batched on servers that support it
+============
+*/
+void G_TraceBatch(const trace_request_t *requests, trace_t *results, int count)
+{
+    int     i;
+
+    if (gix && gix->apiversion >= 2 && gix->TraceBatch) {
+        gix->TraceBatch(requests, results, count);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        results[i] = gi.trace(requests[i].start, requests[i].mins, requests[i].maxs,
+                              requests[i].end, requests[i].passent, requests[i].contentmask);
+}
+
 /*
 ==============================================================================
 
@@ -118,125 +118,229 @@ bool fire_hit(edict_t *self, vec3_t aim, int damage, int kick)
 fire_lead
 
 This is an internal support routine used for bullet/pellet based weapons.
+All pellets are traced in a batch before any damage is dealt.
 =================
 */
-static void fire_lead(edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick, int te_impact, int hspread, int vspread, int mod)
+#define MAX_LEAD_BATCH  32
+
+static void lead_splash(const trace_t *tr)
 {
-    trace_t     tr;
+    int     color;
+
+    if (tr->contents & CONTENTS_WATER) {
+        if (strcmp(tr->surface->name, "*brwater") == 0)
+            color = SPLASH_BROWN_WATER;
+        else
+            color = SPLASH_BLUE_WATER;
+    } else if (tr->contents & CONTENTS_SLIME)
+        color = SPLASH_SLIME;
+    else if (tr->contents & CONTENTS_LAVA)
+        color = SPLASH_LAVA;
+    else
+        return;
+
+    gi.WriteByte(svc_temp_entity);
+    gi.WriteByte(TE_SPLASH);
+    gi.WriteByte(8);
+    gi.WritePosition(tr->endpos);
+    gi.WriteDir(tr->plane.normal);
+    gi.WriteByte(color);
+    gi.multicast(tr->endpos, MULTICAST_PVS);
+}
+
+static void lead_impact(edict_t *self, trace_t *tr, vec3_t aimdir, int damage, int kick, int te_impact, int mod)
+{
+    // send gun puff / flash
+    if (tr->surface && (tr->surface->flags & SURF_SKY))
+        return;
+    if (!(tr->fraction < 1.0f))
+        return;
+
+    if (tr->ent->takedamage) {
+        T_Damage(tr->ent, self, self, aimdir, tr->endpos, tr->plane.normal, damage, kick, DAMAGE_BULLET, mod);
+    } else if (strncmp(tr->surface->name, "sky", 3) != 0) {
+        gi.WriteByte(svc_temp_entity);
+        gi.WriteByte(te_impact);
+        gi.WritePosition(tr->endpos);
+        gi.WriteDir(tr->plane.normal);
+        gi.multicast(tr->endpos, MULTICAST_PVS);
+
+        if (self->client)
+            PlayerNoise(self, tr->endpos, PNOISE_IMPACT);
+    }
+}
+
+// bullet entered water at tr->endpos: make a splash and change its course,
+// updating end for the re-trace that ignores water
+static void lead_enter_water(const trace_t *tr, const vec3_t start, vec3_t end, int hspread, int vspread)
+{
+    vec3_t      dir, forward, right, up;
+    float       r, u;
+
+    if (VectorCompare(start, tr->endpos))
+        return;
+
+    lead_splash(tr);
+
+    VectorSubtract(end, start, dir);
+    vectoangles(dir, dir);
+    AngleVectors(dir, forward, right, up);
+    r = crandom() * hspread * 2;
+    u = crandom() * vspread * 2;
+    VectorMA(tr->endpos, 8192, forward, end);
+    VectorMA(end, r, right, end);
+    VectorMA(end, u, up, end);
+}
+
+// damage from earlier pellets may have killed, gibbed or freed the entity
+// this pellet was traced against, in which case the trace must be redone,
+// including water entry if the pellet now hits water first
+static void lead_revalidate(trace_t *tr, const trace_request_t *req, int spawncount, int linkcount,
+                            bool *water, vec3_t water_start, int hspread, int vspread)
+{
+    edict_t *ent = tr->ent;
+    vec3_t  end;
+
+    if (!ent || (ent->inuse && ent->spawncount == spawncount && ent->linkcount == linkcount))
+        return;
+
+    *tr = gi.trace(req->start, NULL, NULL, req->end, req->passent, req->contentmask);
+    if (!(tr->contents & MASK_WATER))
+        return;
+
+    *water = true;
+    VectorCopy(tr->endpos, water_start);
+    VectorCopy(req->end, end);
+    lead_enter_water(tr, req->start, end, hspread, vspread);
+
+    *tr = gi.trace(water_start, NULL, NULL, end, req->passent, MASK_SHOT);
+}
+
+static void lead_bubbles(const vec3_t water_start, trace_t *tr)
+{
+    vec3_t  dir, pos;
+
+    // determine where the end was and make a bubble trail
+    VectorSubtract(tr->endpos, water_start, dir);
+    VectorNormalize(dir);
+    VectorMA(tr->endpos, -2, dir, pos);
+    if (gi.pointcontents(pos) & MASK_WATER)
+        VectorCopy(pos, tr->endpos);
+    else
+        *tr = gi.trace(pos, NULL, NULL, water_start, tr->ent, MASK_WATER);
+
+    VectorAdd(water_start, tr->endpos, pos);
+    VectorScale(pos, 0.5f, pos);
+
+    gi.WriteByte(svc_temp_entity);
+    gi.WriteByte(TE_BUBBLETRAIL);
+    gi.WritePosition(water_start);
+    gi.WritePosition(tr->endpos);
+    gi.multicast(pos, MULTICAST_PVS);
+}
+
+static void fire_lead(edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick, int te_impact, int hspread, int vspread, int count, int mod)
+{
+    trace_request_t req[MAX_LEAD_BATCH];
+    trace_request_t seg[MAX_LEAD_BATCH];
+    trace_t     tr[MAX_LEAD_BATCH];
+    int         spawncount[MAX_LEAD_BATCH];
+    int         linkcount[MAX_LEAD_BATCH];
+    trace_t     retr[MAX_LEAD_BATCH];
+    int         retrace[MAX_LEAD_BATCH];
+    vec3_t      water_start[MAX_LEAD_BATCH];
+    bool        water[MAX_LEAD_BATCH];
+    trace_t     block;
     vec3_t      dir;
     vec3_t      forward, right, up;
     vec3_t      end;
     float       r;
     float       u;
-    vec3_t      water_start;
-    bool        water = false;
+    bool        start_water;
     int         content_mask = MASK_SHOT | MASK_WATER;
+    int         i, n;
+
+    count = min(count, MAX_LEAD_BATCH);
+
+    block = gi.trace(self->s.origin, NULL, NULL, start, self, MASK_SHOT);
+    if (block.fraction < 1.0f) {
+        for (i = 0; i < count; i++) {
+            VectorCopy(self->s.origin, seg[i].start);
+            VectorCopy(start, seg[i].end);
+            seg[i].passent = self;
+            seg[i].contentmask = MASK_SHOT;
+            tr[i] = block;
+            water[i] = false;
+        }
+        goto impact;
+    }
 
-    tr = gi.trace(self->s.origin, NULL, NULL, start, self, MASK_SHOT);
-    if (!(tr.fraction < 1.0f)) {
-        vectoangles(aimdir, dir);
-        AngleVectors(dir, forward, right, up);
+    vectoangles(aimdir, dir);
+    AngleVectors(dir, forward, right, up);
 
+    start_water = gi.pointcontents(start) & MASK_WATER;
+    if (start_water)
+        content_mask &= ~MASK_WATER;
+
+    memset(req, 0, sizeof(req[0]) * count);
+    for (i = 0; i < count; i++) {
         r = crandom() * hspread;
         u = crandom() * vspread;
         VectorMA(start, 8192, forward, end);
         VectorMA(end, r, right, end);
         VectorMA(end, u, up, end);
 
-        if (gi.pointcontents(start) & MASK_WATER) {
-            water = true;
-            VectorCopy(start, water_start);
-            content_mask &= ~MASK_WATER;
-        }
+        VectorCopy(start, req[i].start);
+        VectorCopy(end, req[i].end);
+        req[i].passent = self;
+        req[i].contentmask = content_mask;
 
-        tr = gi.trace(start, NULL, NULL, end, self, content_mask);
+        water[i] = start_water;
+        VectorCopy(start, water_start[i]);
+    }
 
-        // see if we hit water
-        if (tr.contents & MASK_WATER) {
-            int     color;
+    G_TraceBatch(req, tr, count);
+    memcpy(seg, req, sizeof(req[0]) * count);
 
-            water = true;
-            VectorCopy(tr.endpos, water_start);
-
-            if (!VectorCompare(start, tr.endpos)) {
-                if (tr.contents & CONTENTS_WATER) {
-                    if (strcmp(tr.surface->name, "*brwater") == 0)
-                        color = SPLASH_BROWN_WATER;
-                    else
-                        color = SPLASH_BLUE_WATER;
-                } else if (tr.contents & CONTENTS_SLIME)
-                    color = SPLASH_SLIME;
-                else if (tr.contents & CONTENTS_LAVA)
-                    color = SPLASH_LAVA;
-                else
-                    color = SPLASH_UNKNOWN;
-
-                if (color != SPLASH_UNKNOWN) {
-                    gi.WriteByte(svc_temp_entity);
-                    gi.WriteByte(TE_SPLASH);
-                    gi.WriteByte(8);
-                    gi.WritePosition(tr.endpos);
-                    gi.WriteDir(tr.plane.normal);
-                    gi.WriteByte(color);
-                    gi.multicast(tr.endpos, MULTICAST_PVS);
-                }
-
-                // change bullet's course when it enters water
-                VectorSubtract(end, start, dir);
-                vectoangles(dir, dir);
-                AngleVectors(dir, forward, right, up);
-                r = crandom() * hspread * 2;
-                u = crandom() * vspread * 2;
-                VectorMA(water_start, 8192, forward, end);
-                VectorMA(end, r, right, end);
-                VectorMA(end, u, up, end);
-            }
+    // see if we hit water, re-trace those pellets ignoring water this time
+    for (i = n = 0; i < count; i++) {
+        if (!(tr[i].contents & MASK_WATER))
+            continue;
 
-            // re-trace ignoring water this time
-            tr = gi.trace(water_start, NULL, NULL, end, self, MASK_SHOT);
-        }
+        water[i] = true;
+        VectorCopy(tr[i].endpos, water_start[i]);
+        VectorCopy(req[i].end, end);
+        lead_enter_water(&tr[i], start, end, hspread, vspread);
+
+        // requests before i are no longer needed
+        VectorCopy(water_start[i], req[n].start);
+        VectorCopy(end, req[n].end);
+        req[n].contentmask = MASK_SHOT;
+        seg[i] = req[n];
+        retrace[n++] = i;
     }
 
-    // send gun puff / flash
-    if (!((tr.surface) && (tr.surface->flags & SURF_SKY))) {
-        if (tr.fraction < 1.0f) {
-            if (tr.ent->takedamage) {
-                T_Damage(tr.ent, self, self, aimdir, tr.endpos, tr.plane.normal, damage, kick, DAMAGE_BULLET, mod);
-            } else {
-                if (strncmp(tr.surface->name, "sky", 3) != 0) {
-                    gi.WriteByte(svc_temp_entity);
-                    gi.WriteByte(te_impact);
-                    gi.WritePosition(tr.endpos);
-                    gi.WriteDir(tr.plane.normal);
-                    gi.multicast(tr.endpos, MULTICAST_PVS);
-
-                    if (self->client)
-                        PlayerNoise(self, tr.endpos, PNOISE_IMPACT);
-                }
-            }
-        }
+    if (n) {
+        G_TraceBatch(req, retr, n);
+        for (i = 0; i < n; i++)
+            tr[retrace[i]] = retr[i];
     }
 
-    // if went through water, determine where the end and make a bubble trail
-    if (water) {
-        vec3_t  pos;
-
-        VectorSubtract(tr.endpos, water_start, dir);
-        VectorNormalize(dir);
-        VectorMA(tr.endpos, -2, dir, pos);
-        if (gi.pointcontents(pos) & MASK_WATER)
-            VectorCopy(pos, tr.endpos);
-        else
-            tr = gi.trace(pos, NULL, NULL, water_start, tr.ent, MASK_WATER);
+impact:
+    // remember what each pellet hit before any damage is dealt
+    for (i = 0; i < count; i++) {
+        spawncount[i] = tr[i].ent ? tr[i].ent->spawncount : 0;
+        linkcount[i] = tr[i].ent ? tr[i].ent->linkcount : 0;
+    }
 
-        VectorAdd(water_start, tr.endpos, pos);
-        VectorScale(pos, 0.5f, pos);
+    for (i = 0; i < count; i++) {
+        lead_revalidate(&tr[i], &seg[i], spawncount[i], linkcount[i],
+                        &water[i], water_start[i], hspread, vspread);
+        lead_impact(self, &tr[i], aimdir, damage, kick, te_impact, mod);
 
-        gi.WriteByte(svc_temp_entity);
-        gi.WriteByte(TE_BUBBLETRAIL);
-        gi.WritePosition(water_start);
-        gi.WritePosition(tr.endpos);
-        gi.multicast(pos, MULTICAST_PVS);
+        // if went through water, make a bubble trail
+        if (water[i])
+            lead_bubbles(water_start[i], &tr[i]);
     }
 }
 
@@ -250,7 +354,7 @@ pistols, rifles, etc....
 */
 void fire_bullet(edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick, int hspread, int vspread, int mod)
 {
-    fire_lead(self, start, aimdir, damage, kick, TE_GUNSHOT, hspread, vspread, mod);
+    fire_lead(self, start, aimdir, damage, kick, TE_GUNSHOT, hspread, vspread, 1, mod);
 }
 
 /*
@@ -262,10 +366,13 @@ Shoots shotgun pellets.  Used by shotgun and super shotgun.
 */
 void fire_shotgun(edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick, int hspread, int vspread, int count, int mod)
 {
-    int     i;
+    int     n;
 
-    for (i = 0; i < count; i++)
-        fire_lead(self, start, aimdir, damage, kick, TE_SHOTGUN, hspread, vspread, mod);
+    while (count > 0) {
+        n = min(count, MAX_LEAD_BATCH);
+        fire_lead(self, start, aimdir, damage, kick, TE_SHOTGUN, hspread, vspread, n, mod);
+        count -= n;
+    }
 }
 
 /*
@@ -27,6 +27,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/files.h"
+#include "common/intreadwrite.h"
+#include "common/mdfour.h"
 #include "../client/client.h"
 #include "refresh/images.h"
 #include "system/system.h"
@@ -37,6 +39,22 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <assert.h>
 
+// SSE2 is part of x86-64 and NEON of AArch64 baseline, no runtime detection
+#if (defined __SSE2__) || (defined _M_X64)
+#include <emmintrin.h>
+#define USE_IMG_SSE2    1
+#define USE_IMG_NEON    0
+#elif (defined __ARM_NEON) && (defined __aarch64__)
+#include <arm_neon.h>
+#define USE_IMG_SSE2    0
+#define USE_IMG_NEON    1
+#else
+#define USE_IMG_SSE2    0
+#define USE_IMG_NEON    0
+#endif
+
+#define USE_IMG_SIMD    (USE_IMG_SSE2 || USE_IMG_NEON)
+
 #define R_COLORMAP_PCX    "pics/colormap.pcx"
 
 #define IMG_LOAD(x) \
@@ -222,18 +240,95 @@ static int IMG_DecodePCX(byte *rawdata, size_t rawlen, byte *pixels,
     return Q_ERR_SUCCESS;
 }
 
+/*
+=================================================================
+
+SIMD HELPERS
+
+=================================================================
+*/
+
+bool img_force_scalar;
+
+#if USE_IMG_SSE2
+
+typedef __m128i pix4_t;
+
+#define load_pix4(p)            _mm_loadu_si128((const __m128i *)(p))
+#define make_pix4(a, b, c, d)   _mm_set_epi32(d, c, b, a)
+
+// true if any of 16 bytes at p is 255
+static inline bool any_255x16(const byte *p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi32(-1)));
+}
+
+// writes 2 pixels, each an average of 2 adjacent pixels in a and 2 in b
+static inline void average_2x2(byte *out, pix4_t a, pix4_t b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    lo = _mm_srli_epi16(_mm_unpacklo_epi64(lo, hi), 2);
+    _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(lo, lo));
+}
+
+#elif USE_IMG_NEON
+
+typedef uint8x16_t pix4_t;
+
+#define load_pix4(p)            vld1q_u8(p)
+
+static inline pix4_t make_pix4(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    const uint32_t v[4] = { a, b, c, d };
+    return vreinterpretq_u8_u32(vld1q_u32(v));
+}
+
+static inline bool any_255x16(const byte *p)
+{
+    return vmaxvq_u8(vceqq_u8(vld1q_u8(p), vdupq_n_u8(255)));
+}
+
+static inline void average_2x2(byte *out, pix4_t a, pix4_t b)
+{
+    uint16x8_t lo = vaddl_u8(vget_low_u8(a), vget_low_u8(b));
+    uint16x8_t hi = vaddl_u8(vget_high_u8(a), vget_high_u8(b));
+    uint16x4_t s0 = vadd_u16(vget_low_u16(lo), vget_high_u16(lo));
+    uint16x4_t s1 = vadd_u16(vget_low_u16(hi), vget_high_u16(hi));
+
+    vst1_u8(out, vshrn_n_u16(vcombine_u16(s0, s1), 2));
+}
+
+#endif
+
 /*
 ===============
 IMG_Unpack8
 ===============
 */
-static int IMG_Unpack8(uint32_t *out, const uint8_t *in, int width, int height)
+int IMG_Unpack8(uint32_t *out, const uint8_t *in, int width, int height)
 {
     int         x, y, p;
     bool        has_alpha = false;
 
     for (y = 0; y < height; y++) {
         for (x = 0; x < width; x++) {
+#if USE_IMG_SIMD
+            // skip fringe checks for runs of opaque pixels
+            if (!img_force_scalar && x + 16 <= width && !any_255x16(in)) {
+                for (p = 0; p < 16; p++)
+                    out[p] = d_8to24table[in[p]];
+                in += 16;
+                out += 16;
+                x += 15;
+                continue;
+            }
+#endif
             p = *in;
             if (p == 255) {
                 has_alpha = true;
@@ -827,7 +922,17 @@ void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
     for (i = 0; i < outheight; i++) {
         inrow1 = in + inwidth * (int)((i + 0.25f) * heightScale);
         inrow2 = in + inwidth * (int)((i + 0.75f) * heightScale);
-        for (j = 0; j < outwidth; j++) {
+        j = 0;
+#if USE_IMG_SIMD
+        for (; !img_force_scalar && j + 2 <= outwidth; j += 2, out += 8) {
+            pix4_t a = make_pix4(RN32(inrow1 + p1[j]), RN32(inrow1 + p2[j]),
+                                 RN32(inrow1 + p1[j + 1]), RN32(inrow1 + p2[j + 1]));
+            pix4_t b = make_pix4(RN32(inrow2 + p1[j]), RN32(inrow2 + p2[j]),
+                                 RN32(inrow2 + p1[j + 1]), RN32(inrow2 + p2[j + 1]));
+            average_2x2(out, a, b);
+        }
+#endif
+        for (; j < outwidth; j++) {
             pix1 = inrow1 + p1[j];
             pix2 = inrow1 + p2[j];
             pix3 = inrow2 + p1[j];
@@ -848,7 +953,13 @@ void IMG_MipMap(byte *out, byte *in, int width, int height)
     width <<= 2;
     height >>= 1;
     for (i = 0; i < height; i++, in += width) {
-        for (j = 0; j < width; j += 8, out += 4, in += 8) {
+        j = 0;
+#if USE_IMG_SIMD
+        // may work in place, as 16 bytes are loaded before 8 are stored
+        for (; !img_force_scalar && j + 16 <= width; j += 16, out += 8, in += 16)
+            average_2x2(out, load_pix4(in), load_pix4(in + width));
+#endif
+        for (; j < width; j += 8, out += 4, in += 8) {
             out[0] = (in[0] + in[4] + in[width + 0] + in[width + 4]) >> 2;
             out[1] = (in[1] + in[5] + in[width + 1] + in[width + 5]) >> 2;
             out[2] = (in[2] + in[6] + in[width + 2] + in[width + 6]) >> 2;
@@ -891,6 +1002,7 @@ static int              img_total;
 static cvar_t   *r_override_textures;
 static cvar_t   *r_texture_formats;
 static cvar_t   *r_texture_overrides;
+static cvar_t   *r_image_cache;
 
 static const cmd_option_t o_imagelist[] = {
     { "f", "fonts", "list fonts" },
@@ -1071,26 +1183,216 @@ static image_t *lookup_image(const char *name,
     return NULL;
 }
 
+/*
+=========================================================
+
+DECODED IMAGE CACHE
+
+Images decoded by stb are kept under imagecache/ in the write directory,
+named after MD4 of the source file and decoding parameters, so that
+unchanged files are never decoded twice. Renderers may store processed
+images derived from these with IMG_DeriveCacheKey.
+
+=========================================================
+*/
+
+#define IMG_CACHE_MAGIC     MakeRawLong('I','M','G','C')
+#define IMG_CACHE_HEADER    28
+#define IMG_CACHE_VERSION   1   // bump when decoding changes output
+
+// loader set flags that are restored from cache
+#define IMG_CACHE_FLAGS     (IF_PALETTED | IF_OPAQUE | IF_TRANSPARENT)
+
+static void cache_key(byte *key, const void *data, size_t len, uint32_t param)
+{
+    mdfour_t    md;
+    byte        tail[8];
+
+    WL32(tail, IMG_CACHE_VERSION);
+    WL32(tail + 4, param);
+
+    mdfour_begin(&md);
+    mdfour_update(&md, data, len);
+    mdfour_update(&md, tail, sizeof(tail));
+    mdfour_result(&md, key);
+}
+
+static bool cache_enabled(const byte *key)
+{
+    static const byte zero[IMG_CACHE_KEY];
+
+    return r_image_cache->integer && memcmp(key, zero, IMG_CACHE_KEY);
+}
+
+/*
+===============
+IMG_DeriveCacheKey
+
+Makes key for image processed from the one with `base' key, with `param'
+identifying the processing. Key stays zero if base image is not cached.
+===============
+*/
+void IMG_DeriveCacheKey(byte *key, const byte *base, uint32_t param)
+{
+    if (cache_enabled(base))
+        cache_key(key, base, IMG_CACHE_KEY, param);
+    else
+        memset(key, 0, IMG_CACHE_KEY);
+}
+
+static void cache_path(char *buffer, const byte *key)
+{
+    char *p = buffer + Q_strlcpy(buffer, "imagecache/", MAX_QPATH);
+
+    for (int i = 0; i < IMG_CACHE_KEY; i++)
+        p += Q_snprintf(p, 3, "%02x", key[i]);
+
+    strcpy(p, ".bin");
+}
+
+static size_t cache_pixels_size(const image_t *image)
+{
+    return (size_t)image->upload_width * image->upload_height *
+        (image->pixel_format == PF_R16_UNORM ? 2 : 4);
+}
+
+/*
+===============
+IMG_ReadCache
+
+Loads pixels cached under the given key, filling in image dimensions and
+format. Pixels are read straight into buffer returned in `pic'.
+===============
+*/
+bool IMG_ReadCache(const byte *key, image_t *image, byte **pic)
+{
+    char        path[MAX_QPATH];
+    byte        header[IMG_CACHE_HEADER];
+    qhandle_t   f;
+    int64_t     len;
+    image_t     tmp;
+    size_t      size;
+    byte        *data;
+
+    if (!cache_enabled(key))
+        return false;
+
+    cache_path(path, key);
+    len = FS_OpenFile(path, &f, FS_MODE_READ | FS_TYPE_REAL | FS_PATH_GAME);
+    if (!f)
+        return false;
+
+    if (FS_Read(header, sizeof(header), f) != (int)sizeof(header) ||
+        RL32(header) != IMG_CACHE_MAGIC)
+        goto fail;
+
+    tmp.width = RL32(header + 4);
+    tmp.height = RL32(header + 8);
+    tmp.upload_width = RL32(header + 12);
+    tmp.upload_height = RL32(header + 16);
+    tmp.pixel_format = RL32(header + 20);
+    if (tmp.pixel_format > PF_R16_UNORM || tmp.upload_width < 1 || tmp.upload_height < 1)
+        goto fail;
+
+    size = cache_pixels_size(&tmp);
+    if (len != sizeof(header) + size)
+        goto fail;
+
+    data = Z_Malloc(size);
+    if (FS_Read(data, size, f) != (int)size) {
+        Z_Free(data);
+        goto fail;
+    }
+
+    FS_CloseFile(f);
+
+    image->width = tmp.width;
+    image->height = tmp.height;
+    image->upload_width = tmp.upload_width;
+    image->upload_height = tmp.upload_height;
+    image->pixel_format = tmp.pixel_format;
+    image->flags |= RL32(header + 24) & IMG_CACHE_FLAGS;
+    *pic = data;
+    return true;
+
+fail:
+    Com_WPrintf("Ignoring corrupt %s\n", path);
+    FS_CloseFile(f);
+    return false;
+}
+
+/*
+===============
+IMG_WriteCache
+===============
+*/
+void IMG_WriteCache(const byte *key, const image_t *image, const byte *pic)
+{
+    char        path[MAX_QPATH];
+    byte        header[IMG_CACHE_HEADER];
+    qhandle_t   f;
+    size_t      size;
+    int         ret;
+
+    if (!cache_enabled(key))
+        return;
+
+    cache_path(path, key);
+    ret = FS_OpenFile(path, &f, FS_MODE_WRITE);
+    if (!f) {
+        Com_EPrintf("Couldn't open %s: %s\n", path, Q_ErrorString(ret));
+        return;
+    }
+
+    WL32(header, IMG_CACHE_MAGIC);
+    WL32(header + 4, image->width);
+    WL32(header + 8, image->height);
+    WL32(header + 12, image->upload_width);
+    WL32(header + 16, image->upload_height);
+    WL32(header + 20, image->pixel_format);
+    WL32(header + 24, image->flags & IMG_CACHE_FLAGS);
+
+    size = cache_pixels_size(image);
+    FS_Write(header, sizeof(header), f);
+    FS_Write(pic, size, f);
+
+    // partially written files are rejected by length
+    if (FS_CloseFile(f))
+        Com_EPrintf("Couldn't write %s\n", path);
+}
+
 #define TRY_IMAGE_SRC_GAME      1
 #define TRY_IMAGE_SRC_BASE      0
 
 static int _try_image_format(imageformat_t fmt, image_t *image, int try_src, byte **pic)
 {
-    byte        *data;
+    const void  *data;
     int         len;
     int         ret;
 
-    // load the file
+    // load the file, loaders don't modify it so it can be a view of pack
     int fs_flags = 0;
     if (try_src > 0)
         fs_flags = try_src == TRY_IMAGE_SRC_GAME ? FS_PATH_GAME : FS_PATH_BASE;
-    len = FS_LoadFileFlags(image->name, (void **)&data, fs_flags);
+    len = FS_LoadFileView(image->name, &data, fs_flags);
     if (!data) {
         return len;
     }
 
-    // decompress the image
-    ret = img_loaders[fmt].load(data, len, image, pic);
+    // decompress the image, unless stb already did it before
+    memset(image->cache_key, 0, sizeof(image->cache_key));
+    if (fmt >= IM_TGA && fmt < IM_MAX && r_image_cache->integer) {
+        cache_key(image->cache_key, data, len, fmt | supports_extended_pixel_format() << 8);
+        if (IMG_ReadCache(image->cache_key, image, pic)) {
+            ret = Q_ERR_SUCCESS;
+        } else {
+            ret = img_loaders[fmt].load((byte *)data, len, image, pic);
+            if (ret >= 0)
+                IMG_WriteCache(image->cache_key, image, *pic);
+        }
+    } else {
+        ret = img_loaders[fmt].load((byte *)data, len, image, pic);
+    }
 
     FS_FreeFile(data);
 
@@ -1629,6 +1931,134 @@ image_t *IMG_ForHandle(qhandle_t h)
     return &r_images[h];
 }
 
+// builds the path R_RegisterImage looks up from the registered name
+static size_t image_full_name(char *fullname, const char *name, imagetype_t type)
+{
+    size_t len;
+
+    if (type == IT_SKIN || type == IT_SPRITE) {
+        len = FS_NormalizePathBuffer(fullname, name, MAX_QPATH);
+    } else if (*name == '/' || *name == '\\') {
+        len = FS_NormalizePathBuffer(fullname, name + 1, MAX_QPATH);
+    } else {
+        len = Q_concat(fullname, MAX_QPATH, "pics/", name);
+        if (len < MAX_QPATH) {
+            FS_NormalizePath(fullname);
+            len = COM_DefaultExtension(fullname, ".pcx", MAX_QPATH);
+        }
+    }
+
+    return len;
+}
+
+// checks if the file _try_image_format would load exists
+static bool probe_image_format(imageformat_t fmt, char *name, size_t baselen, int try_src)
+{
+    memcpy(name + baselen + 1, img_loaders[fmt].ext, 4);
+    return FS_FileExistsEx(name, try_src > 0 ? FS_PATH_GAME : 0);
+}
+
+// same search order as try_load_image_candidate and try_other_formats
+static bool probe_image_candidate(char *name, size_t baselen, imagetype_t type, imageflags_t flags, bool allow_override, int try_src)
+{
+    imageformat_t orig, fmt;
+    int i;
+
+    for (orig = 0; orig < IM_MAX; orig++) {
+        if (!Q_stricmp(name + baselen + 1, img_loaders[orig].ext)) {
+            break;
+        }
+    }
+
+    if (orig < IM_MAX && allow_override && !(flags & IF_EXACT) && need_override_image(type, orig)) {
+        orig = IM_MAX;
+    }
+
+    if (orig < IM_MAX) {
+        if (probe_image_format(orig, name, baselen, try_src)) {
+            return true;
+        }
+        if (flags & IF_EXACT) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < img_total; i++) {
+        fmt = img_search[i];
+        if (fmt != orig && probe_image_format(fmt, name, baselen, try_src)) {
+            return true;
+        }
+    }
+
+    fmt = (type == IT_WALL) ? IM_WAL : IM_PCX;
+    return fmt != orig && probe_image_format(fmt, name, baselen, try_src);
+}
+
+/*
+===============
+R_ResolveImagePath
+
+Finds the file R_RegisterImage would load for the given name, following the
+same override, game directory and r_texture_formats search order, without
+loading anything. Returns false if the image is already registered or there
+is no such file. Path must be at least MAX_QPATH bytes.
+===============
+*/
+bool R_ResolveImagePath(const char *name, imagetype_t type, imageflags_t flags, char *path)
+{
+    char        fullname[MAX_QPATH];
+    size_t      len, baselen;
+    const char  *base;
+
+    Q_assert(name);
+
+    if (!*name || !r_numImages) {
+        return false;
+    }
+
+    len = image_full_name(fullname, name, type);
+    if (len >= sizeof(fullname) || len <= 4 || fullname[len - 4] != '.') {
+        return false;
+    }
+
+    if (lookup_image(fullname, type, FS_HashPathLen(fullname, len - 4, RIMAGES_HASH), len - 4)) {
+        return false;
+    }
+
+#if REF_GL
+    bool allow_override = cls.ref_type != REF_TYPE_GL || type == IT_PIC || gl_use_hd_assets->integer;
+#else
+    bool allow_override = true;
+#endif
+
+    if (allow_override) {
+        base = strrchr(fullname, '/');
+        base = base ? base + 1 : fullname;
+        baselen = Q_concat(path, MAX_QPATH, "overrides/", base) - 4;
+        if (baselen + 4 < MAX_QPATH && probe_image_candidate(path, baselen, type, flags, true, -1)) {
+            return true;
+        }
+    }
+
+    bool is_not_baseq2 = fs_game->string[0] && strcmp(fs_game->string, BASEGAME) != 0;
+
+    for (int try_location = is_not_baseq2 ? TRY_IMAGE_SRC_GAME : TRY_IMAGE_SRC_BASE;
+         try_location >= TRY_IMAGE_SRC_BASE;
+         try_location--)
+    {
+        int location_flag = try_location == TRY_IMAGE_SRC_GAME ? IF_SRC_GAME : IF_SRC_BASE;
+        if (((flags & IF_SRC_MASK) != 0) && ((flags & IF_SRC_MASK) != location_flag))
+            continue;
+
+        memcpy(path, fullname, len + 1);
+        if (probe_image_candidate(path, len - 4, type, flags, allow_override, try_location)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /*
 ===============
 R_RegisterImage
@@ -1652,18 +2082,7 @@ qhandle_t R_RegisterImage(const char *name, imagetype_t type, imageflags_t flags
         return 0;
     }
 
-    if (type == IT_SKIN || type == IT_SPRITE) {
-        len = FS_NormalizePathBuffer(fullname, name, sizeof(fullname));
-    } else if (*name == '/' || *name == '\\') {
-        len = FS_NormalizePathBuffer(fullname, name + 1, sizeof(fullname));
-    } else {
-        len = Q_concat(fullname, sizeof(fullname), "pics/", name);
-        if (len < sizeof(fullname)) {
-            FS_NormalizePath(fullname);
-            len = COM_DefaultExtension(fullname, ".pcx", sizeof(fullname));
-        }
-    }
-
+    len = image_full_name(fullname, name, type);
     if (len >= sizeof(fullname)) {
         print_error(fullname, flags, Q_ERR(ENAMETOOLONG));
         return 0;
@@ -1872,6 +2291,7 @@ void IMG_Init(void)
     r_texture_formats->changed = r_texture_formats_changed;
     r_texture_formats_changed(r_texture_formats);
     r_texture_overrides = Cvar_Get("r_texture_overrides", "-1", CVAR_FILES);
+    r_image_cache = Cvar_Get("r_image_cache", "0", 0);
 
     r_screenshot_format = Cvar_Get("gl_screenshot_format", "png", CVAR_ARCHIVE);
     r_screenshot_async = Cvar_Get("gl_screenshot_async", "1", 0);
@@ -18,6 +18,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "vkpt.h"
+#include "common/async.h"
+#include "common/intreadwrite.h"
+#include "system/system.h"
 #include "shader/global_textures.h"
 #include "material.h"
 #include "cameras.h"
@@ -551,22 +554,51 @@ is_sky_or_lava_cluster(bsp_mesh_t* wm, mface_t* surf, int cluster, int material_
 	return false;
 }
 
-static void merge_pvs_rows(bsp_t* bsp, byte* src, byte* dst)
+/*
+  PVS matrix operations. Rows are visrowsize bytes long and packed back to
+  back, so they are processed as unaligned 64-bit words followed by a byte
+  tail. The word loops are simple enough for the compiler to vectorize.
+  Work is spread across clusters with Com_ParallelFor.
+*/
+
+static inline void merge_vis_rows(const byte* src, byte* dst, int rowsize)
 {
-	for (int i = 0; i < bsp->visrowsize; i++)
-	{
+	int i = 0;
+
+	for (; i + 8 <= rowsize; i += 8)
+		WN64(dst + i, RN64(dst + i) | RN64(src + i));
+
+	for (; i < rowsize; i++)
 		dst[i] |= src[i];
-	}
+}
+
+static void merge_pvs_rows(bsp_t* bsp, const byte* src, byte* dst)
+{
+	merge_vis_rows(src, dst, bsp->visrowsize);
+}
+
+// returns up to 64 bits of the row starting at byte i, bit n is cluster i * 8 + n
+static inline uint64_t load_vis_word(const byte* row, int i, int rowsize)
+{
+	uint64_t w = 0;
+
+	if (i + 8 <= rowsize)
+		return RL64(row + i);
+
+	for (int j = 0; i + j < rowsize; j++)
+		w |= (uint64_t)row[i + j] << (j * 8);
+
+	return w;
 }
 
 #define FOREACH_BIT_BEGIN(SET,ROWSIZE,VAR) \
-	for (int _byte_idx = 0; _byte_idx < (ROWSIZE); _byte_idx++) { \
-	if (SET[_byte_idx]) { \
-		for (int _bit_idx = 0; _bit_idx < 8; _bit_idx++) { \
-			if (SET[_byte_idx] & (1 << _bit_idx)) { \
-				int VAR = (_byte_idx << 3) | _bit_idx;
+	for (int _byte_idx = 0; _byte_idx < (ROWSIZE); _byte_idx += 8) { \
+		uint64_t _word = load_vis_word(SET, _byte_idx, ROWSIZE); \
+		while (_word) { \
+			int VAR = (_byte_idx << 3) + Q_ctz64(_word); \
+			_word &= _word - 1;
 
-#define FOREACH_BIT_END  } } } }
+#define FOREACH_BIT_END  } }
 
 static void connect_pvs(bsp_t* bsp, int cluster_a, byte* pvs_a, int cluster_b, byte* pvs_b)
 {
@@ -588,40 +620,187 @@ static void connect_pvs(bsp_t* bsp, int cluster_a, byte* pvs_a, int cluster_b, b
 	merge_pvs_rows(bsp, pvs_b, pvs_a);
 }
 
-static void make_pvs_symmetric(bsp_t* bsp)
+typedef struct {
+	const byte* src;
+	byte* dst;
+	int numclusters;
+	int rowsize;
+} pvs_matrix_job_t;
+
+// sets the transposed bits for rows 8 * k ... 8 * k + 7, which only depend on byte k of each source row
+static void symmetric_pvs_job(void* arg, int k)
 {
-	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
+	const pvs_matrix_job_t* job = arg;
+
+	for (int cluster = 0; cluster < job->numclusters; cluster++)
 	{
-		byte* pvs = BSP_GetPvs(bsp, cluster);
+		int bits = job->src[job->rowsize * cluster + k];
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, vis_cluster)
-			if (vis_cluster != cluster)
-			{
-				byte* vis_pvs = BSP_GetPvs(bsp, vis_cluster);
-				Q_SetBit(vis_pvs, cluster);
-			}
-		FOREACH_BIT_END
+		while (bits)
+		{
+			int vis_cluster = (k << 3) + Q_ctz64(bits);
+			bits &= bits - 1;
+
+			if (vis_cluster < job->numclusters)
+				Q_SetBit(job->dst + job->rowsize * vis_cluster, cluster);
+		}
 	}
 }
 
+// makes the matrix equal to itself OR'ed with its transpose
+static void make_pvs_matrix_symmetric(byte* pvs, int numclusters, int rowsize)
+{
+	size_t matrix_size = rowsize * numclusters;
+	pvs_matrix_job_t job = { .dst = pvs, .numclusters = numclusters, .rowsize = rowsize };
+
+	byte* src = Z_Malloc(matrix_size);
+	memcpy(src, pvs, matrix_size);
+	job.src = src;
+
+	Com_ParallelFor(rowsize, symmetric_pvs_job, &job);
+
+	Z_Free(src);
+}
+
+static void make_pvs_symmetric(bsp_t* bsp)
+{
+	make_pvs_matrix_symmetric(bsp->pvs_matrix, bsp->vis->numclusters, bsp->visrowsize);
+}
+
+static void pvs2_row_job(void* arg, int cluster)
+{
+	const pvs_matrix_job_t* job = arg;
+	const byte* pvs = job->src + job->rowsize * cluster;
+	byte* dest_pvs = job->dst + job->rowsize * cluster;
+
+	memcpy(dest_pvs, pvs, job->rowsize);
+
+	FOREACH_BIT_BEGIN(pvs, job->rowsize, vis_cluster)
+		if (vis_cluster < job->numclusters)
+			merge_vis_rows(job->src + job->rowsize * vis_cluster, dest_pvs, job->rowsize);
+	FOREACH_BIT_END
+}
+
+// each PVS2 row is the union of PVS rows of all clusters visible from it
+static void build_pvs2_matrix(const byte* pvs, byte* pvs2, int numclusters, int rowsize)
+{
+	pvs_matrix_job_t job = { .src = pvs, .dst = pvs2, .numclusters = numclusters, .rowsize = rowsize };
+
+	Com_ParallelFor(numclusters, pvs2_row_job, &job);
+}
+
 static void build_pvs2(bsp_t* bsp)
 {
 	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
 
 	bsp->pvs2_matrix = Z_Mallocz(matrix_size);
 
-	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
+	build_pvs2_matrix(bsp->pvs_matrix, bsp->pvs2_matrix, bsp->vis->numclusters, bsp->visrowsize);
+}
+
+// original byte-at-a-time versions, only used by bsp_pvs2_bench to check results
+static void make_pvs_symmetric_reference(byte* pvs, int numclusters, int rowsize)
+{
+	for (int cluster = 0; cluster < numclusters; cluster++)
 	{
-		byte* pvs = BSP_GetPvs(bsp, cluster);
-		byte* dest_pvs = BSP_GetPvs2(bsp, cluster);
-		memcpy(dest_pvs, pvs, bsp->visrowsize);
+		byte* row = pvs + rowsize * cluster;
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, vis_cluster)
-			byte* pvs2 = BSP_GetPvs(bsp, vis_cluster);
-			merge_pvs_rows(bsp, pvs2, dest_pvs);
-		FOREACH_BIT_END
+		for (int vis_cluster = 0; vis_cluster < numclusters; vis_cluster++)
+		{
+			if (vis_cluster != cluster && Q_IsBitSet(row, vis_cluster))
+				Q_SetBit(pvs + rowsize * vis_cluster, cluster);
+		}
 	}
+}
+
+static void build_pvs2_reference(const byte* pvs, byte* pvs2, int numclusters, int rowsize)
+{
+	for (int cluster = 0; cluster < numclusters; cluster++)
+	{
+		const byte* row = pvs + rowsize * cluster;
+		byte* dest_pvs = pvs2 + rowsize * cluster;
+		memcpy(dest_pvs, row, rowsize);
+
+		for (int vis_cluster = 0; vis_cluster < numclusters; vis_cluster++)
+		{
+			if (!Q_IsBitSet(row, vis_cluster))
+				continue;
+
+			const byte* vis_row = pvs + rowsize * vis_cluster;
+			for (int i = 0; i < rowsize; i++)
+				dest_pvs[i] |= vis_row[i];
+		}
+	}
+}
+
+void bsp_mesh_pvs2_bench(void)
+{
+	char path[MAX_QPATH];
+	bsp_t* bsp;
+	int ret;
+
+	if (Cmd_Argc() != 2)
+	{
+		Com_Printf("Usage: %s <map>\n", Cmd_Argv(0));
+		return;
+	}
+
+	if (Q_concat(path, sizeof(path), "maps/", Cmd_Argv(1), ".bsp") >= sizeof(path))
+	{
+		Com_Printf("Oversize map name\n");
+		return;
+	}
+
+	ret = BSP_Load(path, &bsp);
+	if (!bsp)
+	{
+		Com_EPrintf("Couldn't load %s: %s\n", path, BSP_ErrorString(ret));
+		return;
+	}
+
+	if (!bsp->vis || !bsp->pvs_matrix)
+	{
+		Com_Printf("%s has no visibility data\n", path);
+		BSP_Free(bsp);
+		return;
+	}
+
+	int numclusters = bsp->vis->numclusters;
+	int rowsize = bsp->visrowsize;
+	size_t matrix_size = rowsize * numclusters;
+
+	byte* sym_ref = Z_Malloc(matrix_size);
+	byte* sym = Z_Malloc(matrix_size);
+	byte* pvs2_ref = Z_Malloc(matrix_size);
+	byte* pvs2 = Z_Malloc(matrix_size);
+
+	memcpy(sym_ref, bsp->pvs_matrix, matrix_size);
+	memcpy(sym, bsp->pvs_matrix, matrix_size);
+
+	unsigned t0 = Sys_Milliseconds();
+	make_pvs_symmetric_reference(sym_ref, numclusters, rowsize);
+	unsigned t1 = Sys_Milliseconds();
+	build_pvs2_reference(sym_ref, pvs2_ref, numclusters, rowsize);
+	unsigned t2 = Sys_Milliseconds();
+	make_pvs_matrix_symmetric(sym, numclusters, rowsize);
+	unsigned t3 = Sys_Milliseconds();
+	build_pvs2_matrix(sym, pvs2, numclusters, rowsize);
+	unsigned t4 = Sys_Milliseconds();
+
+	Com_Printf("%s: %d clusters, %d workers\n", path, numclusters, Com_AsyncWorkers());
+	Com_Printf("symmetric: %u ms reference, %u ms new\n", t1 - t0, t3 - t2);
+	Com_Printf("pvs2:      %u ms reference, %u ms new\n", t2 - t1, t4 - t3);
+
+	if (memcmp(sym_ref, sym, matrix_size) || memcmp(pvs2_ref, pvs2, matrix_size))
+		Com_WPrintf("Output differs from reference!\n");
+	else
+		Com_Printf("Output is identical.\n");
 
+	Z_Free(sym_ref);
+	Z_Free(sym);
+	Z_Free(pvs2_ref);
+	Z_Free(pvs2);
+	BSP_Free(bsp);
 }
 
 // Provides an upper estimate (not counting the collinear edge removal, invisible materials etc.)
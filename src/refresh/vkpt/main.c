@@ -3925,6 +3925,7 @@ R_Init_RTX(bool total)
 	Cmd_AddCommand("reload_shader", (xcommand_t)&vkpt_reload_shader);
 	Cmd_AddCommand("reload_textures", (xcommand_t)&vkpt_reload_textures);
 	Cmd_AddCommand("show_pvs", (xcommand_t)&vkpt_show_pvs);
+	Cmd_AddCommand("bsp_pvs2_bench", (xcommand_t)&bsp_mesh_pvs2_bench);
 	Cmd_AddCommand("next_sun", (xcommand_t)&vkpt_next_sun_preset);
 
 	vkpt_fog_init();
@@ -3958,6 +3959,7 @@ R_Shutdown_RTX(bool total)
 	Cmd_RemoveCommand("reload_shader");
 	Cmd_RemoveCommand("reload_textures");
 	Cmd_RemoveCommand("show_pvs");
+	Cmd_RemoveCommand("bsp_pvs2_bench");
 	Cmd_RemoveCommand("next_sun");
 
 	if (vkpt_refdef.bsp_mesh_world_loaded)
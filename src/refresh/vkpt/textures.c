@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "vkpt.h"
 #include "vk_util.h"
+#include "common/async.h"
 #include "refresh/images.h"
 #include "device_memory_allocator.h"
 
@@ -106,6 +107,10 @@ void vkpt_textures_prefetch()
         return;
     }
 
+    // gather the list first so that all files are inflated in parallel
+    int count = 0, max_count = 256;
+    char (*paths)[MAX_QPATH] = Z_Malloc(sizeof(paths[0]) * max_count);
+
     char const * ptr = buffer;
 	char linebuf[MAX_QPATH];
 	while (sgets(linebuf, sizeof(linebuf), &ptr))
@@ -114,8 +119,37 @@ void vkpt_textures_prefetch()
 		if (!line)
 			continue;
 
-		MAT_Find(line, IT_SKIN, IF_PERMANENT);
+		if (count == max_count)
+		{
+			max_count *= 2;
+			paths = Z_Realloc(paths, sizeof(paths[0]) * max_count);
+		}
+		Q_strlcpy(paths[count++], line, MAX_QPATH);
+	}
+
+	// prefetch the files MAT_Find will actually load, which may be overrides
+	// in another format and location than listed
+	char (*resolved)[MAX_QPATH] = Z_Malloc(sizeof(resolved[0]) * (count + 1));
+	const char** names = Z_Malloc(sizeof(names[0]) * (count + 1));
+	int num_names = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (R_ResolveImagePath(paths[i], IT_SKIN, IF_PERMANENT, resolved[num_names]))
+		{
+			names[num_names] = resolved[num_names];
+			num_names++;
+		}
 	}
+
+	FS_PrefetchFiles(names, num_names);
+
+	for (int i = 0; i < count; i++)
+		MAT_Find(paths[i], IT_SKIN, IF_PERMANENT);
+
+	FS_FreePrefetched();
+	Z_Free(names);
+	Z_Free(resolved);
+	Z_Free(paths);
     // Com_Printf("Loaded '%s'\n", filename);
     FS_FreeFile(buffer);
 }
@@ -525,18 +559,39 @@ struct filterscratch_s
 	float *ptr;
 };
 
-static void filterscratch_init(struct filterscratch_s* scratch, unsigned kernel_size, int stripe_size, int num_comps)
+/* Scratch memory is kept between filter passes and only ever grows.
+ * Job i always uses buffer i, and there are never more jobs than threads
+ * taking part in Com_ParallelFor, so no buffer is used by two threads. */
+static struct
+{
+	float *ptr;
+	size_t size;
+} filter_scratch[ASYNC_MAX_WORKERS + 1];
+
+static void filterscratch_init(struct filterscratch_s* scratch, int index, unsigned kernel_size, int stripe_size, int num_comps)
 {
 	scratch->num_comps = num_comps;
 	scratch->pad_left = kernel_size / 2;
 	scratch->pad_right = kernel_size - scratch->pad_left - 1;
 	int num_scratch_pixels = scratch->pad_left + stripe_size + scratch->pad_right;
-	scratch->ptr = Z_Malloc(num_scratch_pixels * num_comps * sizeof(float));
+	size_t size = num_scratch_pixels * num_comps * sizeof(float);
+	if (filter_scratch[index].size < size)
+	{
+		Z_Free(filter_scratch[index].ptr);
+		filter_scratch[index].ptr = Z_Malloc(size);
+		filter_scratch[index].size = size;
+	}
+	scratch->ptr = filter_scratch[index].ptr;
 }
 
-static void filterscratch_free(struct filterscratch_s* scratch)
+static void filterscratch_destroy(void)
 {
-	Z_Free(scratch->ptr);
+	for (int i = 0; i < q_countof(filter_scratch); i++)
+	{
+		Z_Free(filter_scratch[i].ptr);
+		filter_scratch[i].ptr = NULL;
+		filter_scratch[i].size = 0;
+	}
 }
 
 static void filterscratch_fill_from_float_image(struct filterscratch_s *scratch, float *current_stripe, int stripe_size, int element_stride)
@@ -580,40 +635,78 @@ static void filterscratch_fill_from_float_image(struct filterscratch_s *scratch,
 	}
 }
 
-/* Apply a (separable) filter along one dimension of an image.
- * Whether this is done along the X or Y dimension depends on the "stripe size"
- * and "stripe stride" options. See filter_image() for how to use it practically. */
-static void filter_one_dimension_float(float* pixels, int num_comps,
-									   const float kernel[], unsigned kernel_size,
-									   int stripe_size, int num_stripes,
-									   int stripe_stride, int element_stride)
+struct filterjob_s
 {
-	struct filterscratch_s scratch;
-	filterscratch_init(&scratch, kernel_size, stripe_size, num_comps);
-	float *current_stripe = pixels;
+	float *pixels;
+	int num_comps;
+	const float *kernel;
+	unsigned kernel_size;
+	int stripe_size, num_stripes;
+	int stripe_stride, element_stride;
+	int stripes_per_job;
+	struct filterscratch_s *scratch; // one per job, see filter_scratch
+};
+
+static void filter_stripes(void *arg, int job)
+{
+	struct filterjob_s *fj = arg;
+	struct filterscratch_s *scratch = fj->scratch + job;
+	const int num_comps = fj->num_comps;
+	int first = job * fj->stripes_per_job;
+	int last = min(first + fj->stripes_per_job, fj->num_stripes);
+	float *current_stripe = fj->pixels + first * fj->stripe_stride * num_comps;
 	float* values = alloca(num_comps * sizeof(float));
-	for (int s = 0; s < num_stripes; s++)
+	for (int s = first; s < last; s++)
 	{
 		// back up image data to scratch buffer
-		filterscratch_fill_from_float_image(&scratch, current_stripe, stripe_size, element_stride);
+		filterscratch_fill_from_float_image(scratch, current_stripe, fj->stripe_size, fj->element_stride);
 		// filter the stripe
-		for (int i = 0; i < stripe_size; i++)
+		for (int i = 0; i < fj->stripe_size; i++)
 		{
 			memset(values, 0, num_comps * sizeof(float));
-			for (int j = 0; j < kernel_size; j++)
+			for (int j = 0; j < fj->kernel_size; j++)
 			{
-				float f = kernel[j];
-				float *src_p = scratch.ptr + (i + j) * num_comps;
+				float f = fj->kernel[j];
+				float *src_p = scratch->ptr + (i + j) * num_comps;
 				for (int c = 0; c < num_comps; c++)
 				{
 					values[c] += f * src_p[c];
 				}
 			}
-			memcpy(current_stripe + i * element_stride * num_comps, values, num_comps * sizeof(float));
+			memcpy(current_stripe + i * fj->element_stride * num_comps, values, num_comps * sizeof(float));
 		}
-		current_stripe += stripe_stride * num_comps;
+		current_stripe += fj->stripe_stride * num_comps;
 	}
-	filterscratch_free(&scratch);
+}
+
+/* Apply a (separable) filter along one dimension of an image.
+ * Whether this is done along the X or Y dimension depends on the "stripe size"
+ * and "stripe stride" options. See filter_image() for how to use it practically.
+ * Stripes are independent, so they are split between workers, each filtering
+ * through its own scratch buffer. Scratch buffers are grown here as the
+ * zone allocator is not thread safe. */
+static void filter_one_dimension_float(float* pixels, int num_comps,
+									   const float kernel[], unsigned kernel_size,
+									   int stripe_size, int num_stripes,
+									   int stripe_stride, int element_stride)
+{
+	int num_jobs = min(num_stripes, min(Com_AsyncWorkers() + 1, (int)q_countof(filter_scratch)));
+	struct filterjob_s fj = {
+		.pixels = pixels,
+		.num_comps = num_comps,
+		.kernel = kernel,
+		.kernel_size = kernel_size,
+		.stripe_size = stripe_size,
+		.num_stripes = num_stripes,
+		.stripe_stride = stripe_stride,
+		.element_stride = element_stride,
+		.stripes_per_job = (num_stripes + num_jobs - 1) / num_jobs,
+		.scratch = alloca(num_jobs * sizeof(struct filterscratch_s))
+	};
+	for (int i = 0; i < num_jobs; i++)
+		filterscratch_init(fj.scratch + i, i, kernel_size, stripe_size, num_comps);
+
+	Com_ParallelFor(num_jobs, filter_stripes, &fj);
 }
 
 // Apply a (separable) filter to an image.
@@ -720,6 +813,12 @@ static inline void bilerp_get_next_output_line_from_rgb_f32(struct bilerp_s *bil
 	_bilerp_get_next_output_line(bilerp, output_line, next_input, input_w);
 }
 
+// breakdown of texture processing times for the load log, in microseconds
+static struct {
+	uint64_t fake_emissive; // since last upload
+	uint64_t create, staging, mips;
+} texture_timings;
+
 // Fake an emissive texture from a diffuse texture by using pixels brighter than a certain amount
 static void apply_fake_emissive_threshold(image_t *image, int bright_threshold_int)
 {
@@ -884,7 +983,22 @@ image_t *vkpt_fake_emissive_texture(image_t *image, int bright_threshold_int)
 		return image;
 
 	new_image->flags |= IF_FAKE_EMISSIVE | (Q_clip_uint8(bright_threshold_int) << IF_FAKE_EMISSIVE_THRESH_SHIFT);
-	apply_fake_emissive_threshold(new_image, bright_threshold_int);
+
+	// synthesizing is slow, reuse the result from previous runs if possible
+	IMG_DeriveCacheKey(new_image->cache_key, image->cache_key, IF_FAKE_EMISSIVE | Q_clip_uint8(bright_threshold_int));
+	byte *pic;
+	if (IMG_ReadCache(new_image->cache_key, new_image, &pic))
+	{
+		Z_Free(new_image->pix_data);
+		new_image->pix_data = pic;
+	}
+	else
+	{
+		uint64_t start = Sys_Microseconds();
+		apply_fake_emissive_threshold(new_image, bright_threshold_int);
+		texture_timings.fake_emissive += Sys_Microseconds() - start;
+		IMG_WriteCache(new_image->cache_key, new_image, new_image->pix_data);
+	}
 
 	return new_image;
 }
@@ -1519,6 +1633,7 @@ vkpt_textures_destroy()
 	tex_device_memory_allocator = NULL;
 
 	normalize_destroy();
+	filterscratch_destroy();
 
 	LOG_FUNC();
 	return VK_SUCCESS;
@@ -1544,6 +1659,19 @@ static VkFormat get_image_format(image_t *q_img)
 	return VK_FORMAT_R8G8B8A8_UNORM;
 }
 
+struct stagingjob_s
+{
+	void *dst;
+	const void *src;
+	size_t size;
+};
+
+static void fill_staging(void *arg, int i)
+{
+	struct stagingjob_s *job = (struct stagingjob_s *)arg + i;
+	memcpy(job->dst, job->src, job->size);
+}
+
 VkResult
 vkpt_textures_end_registration()
 {
@@ -1597,6 +1725,8 @@ vkpt_textures_end_registration()
 	}
 #endif
 
+	uint64_t time_start = Sys_Microseconds();
+
 	// Phase 1: Create the new texture objects, count the memory required to upload them all.
 	// Also, delete any storage image descriptors that may exist for previously uploaded textures.
 
@@ -1690,6 +1820,8 @@ vkpt_textures_end_registration()
 		}
 	}
 
+	texture_timings.create = Sys_Microseconds() - time_start;
+
 	// Phase 3: Upload the image data.
 
 	BufferResource_t buf_img_upload;
@@ -1700,6 +1832,10 @@ vkpt_textures_end_registration()
 
 	char *staging_buffer = buffer_map(&buf_img_upload);
 
+	// offsets are assigned here, pixels are copied by workers afterwards
+	struct stagingjob_s *staging_jobs = Z_Malloc(new_image_num * sizeof(*staging_jobs));
+	int num_staging_jobs = 0;
+
 	size_t offset = 0;
 	for (int i = 0; i < MAX_RIMAGES; i++)
 	{
@@ -1738,7 +1874,10 @@ vkpt_textures_end_registration()
 		);
 
 		int bytes_per_pixel = q_img->pixel_format == PF_R16_UNORM ? 2 : 4;
-		memcpy(staging_buffer + offset, q_img->pix_data, wd * ht * bytes_per_pixel);
+		struct stagingjob_s *job = staging_jobs + num_staging_jobs++;
+		job->dst = staging_buffer + offset;
+		job->src = q_img->pix_data;
+		job->size = (size_t)wd * ht * bytes_per_pixel;
 
 		VkBufferImageCopy cpy_info = {
 			.bufferOffset = offset,
@@ -1772,9 +1911,14 @@ vkpt_textures_end_registration()
 		offset += mem_req.size;
 	}
 
+	Com_ParallelFor(num_staging_jobs, fill_staging, staging_jobs);
+	Z_Free(staging_jobs);
+
 	buffer_unmap(&buf_img_upload);
 	staging_buffer = NULL;
 
+	texture_timings.staging = Sys_Microseconds() - time_start - texture_timings.create;
+
 	vkpt_submit_command_buffer_simple(cmd_buf, qvk.queue_graphics, true);
 
 	// Phase 4: Process the normal maps using a compute shader, generate mipmaps.
@@ -1894,6 +2038,8 @@ vkpt_textures_end_registration()
 	
 	vkpt_submit_command_buffer_simple(cmd_buf, qvk.queue_graphics, true);
 
+	texture_timings.mips = Sys_Microseconds() - time_start - texture_timings.create - texture_timings.staging;
+
 	// Schedule the upload buffer for delayed destruction.
 
 	const uint32_t destroy_frame_index = (qvk.frame_counter + MAX_FRAMES_IN_FLIGHT) % DESTROY_LATENCY;
@@ -1909,6 +2055,13 @@ vkpt_textures_end_registration()
 	get_device_malloc_stats(tex_device_memory_allocator, &texture_memory_allocated, &texture_memory_used);
 	Com_DPrintf("Texture pool: using %.2f MB, allocated %.2f MB\n", 
 		(float)texture_memory_used / megabyte, (float)texture_memory_allocated / megabyte);
+	Com_DPrintf("Uploaded %u textures (%.2f MB) in %.1f ms: create %.1f ms, staging %.1f ms, "
+		"normalize and mips %.1f ms; fake emissive %.1f ms before\n",
+		new_image_num, (float)total_size / megabyte,
+		(texture_timings.create + texture_timings.staging + texture_timings.mips) * 1e-3,
+		texture_timings.create * 1e-3, texture_timings.staging * 1e-3,
+		texture_timings.mips * 1e-3, texture_timings.fake_emissive * 1e-3);
+	texture_timings.fake_emissive = 0;
 
 	return VK_SUCCESS;
 }
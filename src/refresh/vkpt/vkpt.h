@@ -430,6 +430,7 @@ void bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name);
 void bsp_mesh_destroy(bsp_mesh_t *wm);
 void bsp_mesh_register_textures(bsp_t *bsp);
 void bsp_mesh_animate_light_polys(bsp_mesh_t *wm);
+void bsp_mesh_pvs2_bench(void);
 uint32_t encode_normal(const vec3_t normal);
 
 typedef struct vkpt_refdef_s {
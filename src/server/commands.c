@@ -1748,6 +1748,7 @@ static const cmdreg_t c_server[] = {
     { "kick", SV_Kick_f, SV_SetPlayer_c },
     { "kickban", SV_Kick_f, SV_SetPlayer_c },
     { "status", SV_Status_f },
+    { "msgstats", SV_MsgStats_f },
     { "serverinfo", SV_Serverinfo_f },
     { "dumpuser", SV_DumpUser_f, SV_SetPlayer_c },
     { "stuff", SV_Stuff_f, SV_SetPlayer_c },
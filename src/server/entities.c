@@ -31,6 +31,41 @@ Encode a client frame onto the network channel
 #define Q2PRO_OPTIMIZE(c) \
     ((c)->protocol == PROTOCOL_VERSION_Q2PRO && !(c)->settings[CLS_RECORDING])
 
+struct entity_index_s;
+
+// state of a client frame being built, possibly on a worker thread
+typedef struct frame_build_s {
+    client_t        *client;
+    client_frame_t  *oldframe;
+    entity_packed_t *entities;      // private entity states, NULL if serial
+    byte            *clientpvs;
+    byte            *clientphs;
+    const struct entity_index_s *index; // NULL if scanning all entities
+    byte            *pvs_ents;      // entities in PVS/PHS found by index
+    byte            *phs_ents;
+    byte            *candidates;
+    vec3_t          org;
+    int             clientarea;
+    int             clientcluster;
+    int             max_packet_entities;
+    bool            cull_nonvisible;
+    bool            need_clientnum_fix;
+    bool            toolarge;
+    bool            overflowed;     // message is corrupt, drop the client
+    byte            *data;          // private frame message
+    size_t          cursize;
+    size_t          pe_start;       // offset of packet entities in message
+    struct frame_build_s *leader;   // frame sharing its packet entities
+#if USE_ZLIB
+    size_t          zlimit;         // compress frames larger than this
+    byte            *zdata;         // frame compressed by worker
+    int             zlen;           // -1 if compression failed
+#endif
+    bool            profile;        // measure build and encode times
+    uint64_t        build_start, build_end;
+    uint64_t        encode_start, encode_end;
+} frame_build_t;
+
 /*
 =============
 SV_EmitPacketEntities
@@ -38,11 +73,12 @@ SV_EmitPacketEntities
 Writes a delta update of an entity_packed_t list to the message.
 =============
 */
-static void SV_EmitPacketEntities(client_t         *client,
+static void SV_EmitPacketEntities(frame_build_t    *fb,
                                   client_frame_t   *from,
                                   client_frame_t   *to,
                                   int              clientEntityNum)
 {
+    client_t *client = fb->client;
     entity_packed_t *newent;
     const entity_packed_t *oldent;
     int i, oldnum, newnum, oldindex, newindex, from_num_entities;
@@ -58,12 +94,15 @@ static void SV_EmitPacketEntities(client_t         *client,
     oldent = newent = NULL;
     while (newindex < to->num_entities || oldindex < from_num_entities) {
         if (msg_write.cursize + MAX_PACKETENTITY_BYTES > msg_write.maxsize) {
-            Com_WPrintf("%s: frame got too large, aborting.\n", __func__);
+            fb->toolarge = true;
             break;
         }
 
         if (newindex >= to->num_entities) {
             newnum = 9999;
+        } else if (fb->entities) {
+            newent = &fb->entities[newindex];
+            newnum = newent->number;
         } else {
             i = (to->first_entity + newindex) % svs.num_entities;
             newent = &svs.entities[i];
@@ -171,12 +210,243 @@ static client_frame_t *get_last_frame(client_t *client)
 }
 
 /*
-==================
-SV_WriteFrameToClient_Default
-==================
+=============================================================================
+
+Share encoded packet entities between clients
+
+Spectators chasing the same player, and players standing close together,
+often get identical entity lists. Encoded packet entities only depend on
+the old and new lists and on a few client properties, so the block encoded
+for one client is reused for others with the same view during this server
+frame. Hashes are only used to find candidates, lists are compared in full.
+
+=============================================================================
 */
-void SV_WriteFrameToClient_Default(client_t *client)
+
+#define PE_CACHE_SIZE       64          // power of two
+#define PE_CACHE_BYTES      (MAX_MSGLEN * 4)
+
+// only this much of entity_packed_t is encoded, the rest is padding
+#define PACKED_BYTES        (q_offsetof(entity_packed_t, loop_attenuation) + 1)
+
+#define SHORTANGLES_CAPABLE(c) \
+    ((c)->protocol == PROTOCOL_VERSION_Q2PRO && \
+     (c)->version >= PROTOCOL_VERSION_Q2PRO_SHORT_ANGLES)
+
+typedef struct {
+    uint64_t                key;
+    unsigned                generation;
+    const client_t          *client;
+    const client_frame_t    *from;
+    const client_frame_t    *to;
+    const entity_packed_t   *entities;  // new states, NULL if in the ring
+    frame_build_t           *fb;        // frame encoded in parallel
+    size_t                  offset;     // cached block, if encoded serially
+    size_t                  length;
+} pe_cache_t;
+
+static pe_cache_t   sv_pe_cache[PE_CACHE_SIZE];
+static unsigned     sv_pe_generation = 1;
+static byte         *sv_pe_data;
+static size_t       sv_pe_size;
+
+static inline uint64_t pe_mix(uint64_t hash)
+{
+    hash *= UINT64_C(0x9e3779b97f4a7c15);
+    return hash ^ (hash >> 32);
+}
+
+uint64_t SV_HashEntities(uint64_t hash, const entity_packed_t *ents, int count)
+{
+    const byte *p;
+    int i, j;
+
+    for (i = 0; i < count; i++) {
+        p = (const byte *)&ents[i];
+        for (j = 0; j + 8 <= PACKED_BYTES; j += 8)
+            hash = pe_mix(hash ^ RN64(p + j));
+        for (; j < PACKED_BYTES; j++)
+            hash = pe_mix(hash ^ p[j]);
+    }
+
+    return hash;
+}
+
+static inline const entity_packed_t *frame_entity(const client_frame_t *frame,
+                                                  const entity_packed_t *ents, int i)
+{
+    if (ents)
+        return &ents[i];
+    return &svs.entities[(frame->first_entity + i) % svs.num_entities];
+}
+
+static uint64_t hash_frame(const client_frame_t *frame, const entity_packed_t *ents)
+{
+    uint64_t hash = frame->num_entities;
+    unsigned first, count;
+
+    if (ents) {
+        hash = SV_HashEntities(hash, ents, frame->num_entities);
+    } else {
+        first = frame->first_entity % svs.num_entities;
+        count = min(frame->num_entities, svs.num_entities - first);
+        hash = SV_HashEntities(hash, svs.entities + first, count);
+        hash = SV_HashEntities(hash, svs.entities, frame->num_entities - count);
+    }
+
+    return hash ? hash : 1;
+}
+
+static bool frames_equal(const client_frame_t *a, const entity_packed_t *a_ents,
+                         const client_frame_t *b, const entity_packed_t *b_ents)
+{
+    int i;
+
+    if (a->num_entities != b->num_entities)
+        return false;
+
+    for (i = 0; i < a->num_entities; i++)
+        if (memcmp(frame_entity(a, a_ents, i), frame_entity(b, b_ents, i), PACKED_BYTES))
+            return false;
+
+    return true;
+}
+
+// entity number sent with MSG_ES_FIRSTPERSON, whose states get modified
+static int frame_client_entity(const client_t *client, const client_frame_t *frame)
+{
+    if (client->protocol == PROTOCOL_VERSION_Q2PRO &&
+        frame->ps.pmove.pm_type < PM_DEAD && !client->settings[CLS_RECORDING])
+        return frame->clientNum + 1;
+
+    return 0;
+}
+
+// new frame hash must be known
+static uint64_t packet_entities_key(const client_t *client, client_frame_t *from,
+                                    const client_frame_t *to)
 {
+    uint64_t key = to->hash;
+
+    if (from) {
+        // states of old frame are final once in the ring
+        if (!from->hash)
+            from->hash = hash_frame(from, NULL);
+        key = pe_mix(key ^ from->hash);
+    }
+
+    key = pe_mix(key ^ client->baselines_hash);
+    key = pe_mix(key ^ client->esFlags ^ (uint64_t)client->maxclients << 32);
+
+    return key;
+}
+
+static pe_cache_t *find_packet_entities(const client_t *client, const client_frame_t *from,
+                                        const client_frame_t *to, const entity_packed_t *ents,
+                                        uint64_t key, bool parallel)
+{
+    pe_cache_t *c = &sv_pe_cache[key & (PE_CACHE_SIZE - 1)];
+
+    if (c->generation != sv_pe_generation || c->key != key || !c->fb != !parallel)
+        return NULL;
+
+    if (c->client->protocol != client->protocol ||
+        c->client->esFlags != client->esFlags ||
+        c->client->maxclients != client->maxclients ||
+        c->client->ge != client->ge ||
+        c->client->baselines_hash != client->baselines_hash ||
+        SHORTANGLES_CAPABLE(c->client) != SHORTANGLES_CAPABLE(client))
+        return NULL;
+
+    if (!c->from != !from)
+        return NULL;
+    if (from && !frames_equal(c->from, NULL, from, NULL))
+        return NULL;
+    if (!frames_equal(c->to, c->entities, to, ents))
+        return NULL;
+
+    return c;
+}
+
+static pe_cache_t *add_packet_entities(const client_t *client, const client_frame_t *from,
+                                       const client_frame_t *to, uint64_t key)
+{
+    pe_cache_t *c = &sv_pe_cache[key & (PE_CACHE_SIZE - 1)];
+
+    memset(c, 0, sizeof(*c));
+    c->key = key;
+    c->generation = sv_pe_generation;
+    c->client = client;
+    c->from = from;
+    c->to = to;
+    return c;
+}
+
+// cached blocks refer to frames and game state of this server frame only
+static void clear_packet_entities(void)
+{
+    sv_pe_generation++;
+    sv_pe_size = 0;
+}
+
+static void emit_packet_entities(frame_build_t    *fb,
+                                 client_frame_t   *from,
+                                 client_frame_t   *to,
+                                 int              clientEntityNum)
+{
+    size_t start = msg_write.cursize;
+    size_t length;
+    uint64_t key;
+    pe_cache_t *c;
+
+    // frames built in parallel were grouped by share_packet_entities()
+    if (fb->entities) {
+        fb->pe_start = start;
+        if (!fb->leader)
+            SV_EmitPacketEntities(fb, from, to, clientEntityNum);
+        return;
+    }
+
+    to->hash = 0;
+    svs.pe_encoded++;
+
+    if (clientEntityNum || !sv_share_entities->integer) {
+        SV_EmitPacketEntities(fb, from, to, clientEntityNum);
+        return;
+    }
+
+    to->hash = hash_frame(to, NULL);
+    key = packet_entities_key(fb->client, from, to);
+
+    c = find_packet_entities(fb->client, from, to, NULL, key, false);
+    if (c && start + c->length + MAX_PACKETENTITY_BYTES <= msg_write.maxsize) {
+        MSG_WriteData(sv_pe_data + c->offset, c->length);
+        svs.pe_encoded--;
+        svs.pe_shared++;
+        return;
+    }
+
+    SV_EmitPacketEntities(fb, from, to, 0);
+    if (fb->toolarge)
+        return;
+
+    length = msg_write.cursize - start;
+    if (sv_pe_size + length > PE_CACHE_BYTES)
+        return;
+
+    if (!sv_pe_data)
+        sv_pe_data = SV_Malloc(PE_CACHE_BYTES);
+
+    c = add_packet_entities(fb->client, from, to, key);
+    c->offset = sv_pe_size;
+    c->length = length;
+    memcpy(sv_pe_data + sv_pe_size, msg_write.data + start, length);
+    sv_pe_size += length;
+}
+
+static void write_frame_default(frame_build_t *fb)
+{
+    client_t        *client = fb->client;
     client_frame_t  *frame, *oldframe;
     player_packed_t *oldstate;
     int             lastframe;
@@ -185,7 +455,7 @@ void SV_WriteFrameToClient_Default(client_t *client)
     frame = &client->frames[client->framenum & UPDATE_MASK];
 
     // this is the frame we are delta'ing from
-    oldframe = get_last_frame(client);
+    oldframe = fb->oldframe;
     if (oldframe) {
         oldstate = &oldframe->ps;
         lastframe = client->lastframe;
@@ -211,16 +481,28 @@ void SV_WriteFrameToClient_Default(client_t *client)
 
     // delta encode the entities
     MSG_WriteByte(svc_packetentities);
-    SV_EmitPacketEntities(client, oldframe, frame, 0);
+    emit_packet_entities(fb, oldframe, frame, 0);
 }
 
 /*
 ==================
-SV_WriteFrameToClient_Enhanced
+SV_WriteFrameToClient_Default
 ==================
 */
-void SV_WriteFrameToClient_Enhanced(client_t *client)
+void SV_WriteFrameToClient_Default(client_t *client)
+{
+    frame_build_t fb = { .client = client };
+
+    fb.oldframe = get_last_frame(client);
+    write_frame_default(&fb);
+
+    if (fb.toolarge)
+        Com_WPrintf("%s: frame got too large, aborting.\n", __func__);
+}
+
+static void write_frame_enhanced(frame_build_t *fb)
 {
+    client_t        *client = fb->client;
     client_frame_t  *frame, *oldframe;
     player_packed_t *oldstate;
     uint32_t        extraflags, delta;
@@ -233,7 +515,7 @@ void SV_WriteFrameToClient_Enhanced(client_t *client)
     frame = &client->frames[client->framenum & UPDATE_MASK];
 
     // this is the frame we are delta'ing from
-    oldframe = get_last_frame(client);
+    oldframe = fb->oldframe;
     if (oldframe) {
         oldstate = &oldframe->ps;
         delta = client->framenum - client->lastframe;
@@ -276,11 +558,8 @@ void SV_WriteFrameToClient_Enhanced(client_t *client)
         }
     }
 
-    clientEntityNum = 0;
+    clientEntityNum = frame_client_entity(client, frame);
     if (client->protocol == PROTOCOL_VERSION_Q2PRO) {
-        if (frame->ps.pmove.pm_type < PM_DEAD && !client->settings[CLS_RECORDING]) {
-            clientEntityNum = frame->clientNum + 1;
-        }
         if (client->settings[CLS_NOPREDICT]) {
             psFlags |= MSG_PS_IGNORE_PREDICTION;
         }
@@ -318,7 +597,23 @@ void SV_WriteFrameToClient_Enhanced(client_t *client)
     client->frameflags = 0;
 
     // delta encode the entities
-    SV_EmitPacketEntities(client, oldframe, frame, clientEntityNum);
+    emit_packet_entities(fb, oldframe, frame, clientEntityNum);
+}
+
+/*
+==================
+SV_WriteFrameToClient_Enhanced
+==================
+*/
+void SV_WriteFrameToClient_Enhanced(client_t *client)
+{
+    frame_build_t fb = { .client = client };
+
+    fb.oldframe = get_last_frame(client);
+    write_frame_enhanced(&fb);
+
+    if (fb.toolarge)
+        Com_WPrintf("%s: frame got too large, aborting.\n", __func__);
 }
 
 /*
@@ -399,55 +694,278 @@ static bool SV_EntityAttenuatedAway(vec3_t org, edict_t *ent)
     return (dist - SOUND_FULLVOLUME) * dist_mult > 1.0f;
 }
 
+/*
+=============================================================================
+
+Cluster to entity visibility index
+
+Built once per frame for each game (there can be several MVD channels), maps
+each cluster to the list of entities linked into it. A client's candidate
+entities are then found by walking the clusters set in its PVS and PHS instead
+of testing every edict. Entities that can't be indexed (linked by headnode,
+SVF_NOCULL, bad cluster numbers) are always tested the usual way, so the
+resulting frame is identical to the full scan.
+
+=============================================================================
+*/
+
+#define MAX_ENTITY_INDEXES  4
+
+typedef struct entity_index_s {
+    const game_export_t *ge;
+    const cm_t  *cm;
+    unsigned    generation;
+    int         numclusters;
+    int         num_edicts;
+    int         *firstent;      // [numclusters + 1]
+    uint16_t    *ents;          // entity numbers sorted by cluster
+    int         max_clusters;
+    int         max_ents;
+    byte        always[MAX_EDICTS / 8];
+} entity_index_t;
+
+static entity_index_t   sv_entity_indexes[MAX_ENTITY_INDEXES];
+static unsigned         sv_index_generation = 1;
+
+/*
+=============
+SV_ClearEntityIndex
+
+Called when entities may have been relinked. Shared packet entities are
+dropped too, as they depend on entity solidity.
+=============
+*/
+void SV_ClearEntityIndex(void)
+{
+    sv_index_generation++;
+    clear_packet_entities();
+}
+
+// filters that don't depend on the client, entities failing these are never
+// sent and needn't be indexed
+static inline bool entity_ignored(const edict_t *ent)
+{
+    if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE))
+        return true;
+    if (ent->svflags & SVF_NOCLIENT)
+        return true;
+    return !HAS_EFFECTS(ent);
+}
+
+static void build_entity_index(entity_index_t *ix, const game_export_t *ge, const cm_t *cm)
+{
+    int numclusters = cm->cache->vis->numclusters;
+    int i, c, e, total;
+    edict_t *ent;
+
+    if (numclusters + 1 > ix->max_clusters) {
+        Z_Free(ix->firstent);
+        ix->firstent = SV_Malloc(sizeof(ix->firstent[0]) * (numclusters + 1));
+        ix->max_clusters = numclusters + 1;
+    }
+
+    // count links into each cluster
+    memset(ix->firstent, 0, sizeof(ix->firstent[0]) * (numclusters + 1));
+    memset(ix->always, 0, sizeof(ix->always));
+    total = 0;
+
+    for (e = 1; e < ge->num_edicts; e++) {
+        ent = EDICT_NUM2(ge, e);
+        if (entity_ignored(ent))
+            continue;
+
+        if (ent->num_clusters == -1 || ent->svflags & SVF_NOCULL) {
+            Q_SetBit(ix->always, e);
+            continue;
+        }
+
+        for (i = 0; i < ent->num_clusters; i++) {
+            c = ent->clusternums[i];
+            if (c < 0 || c >= numclusters) {
+                Q_SetBit(ix->always, e);
+                break;
+            }
+        }
+        if (i < ent->num_clusters)
+            continue;
+
+        for (i = 0; i < ent->num_clusters; i++)
+            ix->firstent[ent->clusternums[i] + 1]++;
+        total += ent->num_clusters;
+    }
+
+    if (total > ix->max_ents) {
+        Z_Free(ix->ents);
+        ix->ents = SV_Malloc(sizeof(ix->ents[0]) * total);
+        ix->max_ents = total;
+    }
+
+    for (c = 0; c < numclusters; c++)
+        ix->firstent[c + 1] += ix->firstent[c];
+
+    // fill in entity numbers, firstent[c] is advanced to the end of cluster c
+    for (e = 1; e < ge->num_edicts; e++) {
+        ent = EDICT_NUM2(ge, e);
+        if (entity_ignored(ent) || Q_IsBitSet(ix->always, e))
+            continue;
+
+        for (i = 0; i < ent->num_clusters; i++)
+            ix->ents[ix->firstent[ent->clusternums[i]]++] = e;
+    }
+
+    // shift back so that firstent[c] is the start of cluster c
+    for (c = numclusters; c > 0; c--)
+        ix->firstent[c] = ix->firstent[c - 1];
+    ix->firstent[0] = 0;
+
+    ix->ge = ge;
+    ix->cm = cm;
+    ix->generation = sv_index_generation;
+    ix->numclusters = numclusters;
+    ix->num_edicts = ge->num_edicts;
+}
+
+// returns up to date index for the game, must be called from main thread
+static const entity_index_t *get_entity_index(const client_t *client)
+{
+    entity_index_t *ix, *oldest = NULL;
+    int i;
+
+    if (!client->cm->cache || !client->cm->cache->vis)
+        return NULL;
+
+    for (i = 0, ix = sv_entity_indexes; i < MAX_ENTITY_INDEXES; i++, ix++) {
+        if (ix->ge == client->ge && ix->cm == client->cm) {
+            if (ix->generation != sv_index_generation)
+                build_entity_index(ix, client->ge, client->cm);
+            return ix;
+        }
+        if (!oldest || ix->generation < oldest->generation)
+            oldest = ix;
+    }
+
+    // frames being built may still use all of them
+    if (oldest->generation == sv_index_generation)
+        return NULL;
+
+    build_entity_index(oldest, client->ge, client->cm);
+    return oldest;
+}
+
+// marks entities linked into clusters set in mask
+static void mark_cluster_entities(const entity_index_t *ix, const byte *mask, byte *ents)
+{
+    int i, c, j;
+
+    for (i = 0; i < ix->numclusters; i += 8) {
+        if (!mask[i >> 3])
+            continue;
+        for (c = i; c < i + 8 && c < ix->numclusters; c++) {
+            if (!Q_IsBitSet(mask, c))
+                continue;
+            for (j = ix->firstent[c]; j < ix->firstent[c + 1]; j++)
+                Q_SetBit(ents, ix->ents[j]);
+        }
+    }
+}
+
 /*
 =============
-SV_BuildClientFrame
+find_frame_candidates
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstat and areabits.
+Finds entities that can possibly be visible to the client using the index.
+Entities not marked here would be culled by the full scan.
 =============
 */
-void SV_BuildClientFrame(client_t *client)
+static void find_frame_candidates(frame_build_t *fb)
 {
-    int         e;
-    vec3_t      org;
-    edict_t     *ent;
-    edict_t     *clent;
+    const entity_index_t *ix = fb->index;
+    const game_export_t *ge = fb->client->ge;
+    int i, e, bytes = (ix->num_edicts + 7) >> 3;
+
+    memset(fb->pvs_ents, 0, bytes);
+    memset(fb->phs_ents, 0, bytes);
+
+    mark_cluster_entities(ix, fb->clientpvs, fb->pvs_ents);
+    mark_cluster_entities(ix, fb->clientphs, fb->phs_ents);
+
+    for (i = 0; i < bytes; i++)
+        fb->candidates[i] = fb->pvs_ents[i] | fb->phs_ents[i] | ix->always[i];
+
+    // player's own entity is never culled
+    e = ((byte *)fb->client->edict - (byte *)ge->edicts) / ge->edict_size;
+    if (e > 0 && e < ix->num_edicts && fb->client->edict == EDICT_NUM2(ge, e))
+        Q_SetBit(fb->candidates, e);
+}
+
+// returns next entity number to consider for the frame
+static int next_frame_entity(const frame_build_t *fb, int e)
+{
+    int num_edicts;
+
+    if (!fb->index)
+        return e + 1;
+
+    num_edicts = fb->index->num_edicts;
+    for (e++; e < num_edicts; e++) {
+        if (!fb->candidates[e >> 3]) {
+            e |= 7;
+            continue;
+        }
+        if (Q_IsBitSet(fb->candidates, e))
+            return e;
+    }
+
+    return fb->client->ge->num_edicts;
+}
+
+// same as SV_EntityVisible, but uses the index when possible
+static bool frame_entity_visible(const frame_build_t *fb, edict_t *ent, int e, bool phs)
+{
+    if (fb->index && !Q_IsBitSet(fb->index->always, e))
+        return Q_IsBitSet(phs ? fb->phs_ents : fb->pvs_ents, e);
+
+    return SV_EntityVisible(fb->client, ent, phs ? fb->clientphs : fb->clientpvs);
+}
+
+/*
+=============
+begin_client_frame
+
+Sets up the frame and finds the client's PVS and PHS.
+=============
+*/
+static bool begin_client_frame(frame_build_t *fb)
+{
+    client_t        *client = fb->client;
+    edict_t         *clent;
     client_frame_t  *frame;
-    entity_packed_t *state;
     player_state_t  *ps;
-	entity_state_t  es;
-    int         clientarea, clientcluster;
-    mleaf_t     *leaf;
-    byte        clientphs[VIS_MAX_BYTES];
-    byte        clientpvs[VIS_MAX_BYTES];
-    bool    ent_visible;
-    int cull_nonvisible_entities = Cvar_Get("sv_cull_nonvisible_entities", "1", CVAR_CHEAT)->integer;
-    bool        need_clientnum_fix;
-    int         max_packet_entities;
+    mleaf_t         *leaf;
 
     clent = client->edict;
     if (!clent->client)
-        return;        // not in game yet
+        return false;   // not in game yet
 
     // this is the frame we are creating
     frame = &client->frames[client->framenum & UPDATE_MASK];
     frame->number = client->framenum;
     frame->sentTime = com_eventTime; // save it for ping calc later
     frame->latency = -1; // not yet acked
+    frame->hash = 0;
 
     client->frames_sent++;
 
     // find the client's PVS
     ps = &clent->client->ps;
-    VectorMA(ps->viewoffset, 0.125f, ps->pmove.origin, org);
+    VectorMA(ps->viewoffset, 0.125f, ps->pmove.origin, fb->org);
 
-    leaf = CM_PointLeaf(client->cm, org);
-    clientarea = leaf->area;
-    clientcluster = leaf->cluster;
+    leaf = CM_PointLeaf(client->cm, fb->org);
+    fb->clientarea = leaf->area;
+    fb->clientcluster = leaf->cluster;
 
     // calculate the visible areas
-    frame->areabytes = CM_WriteAreaBits(client->cm, frame->areabits, clientarea);
+    frame->areabytes = CM_WriteAreaBits(client->cm, frame->areabits, fb->clientarea);
     if (!frame->areabytes && client->protocol != PROTOCOL_VERSION_Q2PRO) {
         frame->areabits[0] = 255;
         frame->areabytes = 1;
@@ -461,7 +979,7 @@ void SV_BuildClientFrame(client_t *client)
         frame->clientNum = clent->client->clientNum;
         if (!VALIDATE_CLIENTNUM(client->csr, frame->clientNum)) {
             Com_WPrintf("%s: bad clientNum %d for client %d\n",
-                        __func__, frame->clientNum, client->number);
+                        "SV_BuildClientFrame", frame->clientNum, client->number);
             frame->clientNum = client->number;
         }
     } else {
@@ -469,31 +987,64 @@ void SV_BuildClientFrame(client_t *client)
     }
 
     // fix clientNum if out of range for older version of Q2PRO protocol
-    need_clientnum_fix = client->protocol == PROTOCOL_VERSION_Q2PRO
+    fb->need_clientnum_fix = client->protocol == PROTOCOL_VERSION_Q2PRO
         && client->version < PROTOCOL_VERSION_Q2PRO_CLIENTNUM_SHORT
         && frame->clientNum >= CLIENTNUM_NONE;
 
     // limit maximum number of entities in client frame
-    max_packet_entities =
+    fb->max_packet_entities =
         sv_max_packet_entities->integer > 0 ? sv_max_packet_entities->integer :
         client->csr->extended ? MAX_PACKET_ENTITIES : MAX_PACKET_ENTITIES_OLD;
 
-	if (clientcluster >= 0)
+    fb->cull_nonvisible = Cvar_Get("sv_cull_nonvisible_entities", "1", CVAR_CHEAT)->integer;
+
+	if (fb->clientcluster >= 0)
 	{
-		CM_FatPVS(client->cm, clientpvs, org, DVIS_PVS2);
-		client->last_valid_cluster = clientcluster;
+		CM_FatPVS(client->cm, fb->clientpvs, fb->org, DVIS_PVS2);
+		client->last_valid_cluster = fb->clientcluster;
 	}
 	else
 	{
-		BSP_ClusterVis(client->cm->cache, clientpvs, client->last_valid_cluster, DVIS_PVS2);
+		BSP_ClusterVis(client->cm->cache, fb->clientpvs, client->last_valid_cluster, DVIS_PVS2);
 	}
-    BSP_ClusterVis(client->cm->cache, clientphs, clientcluster, DVIS_PHS);
+    BSP_ClusterVis(client->cm->cache, fb->clientphs, fb->clientcluster, DVIS_PHS);
+
+    // index is only useful when every entity is culled by PVS/PHS
+    fb->index = NULL;
+    if (sv_entity_index->integer && fb->cull_nonvisible && !sv_novis->integer)
+        fb->index = get_entity_index(client);
 
-    // build up the list of visible entities
     frame->num_entities = 0;
-    frame->first_entity = svs.next_entity;
+    return true;
+}
 
-    for (e = 1; e < client->ge->num_edicts; e++) {
+/*
+=============
+add_frame_entities
+
+Decides which entities are going to be visible to the client. Doesn't touch
+any shared state when building into private entity states, so this can run
+on a worker thread.
+=============
+*/
+static void add_frame_entities(frame_build_t *fb)
+{
+    client_t        *client = fb->client;
+    int             e;
+    edict_t         *ent;
+    edict_t         *clent;
+    client_frame_t  *frame;
+    entity_packed_t *state;
+	entity_state_t  es;
+    bool    ent_visible;
+
+    clent = client->edict;
+    frame = &client->frames[client->framenum & UPDATE_MASK];
+
+    if (fb->index)
+        find_frame_candidates(fb);
+
+    for (e = next_frame_entity(fb, 0); e < client->ge->num_edicts; e = next_frame_entity(fb, e)) {
         ent = EDICT_NUM2(client->ge, e);
 
         // ignore entities not in use
@@ -519,10 +1070,10 @@ void SV_BuildClientFrame(client_t *client)
         // ignore if not touching a PV leaf
         if (ent != clent && !(client->csr->extended && ent->svflags & SVF_NOCULL)) {
             // check area
-			if (clientcluster >= 0 && !CM_AreasConnected(client->cm, clientarea, ent->areanum)) {
+			if (fb->clientcluster >= 0 && !CM_AreasConnected(client->cm, fb->clientarea, ent->areanum)) {
                 // doors can legally straddle two areas, so
                 // we may need to check another one
-                if (!CM_AreasConnected(client->cm, clientarea, ent->areanum2)) {
+                if (!CM_AreasConnected(client->cm, fb->clientarea, ent->areanum2)) {
                     ent_visible = false;        // blocked by a door
                 }
             }
@@ -532,21 +1083,21 @@ void SV_BuildClientFrame(client_t *client)
             bool beam_cull = ent->s.renderfx & RF_BEAM;
             bool sound_cull = client->csr->extended && ent->s.sound;
 
-            if (beam_cull || cull_nonvisible_entities) {
-                if (!SV_EntityVisible(client, ent, (beam_cull || sound_cull) ? clientphs : clientpvs))
+            if (beam_cull || fb->cull_nonvisible) {
+                if (!frame_entity_visible(fb, ent, e, beam_cull || sound_cull))
                     ent_visible = false;       // not visible
             }
 
             // don't send sounds if they will be attenuated away
             if (sound_cull) {
-                if (SV_EntityAttenuatedAway(org, ent)) {
+                if (SV_EntityAttenuatedAway(fb->org, ent)) {
                     if (!ent->s.modelindex)
                         ent_visible = false;
-                    if (ent_visible && !beam_cull && !SV_EntityVisible(client, ent, clientpvs))
+                    if (ent_visible && !beam_cull && !frame_entity_visible(fb, ent, e, false))
                         ent_visible = false;
                 }
             } else if (!ent->s.modelindex) {
-                if (Distance(org, ent->s.origin) > 400)
+                if (Distance(fb->org, ent->s.origin) > 400)
                     ent_visible = false;
             }
         }
@@ -554,9 +1105,10 @@ void SV_BuildClientFrame(client_t *client)
         if(!ent_visible && (!sv_novis->integer || !ent->s.modelindex))
             continue;
         
+		// entity numbers are fixed up front when building in parallel
 		if (ent->s.number != e) {
 			Com_WPrintf("%s: fixing ent->s.number: %d to %d\n",
-				__func__, ent->s.number, e);
+				"SV_BuildClientFrame", ent->s.number, e);
 			ent->s.number = e;
 		}
 
@@ -567,8 +1119,11 @@ void SV_BuildClientFrame(client_t *client)
 			es.sound = 0;
 		}
 
-        // add it to the circular client_entities array
-        state = &svs.entities[svs.next_entity % svs.num_entities];
+        // add it to the private or circular client_entities array
+        if (fb->entities)
+            state = &fb->entities[frame->num_entities];
+        else
+            state = &svs.entities[(frame->first_entity + frame->num_entities) % svs.num_entities];
         MSG_PackEntity(state, &ent->s, ENT_EXTENSION(client->csr, ent));
 
 #if USE_FPS
@@ -587,7 +1142,7 @@ void SV_BuildClientFrame(client_t *client)
 
         // hide POV entity from renderer, unless this is player's own entity
         if (e == frame->clientNum + 1 && ent != clent &&
-            (!Q2PRO_OPTIMIZE(client) || need_clientnum_fix)) {
+            (!Q2PRO_OPTIMIZE(client) || fb->need_clientnum_fix)) {
             state->modelindex = 0;
         }
 
@@ -605,14 +1160,607 @@ void SV_BuildClientFrame(client_t *client)
             state->solid = sv.entities[e].solid32;
         }
 
-        svs.next_entity++;
-
-        if (++frame->num_entities == max_packet_entities) {
+        if (++frame->num_entities == fb->max_packet_entities) {
             break;
         }
     }
 
-    if (need_clientnum_fix)
+    if (fb->need_clientnum_fix)
         frame->clientNum = client->slot;
 }
 
+/*
+=============
+SV_BuildClientFrame
+
+Decides which entities are going to be visible to the client, and
+copies off the playerstat and areabits.
+=============
+*/
+void SV_BuildClientFrame(client_t *client)
+{
+    byte            clientphs[VIS_MAX_BYTES];
+    byte            clientpvs[VIS_MAX_BYTES];
+    byte            ents[3][MAX_EDICTS / 8];
+    client_frame_t  *frame;
+    frame_build_t   fb = {
+        .client = client,
+        .clientpvs = clientpvs,
+        .clientphs = clientphs,
+        .pvs_ents = ents[0],
+        .phs_ents = ents[1],
+        .candidates = ents[2],
+    };
+
+    if (!begin_client_frame(&fb))
+        return;
+
+    // build up the list of visible entities
+    frame = &client->frames[client->framenum & UPDATE_MASK];
+    frame->first_entity = svs.next_entity;
+
+    add_frame_entities(&fb);
+
+    svs.next_entity += frame->num_entities;
+}
+
+/*
+=============================================================================
+
+Build and encode client frames on worker threads
+
+Entity selection and delta encoding are independent for each client, except
+for the shared svs.entities ring. Each client gets private entity states and
+a private message buffer. Ring positions are assigned in client order after
+selection, and private states are copied into the ring after encoding, so
+the output is identical to building the frames serially.
+
+=============================================================================
+*/
+
+// PVS, PHS and entity index bitmasks
+#define BUILD_VIS_BYTES     (VIS_MAX_BYTES * 2 + MAX_EDICTS / 8 * 3)
+
+static frame_build_t    *sv_builds;
+static int              sv_max_builds;
+static entity_packed_t  *sv_build_entities;
+static int              sv_build_max_entities;
+static byte             *sv_build_vis;
+static byte             *sv_build_data;
+
+#if USE_ZLIB
+static z_stream         *sv_build_z;        // one per worker
+static int              sv_build_num_z;
+static int              sv_build_z_level;
+static byte             *sv_build_zdata;
+static frame_build_t    **sv_build_zlist;   // frames to be compressed
+static int              sv_build_zcount;
+static int              sv_build_zjobs;
+#endif
+
+static void alloc_frame_builds(int count, int max_entities)
+{
+    if (count > sv_max_builds) {
+        Z_Free(sv_builds);
+        Z_Free(sv_build_vis);
+        Z_Free(sv_build_data);
+        sv_builds = SV_Malloc(sizeof(sv_builds[0]) * count);
+        sv_build_vis = SV_Malloc(BUILD_VIS_BYTES * count);
+        sv_build_data = SV_Malloc(MAX_MSGLEN * count);
+#if USE_ZLIB
+        Z_Free(sv_build_zdata);
+        Z_Free(sv_build_zlist);
+        sv_build_zdata = SV_Malloc(MAX_PACKETLEN * count);
+        sv_build_zlist = SV_Malloc(sizeof(sv_build_zlist[0]) * count);
+#endif
+        sv_max_builds = count;
+        sv_build_max_entities = 0;
+    }
+
+    if (max_entities > sv_build_max_entities) {
+        Z_Free(sv_build_entities);
+        sv_build_entities = SV_Malloc(sizeof(sv_build_entities[0]) * max_entities * sv_max_builds);
+        sv_build_max_entities = max_entities;
+    }
+}
+
+void SV_FreeFrameBuilds(void)
+{
+    Z_Freep((void **)&sv_builds);
+    Z_Freep((void **)&sv_build_entities);
+    Z_Freep((void **)&sv_build_vis);
+    Z_Freep((void **)&sv_build_data);
+    sv_max_builds = sv_build_max_entities = 0;
+
+    Z_Freep((void **)&sv_pe_data);
+    clear_packet_entities();
+
+#if USE_ZLIB
+    for (int i = 0; i < sv_build_num_z; i++)
+        deflateEnd(&sv_build_z[i]);
+    Z_Freep((void **)&sv_build_z);
+    Z_Freep((void **)&sv_build_zdata);
+    Z_Freep((void **)&sv_build_zlist);
+    sv_build_num_z = 0;
+#endif
+
+    for (int i = 0; i < MAX_ENTITY_INDEXES; i++) {
+        entity_index_t *ix = &sv_entity_indexes[i];
+        Z_Free(ix->firstent);
+        Z_Free(ix->ents);
+        memset(ix, 0, sizeof(*ix));
+    }
+}
+
+// entity numbers are fixed here once rather than by each worker
+static void fix_entity_numbers(client_t **clients, int count)
+{
+    const game_export_t *last = NULL;
+    edict_t *ent;
+    int i, e;
+
+    for (i = 0; i < count; i++) {
+        const game_export_t *ge = clients[i]->ge;
+
+        if (ge == last)
+            continue;
+        last = ge;
+
+        for (e = 1; e < ge->num_edicts; e++) {
+            ent = EDICT_NUM2(ge, e);
+            if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE))
+                continue;
+            if (ent->svflags & SVF_NOCLIENT)
+                continue;
+            if (!HAS_EFFECTS(ent))
+                continue;
+            if (ent->s.number != e) {
+                Com_WPrintf("%s: fixing ent->s.number: %d to %d\n",
+                            "SV_BuildClientFrame", ent->s.number, e);
+                ent->s.number = e;
+            }
+        }
+    }
+}
+
+static void copy_frame_entities(const client_frame_t *frame, const entity_packed_t *src)
+{
+    unsigned first = frame->first_entity % svs.num_entities;
+    unsigned count = min(frame->num_entities, svs.num_entities - first);
+
+    memcpy(svs.entities + first, src, sizeof(*src) * count);
+    memcpy(svs.entities, src + count, sizeof(*src) * (frame->num_entities - count));
+}
+
+static void build_frame_job(void *arg, int index)
+{
+    frame_build_t *fb = (frame_build_t *)arg + index;
+    client_frame_t *frame;
+
+    if (!fb->client)
+        return;
+
+    if (fb->profile)
+        fb->build_start = Sys_Microseconds();
+
+    add_frame_entities(fb);
+
+    // states may only get modified by encoding with MSG_ES_FIRSTPERSON
+    frame = &fb->client->frames[fb->client->framenum & UPDATE_MASK];
+    if (sv_share_entities->integer && !frame_client_entity(fb->client, frame))
+        frame->hash = hash_frame(frame, fb->entities);
+
+    if (fb->profile)
+        fb->build_end = Sys_Microseconds();
+}
+
+static void encode_frame_job(void *arg, int index)
+{
+    frame_build_t *fb = (frame_build_t *)arg + index;
+    sizebuf_t saved;
+
+    if (!fb->client)
+        return;
+
+    if (fb->profile)
+        fb->encode_start = Sys_Microseconds();
+
+    // main thread takes part in the work too, don't leave its buffer
+    // pointing to private frame message
+    saved = msg_write;
+    SZ_Init(&msg_write, fb->data, MAX_MSGLEN);
+
+    // Com_Error can't be thrown from workers, let overflow just set the
+    // flag and fail the job
+    msg_write.allowoverflow = true;
+
+    if (fb->client->protocol == PROTOCOL_VERSION_DEFAULT)
+        write_frame_default(fb);
+    else
+        write_frame_enhanced(fb);
+
+    fb->cursize = msg_write.cursize;
+    fb->overflowed = msg_write.overflowed;
+    msg_write = saved;
+
+    if (fb->profile)
+        fb->encode_end = Sys_Microseconds();
+}
+
+// frames with the same view as an earlier one get packet entities encoded
+// only once, and copied by copy_shared_entities()
+static void share_packet_entities(int count)
+{
+    frame_build_t   *fb;
+    client_frame_t  *frame;
+    pe_cache_t      *c;
+    uint64_t        key;
+    int             i;
+
+    clear_packet_entities();
+
+    for (i = 0; i < count; i++) {
+        fb = &sv_builds[i];
+        if (!fb->client)
+            continue;
+
+        frame = &fb->client->frames[fb->client->framenum & UPDATE_MASK];
+        if (frame->hash) {
+            key = packet_entities_key(fb->client, fb->oldframe, frame);
+            c = find_packet_entities(fb->client, fb->oldframe, frame,
+                                     fb->entities, key, true);
+            if (c) {
+                fb->leader = c->fb;
+                svs.pe_shared++;
+                continue;
+            }
+            c = add_packet_entities(fb->client, fb->oldframe, frame, key);
+            c->entities = fb->entities;
+            c->fb = fb;
+        }
+
+        svs.pe_encoded++;
+    }
+}
+
+static void copy_shared_entities(frame_build_t *fb)
+{
+    const frame_build_t *leader = fb->leader;
+    size_t length = leader->cursize - leader->pe_start;
+    client_frame_t *frame;
+    sizebuf_t saved;
+
+    if (!leader->toolarge && fb->pe_start + length + MAX_PACKETENTITY_BYTES <= MAX_MSGLEN) {
+        memcpy(fb->data + fb->pe_start, leader->data + leader->pe_start, length);
+        fb->cursize = fb->pe_start + length;
+        return;
+    }
+
+    // wouldn't be identical, encode on main thread
+    frame = &fb->client->frames[fb->client->framenum & UPDATE_MASK];
+    saved = msg_write;
+    SZ_Init(&msg_write, fb->data, MAX_MSGLEN);
+    msg_write.cursize = fb->pe_start;
+    SV_EmitPacketEntities(fb, fb->oldframe, frame, 0);
+    fb->cursize = msg_write.cursize;
+    fb->overflowed = msg_write.overflowed;
+    msg_write = saved;
+
+    svs.pe_shared--;
+    svs.pe_encoded++;
+}
+
+#if USE_ZLIB
+
+// deflate streams can't be allocated by workers, so one for each worker is
+// allocated on the main thread in advance. streams can't be moved in memory.
+static void alloc_deflate_streams(void)
+{
+    int i;
+
+    if (!sv_build_num_z) {
+        sv_build_num_z = Com_AsyncWorkers() + 1;
+        sv_build_z = SV_Malloc(sizeof(sv_build_z[0]) * sv_build_num_z);
+        for (i = 0; i < sv_build_num_z; i++)
+            SV_InitDeflate(&sv_build_z[i]);
+        sv_build_z_level = sv_compress_level->integer;
+    }
+
+    if (sv_build_z_level != sv_compress_level->integer) {
+        for (i = 0; i < sv_build_num_z; i++)
+            deflateParams(&sv_build_z[i], sv_compress_level->integer, Z_DEFAULT_STRATEGY);
+        sv_build_z_level = sv_compress_level->integer;
+    }
+}
+
+static void compress_frames_job(void *arg, int index)
+{
+    frame_build_t *fb;
+    int i;
+
+    for (i = index; i < sv_build_zcount; i += sv_build_zjobs) {
+        fb = sv_build_zlist[i];
+        fb->zlen = SV_CompressMessage(&sv_build_z[index], fb->zdata,
+                                      MAX_PACKETLEN, fb->data, fb->cursize);
+        if (!fb->zlen)
+            fb->zlen = -1;
+    }
+}
+
+// compress frames that don't fit into datagram on workers, with the same
+// rules as write_datagram_old(), which falls back to compressing on main
+// thread if reliable messages got added in the meantime
+static void compress_frames(int count)
+{
+    frame_build_t *fb;
+    int i;
+
+    sv_build_zcount = 0;
+    for (i = 0; i < count; i++) {
+        fb = &sv_builds[i];
+        if (!fb->client || !fb->zlimit || fb->cursize <= fb->zlimit)
+            continue;
+        if (fb->cursize - fb->cursize / 5 >= fb->zlimit)
+            continue;
+        sv_build_zlist[sv_build_zcount++] = fb;
+    }
+
+    if (!sv_build_zcount)
+        return;
+
+    alloc_deflate_streams();
+    sv_build_zjobs = min(sv_build_zcount, sv_build_num_z);
+
+    Com_ParallelFor(sv_build_zjobs, compress_frames_job, NULL);
+
+    svs.z_frames += sv_build_zcount;
+}
+
+#endif // USE_ZLIB
+
+/*
+=============
+SV_BuildClientFrames
+
+Builds and encodes frames for the given spawned clients on worker threads.
+Encoded frames are then written by SV_WriteBuiltFrame, in the same order.
+=============
+*/
+void SV_BuildClientFrames(client_t **clients, int count)
+{
+    frame_build_t   *fb;
+    client_frame_t  *frame;
+    int             i, max_entities;
+
+    max_entities = 0;
+    for (i = 0; i < count; i++)
+        max_entities = max(max_entities, clients[i]->ge->num_edicts);
+
+    alloc_frame_builds(count, max_entities);
+
+    fix_entity_numbers(clients, count);
+
+    for (i = 0; i < count; i++) {
+        fb = &sv_builds[i];
+        memset(fb, 0, sizeof(*fb));
+        fb->client = clients[i];
+        fb->entities = sv_build_entities + sv_build_max_entities * i;
+        fb->clientpvs = sv_build_vis + BUILD_VIS_BYTES * i;
+        fb->clientphs = fb->clientpvs + VIS_MAX_BYTES;
+        fb->pvs_ents = fb->clientphs + VIS_MAX_BYTES;
+        fb->phs_ents = fb->pvs_ents + MAX_EDICTS / 8;
+        fb->candidates = fb->phs_ents + MAX_EDICTS / 8;
+        fb->data = sv_build_data + MAX_MSGLEN * i;
+#if USE_ZLIB
+        fb->zlimit = SV_FrameCompressLimit(clients[i]);
+        fb->zdata = sv_build_zdata + MAX_PACKETLEN * i;
+#endif
+        fb->profile = sv_profiling;
+        if (!begin_client_frame(fb))
+            fb->client = NULL;
+    }
+
+    Com_ParallelFor(count, build_frame_job, sv_builds);
+
+    // assign ring positions and find delta frames in client order
+    for (i = 0; i < count; i++) {
+        fb = &sv_builds[i];
+        if (!fb->client)
+            continue;
+        frame = &fb->client->frames[fb->client->framenum & UPDATE_MASK];
+        frame->first_entity = svs.next_entity;
+        svs.next_entity += frame->num_entities;
+        fb->oldframe = get_last_frame(fb->client);
+    }
+
+    share_packet_entities(count);
+
+    Com_ParallelFor(count, encode_frame_job, sv_builds);
+
+    for (i = 0; i < count; i++) {
+        fb = &sv_builds[i];
+        if (fb->client && fb->leader)
+            copy_shared_entities(fb);
+    }
+
+#if USE_ZLIB
+    compress_frames(count);
+#endif
+
+    // old frames are no longer needed, copy private states into the ring
+    for (i = 0; i < count; i++) {
+        fb = &sv_builds[i];
+        clients[i]->frame_build = fb;
+        if (!fb->client)
+            continue;
+        frame = &fb->client->frames[fb->client->framenum & UPDATE_MASK];
+        copy_frame_entities(frame, fb->entities);
+
+        if (fb->profile) {
+            SV_ProfileSample(PROF_BUILD, fb->client->number, fb->build_start, fb->build_end);
+            SV_ProfileSample(PROF_ENCODE, fb->client->number, fb->encode_start, fb->encode_end);
+        }
+    }
+}
+
+/*
+=============
+SV_BuiltFrameOverflowed
+
+Returns true if frame built by SV_BuildClientFrames overflowed its buffer.
+The frame is discarded then and the client should be dropped.
+=============
+*/
+bool SV_BuiltFrameOverflowed(client_t *client)
+{
+    frame_build_t *fb = client->frame_build;
+
+    if (!fb || !fb->overflowed)
+        return false;
+
+    client->frame_build = NULL;
+    return true;
+}
+
+/*
+=============
+SV_WriteBuiltFrame
+
+Writes frame built by SV_BuildClientFrames to the message. If the frame was
+also compressed by a worker, returns compressed length and data.
+=============
+*/
+int SV_WriteBuiltFrame(client_t *client, const byte **zdata)
+{
+    frame_build_t *fb = client->frame_build;
+
+    client->frame_build = NULL;
+
+    // client not in game yet
+    if (!fb->client) {
+        client->WriteFrame(client);
+        return 0;
+    }
+
+    if (fb->toolarge)
+        Com_WPrintf("%s: frame got too large, aborting.\n", "SV_EmitPacketEntities");
+
+    MSG_WriteData(fb->data, fb->cursize);
+
+#if USE_ZLIB
+    if (fb->zlen) {
+        *zdata = fb->zdata;
+        return max(fb->zlen, 0);
+    }
+#endif
+
+    return 0;
+}
+
+/*
+=============================================================================
+
+Entity index benchmark
+
+=============================================================================
+*/
+
+static int bench_frame(client_t *client, entity_packed_t *entities, bool use_index)
+{
+    byte            clientphs[VIS_MAX_BYTES];
+    byte            clientpvs[VIS_MAX_BYTES];
+    byte            ents[3][MAX_EDICTS / 8];
+    frame_build_t   fb = {
+        .client = client,
+        .entities = entities,
+        .clientpvs = clientpvs,
+        .clientphs = clientphs,
+        .pvs_ents = ents[0],
+        .phs_ents = ents[1],
+        .candidates = ents[2],
+    };
+
+    if (!begin_client_frame(&fb))
+        return 0;
+
+    // override sv_entity_index
+    fb.index = NULL;
+    if (use_index && fb.cull_nonvisible && !sv_novis->integer)
+        fb.index = get_entity_index(client);
+
+    add_frame_entities(&fb);
+    return client->frames[client->framenum & UPDATE_MASK].num_entities;
+}
+
+static void bench_view(client_t *client, gclient_t *gclient, player_state_t *ps, int number)
+{
+    memset(gclient, 0, sizeof(*gclient));
+    memset(client->edict, 0, sizeof(*client->edict));
+    gclient->ps = *ps;
+    gclient->clientNum = number;
+    client->edict->client = gclient;
+    client->edict->inuse = true;
+    client->number = client->slot = number;
+}
+
+/*
+=============
+SV_BenchEntityIndex
+
+Builds frames from each of the given views, both by scanning all entities and
+by using the cluster index, and checks that the results are identical.
+=============
+*/
+void SV_BenchEntityIndex(sv_visbench_t *bench, const game_export_t *ge, cm_t *cm,
+                         const cs_remap_t *csr, player_state_t **views, int numviews, int repeat)
+{
+    client_t        *client;
+    entity_packed_t *ents[2];
+    gclient_t       gclient;
+    edict_t         edict;
+    int             i, j, pass, count[2];
+    unsigned        start, time[2];
+
+    client = SV_Mallocz(sizeof(*client));
+    ents[0] = SV_Malloc(sizeof(ents[0][0]) * MAX_EDICTS);
+    ents[1] = SV_Malloc(sizeof(ents[1][0]) * MAX_EDICTS);
+
+    client->protocol = PROTOCOL_VERSION_Q2PRO;
+    client->version = PROTOCOL_VERSION_Q2PRO_CURRENT;
+    client->csr = csr;
+    client->ge = ge;
+    client->cm = cm;
+    client->edict = &edict;
+
+    // time both paths, index is rebuilt once per frame like in game
+    for (pass = 0; pass < 2; pass++) {
+        start = Sys_Milliseconds();
+        for (j = 0; j < repeat; j++) {
+            SV_ClearEntityIndex();
+            for (i = 0; i < numviews; i++) {
+                bench_view(client, &gclient, views[i], i);
+                bench_frame(client, ents[pass], pass);
+            }
+        }
+        time[pass] = Sys_Milliseconds() - start;
+    }
+
+    // compare results
+    for (i = 0; i < numviews; i++) {
+        bench_view(client, &gclient, views[i], i);
+        for (pass = 0; pass < 2; pass++)
+            count[pass] = bench_frame(client, ents[pass], pass);
+
+        bench->views++;
+        bench->entities += count[0];
+        if (count[0] != count[1] || memcmp(ents[0], ents[1], sizeof(ents[0][0]) * count[0]))
+            bench->mismatches++;
+    }
+
+    bench->scan_msec += time[0];
+    bench->index_msec += time[1];
+
+    Z_Free(ents[0]);
+    Z_Free(ents[1]);
+    Z_Free(client);
+}
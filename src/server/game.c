@@ -836,6 +836,8 @@ static const game_import_ex_t game_import_ex = {
 
     .ErrorString = Q_ErrorString,
     .TagRealloc = PF_TagRealloc,
+
+    .TraceBatch = SV_TraceBatch,
 };
 
 static void *game_library;
@@ -419,12 +419,10 @@ void SV_InitGame(unsigned mvd_spawn)
     Cvar_ClampInteger(sv_reserved_slots, 0, sv_maxclients->integer - 1);
 
     svs.client_pool = SV_Mallocz(sizeof(svs.client_pool[0]) * sv_maxclients->integer);
+    SV_InitMessagePool();
 
 #if USE_ZLIB
-    svs.z.zalloc = SV_zalloc;
-    svs.z.zfree = SV_zfree;
-    Q_assert(deflateInit2(&svs.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-             -MAX_WBITS, 9, Z_DEFAULT_STRATEGY) == Z_OK);
+    SV_InitDeflate(&svs.z);
     svs.z_buffer_size = ZPACKET_HEADER + deflateBound(&svs.z, MAX_MSGLEN);
     svs.z_buffer = SV_Malloc(svs.z_buffer_size);
 #endif
@@ -83,6 +83,12 @@ cvar_t  *sv_calcpings_method;
 cvar_t  *sv_changemapcmd;
 cvar_t  *sv_max_download_size;
 cvar_t  *sv_max_packet_entities;
+cvar_t  *sv_parallel_frames;
+#if USE_ZLIB
+cvar_t  *sv_compress_level;
+#endif
+cvar_t  *sv_entity_index;
+cvar_t  *sv_share_entities;
 
 cvar_t  *sv_strafejump_hack;
 cvar_t  *sv_waterjump_hack;
@@ -1778,15 +1784,22 @@ SV_RunGameFrame
 */
 static void SV_RunGameFrame(void)
 {
+    uint64_t start;
+
     // save the entire world state if recording a serverdemo
     SV_MvdBeginFrame();
 
+    // game may have changed entities without relinking them
+    SV_InvalidateTraceCache();
+
 #if USE_CLIENT
     if (host_speeds->integer)
         time_before_game = Sys_Milliseconds();
 #endif
 
+    start = SV_ProfileBegin();
     ge->RunFrame();
+    SV_ProfileEnd(PROF_GAME, start);
 
 #if USE_CLIENT
     if (host_speeds->integer)
@@ -1801,7 +1814,9 @@ static void SV_RunGameFrame(void)
     }
 
     // save the entire world state if recording a serverdemo
+    start = SV_ProfileBegin();
     SV_MvdEndFrame();
+    SV_ProfileEnd(PROF_MVD, start);
 }
 
 /*
@@ -1900,6 +1915,8 @@ Returns amount of extra frametime available for sleeping on IO.
 */
 unsigned SV_Frame(unsigned msec)
 {
+    uint64_t start, tick;
+
 #if USE_CLIENT
     time_before_game = time_after_game = 0;
 #endif
@@ -1918,9 +1935,13 @@ unsigned SV_Frame(unsigned msec)
 #endif
 
     // read packets from UDP clients
+    start = SV_ProfileBegin();
     NET_GetPackets(NS_SERVER, SV_PacketEvent);
+    SV_ProfileEnd(PROF_PACKETS, start);
 
     if (svs.initialized) {
+        start = SV_ProfileBegin();
+
         // run connection to the anticheat server
         AC_Run();
 
@@ -1929,6 +1950,8 @@ unsigned SV_Frame(unsigned msec)
 
         // deliver fragments and reliable messages for connecting clients
         SV_SendAsyncPackets();
+
+        SV_ProfileEnd(PROF_ASYNC, start);
     }
 
     // move autonomous things around if enough time has passed
@@ -1938,6 +1961,8 @@ unsigned SV_Frame(unsigned msec)
     }
 
     if (svs.initialized && !check_paused()) {
+        tick = SV_ProfileBegin();
+
         // check timeouts
         SV_CheckTimeouts();
 
@@ -1951,7 +1976,9 @@ unsigned SV_Frame(unsigned msec)
         SV_RunGameFrame();
 
         // send messages back to the UDP clients
+        start = SV_ProfileBegin();
         SV_SendClientMessages();
+        SV_ProfileEnd(PROF_SEND, start);
 
         // send a heartbeat to the master if needed
         SV_MasterHeartbeat();
@@ -1961,6 +1988,8 @@ unsigned SV_Frame(unsigned msec)
 
         // advance for next frame
         sv.framenum++;
+
+        SV_ProfileEnd(PROF_TICK, tick);
     }
 
     if (COM_DEDICATED) {
@@ -2137,6 +2166,64 @@ void SV_zfree(voidpf opaque, voidpf address)
 {
     Z_Free(address);
 }
+
+// deflate never allocates after init, so streams can be used by workers
+void SV_InitDeflate(z_stream *z)
+{
+    memset(z, 0, sizeof(*z));
+    z->zalloc = SV_zalloc;
+    z->zfree = SV_zfree;
+    Q_assert(deflateInit2(z, sv_compress_level->integer, Z_DEFLATED,
+             -MAX_WBITS, 9, Z_DEFAULT_STRATEGY) == Z_OK);
+}
+
+/*
+==================
+SV_CompressMessage
+
+Compresses message into svc_zpacket. Returns total length written, or 0 if
+compressed message didn't fit. Safe to call from worker threads.
+==================
+*/
+int SV_CompressMessage(z_stream *z, byte *out, size_t size, const byte *in, size_t len)
+{
+    int ret;
+
+    if (size <= ZPACKET_HEADER)
+        return 0;
+
+    z->next_in = (byte *)in;
+    z->avail_in = len;
+    z->next_out = out + ZPACKET_HEADER;
+    z->avail_out = size - ZPACKET_HEADER;
+
+    ret = deflate(z, Z_FINISH);
+    size = z->total_out;
+
+    // prepare for next deflate()
+    deflateReset(z);
+
+    if (ret != Z_STREAM_END)
+        return 0;
+
+    // write the packet header
+    out[0] = svc_zpacket;
+    WL16(&out[1], size);
+    WL16(&out[3], len);
+
+    return size + ZPACKET_HEADER;
+}
+
+static void sv_compress_level_changed(cvar_t *self)
+{
+    Cvar_ClampInteger(self, 1, 9);
+
+    // worker streams are updated before next use
+    if (svs.z_buffer) {
+        deflateParams(&svs.z, self->integer, Z_DEFAULT_STRATEGY);
+        SV_ClearCompressCache();
+    }
+}
 #endif
 
 /*
@@ -2159,6 +2246,8 @@ void SV_Init(void)
     AC_Register();
 
     SV_RegisterSavegames();
+    SV_RegisterWorld();
+    SV_RegisterProfile();
 
     Cvar_Get("protocol", STRINGIFY(PROTOCOL_VERSION_DEFAULT), CVAR_SERVERINFO | CVAR_ROM);
 
@@ -2224,6 +2313,14 @@ void SV_Init(void)
     sv_changemapcmd = Cvar_Get("sv_changemapcmd", "", 0);
     sv_max_download_size = Cvar_Get("sv_max_download_size", "8388608", 0);
     sv_max_packet_entities = Cvar_Get("sv_max_packet_entities", "0", 0);
+    sv_parallel_frames = Cvar_Get("sv_parallel_frames", "0", 0);
+#if USE_ZLIB
+    sv_compress_level = Cvar_Get("sv_compress_level", "6", 0);
+    sv_compress_level->changed = sv_compress_level_changed;
+    sv_compress_level_changed(sv_compress_level);
+#endif
+    sv_entity_index = Cvar_Get("sv_entity_index", "1", 0);
+    sv_share_entities = Cvar_Get("sv_share_entities", "1", 0);
 
     sv_strafejump_hack = Cvar_Get("sv_strafejump_hack", "1", CVAR_LATCH);
     sv_waterjump_hack = Cvar_Get("sv_waterjump_hack", "1", CVAR_LATCH);
@@ -2383,8 +2480,12 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
 
     // free server static data
     Z_Free(svs.client_pool);
+    SV_FreeMessagePool();
     Z_Free(svs.entities);
+    SV_FreeFrameBuilds();
+    SV_FreeWorld();
 #if USE_ZLIB
+    SV_ClearCompressCache();
     deflateEnd(&svs.z);
     Z_Free(svs.z_buffer);
 #endif
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "server.h"
 #include "server/mvd/protocol.h"
+#include "common/demoindex.h"
 
 #define FOR_EACH_GTV(client) \
     LIST_FOR_EACH(gtv_client_t, client, &gtv_client_list, entry)
@@ -29,6 +30,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define FOR_EACH_ACTIVE_GTV(client) \
     LIST_FOR_EACH(gtv_client_t, client, &gtv_active_list, active)
 
+// shared stream chunk is sent every this many frames
+#define SHARED_FRAMES   10
+
 typedef struct {
     list_t      entry;
     list_t      active;
@@ -36,6 +40,8 @@ typedef struct {
     netstream_t stream;
 #if USE_ZLIB
     z_stream    z;
+    bool        shared;     // receives chunks of shared stream
+    uLong       adler;      // of uncompressed stream, if shared
 #endif
     unsigned    msglen;
     unsigned    lastmessage;
@@ -77,8 +83,27 @@ typedef struct {
     int             numlevels; // stop after that many levels
     int             numframes; // stop after that many frames
 
+    // demo index of local recording
+    bool            indexing;
+    configstring_t  *baseconfigstrings; // as of first gamestate, NULL when done
+    demosnap_t      **snapshots;
+    int             numsnapshots;
+    int             framenum;           // since first gamestate
+    int             last_snapshot;
+
     // TCP client pool
     gtv_client_t    *clients; // [sv_mvd_maxclients]
+
+#if USE_ZLIB
+    // stream deflated once for all GTV clients
+    z_stream        z;
+    byte            *zbuf;
+    size_t          zsize;      // allocated
+    size_t          zlen;       // compressed bytes in current chunk
+    size_t          zraw;       // uncompressed bytes in current chunk
+    uLong           zadler;     // adler32 of uncompressed bytes in current chunk
+    unsigned        zframes;    // frames in current chunk
+#endif
 } mvd_server_t;
 
 static mvd_server_t     mvd;
@@ -108,6 +133,8 @@ static cvar_t   *sv_mvd_disconnect_time;
 static cvar_t   *sv_mvd_suspend_time;
 static cvar_t   *sv_mvd_allow_stufftext;
 static cvar_t   *sv_mvd_spawn_dummy;
+static cvar_t   *sv_mvd_index;
+static cvar_t   *sv_mvd_shared_stream;
 
 static bool     mvd_enable(void);
 static void     mvd_disable(void);
@@ -115,14 +142,21 @@ static void     mvd_error(const char *reason);
 
 static void     write_stream(gtv_client_t *client, void *data, size_t len);
 static void     write_message(gtv_client_t *client, gtv_serverop_t op);
+static void     drop_client(gtv_client_t *client, const char *error);
 #if USE_ZLIB
 static void     flush_stream(gtv_client_t *client, int flush);
+static bool     shared_active(void);
+static void     write_shared(void *data, size_t len);
+static void     write_shared_message(gtv_serverop_t op);
+static void     flush_shared(void);
 #endif
 
 static void     rec_stop(void);
 static bool     rec_allowed(void);
-static void     rec_start(qhandle_t demofile);
+static void     rec_start(qhandle_t demofile, unsigned mode);
 static void     rec_write(void);
+static void     rec_index_gamestate(void);
+static void     rec_index_frame(void);
 
 
 /*
@@ -182,7 +216,7 @@ static void dummy_record_f(void)
         return;
     }
 
-    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE | FS_FLAG_ASYNC,
                         "demos/", Cmd_Argv(1), ".mvd2");
     if (!f) {
         return;
@@ -195,7 +229,7 @@ static void dummy_record_f(void)
 
     Com_Printf("Auto-recording local MVD to %s\n", buffer);
 
-    rec_start(f);
+    rec_start(f, FS_MODE_WRITE);
 }
 
 static void dummy_stop_f(void)
@@ -589,17 +623,56 @@ static void build_gamestate(void)
     }
 }
 
+// Writes all player and entity states uncompressed.
+static void emit_base_frame(void)
+{
+    player_packed_t *ps;
+    entity_packed_t *es;
+    int         i, j, flags, portalbytes;
+    byte        portalbits[MAX_MAP_PORTAL_BYTES];
+
+    portalbytes = CM_WritePortalBits(&sv.cm, portalbits);
+    MSG_WriteByte(portalbytes);
+    MSG_WriteData(portalbits, portalbytes);
+
+    // send player states
+    for (i = 0, ps = mvd.players; i < sv_maxclients->integer; i++, ps++) {
+        flags = mvd.psFlags;
+        if (!PPS_INUSE(ps)) {
+            flags |= MSG_PS_REMOVE;
+        }
+        MSG_WriteDeltaPlayerstate_Packet(NULL, ps, i, flags);
+    }
+    MSG_WriteByte(CLIENTNUM_NONE);
+
+    // send entity states
+    for (i = 1, es = mvd.entities + 1; i < ge->num_edicts; i++, es++) {
+        flags = mvd.esFlags;
+        if ((j = es->number) != 0) {
+            if (i <= sv_maxclients->integer) {
+                ps = &mvd.players[i - 1];
+                if (PPS_INUSE(ps) && ps->pmove.pm_type == PM_NORMAL) {
+                    flags |= MSG_ES_FIRSTPERSON;
+                }
+            }
+        } else {
+            flags |= MSG_ES_REMOVE;
+        }
+        es->number = i;
+        MSG_WriteDeltaEntity(NULL, es, flags);
+        es->number = j;
+    }
+    MSG_WriteShort(0);
+}
+
 // Writes a single giant message with all the startup info,
 // followed by an uncompressed (baseline) frame.
 static void emit_gamestate(void)
 {
     char        *string;
-    int         i, j;
-    player_packed_t *ps;
-    entity_packed_t *es;
+    int         i;
     size_t      length;
-    int         flags, extra, portalbytes;
-    byte        portalbits[MAX_MAP_PORTAL_BYTES];
+    int         extra;
 
     // don't bother writing if there are no active MVD clients
     if (!mvd.recording && LIST_EMPTY(&gtv_active_list)) {
@@ -643,38 +716,7 @@ static void emit_gamestate(void)
     MSG_WriteShort(i);
 
     // send baseline frame
-    portalbytes = CM_WritePortalBits(&sv.cm, portalbits);
-    MSG_WriteByte(portalbytes);
-    MSG_WriteData(portalbits, portalbytes);
-
-    // send player states
-    for (i = 0, ps = mvd.players; i < sv_maxclients->integer; i++, ps++) {
-        flags = mvd.psFlags;
-        if (!PPS_INUSE(ps)) {
-            flags |= MSG_PS_REMOVE;
-        }
-        MSG_WriteDeltaPlayerstate_Packet(NULL, ps, i, flags);
-    }
-    MSG_WriteByte(CLIENTNUM_NONE);
-
-    // send entity states
-    for (i = 1, es = mvd.entities + 1; i < ge->num_edicts; i++, es++) {
-        flags = mvd.esFlags;
-        if ((j = es->number) != 0) {
-            if (i <= sv_maxclients->integer) {
-                ps = &mvd.players[i - 1];
-                if (PPS_INUSE(ps) && ps->pmove.pm_type == PM_NORMAL) {
-                    flags |= MSG_ES_FIRSTPERSON;
-                }
-            }
-        } else {
-            flags |= MSG_ES_REMOVE;
-        }
-        es->number = i;
-        MSG_WriteDeltaEntity(NULL, es, flags);
-        es->number = j;
-    }
-    MSG_WriteShort(0);
+    emit_base_frame();
 }
 
 static void copy_entity_state(entity_packed_t *dst, const entity_packed_t *src, int flags)
@@ -813,7 +855,18 @@ static void suspend_streams(void)
 {
     gtv_client_t *client;
 
+#if USE_ZLIB
+    if (shared_active()) {
+        write_shared_message(GTS_STREAM_DATA);
+        flush_shared();
+    }
+#endif
+
     FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        if (client->shared)
+            continue;
+#endif
         // send stream suspend marker
         write_message(client, GTS_STREAM_DATA);
 #if USE_ZLIB
@@ -834,7 +887,18 @@ static void resume_streams(void)
     build_gamestate();
     emit_gamestate();
 
+#if USE_ZLIB
+    if (shared_active()) {
+        write_shared_message(GTS_STREAM_DATA);
+        flush_shared();
+    }
+#endif
+
     FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        if (client->shared)
+            continue;
+#endif
         // send gamestate
         write_message(client, GTS_STREAM_DATA);
 #if USE_ZLIB
@@ -851,6 +915,10 @@ static void resume_streams(void)
     // clear gamestate
     SZ_Clear(&msg_write);
 
+    if (mvd.recording) {
+        rec_index_gamestate();
+    }
+
     SZ_Clear(&mvd.datagram);
     SZ_Clear(&mvd.message);
 
@@ -1060,8 +1128,25 @@ void SV_MvdEndFrame(void)
     WL16(header, total + 1);
     header[2] = GTS_STREAM_DATA;
 
+#if USE_ZLIB
+    // deflate frame once for clients of shared stream
+    if (shared_active()) {
+        write_shared(header, sizeof(header));
+        write_shared(mvd.message.data, mvd.message.cursize);
+        write_shared(msg_write.data, msg_write.cursize);
+        write_shared(mvd.datagram.data, mvd.datagram.cursize);
+        if (++mvd.zframes >= SHARED_FRAMES || mvd.zraw >= MAX_GTS_MSGLEN) {
+            flush_shared();
+        }
+    }
+#endif
+
     // send frame to clients
     FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        if (client->shared)
+            continue;
+#endif
         write_stream(client, header, sizeof(header));
         write_stream(client, mvd.message.data, mvd.message.cursize);
         write_stream(client, msg_write.data, msg_write.cursize);
@@ -1082,6 +1167,10 @@ void SV_MvdEndFrame(void)
     // clear frame
     SZ_Clear(&msg_write);
 
+    if (mvd.recording) {
+        rec_index_frame();
+    }
+
     // clear datagrams
     SZ_Clear(&mvd.datagram);
     SZ_Clear(&mvd.message);
@@ -1325,12 +1414,22 @@ static void flush_stream(gtv_client_t *client, int flush)
         return;
     }
 
+    // shared stream chunks are inserted between flushes, they must end on
+    // byte boundary and not reference previous data
+    if (client->shared && flush == Z_SYNC_FLUSH) {
+        flush = Z_FULL_FLUSH;
+    }
+
     z->next_in = NULL;
     z->avail_in = 0;
 
     do {
         data = FIFO_Reserve(fifo, &len);
         if (!len) {
+            // incomplete flush would corrupt following shared chunk
+            if (client->shared && flush != Z_FINISH) {
+                drop_client(client, "overflowed");
+            }
             // FIXME: this is not an error when flushing
             return;
         }
@@ -1346,6 +1445,17 @@ static void flush_stream(gtv_client_t *client, int flush)
             client->bufcount = 0;
         }
     } while (ret == Z_OK);
+
+    // raw deflate doesn't write zlib trailer
+    if (client->shared && ret == Z_STREAM_END) {
+        byte trailer[4];
+
+        trailer[0] = client->adler >> 24;
+        trailer[1] = client->adler >> 16;
+        trailer[2] = client->adler >> 8;
+        trailer[3] = client->adler;
+        FIFO_TryWrite(fifo, trailer, sizeof(trailer));
+    }
 }
 #endif
 
@@ -1391,6 +1501,10 @@ static void write_stream(gtv_client_t *client, void *data, size_t len)
     if (client->z.state) {
         z_streamp z = &client->z;
 
+        if (client->shared) {
+            client->adler = adler32(client->adler, data, len);
+        }
+
         z->next_in = data;
         z->avail_in = (uInt)len;
 
@@ -1434,6 +1548,115 @@ static void write_message(gtv_client_t *client, gtv_serverop_t op)
     write_stream(client, msg_write.data, msg_write.cursize);
 }
 
+#if USE_ZLIB
+/*
+==================
+Shared stream
+
+When sv_mvd_shared_stream is enabled, stream data common to all active
+deflate clients is compressed once into chunks. Each chunk ends with full
+flush and is copied into send buffers of shared clients as is. Messages
+for single client are deflated by its own raw compressor, also ending
+with full flush, so that both can be interleaved in one zlib stream. Client
+keeps adler32 of the whole stream to write proper zlib trailer.
+==================
+*/
+
+static bool shared_active(void)
+{
+    gtv_client_t *client;
+
+    if (!mvd.z.state) {
+        return false;
+    }
+
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (client->shared) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void shared_deflate(int flush)
+{
+    z_streamp z = &mvd.z;
+    int ret;
+
+    do {
+        if (mvd.zlen == mvd.zsize) {
+            mvd.zsize = mvd.zsize ? mvd.zsize * 2 : MAX_GTS_MSGLEN;
+            mvd.zbuf = Z_Realloc(mvd.zbuf, mvd.zsize);
+        }
+
+        z->next_out = mvd.zbuf + mvd.zlen;
+        z->avail_out = (uInt)(mvd.zsize - mvd.zlen);
+
+        ret = deflate(z, flush);
+        Q_assert(ret == Z_OK || ret == Z_BUF_ERROR);
+
+        mvd.zlen = mvd.zsize - z->avail_out;
+    } while (z->avail_in || !z->avail_out);
+}
+
+static void write_shared(void *data, size_t len)
+{
+    if (!len) {
+        return;
+    }
+
+    mvd.zadler = adler32(mvd.zadler, data, len);
+    mvd.zraw += len;
+
+    mvd.z.next_in = data;
+    mvd.z.avail_in = (uInt)len;
+    shared_deflate(Z_NO_FLUSH);
+}
+
+static void write_shared_message(gtv_serverop_t op)
+{
+    byte header[3];
+
+    WL16(header, msg_write.cursize + 1);
+    header[2] = op;
+    write_shared(header, sizeof(header));
+
+    write_shared(msg_write.data, msg_write.cursize);
+}
+
+static void flush_shared(void)
+{
+    gtv_client_t *client;
+
+    if (!mvd.zraw) {
+        return;
+    }
+
+    mvd.z.next_in = NULL;
+    mvd.z.avail_in = 0;
+    shared_deflate(Z_FULL_FLUSH);
+
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (!client->shared) {
+            continue;
+        }
+        if (!FIFO_TryWrite(&client->stream.send, mvd.zbuf, mvd.zlen)) {
+            drop_client(client, "overflowed");
+            continue;
+        }
+        client->adler = adler32_combine(client->adler, mvd.zadler, mvd.zraw);
+        client->bufcount = 0;
+        NET_UpdateStream(&client->stream);
+    }
+
+    mvd.zlen = 0;
+    mvd.zraw = 0;
+    mvd.zadler = adler32(0, NULL, 0);
+    mvd.zframes = 0;
+}
+#endif
+
 static bool auth_client(gtv_client_t *client, const char *password)
 {
     if (SV_MatchAddress(&gtv_white_list, &client->stream.address))
@@ -1513,7 +1736,21 @@ static void parse_hello(gtv_client_t *client)
 
 #if USE_ZLIB
     // the rest of the stream will be deflated
-    if (flags & GTF_DEFLATE) {
+    if (flags & GTF_DEFLATE && mvd.z.state) {
+        static const byte header[2] = { 0x78, 0x9c };
+
+        // raw deflate, zlib header and trailer are written manually
+        client->z.zalloc = SV_zalloc;
+        client->z.zfree = SV_zfree;
+        if (deflateInit2(&client->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            drop_client(client, "deflateInit2 failed");
+            return;
+        }
+        FIFO_Write(&client->stream.send, (void *)header, sizeof(header));
+        client->shared = true;
+        client->adler = adler32(0, NULL, 0);
+    } else if (flags & GTF_DEFLATE) {
         client->z.zalloc = SV_zalloc;
         client->z.zfree = SV_zfree;
         if (deflateInit(&client->z, Z_DEFAULT_COMPRESSION) != Z_OK) {
@@ -1560,6 +1797,12 @@ static void parse_stream_start(gtv_client_t *client)
     client->maxbuf = max(maxbuf, 10);
     client->state = cs_spawned;
 
+#if USE_ZLIB
+    // shared stream data written so far is not for this client,
+    // it starts receiving chunks after the gamestate below
+    flush_shared();
+#endif
+
     List_Append(&gtv_active_list, &client->active);
 
     // send ack to client
@@ -1917,6 +2160,10 @@ static void mvd_drop(gtv_serverop_t op)
 {
     gtv_client_t *client;
 
+#if USE_ZLIB
+    flush_shared();
+#endif
+
     // drop GTV clients
     FOR_EACH_GTV(client) {
         switch (client->state) {
@@ -2006,7 +2253,16 @@ void SV_MvdMapChanged(void)
         emit_gamestate();
 
         // send gamestate to all MVD clients
+#if USE_ZLIB
+        if (shared_active()) {
+            write_shared_message(GTS_STREAM_DATA);
+        }
+#endif
         FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+            if (client->shared)
+                continue;
+#endif
             write_message(client, GTS_STREAM_DATA);
             NET_UpdateStream(&client->stream);
         }
@@ -2029,6 +2285,10 @@ void SV_MvdMapChanged(void)
     // clear gamestate
     SZ_Clear(&msg_write);
 
+    if (mvd.recording && mvd.active) {
+        rec_index_gamestate();
+    }
+
     SZ_Clear(&mvd.datagram);
     SZ_Clear(&mvd.message);
 }
@@ -2122,6 +2382,20 @@ void SV_MvdPostInit(void)
         mvd.esFlags |= MSG_ES_EXTENSIONS;
         mvd.psFlags |= MSG_PS_EXTENSIONS;
     }
+
+#if USE_ZLIB
+    // compress stream once for all deflate clients
+    if (mvd.clients && sv_mvd_shared_stream->integer) {
+        mvd.z.zalloc = SV_zalloc;
+        mvd.z.zfree = SV_zfree;
+        if (deflateInit2(&mvd.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            Com_EPrintf("Couldn't initialize shared MVD stream.\n");
+            memset(&mvd.z, 0, sizeof(mvd.z));
+        }
+        mvd.zadler = adler32(0, NULL, 0);
+    }
+#endif
 }
 
 /*
@@ -2154,6 +2428,13 @@ void SV_MvdShutdown(error_type_t type)
     Z_Free(mvd.entities);
     Z_Free(mvd.clients);
 
+#if USE_ZLIB
+    if (mvd.z.state) {
+        deflateEnd(&mvd.z);
+    }
+    Z_Free(mvd.zbuf);
+#endif
+
     // close server TCP socket
     NET_Listen(false);
 
@@ -2190,10 +2471,96 @@ fail:
     rec_stop();
 }
 
+/*
+Snapshots for demo index are built from the same state the MVD stream is
+delta compressed from, in the form MVD players build them while seeking.
+Players restart frame numbering at each gamestate, so only the first one is
+indexed. Private configstrings and layouts are not tracked and not saved.
+*/
+static void rec_index_snapshot(void)
+{
+    demosnap_t *snap;
+    int64_t pos;
+    size_t len;
+    char *s;
+    int i;
+
+    pos = FS_Tell(mvd.recording);
+    if (pos < 0)
+        return;
+
+    MSG_WriteByte(mvd_frame);
+    emit_base_frame();
+
+    for (i = 0; i < svs.csr.end; i++) {
+        s = sv.configstrings[i];
+        if (!strcmp(s, mvd.baseconfigstrings[i]))
+            continue;
+
+        len = Q_strnlen(s, MAX_QPATH);
+        if (msg_write.cursize + len + 4 > msg_write.maxsize) {
+            SZ_Clear(&msg_write);
+            return;
+        }
+
+        MSG_WriteByte(mvd_configstring);
+        MSG_WriteShort(i);
+        MSG_WriteData(s, len);
+        MSG_WriteByte(0);
+    }
+
+    snap = Z_Malloc(sizeof(*snap) + msg_write.cursize - 1);
+    snap->framenum = mvd.framenum;
+    snap->filepos = pos;
+    snap->msglen = msg_write.cursize;
+    memcpy(snap->data, msg_write.data, msg_write.cursize);
+
+    mvd.snapshots = Z_Realloc(mvd.snapshots, sizeof(snap) * ALIGN(mvd.numsnapshots + 1, 64));
+    mvd.snapshots[mvd.numsnapshots++] = snap;
+
+    SZ_Clear(&msg_write);
+
+    mvd.last_snapshot = mvd.framenum;
+}
+
+// Called after gamestate is written to demofile.
+static void rec_index_gamestate(void)
+{
+    if (!mvd.indexing)
+        return;
+
+    if (mvd.baseconfigstrings || mvd.numsnapshots) {
+        // frame numbers restart here
+        Z_Freep((void **)&mvd.baseconfigstrings);
+        mvd.indexing = false;
+        return;
+    }
+
+    mvd.baseconfigstrings = Z_Malloc(sizeof(sv.configstrings[0]) * svs.csr.end);
+    memcpy(mvd.baseconfigstrings, sv.configstrings, sizeof(sv.configstrings[0]) * svs.csr.end);
+
+    mvd.framenum = 1;   // counting baseline frame, as players do
+    rec_index_snapshot();
+}
+
+// Called after frame is written to demofile.
+static void rec_index_frame(void)
+{
+    if (!mvd.baseconfigstrings)
+        return;
+
+    mvd.framenum++;
+    if (mvd.framenum < mvd.last_snapshot + sv_mvd_index->integer * 10)
+        return;
+
+    rec_index_snapshot();
+}
+
 // Stops server local MVD recording.
 static void rec_stop(void)
 {
     uint16_t msglen;
+    int ret;
 
     if (!mvd.recording) {
         return;
@@ -2203,8 +2570,19 @@ static void rec_stop(void)
     msglen = 0;
     FS_Write(&msglen, 2, mvd.recording);
 
+    // write demo index after it
+    if (mvd.numsnapshots) {
+        ret = Demo_WriteIndex(mvd.recording, mvd.snapshots, mvd.numsnapshots);
+        if (ret)
+            Com_EPrintf("Couldn't write MVD index: %s\n", Q_ErrorString(ret));
+    }
+
     FS_CloseFile(mvd.recording);
     mvd.recording = 0;
+
+    Demo_FreeSnapshots(&mvd.snapshots, &mvd.numsnapshots);
+    Z_Freep((void **)&mvd.baseconfigstrings);
+    mvd.indexing = false;
 }
 
 static bool rec_allowed(void)
@@ -2222,13 +2600,15 @@ static bool rec_allowed(void)
     return true;
 }
 
-static void rec_start(qhandle_t demofile)
+static void rec_start(qhandle_t demofile, unsigned mode)
 {
     uint32_t magic;
 
     mvd.recording = demofile;
     mvd.numlevels = 0;
     mvd.numframes = 0;
+    // compressed demos are not seekable anyway
+    mvd.indexing = sv_mvd_index->integer > 0 && !(mode & FS_FLAG_GZIP);
     mvd.clients_active = svs.realtime;
 
     magic = MVD_MAGIC;
@@ -2238,6 +2618,7 @@ static void rec_start(qhandle_t demofile)
         emit_gamestate();
         rec_write();
         SZ_Clear(&msg_write);
+        rec_index_gamestate();
     }
 }
 
@@ -2253,7 +2634,7 @@ void SV_MvdRecord_f(void)
 {
     char buffer[MAX_OSPATH];
     qhandle_t f;
-    unsigned mode = FS_MODE_WRITE;
+    unsigned mode = FS_MODE_WRITE | FS_FLAG_ASYNC;
     int c;
 
     if (sv.state != ss_game) {
@@ -2302,7 +2683,7 @@ void SV_MvdRecord_f(void)
 
     Com_Printf("Recording local MVD to %s\n", buffer);
 
-    rec_start(f);
+    rec_start(f, mode);
 }
 
 
@@ -2420,6 +2801,8 @@ void SV_MvdRegister(void)
     sv_mvd_suspend_time->changed(sv_mvd_suspend_time);
     sv_mvd_allow_stufftext = Cvar_Get("sv_mvd_allow_stufftext", "0", CVAR_LATCH);
     sv_mvd_spawn_dummy = Cvar_Get("sv_mvd_spawn_dummy", "1", 0);
+    sv_mvd_index = Cvar_Get("sv_mvd_index", "10", 0);
+    sv_mvd_shared_stream = Cvar_Get("sv_mvd_shared_stream", "0", CVAR_LATCH);
 
     Cmd_Register(c_svmvd);
 }
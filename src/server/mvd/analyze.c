@@ -0,0 +1,906 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// mvd_analyze.c -- batch MVD demo analyzer
+//
+// Extracts per player statistics from MVD2 demos without creating channels
+// or loading maps. Demos are loaded on the main thread in batches and parsed
+// in parallel on worker threads, each using its own msg_read. Only player
+// states and configstrings are tracked, entity deltas and effects are parsed
+// just to skip over them. Results are written on the main thread.
+//
+
+#include "client.h"
+#include "common/async.h"
+#include "system/pthread.h"
+
+#define ANA_MAX_BATCH       64
+#define ANA_BATCH_BYTES     0x10000000  // stop loading batch after this much
+#define ANA_TELEPORT_DIST   2048        // 1/8 units per frame, not counted
+
+typedef enum {
+    EV_POS,
+    EV_PICKUP,
+    EV_SCORE,
+    EV_DEATH,
+
+    EV_NUM_TYPES
+} anaevtype_t;
+
+typedef struct {
+    int         framenum;
+    uint8_t     type;
+    uint8_t     player;
+    int16_t     value;      // item number or new score
+    int16_t     origin[3];
+} anaevent_t;
+
+typedef struct {
+    char        name[MAX_CLIENT_NAME];
+    bool        seen;
+    int         frames;
+    int         score;
+    int         deaths;
+    double      distance;
+} anaplayer_t;
+
+typedef struct {
+    char            mapname[MAX_QPATH];
+    char            gamedir[MAX_QPATH];
+    int             numframes;
+    int             maxclients;
+    anaplayer_t     *players;   // [maxclients]
+    configstring_t  *items;     // [MAX_ITEMS], copied at end of map
+    anaevent_t      *events;
+    int             numevents;
+    int             maxevents;
+} anamap_t;
+
+typedef struct {
+    player_state_t  ps;
+    bool            inuse;
+    int             pickup;     // last STAT_PICKUP_STRING
+    int             lastpos;    // frame of last path sample
+} anastate_t;
+
+typedef struct {
+    char            path[MAX_OSPATH];
+    byte            *data;
+    size_t          size;
+    int             interval;   // path sampling interval in frames
+
+    // results
+    anamap_t        *maps;
+    int             nummaps;
+    int             numframes;
+    uint64_t        usec;
+    char            error[MAX_QPATH];
+
+    // parser state
+    jmp_buf         jmpbuf;
+    anamap_t        *map;       // current map, NULL after finished
+    const cs_remap_t    *csr;
+    msgEsFlags_t    esFlags;
+    msgPsFlags_t    psFlags;
+    int             clientNum;
+    configstring_t  *configstrings; // [MAX_CONFIGSTRINGS]
+    anastate_t      *states;        // [MAX_CLIENTS]
+} anajob_t;
+
+static const char *const ana_evnames[EV_NUM_TYPES] = {
+    "pos", "pickup", "score", "death"
+};
+
+// zone allocator is not thread safe, workers serialize on this lock. main
+// thread takes part in parallel loop and doesn't allocate meanwhile.
+static pthread_mutex_t  ana_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *ana_realloc(void *ptr, size_t size)
+{
+    pthread_mutex_lock(&ana_lock);
+    if (ptr)
+        ptr = Z_Realloc(ptr, size);
+    else
+        ptr = MVD_Malloc(size);
+    pthread_mutex_unlock(&ana_lock);
+    return ptr;
+}
+
+static void *ana_mallocz(size_t size)
+{
+    return memset(ana_realloc(NULL, size), 0, size);
+}
+
+/*
+==============================================================================
+
+PARSING (worker threads)
+
+==============================================================================
+*/
+
+static void ana_errorf(anajob_t *job, const char *fmt, ...) q_noreturn q_printf(2, 3);
+
+static void ana_errorf(anajob_t *job, const char *fmt, ...)
+{
+    va_list argptr;
+
+    va_start(argptr, fmt);
+    Q_vsnprintf(job->error, sizeof(job->error), fmt, argptr);
+    va_end(argptr);
+
+    longjmp(job->jmpbuf, -1);
+}
+
+static void ana_add_event(anajob_t *job, anaevtype_t type, int player, int value)
+{
+    anamap_t *map = job->map;
+    anaevent_t *ev;
+
+    if (map->numevents == map->maxevents) {
+        map->maxevents = max(map->maxevents * 2, 1024);
+        map->events = ana_realloc(map->events, sizeof(map->events[0]) * map->maxevents);
+    }
+
+    ev = &map->events[map->numevents++];
+    ev->framenum = map->numframes;
+    ev->type = type;
+    ev->player = player;
+    ev->value = value;
+    VectorCopy(job->states[player].ps.pmove.origin, ev->origin);
+}
+
+// copies names that can change during the map
+static void ana_finish_map(anajob_t *job)
+{
+    anamap_t *map = job->map;
+    char *s;
+    int i;
+
+    if (!map)
+        return;
+
+    for (i = 0; i < map->maxclients; i++) {
+        s = job->configstrings[job->csr->playerskins + i];
+        Q_strlcpy(map->players[i].name, s, min(sizeof(map->players[i].name), strcspn(s, "\\") + 1));
+    }
+
+    map->items = ana_realloc(NULL, sizeof(map->items[0]) * MAX_ITEMS);
+    memcpy(map->items, job->configstrings + job->csr->items, sizeof(map->items[0]) * MAX_ITEMS);
+
+    job->map = NULL;
+}
+
+static void ana_parse_players(anajob_t *job)
+{
+    anastate_t  *s;
+    int         number, bits;
+
+    while (1) {
+        if (msg_read.readcount > msg_read.cursize)
+            ana_errorf(job, "read past end of message");
+
+        number = MSG_ReadByte();
+        if (number == CLIENTNUM_NONE)
+            break;
+
+        if (number < 0 || number >= job->map->maxclients)
+            ana_errorf(job, "bad player number: %d", number);
+
+        s = &job->states[number];
+        bits = MSG_ReadWord();
+        MSG_ParseDeltaPlayerstate_Packet(&s->ps, &s->ps, bits, job->psFlags);
+        s->inuse = !(bits & PPS_REMOVE);
+    }
+}
+
+// entities are of no interest, just skip them
+static void ana_parse_entities(anajob_t *job)
+{
+    entity_state_t              es;
+    entity_state_extension_t    ext;
+    uint64_t    bits;
+    int         number;
+
+    memset(&es, 0, sizeof(es));
+    memset(&ext, 0, sizeof(ext));
+
+    while (1) {
+        if (msg_read.readcount > msg_read.cursize)
+            ana_errorf(job, "read past end of message");
+
+        number = MSG_ParseEntityBits(&bits, job->esFlags);
+        if (number < 0 || number >= job->csr->max_edicts)
+            ana_errorf(job, "bad entity number: %d", number);
+
+        if (!number)
+            break;
+
+        MSG_ParseDeltaEntity(&es, &ext, number, bits, job->esFlags);
+    }
+}
+
+static void ana_update_player(anajob_t *job, int number)
+{
+    anamap_t        *map = job->map;
+    anaplayer_t     *p = &map->players[number];
+    anastate_t      *s = &job->states[number];
+    const short     *stats = s->ps.stats;
+    int             item;
+
+    p->frames++;
+
+    // pickup string remains set for a few seconds after pickup
+    if (stats[STAT_PICKUP_STRING] != s->pickup) {
+        s->pickup = stats[STAT_PICKUP_STRING];
+        item = s->pickup - job->csr->items;
+        if (item > 0 && item < MAX_ITEMS && p->seen)
+            ana_add_event(job, EV_PICKUP, number, item);
+    }
+
+    if (stats[STAT_FRAGS] != p->score) {
+        p->score = stats[STAT_FRAGS];
+        if (p->seen)
+            ana_add_event(job, EV_SCORE, number, p->score);
+    }
+
+    p->seen = true;
+
+    if (job->interval && map->numframes - s->lastpos >= job->interval &&
+        s->ps.pmove.pm_type == PM_NORMAL) {
+        ana_add_event(job, EV_POS, number, 0);
+        s->lastpos = map->numframes;
+    }
+}
+
+static void ana_parse_frame(anajob_t *job)
+{
+    anamap_t        *map = job->map;
+    anastate_t      *s;
+    pmove_state_t   oldpm[MAX_CLIENTS];
+    bool            oldinuse[MAX_CLIENTS];
+    vec3_t          delta;
+    float           dist;
+    int             i, length;
+
+    // skip portalbits
+    length = MSG_ReadByte();
+    if (!MSG_ReadData(length))
+        ana_errorf(job, "read past end of message");
+
+    for (i = 0; i < map->maxclients; i++) {
+        oldpm[i] = job->states[i].ps.pmove;
+        oldinuse[i] = job->states[i].inuse;
+    }
+
+    ana_parse_players(job);
+    ana_parse_entities(job);
+
+    for (i = 0; i < map->maxclients; i++) {
+        s = &job->states[i];
+        if (!s->inuse || i == job->clientNum)
+            continue;
+
+        if (oldinuse[i] && oldpm[i].pm_type == PM_NORMAL) {
+            if (s->ps.pmove.pm_type == PM_DEAD || s->ps.pmove.pm_type == PM_GIB) {
+                map->players[i].deaths++;
+                ana_add_event(job, EV_DEATH, i, 0);
+            } else if (s->ps.pmove.pm_type == PM_NORMAL) {
+                VectorSubtract(s->ps.pmove.origin, oldpm[i].origin, delta);
+                dist = VectorLength(delta);
+                if (dist < ANA_TELEPORT_DIST)
+                    map->players[i].distance += SHORT2COORD(dist);
+            }
+        }
+
+        ana_update_player(job, i);
+    }
+
+    map->numframes++;
+    job->numframes++;
+}
+
+static void ana_parse_serverdata(anajob_t *job, int extrabits)
+{
+    anamap_t    *map;
+    int         i, index, version, maxclients;
+    char        *s;
+
+    ana_finish_map(job);
+
+    if (MSG_ReadLong() != PROTOCOL_VERSION_MVD)
+        ana_errorf(job, "unsupported protocol");
+
+    version = MSG_ReadWord();
+    if (!MVD_SUPPORTED(version))
+        ana_errorf(job, "unsupported MVD protocol version: %d", version);
+
+    job->maps = ana_realloc(job->maps, sizeof(job->maps[0]) * (job->nummaps + 1));
+    map = memset(&job->maps[job->nummaps++], 0, sizeof(*map));
+
+    MSG_ReadLong();     // servercount
+    MSG_ReadString(map->gamedir, sizeof(map->gamedir));
+    job->clientNum = MSG_ReadShort();
+    job->esFlags = MSG_ES_UMASK;
+    job->psFlags = 0;
+    job->csr = &cs_remap_old;
+
+    if (version >= PROTOCOL_VERSION_MVD_EXTENDED_LIMITS && extrabits & MVF_EXTLIMITS) {
+        job->esFlags |= MSG_ES_EXTENSIONS;
+        job->psFlags |= MSG_PS_EXTENSIONS;
+        job->csr = &cs_remap_new;
+    }
+
+    // parse configstrings
+    memset(job->configstrings, 0, sizeof(job->configstrings[0]) * job->csr->end);
+    while (1) {
+        index = MSG_ReadWord();
+        if (index == job->csr->end)
+            break;
+
+        if (index < 0 || index >= job->csr->end)
+            ana_errorf(job, "bad configstring index: %d", index);
+
+        MSG_ReadString(job->configstrings[index], CS_SIZE(job->csr, index));
+
+        if (msg_read.readcount > msg_read.cursize)
+            ana_errorf(job, "read past end of message");
+    }
+
+    maxclients = Q_atoi(job->configstrings[job->csr->maxclients]);
+    if (maxclients < 1 || maxclients > MAX_CLIENTS)
+        ana_errorf(job, "invalid maxclients");
+
+    s = job->configstrings[job->csr->models + 1];
+    if (!Com_ParseMapName(map->mapname, s, sizeof(map->mapname)))
+        ana_errorf(job, "bad world model: %s", s);
+
+    map->maxclients = maxclients;
+    map->players = ana_mallocz(sizeof(map->players[0]) * maxclients);
+    memset(job->states, 0, sizeof(job->states[0]) * MAX_CLIENTS);
+    for (i = 0; i < maxclients; i++)
+        job->states[i].lastpos = -job->interval;
+    job->map = map;
+
+    // parse baseline frame, which is frame 0 like in MVD channels
+    ana_parse_frame(job);
+}
+
+static void ana_parse_configstring(anajob_t *job)
+{
+    int index;
+
+    index = MSG_ReadWord();
+    if (index < 0 || index >= job->csr->end)
+        ana_errorf(job, "bad configstring index: %d", index);
+
+    MSG_ReadString(job->configstrings[index], CS_SIZE(job->csr, index));
+}
+
+static void ana_skip_data(anajob_t *job, int length)
+{
+    if (!MSG_ReadData(length))
+        ana_errorf(job, "read past end of message");
+}
+
+static void ana_parse_message(anajob_t *job)
+{
+    char    string[MAX_STRING_CHARS];
+    int     cmd, extrabits, length, flags;
+
+    while (1) {
+        if (msg_read.readcount > msg_read.cursize)
+            ana_errorf(job, "read past end of message");
+        if (msg_read.readcount == msg_read.cursize)
+            break;
+
+        cmd = MSG_ReadByte();
+        extrabits = cmd >> SVCMD_BITS;
+        cmd &= SVCMD_MASK;
+
+        if (cmd != mvd_serverdata && cmd != mvd_nop && !job->map)
+            ana_errorf(job, "no gamestate");
+
+        switch (cmd) {
+        case mvd_serverdata:
+            ana_parse_serverdata(job, extrabits);
+            break;
+        case mvd_multicast_all:
+        case mvd_multicast_all_r:
+            ana_skip_data(job, MSG_ReadByte() | extrabits << 8);
+            break;
+        case mvd_multicast_pvs:
+        case mvd_multicast_phs:
+        case mvd_multicast_pvs_r:
+        case mvd_multicast_phs_r:
+        case mvd_unicast:
+        case mvd_unicast_r:
+            // leafnum or clientnum follows length
+            length = MSG_ReadByte() | extrabits << 8;
+            if (cmd >= mvd_multicast_all)
+                MSG_ReadWord();
+            else
+                MSG_ReadByte();
+            ana_skip_data(job, length);
+            break;
+        case mvd_configstring:
+            ana_parse_configstring(job);
+            break;
+        case mvd_frame:
+            ana_parse_frame(job);
+            break;
+        case mvd_sound:
+            flags = MSG_ReadByte();
+            if (job->csr->extended && flags & SND_INDEX16)
+                MSG_ReadWord();
+            else
+                MSG_ReadByte();
+            ana_skip_data(job, !!(flags & SND_VOLUME) + !!(flags & SND_ATTENUATION) +
+                          !!(flags & SND_OFFSET) + 2);
+            break;
+        case mvd_print:
+            MSG_ReadByte();
+            MSG_ReadString(string, sizeof(string));
+            break;
+        case mvd_nop:
+            break;
+        default:
+            ana_errorf(job, "illegible command at %zu: %d", msg_read.readcount - 1, cmd);
+        }
+    }
+}
+
+static void ana_parse_demo(anajob_t *job)
+{
+    size_t  pos, msglen;
+
+    if (job->size < 4 || RL32(job->data) != MVD_MAGIC)
+        ana_errorf(job, "not an MVD2 demo");
+
+    for (pos = 4; ; pos += msglen) {
+        if (job->size - pos < 2)
+            ana_errorf(job, "unexpected end of file");
+
+        msglen = RL16(job->data + pos);
+        pos += 2;
+        if (!msglen)
+            break;  // end of demo, index may follow
+
+        if (msglen > MAX_MSGLEN || msglen > job->size - pos)
+            ana_errorf(job, "bad message length: %zu", msglen);
+
+        SZ_Init(&msg_read, job->data + pos, msglen);
+        msg_read.cursize = msglen;
+
+        ana_parse_message(job);
+    }
+}
+
+static void ana_work(void *arg, int i)
+{
+    anajob_t *job = (anajob_t *)arg + i;
+    uint64_t start = Sys_Microseconds();
+
+    if (!setjmp(job->jmpbuf))
+        ana_parse_demo(job);
+
+    // keep partial results of broken demos
+    ana_finish_map(job);
+
+    job->usec = Sys_Microseconds() - start;
+}
+
+/*
+==============================================================================
+
+OUTPUT (main thread)
+
+==============================================================================
+*/
+
+// high bit of Quake 2 strings is color, not UTF-8
+static void ana_json_string(qhandle_t f, const char *s)
+{
+    char buffer[MAX_STRING_CHARS * 6 + 3], *p = buffer;
+    int c;
+
+    *p++ = '"';
+    while (*s && p - buffer < sizeof(buffer) - 8) {
+        c = *s++ & 127;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c < 32 || c == 127) {
+            p += Q_snprintf(p, 7, "\\u%04x", c);
+        } else {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+
+    FS_Write(buffer, p - buffer, f);
+}
+
+static void ana_csv_string(qhandle_t f, const char *s)
+{
+    char buffer[MAX_STRING_CHARS * 2 + 3], *p = buffer;
+    int c;
+
+    *p++ = '"';
+    while (*s && p - buffer < sizeof(buffer) - 3) {
+        c = *s++ & 127;
+        if (c == '"')
+            *p++ = '"';
+        *p++ = c < 32 ? ' ' : c;
+    }
+    *p++ = '"';
+
+    FS_Write(buffer, p - buffer, f);
+}
+
+static const char *ana_item_name(const anamap_t *map, const anaevent_t *ev)
+{
+    return ev->type == EV_PICKUP ? map->items[ev->value] : "";
+}
+
+static void ana_json_events(qhandle_t f, const anamap_t *map, int player,
+                            anaevtype_t type, const char *key)
+{
+    const anaevent_t *ev;
+    bool first = true;
+    int i;
+
+    FS_FPrintf(f, ",\"%s\":[", key);
+    for (i = 0, ev = map->events; i < map->numevents; i++, ev++) {
+        if (ev->player != player || ev->type != type)
+            continue;
+
+        FS_FPrintf(f, "%s[%d,", first ? "" : ",", ev->framenum);
+        if (type == EV_PICKUP) {
+            ana_json_string(f, ana_item_name(map, ev));
+            FS_FPrintf(f, ",");
+        } else if (type == EV_SCORE) {
+            FS_FPrintf(f, "%d]", ev->value);
+            first = false;
+            continue;
+        }
+        FS_FPrintf(f, "%.0f,%.0f,%.0f]", SHORT2COORD(ev->origin[0]),
+                   SHORT2COORD(ev->origin[1]), SHORT2COORD(ev->origin[2]));
+        first = false;
+    }
+    FS_FPrintf(f, "]");
+}
+
+static void ana_write_json(qhandle_t f, const anajob_t *job)
+{
+    const anamap_t *map;
+    const anaplayer_t *p;
+    int i, j;
+    bool first;
+
+    FS_FPrintf(f, "{\"file\":");
+    ana_json_string(f, job->path);
+    FS_FPrintf(f, ",\"size\":%zu,\"frames\":%d,\"usec\":%"PRIu64,
+               job->size, job->numframes, job->usec);
+    if (job->error[0]) {
+        FS_FPrintf(f, ",\"error\":");
+        ana_json_string(f, job->error);
+    }
+    FS_FPrintf(f, ",\"maps\":[");
+
+    for (i = 0, map = job->maps; i < job->nummaps; i++, map++) {
+        FS_FPrintf(f, "%s\n{\"map\":", i ? "," : "");
+        ana_json_string(f, map->mapname);
+        FS_FPrintf(f, ",\"gamedir\":");
+        ana_json_string(f, map->gamedir);
+        FS_FPrintf(f, ",\"frames\":%d,\"players\":[", map->numframes);
+
+        first = true;
+        for (j = 0, p = map->players; j < map->maxclients; j++, p++) {
+            if (!p->seen)
+                continue;
+
+            FS_FPrintf(f, "%s\n{\"num\":%d,\"name\":", first ? "" : ",", j);
+            ana_json_string(f, p->name);
+            FS_FPrintf(f, ",\"frames\":%d,\"score\":%d,\"deaths\":%d,\"distance\":%.0f",
+                       p->frames, p->score, p->deaths, p->distance);
+            ana_json_events(f, map, j, EV_SCORE, "scores");
+            ana_json_events(f, map, j, EV_PICKUP, "pickups");
+            ana_json_events(f, map, j, EV_DEATH, "died");
+            ana_json_events(f, map, j, EV_POS, "path");
+            FS_FPrintf(f, "}");
+            first = false;
+        }
+
+        FS_FPrintf(f, "]}");
+    }
+
+    FS_FPrintf(f, "]}\n");
+}
+
+static void ana_write_csv(qhandle_t f, const anajob_t *job)
+{
+    const anamap_t *map;
+    const anaevent_t *ev;
+    int i, j;
+
+    FS_FPrintf(f, "map,frame,player,name,event,value,x,y,z\n");
+
+    for (i = 0, map = job->maps; i < job->nummaps; i++, map++) {
+        for (j = 0, ev = map->events; j < map->numevents; j++, ev++) {
+            FS_FPrintf(f, "%s,%d,%d,", map->mapname, ev->framenum, ev->player);
+            ana_csv_string(f, map->players[ev->player].name);
+            FS_FPrintf(f, ",%s,", ana_evnames[ev->type]);
+            if (ev->type == EV_PICKUP)
+                ana_csv_string(f, ana_item_name(map, ev));
+            else if (ev->type == EV_SCORE)
+                FS_FPrintf(f, "%d", ev->value);
+            FS_FPrintf(f, ",%.0f,%.0f,%.0f\n", SHORT2COORD(ev->origin[0]),
+                       SHORT2COORD(ev->origin[1]), SHORT2COORD(ev->origin[2]));
+        }
+    }
+}
+
+static void ana_write(const anajob_t *job, const char *ext,
+                      void (*write)(qhandle_t, const anajob_t *))
+{
+    char name[MAX_OSPATH], buffer[MAX_OSPATH];
+    qhandle_t f;
+
+    // strip .mvd2.gz
+    COM_StripExtension(name, COM_SkipPath(job->path), sizeof(name));
+    if (COM_CompareExtension(name, ".mvd2") == 0)
+        *COM_FileExtension(name) = 0;
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                        "analysis/", name, ext);
+    if (!f)
+        return;
+
+    write(f, job);
+
+    if (FS_CloseFile(f))
+        Com_EPrintf("Error writing %s\n", buffer);
+}
+
+/*
+==============================================================================
+
+COMMAND
+
+==============================================================================
+*/
+
+static bool ana_load(anajob_t *job, const char *name)
+{
+    size_t maxsize;
+    int64_t len;
+    qhandle_t f;
+    int ret;
+
+    f = FS_EasyOpenFile(job->path, sizeof(job->path), FS_MODE_READ | FS_FLAG_GZIP,
+                        "demos/", name, ".mvd2");
+    if (!f)
+        return false;
+
+    // length of compressed files is not known, read until EOF
+    len = FS_Length(f);
+    maxsize = len > 0 ? len + 1 : 0x100000;
+    job->data = MVD_Malloc(maxsize);
+    job->size = 0;
+
+    while (1) {
+        if (job->size == maxsize) {
+            maxsize *= 2;
+            job->data = Z_Realloc(job->data, maxsize);
+        }
+
+        ret = FS_Read(job->data + job->size, maxsize - job->size, f);
+        if (ret <= 0)
+            break;
+
+        job->size += ret;
+    }
+
+    FS_CloseFile(f);
+
+    if (ret < 0) {
+        Com_Printf("Couldn't read %s: %s\n", job->path, Q_ErrorString(ret));
+        Z_Freep((void **)&job->data);
+        return false;
+    }
+
+    return true;
+}
+
+static void ana_clear(anajob_t *job)
+{
+    int i;
+
+    for (i = 0; i < job->nummaps; i++) {
+        Z_Free(job->maps[i].players);
+        Z_Free(job->maps[i].items);
+        Z_Free(job->maps[i].events);
+    }
+
+    Z_Freep((void **)&job->maps);
+    Z_Freep((void **)&job->data);
+    job->nummaps = 0;
+    job->numframes = 0;
+    job->error[0] = 0;
+    job->map = NULL;
+}
+
+static const cmd_option_t o_mvdanalyze[] = {
+    { "f:format", "format", "write results in <format>: json, csv or all (default json)" },
+    { "h", "help", "display this message" },
+    { "p:frames", "path", "sample player positions every <frames> (default 10, 0 disables)" },
+    { NULL }
+};
+
+static void MVD_Analyze_c(genctx_t *ctx, int argnum)
+{
+    Cmd_Option_c(o_mvdanalyze, MVD_File_g, ctx, argnum);
+}
+
+static void MVD_Analyze_f(void)
+{
+    bool        json = true, csv = false;
+    int         interval = 10;
+    char        **names = NULL, **list;
+    int         numnames = 0;
+    anajob_t    *jobs;
+    int         batch, i, j, n, c;
+    int         demos = 0, failed = 0, frames = 0;
+    uint64_t    start, parse = 0, usec;
+    size_t      bytes, total = 0;
+
+    while ((c = Cmd_ParseOptions(o_mvdanalyze)) != -1) {
+        switch (c) {
+        case 'f':
+            json = !strcmp(cmd_optarg, "json") || !strcmp(cmd_optarg, "all");
+            csv = !strcmp(cmd_optarg, "csv") || !strcmp(cmd_optarg, "all");
+            if (!json && !csv) {
+                Com_Printf("Invalid value for %s option.\n", cmd_optopt);
+                Cmd_PrintHint();
+                return;
+            }
+            break;
+        case 'h':
+            Cmd_PrintUsage(o_mvdanalyze, "[/]<filename|pattern> [...]");
+            Com_Printf("Parse MVD demos in parallel and write player statistics\n"
+                       "to analysis/<demoname>.json or .csv.\n");
+            Cmd_PrintHelp(o_mvdanalyze);
+            Com_Printf("Patterns with wildcards are matched in demos/ directory.\n");
+            return;
+        case 'p':
+            interval = Q_atoi(cmd_optarg);
+            if (interval < 0) {
+                Com_Printf("Invalid value for %s option.\n", cmd_optopt);
+                Cmd_PrintHint();
+                return;
+            }
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (cmd_optind == Cmd_Argc()) {
+        Com_Printf("Missing filename argument.\n");
+        Cmd_PrintHint();
+        return;
+    }
+
+    // build the file list
+    for (i = cmd_optind; i < Cmd_Argc(); i++) {
+        char *arg = Cmd_Argv(i);
+
+        if (!strpbrk(arg, "*?[")) {
+            names = Z_Realloc(names, sizeof(names[0]) * (numnames + 1));
+            names[numnames++] = MVD_CopyString(arg);
+            continue;
+        }
+
+        list = (char **)FS_ListFiles("demos", arg, FS_SEARCH_BYFILTER, &n);
+        if (!list) {
+            Com_Printf("No demos found matching %s.\n", arg);
+            continue;
+        }
+        names = Z_Realloc(names, sizeof(names[0]) * (numnames + n));
+        for (j = 0; j < n; j++)
+            names[numnames++] = MVD_CopyString(list[j]);
+        FS_FreeList((void **)list);
+    }
+
+    if (!numnames)
+        return;
+
+    batch = min((Com_AsyncWorkers() + 1) * 2, ANA_MAX_BATCH);
+    jobs = MVD_Mallocz(sizeof(jobs[0]) * batch);
+    for (i = 0; i < batch; i++) {
+        jobs[i].interval = interval;
+        jobs[i].configstrings = MVD_Malloc(sizeof(jobs[i].configstrings[0]) * MAX_CONFIGSTRINGS);
+        jobs[i].states = MVD_Malloc(sizeof(jobs[i].states[0]) * MAX_CLIENTS);
+    }
+
+    start = Sys_Microseconds();
+
+    for (i = 0; i < numnames; ) {
+        // load next batch
+        for (n = 0, bytes = 0; i < numnames && n < batch && bytes < ANA_BATCH_BYTES; i++) {
+            if (ana_load(&jobs[n], names[i]))
+                bytes += jobs[n++].size;
+            else
+                failed++;
+        }
+
+        usec = Sys_Microseconds();
+        Com_ParallelFor(n, ana_work, jobs);
+        parse += Sys_Microseconds() - usec;
+        total += bytes;
+
+        for (j = 0; j < n; j++) {
+            anajob_t *job = &jobs[j];
+
+            if (job->error[0]) {
+                Com_WPrintf("%s: %s\n", job->path, job->error);
+                failed++;
+            }
+            if (json)
+                ana_write(job, ".json", ana_write_json);
+            if (csv)
+                ana_write(job, ".csv", ana_write_csv);
+
+            Com_DPrintf("%s: %d maps, %d frames in %"PRIu64" usec\n",
+                        job->path, job->nummaps, job->numframes, job->usec);
+            frames += job->numframes;
+            demos++;
+            ana_clear(job);
+        }
+    }
+
+    usec = max(Sys_Microseconds() - start, 1);
+    parse = max(parse, 1);
+
+    Com_Printf("Analyzed %d demo%s (%d failed), %d frames, %.1f MB in %.2f sec "
+               "with %d threads.\n", demos, demos == 1 ? "" : "s", failed, frames,
+               total / 1048576.0, usec * 1e-6, min(batch, Com_AsyncWorkers() + 1));
+    Com_Printf("%.0f frames/sec overall, %.0f frames/sec parsing, %.1f MB/sec.\n",
+               frames * 1e6 / usec, frames * 1e6 / parse, total / (double)parse);
+
+    for (i = 0; i < batch; i++) {
+        Z_Free(jobs[i].configstrings);
+        Z_Free(jobs[i].states);
+    }
+    Z_Free(jobs);
+
+    for (i = 0; i < numnames; i++)
+        Z_Free(names[i]);
+    Z_Free(names);
+}
+
+static const cmdreg_t c_analyze[] = {
+    { "mvdanalyze", MVD_Analyze_f, MVD_Analyze_c },
+
+    { NULL }
+};
+
+void MVD_RegisterAnalyze(void)
+{
+    Cmd_Register(c_analyze);
+}
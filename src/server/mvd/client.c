@@ -79,6 +79,8 @@ typedef struct gtv_s {
     int64_t         demosize, demoofs;
     float           demoprogress;
     bool            demowait;
+    bool            demonextmap;    // past the first map of current file
+    bool            demoindexed;
 } gtv_t;
 
 static const char *const gtv_states[GTV_NUM_STATES] = {
@@ -140,10 +142,7 @@ static void MVD_Free(mvd_t *mvd)
 {
     int i;
 
-    for (i = 0; i < mvd->numsnapshots; i++) {
-        Z_Free(mvd->snapshots[i]);
-    }
-    Z_Free(mvd->snapshots);
+    Demo_FreeSnapshots(&mvd->snapshots, &mvd->numsnapshots);
 
     // stop demo recording
     if (mvd->demorecording) {
@@ -725,6 +724,7 @@ static bool demo_read_frame(mvd_t *mvd)
                 goto next;
             }
         } while (--count);
+        gtv->demonextmap = true;
     } else {
         ret = demo_read_message(gtv->demoplayback);
         if (ret <= 0) {
@@ -734,7 +734,8 @@ static bool demo_read_frame(mvd_t *mvd)
 
     demo_update(gtv);
 
-    MVD_ParseMessage(mvd);
+    if (MVD_ParseMessage(mvd))
+        gtv->demonextmap = true;
     demo_emit_snapshot(mvd);
     return true;
 
@@ -743,6 +744,43 @@ next:
     return true;
 }
 
+// loads snapshots saved by recorder, if any
+static void demo_load_index(gtv_t *gtv)
+{
+    mvd_t *mvd = gtv->mvd;
+    demosnap_t **snapshots;
+    int64_t end;
+    int ret;
+
+    // finding index in compressed demo would need to inflate it all
+    if (!COM_CompareExtension(gtv->demoentry->string, ".gz"))
+        return;
+
+    ret = Demo_ReadIndex(gtv->demoplayback, &snapshots, &end, TAG_MVD);
+    if (ret < 0) {
+        Com_WPrintf("[%s] Couldn't read index of %s: %s\n", gtv->name,
+                    gtv->demoentry->string, Q_ErrorString(ret));
+        return;
+    }
+    if (!ret)
+        return;
+    if (end <= gtv->demoofs) {
+        Demo_FreeSnapshots(&snapshots, &ret);
+        return;
+    }
+
+    Demo_FreeSnapshots(&mvd->snapshots, &mvd->numsnapshots);
+    mvd->snapshots = snapshots;
+    mvd->numsnapshots = ret;
+    mvd->last_snapshot = snapshots[ret - 1]->framenum;
+
+    // don't count index in progress
+    gtv->demosize = end - gtv->demoofs;
+    gtv->demoindexed = true;
+
+    Com_DPrintf("[%s] Loaded %d snapshots from index\n", gtv->name, ret);
+}
+
 static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
 {
     int64_t len, ofs;
@@ -781,6 +819,8 @@ static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
         gtv->mvd->read_frame = demo_read_frame;
     } else {
         gtv->mvd->demoseeking = false;
+        // snapshots of previous file are useless
+        Demo_FreeSnapshots(&gtv->mvd->snapshots, &gtv->mvd->numsnapshots);
     }
 
     Com_Printf("[%s] -=- Reading from %s\n", gtv->name, entry->string);
@@ -795,6 +835,8 @@ static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
 
     // reset state
     gtv->demoentry = entry;
+    gtv->demonextmap = false;
+    gtv->demoindexed = false;
 
     // set channel address
     Q_strlcpy(gtv->address, COM_SkipPath(entry->string), sizeof(gtv->address));
@@ -803,6 +845,7 @@ static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
     if (ofs > 0 && ofs < len) {
         gtv->demoofs = ofs;
         gtv->demosize = len - ofs;
+        demo_load_index(gtv);
     } else {
         gtv->demosize = gtv->demoofs = 0;
     }
@@ -1921,7 +1964,7 @@ void MVD_StreamedRecord_f(void)
     mvd_t *mvd;
     uint32_t magic;
     uint16_t msglen;
-    unsigned mode = FS_MODE_WRITE;
+    unsigned mode = FS_MODE_WRITE | FS_FLAG_ASYNC;
     int ret;
     int c;
 
@@ -2192,6 +2235,127 @@ static void MVD_Pause_f(void)
     }
 }
 
+/*
+==============
+MVD_Index_f
+
+Reads the rest of the first map of demo, saving snapshots as usual, and
+appends them to demo file. Then seeks back to where playback was.
+==============
+*/
+static void MVD_Index_f(void)
+{
+    mvd_t *mvd;
+    gtv_t *gtv;
+    qhandle_t f;
+    int64_t pos, start;
+    int ret, framenum;
+
+    mvd = MVD_SetChannel(1);
+    if (!mvd) {
+        Com_Printf("Usage: %s [chanid]\n", Cmd_Argv(0));
+        return;
+    }
+
+    gtv = mvd->gtv;
+    if (!gtv || !gtv->demoplayback) {
+        Com_Printf("[%s] Indexing is only supported on demo channels.\n", mvd->name);
+        return;
+    }
+
+    if (mvd->demorecording) {
+        Com_Printf("[%s] Indexing is not supported during demo recording.\n", mvd->name);
+        return;
+    }
+
+    if (mvd_snaps->integer <= 0) {
+        Com_Printf("[%s] Snapshots are disabled.\n", mvd->name);
+        return;
+    }
+
+    if (!gtv->demosize) {
+        Com_Printf("[%s] Unknown file size, can't index.\n", mvd->name);
+        return;
+    }
+
+    if (!COM_CompareExtension(gtv->demoentry->string, ".gz")) {
+        Com_Printf("[%s] Can't index compressed demo.\n", mvd->name);
+        return;
+    }
+
+    if (gtv->demoindexed) {
+        Com_Printf("[%s] Demo is already indexed.\n", mvd->name);
+        return;
+    }
+
+    if (gtv->demonextmap || !mvd->numsnapshots) {
+        Com_Printf("[%s] Demo must be indexed while playing its first map.\n", mvd->name);
+        return;
+    }
+
+    if (setjmp(mvd_jmpbuf))
+        return;
+
+    framenum = mvd->framenum;
+    start = FS_Tell(gtv->demoplayback);
+
+    // disable effects processing
+    mvd->demoseeking = true;
+
+    while (1) {
+        ret = demo_read_message(gtv->demoplayback);
+        if (ret < 0) {
+            demo_finish(gtv, ret);
+            return;
+        }
+        if (!ret)
+            break;
+
+        // stop before next gamestate, frame numbers restart there
+        if ((msg_read.data[0] & SVCMD_MASK) == mvd_serverdata)
+            break;
+
+        MVD_ParseMessage(mvd);
+        demo_emit_snapshot(mvd);
+    }
+
+    mvd->demoseeking = false;
+
+    // index goes right after the end of demo
+    pos = FS_OpenFile(gtv->demoentry->string, &f, FS_MODE_RDWR);
+    if (!f) {
+        Com_EPrintf("[%s] Couldn't open %s for writing: %s\n", mvd->name,
+                    gtv->demoentry->string, Q_ErrorString(pos));
+    } else if (pos != FS_Length(gtv->demoplayback)) {
+        Com_EPrintf("[%s] Couldn't index %s: file is not in writable directory\n",
+                    mvd->name, gtv->demoentry->string);
+        FS_CloseFile(f);
+    } else {
+        ret = Demo_WriteIndex(f, mvd->snapshots, mvd->numsnapshots);
+        if (!ret)
+            ret = FS_CloseFile(f);
+        else
+            FS_CloseFile(f);
+        if (ret) {
+            Com_EPrintf("[%s] Couldn't index %s: %s\n", mvd->name,
+                        gtv->demoentry->string, Q_ErrorString(ret));
+        } else {
+            Com_Printf("[%s] Indexed %d snapshots.\n", mvd->name, mvd->numsnapshots);
+            gtv->demoindexed = true;
+        }
+    }
+
+    // no frames left, don't read past the end
+    if (mvd->framenum == framenum) {
+        FS_Seek(gtv->demoplayback, start, SEEK_SET);
+        return;
+    }
+
+    // configstrings will be the same after seeking back, so dirty
+    // ones need not be sent
+    Cbuf_InsertText(&cmd_buffer, va("mvdseek 0.%d %d\n", framenum, mvd->id));
+}
+
 static void MVD_Skip_f(void)
 {
     mvd_t *mvd;
@@ -2368,6 +2532,7 @@ static void MVD_Seek_f(void)
         if (gamestate) {
             // got a gamestate, abort seek
             Com_DPrintf("got gamestate while seeking!\n");
+            gtv->demonextmap = true;
             goto done;
         }
     }
@@ -2661,6 +2826,68 @@ void MVD_Shutdown(void)
     Z_LeakTest(TAG_MVD);
 }
 
+/*
+==============
+MVD_VisBench_f
+
+Steps through demo frames and compares entity visibility culling with and
+without the cluster index, using each player's view.
+==============
+*/
+static void MVD_VisBench_f(void)
+{
+    player_state_t *views[MAX_CLIENTS];
+    sv_visbench_t bench;
+    mvd_t *mvd;
+    int i, numviews, frames, repeat;
+    int framenum;
+
+    mvd = MVD_SetChannel(1);
+    if (!mvd) {
+        Com_Printf("Usage: %s [chan_id] [frames] [repeat]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (mvd->state < MVD_WAITING || !mvd->cm.cache) {
+        Com_Printf("[%s] Channel is not ready.\n", mvd->name);
+        return;
+    }
+
+    frames = Q_clip(Q_atoi(Cmd_Argv(2)), 1, 100000);
+    repeat = Q_clip(Q_atoi(Cmd_Argv(3)), 1, 1000);
+    if (!*Cmd_Argv(2))
+        frames = 100;
+    if (!*Cmd_Argv(3))
+        repeat = 10;
+
+    memset(&bench, 0, sizeof(bench));
+
+    if (setjmp(mvd_jmpbuf))
+        return;
+
+    for (framenum = 0; framenum < frames; framenum++) {
+        numviews = 0;
+        for (i = 0; i < mvd->maxclients && numviews < MAX_CLIENTS; i++)
+            if (mvd->players[i].inuse)
+                views[numviews++] = &mvd->players[i].ps;
+
+        SV_BenchEntityIndex(&bench, &mvd->ge, &mvd->cm, mvd->csr, views, numviews, repeat);
+
+        // advance to the next frame, only possible on demo channels
+        if (!mvd->gtv || !mvd->gtv->demoplayback || !demo_read_frame(mvd))
+            break;
+    }
+
+    Com_Printf("%d frames, %u views, %.1f entities per view\n", framenum,
+               bench.views, bench.views ? (float)bench.entities / bench.views : 0.0f);
+    Com_Printf("full scan: %u ms, cluster index: %u ms\n",
+               bench.scan_msec, bench.index_msec);
+    if (bench.mismatches)
+        Com_WPrintf("%u views differ between paths!\n", bench.mismatches);
+    else
+        Com_Printf("All views identical.\n");
+}
+
 static const cmdreg_t c_mvd[] = {
     { "mvdplay", MVD_Play_f, MVD_Play_c },
     { "mvdconnect", MVD_Connect_f, MVD_Connect_c },
@@ -2673,6 +2900,8 @@ static const cmdreg_t c_mvd[] = {
     { "mvdpause", MVD_Pause_f },
     { "mvdskip", MVD_Skip_f },
     { "mvdseek", MVD_Seek_f },
+    { "mvdindex", MVD_Index_f },
+    { "mvdvisbench", MVD_VisBench_f },
 
     { NULL }
 };
@@ -2708,5 +2937,7 @@ void MVD_Register(void)
     mvd_snaps = Cvar_Get("mvd_snaps", "10", 0);
 
     Cmd_Register(c_mvd);
+
+    MVD_RegisterAnalyze();
 }
 
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "../server.h"
+#include "common/demoindex.h"
 #include <setjmp.h>
 
 #define MVD_Malloc(size)    Z_TagMalloc(size, TAG_MVD)
@@ -113,12 +114,7 @@ typedef enum {
     MVD_NUM_STATES
 } mvd_state_t;
 
-typedef struct {
-    int framenum;
-    int64_t filepos;
-    size_t msglen;
-    byte data[1];
-} mvd_snap_t;
+typedef demosnap_t mvd_snap_t;
 
 struct gtv_s;
 
@@ -224,6 +220,12 @@ bool MVD_ParseMessage(mvd_t *mvd);
 void MVD_ParseEntityString(mvd_t *mvd, const char *data);
 void MVD_ClearState(mvd_t *mvd, bool full);
 
+//
+// mvd_analyze.c
+//
+
+void MVD_RegisterAnalyze(void);
+
 //
 // mvd_game.c
 //
@@ -0,0 +1,246 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// profile.c -- server frame profiler
+//
+// Stages of each server frame are timed with SV_ProfileBegin/SV_ProfileEnd.
+// Last PROF_WINDOW samples of each stage are kept for percentiles, and last
+// PROF_EVENTS samples of all stages are kept in order for dumping as Chrome
+// trace events (chrome://tracing, Perfetto). Per-client frame build and
+// encode times are measured by workers and added from the main thread.
+//
+
+#include "server.h"
+
+#define PROF_WINDOW     1024    // samples kept per stage, power of two
+#define PROF_EVENTS     65536   // events kept for dumping, power of two
+#define PROF_BUCKETS    24      // histogram buckets, powers of two in usec
+
+typedef struct {
+    uint32_t    samples[PROF_WINDOW];   // usec
+    unsigned    count;                  // total samples ever added
+} profstage_t;
+
+typedef struct {
+    uint64_t    start;      // usec
+    uint32_t    duration;
+    uint16_t    stage;
+    int16_t     client;     // -1 if not client specific
+} profevent_t;
+
+static const char *const prof_names[PROF_NUM_STAGES] = {
+    "tick", "packets", "async", "game", "mvd", "send", "build", "encode"
+};
+
+bool                sv_profiling;
+
+static profstage_t  *prof_stages;
+static profevent_t  *prof_events;
+static unsigned     prof_numevents;
+
+void SV_ProfileSample(sv_profstage_t stage, int client, uint64_t start, uint64_t end)
+{
+    profstage_t *s;
+    profevent_t *e;
+    uint32_t    duration;
+
+    if (!sv_profiling || !start)
+        return;
+
+    duration = min(end - start, UINT32_MAX);
+
+    s = &prof_stages[stage];
+    s->samples[s->count++ & (PROF_WINDOW - 1)] = duration;
+
+    e = &prof_events[prof_numevents++ & (PROF_EVENTS - 1)];
+    e->start = start;
+    e->duration = duration;
+    e->stage = stage;
+    e->client = client;
+}
+
+static void SV_ProfileEnable(bool enable)
+{
+    if (enable && !prof_stages) {
+        prof_stages = Z_Mallocz(sizeof(prof_stages[0]) * PROF_NUM_STAGES);
+        prof_events = Z_Mallocz(sizeof(prof_events[0]) * PROF_EVENTS);
+        prof_numevents = 0;
+    } else if (!enable) {
+        Z_Freep((void **)&prof_stages);
+        Z_Freep((void **)&prof_events);
+    }
+
+    sv_profiling = enable;
+}
+
+static int prof_cmp(const void *p1, const void *p2)
+{
+    uint32_t a = *(const uint32_t *)p1;
+    uint32_t b = *(const uint32_t *)p2;
+
+    return (a > b) - (a < b);
+}
+
+static void SV_ProfileStats(void)
+{
+    uint32_t    sorted[PROF_WINDOW];
+    uint64_t    total;
+    int         i, j, n;
+
+    Com_Printf("stage   samples     avg     p50     p99     max (usec)\n"
+               "------- ------- ------- ------- ------- -------\n");
+    for (i = 0; i < PROF_NUM_STAGES; i++) {
+        n = min(prof_stages[i].count, PROF_WINDOW);
+        if (!n)
+            continue;
+
+        memcpy(sorted, prof_stages[i].samples, sizeof(sorted[0]) * n);
+        qsort(sorted, n, sizeof(sorted[0]), prof_cmp);
+
+        total = 0;
+        for (j = 0; j < n; j++)
+            total += sorted[j];
+
+        Com_Printf("%-7s %7d %7"PRIu64" %7u %7u %7u\n", prof_names[i], n,
+                   total / n, sorted[n / 2], sorted[n * 99 / 100], sorted[n - 1]);
+    }
+}
+
+static void SV_ProfileHistogram(const char *name)
+{
+    unsigned    buckets[PROF_BUCKETS];
+    unsigned    most;
+    int         i, n, stage, bucket;
+
+    for (stage = 0; stage < PROF_NUM_STAGES; stage++)
+        if (!strcmp(prof_names[stage], name))
+            break;
+
+    if (stage == PROF_NUM_STAGES) {
+        Com_Printf("No such stage: %s\n", name);
+        return;
+    }
+
+    memset(buckets, 0, sizeof(buckets));
+    n = min(prof_stages[stage].count, PROF_WINDOW);
+    for (i = 0; i < n; i++) {
+        for (bucket = 0; bucket < PROF_BUCKETS - 1; bucket++)
+            if (prof_stages[stage].samples[i] < 2U << bucket)
+                break;
+        buckets[bucket]++;
+    }
+
+    most = 1;
+    for (i = 0; i < PROF_BUCKETS; i++)
+        most = max(most, buckets[i]);
+
+    for (i = 0; i < PROF_BUCKETS; i++) {
+        char bar[41];
+
+        if (!buckets[i])
+            continue;
+
+        n = buckets[i] * 40 / most;
+        memset(bar, '*', n);
+        bar[n] = 0;
+        Com_Printf("< %8u usec %6u %s\n", 2U << i, buckets[i], bar);
+    }
+}
+
+static void SV_ProfileDump(const char *name)
+{
+    char        buffer[MAX_OSPATH];
+    qhandle_t   f;
+    profevent_t *e;
+    unsigned    i, first;
+    uint64_t    base;
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                        "profiles/", name, ".json");
+    if (!f)
+        return;
+
+    first = prof_numevents > PROF_EVENTS ? prof_numevents - PROF_EVENTS : 0;
+    base = prof_numevents ? prof_events[first & (PROF_EVENTS - 1)].start : 0;
+
+    FS_FPrintf(f, "{\"traceEvents\":[\n"
+               "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+               "\"args\":{\"name\":\"server\"}}");
+
+    for (i = 0; i < sv_maxclients->integer; i++)
+        FS_FPrintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                   "\"args\":{\"name\":\"client %u\"}}", i + 1, i);
+
+    // events are kept in order of completion, viewers don't mind
+    for (i = first; i < prof_numevents; i++) {
+        e = &prof_events[i & (PROF_EVENTS - 1)];
+        FS_FPrintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                   "\"ts\":%"PRId64",\"dur\":%u}", prof_names[e->stage],
+                   e->client + 1, (int64_t)(e->start - base), e->duration);
+    }
+
+    FS_FPrintf(f, "\n]}\n");
+
+    if (FS_CloseFile(f))
+        Com_EPrintf("Error writing %s\n", buffer);
+    else
+        Com_Printf("Dumped %u events to %s\n", prof_numevents - first, buffer);
+}
+
+static void SV_Profile_f(void)
+{
+    char *cmd = Cmd_Argv(1);
+
+    if (!strcmp(cmd, "on")) {
+        SV_ProfileEnable(true);
+        return;
+    }
+
+    if (!strcmp(cmd, "off")) {
+        SV_ProfileEnable(false);
+        return;
+    }
+
+    if (!sv_profiling) {
+        Com_Printf("Usage: %s <on|off|reset|hist <stage>|dump <filename>>\n"
+                   "Profiling is disabled.\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (!strcmp(cmd, "reset")) {
+        memset(prof_stages, 0, sizeof(prof_stages[0]) * PROF_NUM_STAGES);
+        prof_numevents = 0;
+        return;
+    }
+
+    if (!strcmp(cmd, "hist") && Cmd_Argc() > 2) {
+        SV_ProfileHistogram(Cmd_Argv(2));
+        return;
+    }
+
+    if (!strcmp(cmd, "dump") && Cmd_Argc() > 2) {
+        SV_ProfileDump(Cmd_Argv(2));
+        return;
+    }
+
+    SV_ProfileStats();
+}
+
+void SV_RegisterProfile(void)
+{
+    Cmd_AddCommand("sv_profile", SV_Profile_f);
+}
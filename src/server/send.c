@@ -239,6 +239,24 @@ void SV_BroadcastCommand(const char *fmt, ...)
 }
 
 
+// while set, large messages added from msg_write share one copy of data
+static bool             msg_sharing;
+static message_ref_t    *msg_shared_ref;
+
+static mleaf_t *client_leaf(client_t *client)
+{
+    const float *origin = client->edict->s.origin;
+
+    if (!client->leaf || client->leaf_spawncount != sv.spawncount ||
+        !VectorCompare(client->leaf_origin, origin)) {
+        client->leaf = CM_PointLeaf(&sv.cm, origin);
+        client->leaf_spawncount = sv.spawncount;
+        VectorCopy(origin, client->leaf_origin);
+    }
+
+    return client->leaf;
+}
+
 /*
 =================
 SV_Multicast
@@ -291,6 +309,8 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
         Com_Error(ERR_DROP, "SV_Multicast: bad to: %i", to);
     }
 
+    msg_sharing = true;
+
     // send the data to all relevent clients
     FOR_EACH_CLIENT(client) {
         if (client->state < cs_primed) {
@@ -302,7 +322,7 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
         }
 
         if (leaf1) {
-            leaf2 = CM_PointLeaf(&sv.cm, client->edict->s.origin);
+            leaf2 = client_leaf(client);
             if (!CM_AreasConnected(&sv.cm, leaf1->area, leaf2->area))
                 continue;
             if (leaf2->cluster == -1)
@@ -314,6 +334,9 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
         SV_ClientAddMessage(client, flags);
     }
 
+    msg_sharing = false;
+    msg_shared_ref = NULL;
+
     // add to MVD datagram
     SV_MvdMulticast(leafnum, to);
 
@@ -342,47 +365,103 @@ static bool can_auto_compress(client_t *client)
     return true;
 }
 
-static int compress_message(client_t *client)
+/*
+Reliable messages are often identical for many clients (e.g. gamestate after
+map change), so large ones are compressed once and kept in a small cache
+keyed by content hash. Entries are replaced on collision.
+*/
+
+#define ZCACHE_SIZE     64      // power of two
+#define ZCACHE_MINLEN   256     // don't bother caching smaller messages
+
+typedef struct {
+    uint64_t    hash;
+    uint32_t    usec;       // time it took to compress
+    uint16_t    inlen;
+    uint16_t    outlen;
+    byte        data[1];    // message followed by compressed message
+} zcache_t;
+
+static zcache_t     *zcache[ZCACHE_SIZE];
+static byte         *zcache_data;   // last compressed message
+
+void SV_ClearCompressCache(void)
+{
+    for (int i = 0; i < ZCACHE_SIZE; i++)
+        Z_Freep((void **)&zcache[i]);
+}
+
+static uint64_t hash_message(const byte *data, size_t len)
 {
-    int     ret, len;
-    byte    *hdr;
+    uint64_t hash = 14695981039346656037ULL;
+
+    while (len--) {
+        hash ^= *data++;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static int compress_message(client_t *client, bool cache)
+{
+    zcache_t    **slot = NULL, *z;
+    uint64_t    hash = 0, start, usec;
+    int         len;
 
     if (!client->has_zlib)
         return 0;
 
-    svs.z.next_in = msg_write.data;
-    svs.z.avail_in = msg_write.cursize;
-    svs.z.next_out = svs.z_buffer + ZPACKET_HEADER;
-    svs.z.avail_out = svs.z_buffer_size - ZPACKET_HEADER;
+    zcache_data = svs.z_buffer;
+
+    if (cache && msg_write.cursize >= ZCACHE_MINLEN) {
+        hash = hash_message(msg_write.data, msg_write.cursize);
+        slot = &zcache[hash & (ZCACHE_SIZE - 1)];
+        z = *slot;
+        if (z && z->hash == hash && z->inlen == msg_write.cursize &&
+            !memcmp(z->data, msg_write.data, z->inlen)) {
+            svs.z_cache_hits++;
+            svs.z_saved_usec += z->usec;
+            zcache_data = z->data + z->inlen;
+            return z->outlen;
+        }
+    }
 
-    ret = deflate(&svs.z, Z_FINISH);
-    len = svs.z.total_out;
+    start = Sys_Microseconds();
+    len = SV_CompressMessage(&svs.z, svs.z_buffer, svs.z_buffer_size,
+                             msg_write.data, msg_write.cursize);
+    usec = Sys_Microseconds() - start;
 
-    // prepare for next deflate()
-    deflateReset(&svs.z);
+    svs.z_messages++;
+    svs.z_usec += usec;
 
-    if (ret != Z_STREAM_END) {
-        Com_WPrintf("Error %d compressing %zu bytes message for %s\n",
-                    ret, msg_write.cursize, client->name);
+    if (!len) {
+        Com_WPrintf("Error compressing %zu bytes message for %s\n",
+                    msg_write.cursize, client->name);
         return 0;
     }
 
-    // write the packet header
-    hdr = svs.z_buffer;
-    hdr[0] = svc_zpacket;
-    WL16(&hdr[1], len);
-    WL16(&hdr[3], msg_write.cursize);
+    if (slot) {
+        Z_Free(*slot);
+        *slot = z = SV_Malloc(sizeof(*z) + msg_write.cursize + len - 1);
+        z->hash = hash;
+        z->usec = min(usec, UINT32_MAX);
+        z->inlen = msg_write.cursize;
+        z->outlen = len;
+        memcpy(z->data, msg_write.data, msg_write.cursize);
+        memcpy(z->data + msg_write.cursize, svs.z_buffer, len);
+    }
 
-    return len + ZPACKET_HEADER;
+    return len;
 }
 
 static byte *get_compressed_data(void)
 {
-    return svs.z_buffer;
+    return zcache_data;
 }
 #else
 #define can_auto_compress(c)    false
-#define compress_message(c)     0
+#define compress_message(c, r)  0
 #define get_compressed_data()   NULL
 #endif
 
@@ -407,7 +486,8 @@ void SV_ClientAddMessage(client_t *client, int flags)
         flags |= MSG_COMPRESS;
     }
 
-    if ((flags & MSG_COMPRESS) && (len = compress_message(client)) && len < msg_write.cursize) {
+    if ((flags & MSG_COMPRESS) && (len = compress_message(client, flags & MSG_RELIABLE)) &&
+        len < msg_write.cursize) {
         client->AddMessage(client, get_compressed_data(), len, flags & MSG_RELIABLE);
         SV_DPrintf(0, "Compressed %sreliable message to %s: %zu into %d\n",
                    (flags & MSG_RELIABLE) ? "" : "un", client->name, msg_write.cursize, len);
@@ -430,6 +510,121 @@ FRAME UPDATES - COMMON
 ===============================================================================
 */
 
+/*
+Message data larger than MSG_TRESHOLD comes from free lists of power of
+two sized blocks. Blocks are carved from slabs that are kept until server
+shutdown, so once the pool has grown to the working set, adding messages
+doesn't touch the zone allocator.
+*/
+
+typedef union msgblock_u {
+    union msgblock_u    *next;
+    message_ref_t       ref;
+} msgblock_t;
+
+typedef struct msgslab_s {
+    struct msgslab_s    *next;
+    size_t              size;
+} msgslab_t;
+
+static msgblock_t   *msg_free_blocks[MSG_REF_CLASSES];
+static msgslab_t    *msg_slabs;
+
+static void grow_msg_pool(unsigned sizeclass, size_t count)
+{
+    size_t      blocksize = 1 << (sizeclass + MSG_REF_SHIFT);
+    size_t      size = max(count * blocksize, MSG_SLAB_SIZE);
+    msgslab_t   *slab;
+    msgblock_t  *block;
+    byte        *data;
+    size_t      i;
+
+    size = max(size, blocksize);
+    slab = SV_Malloc(sizeof(*slab) + size);
+    slab->next = msg_slabs;
+    slab->size = size;
+    msg_slabs = slab;
+    svs.msg_ref_slabs++;
+
+    data = (byte *)(slab + 1);
+    for (i = 0; i < size / blocksize; i++) {
+        block = (msgblock_t *)(data + i * blocksize);
+        block->next = msg_free_blocks[sizeclass];
+        msg_free_blocks[sizeclass] = block;
+    }
+}
+
+static message_ref_t *alloc_msg_ref(size_t len)
+{
+    size_t      size = sizeof(message_ref_t) + len - 1;
+    unsigned    sizeclass = 0;
+    msgblock_t  *block;
+
+    while (size > 1 << (sizeclass + MSG_REF_SHIFT))
+        sizeclass++;
+    Q_assert(sizeclass < MSG_REF_CLASSES);
+
+    if (!msg_free_blocks[sizeclass])
+        grow_msg_pool(sizeclass, 1);
+
+    block = msg_free_blocks[sizeclass];
+    msg_free_blocks[sizeclass] = block->next;
+    block->ref.sizeclass = sizeclass;
+    svs.msg_ref_allocs++;
+
+    return &block->ref;
+}
+
+static void free_msg_ref(message_ref_t *ref)
+{
+    msgblock_t *block = (msgblock_t *)ref;
+    unsigned sizeclass = ref->sizeclass;
+
+    block->next = msg_free_blocks[sizeclass];
+    msg_free_blocks[sizeclass] = block;
+}
+
+/*
+================
+SV_InitMessagePool
+
+Message packets for all clients are allocated at once. Size classes up to
+maximum packet length are preallocated with one block for each client, which
+covers a multicast received by everyone.
+================
+*/
+void SV_InitMessagePool(void)
+{
+    unsigned i;
+
+    svs.msg_pool = SV_Malloc(sizeof(svs.msg_pool[0]) * MSG_POOLSIZE * sv_maxclients->integer);
+
+    for (i = 0; i < MSG_REF_CLASSES; i++) {
+        if (1 << (i + MSG_REF_SHIFT) > MAX_PACKETLEN_DEFAULT)
+            break;
+        grow_msg_pool(i, sv_maxclients->integer);
+    }
+}
+
+void SV_FreeMessagePool(void)
+{
+    msgslab_t *slab, *next;
+
+    for (slab = msg_slabs; slab; slab = next) {
+        next = slab->next;
+        Z_Free(slab);
+    }
+
+    msg_slabs = NULL;
+    memset(msg_free_blocks, 0, sizeof(msg_free_blocks));
+    Z_Freep((void **)&svs.msg_pool);
+}
+
+static inline byte *msg_data(message_packet_t *msg)
+{
+    return msg->cursize > MSG_TRESHOLD ? msg->ref->data : msg->data;
+}
+
 static inline void free_msg_packet(client_t *client, message_packet_t *msg)
 {
     List_Remove(&msg->entry);
@@ -437,10 +632,33 @@ static inline void free_msg_packet(client_t *client, message_packet_t *msg)
     if (msg->cursize > MSG_TRESHOLD) {
         Q_assert(msg->cursize <= client->msg_dynamic_bytes);
         client->msg_dynamic_bytes -= msg->cursize;
-        Z_Free(msg);
+        if (!--msg->ref->refcount)
+            free_msg_ref(msg->ref);
+    }
+
+    List_Insert(&client->msg_free_list, &msg->entry);
+}
+
+static message_ref_t *ref_msg_data(byte *data, size_t len)
+{
+    message_ref_t *ref;
+
+    // multicast data is copied only once
+    if (msg_sharing && data == msg_write.data) {
+        if (msg_shared_ref) {
+            svs.msg_bytes_shared += len;
+            msg_shared_ref->refcount++;
+            return msg_shared_ref;
+        }
+        ref = msg_shared_ref = alloc_msg_ref(len);
     } else {
-        List_Insert(&client->msg_free_list, &msg->entry);
+        ref = alloc_msg_ref(len);
     }
+
+    svs.msg_bytes_copied += len;
+    memcpy(ref->data, data, len);
+    ref->refcount = 1;
+    return ref;
 }
 
 #define FOR_EACH_MSG_SAFE(list) \
@@ -475,25 +693,28 @@ static void add_msg_packet(client_t     *client,
 
     Q_assert(len <= MAX_MSGLEN);
 
+    if (len > MSG_TRESHOLD && client->msg_dynamic_bytes > MAX_MSGLEN - len) {
+        Com_WPrintf("%s: %s: out of dynamic memory\n",
+                    __func__, client->name);
+        goto overflowed;
+    }
+
+    if (LIST_EMPTY(&client->msg_free_list)) {
+        Com_WPrintf("%s: %s: out of message slots\n",
+                    __func__, client->name);
+        goto overflowed;
+    }
+
+    msg = MSG_FIRST(&client->msg_free_list);
+    List_Remove(&msg->entry);
+
     if (len > MSG_TRESHOLD) {
-        if (client->msg_dynamic_bytes > MAX_MSGLEN - len) {
-            Com_WPrintf("%s: %s: out of dynamic memory\n",
-                        __func__, client->name);
-            goto overflowed;
-        }
-        msg = SV_Malloc(sizeof(*msg) + len - MSG_TRESHOLD);
+        msg->ref = ref_msg_data(data, len);
         client->msg_dynamic_bytes += len;
     } else {
-        if (LIST_EMPTY(&client->msg_free_list)) {
-            Com_WPrintf("%s: %s: out of message slots\n",
-                        __func__, client->name);
-            goto overflowed;
-        }
-        msg = MSG_FIRST(&client->msg_free_list);
-        List_Remove(&msg->entry);
+        memcpy(msg->data, data, len);
+        svs.msg_bytes_copied += len;
     }
-
-    memcpy(msg->data, data, len);
     msg->cursize = (uint16_t)len;
 
     if (reliable) {
@@ -583,7 +804,7 @@ static inline void write_msg(client_t *client, message_packet_t *msg, size_t max
 {
     // if this msg fits, write it
     if (msg_write.cursize + msg->cursize <= maxsize) {
-        MSG_WriteData(msg->data, msg->cursize);
+        MSG_WriteData(msg_data(msg), msg->cursize);
     }
     free_msg_packet(client, msg);
 }
@@ -609,6 +830,62 @@ FRAME UPDATES - OLD NETCHAN
 ===============================================================================
 */
 
+// returns frame compressed in advance by a worker thread, if any
+static int write_frame(client_t *client, const byte **zdata)
+{
+    uint64_t start;
+
+    *zdata = NULL;
+
+    if (client->frame_build)
+        return SV_WriteBuiltFrame(client, zdata);
+
+    start = SV_ProfileBegin();
+    client->WriteFrame(client);
+    SV_ProfileEndClient(PROF_ENCODE, client, start);
+    return 0;
+}
+
+// space left for the frame in the next datagram
+static size_t frame_space_old(client_t *client)
+{
+    message_packet_t *msg;
+    size_t maxsize;
+
+    // determine how much space is left for unreliable data
+    maxsize = client->netchan.maxpacketlen;
+    if (client->netchan.reliable_length) {
+        // there is still unacked reliable message pending
+        maxsize -= client->netchan.reliable_length;
+    } else {
+        // find at least one reliable message to send
+        // and make sure to reserve space for it
+        if (!LIST_EMPTY(&client->msg_reliable_list)) {
+            msg = MSG_FIRST(&client->msg_reliable_list);
+            maxsize -= msg->cursize;
+        }
+    }
+    Q_assert(maxsize <= client->netchan.maxpacketlen);
+
+    return maxsize;
+}
+
+/*
+=======================
+SV_FrameCompressLimit
+
+Returns maximum frame size that doesn't need compression for the next
+datagram, or 0 if frames are never compressed for this client.
+=======================
+*/
+size_t SV_FrameCompressLimit(client_t *client)
+{
+    if (!client->has_zlib || client->netchan.type != NETCHAN_OLD)
+        return 0;
+
+    return frame_space_old(client);
+}
+
 static void add_message_old(client_t *client, byte *data,
                             size_t len, bool reliable)
 {
@@ -651,7 +928,7 @@ static void write_reliables_old(client_t *client, size_t maxsize)
         SV_DPrintf(1, "%s to %s: writing msg %d: %d bytes\n",
                    __func__, client->name, count, msg->cursize);
 
-        SZ_Write(&client->netchan.message, msg->data, msg->cursize);
+        SZ_Write(&client->netchan.message, msg_data(msg), msg->cursize);
         free_msg_packet(client, msg);
         count++;
     }
@@ -668,13 +945,13 @@ static void repack_unreliables(client_t *client, size_t maxsize)
 
     // temp entities first
     FOR_EACH_MSG_SAFE(&client->msg_unreliable_list) {
-        if (!msg->cursize || msg->data[0] != svc_temp_entity) {
+        if (!msg->cursize || msg_data(msg)[0] != svc_temp_entity) {
             continue;
         }
         // ignore some low-priority effects, these checks come from r1q2
-        if (msg->data[1] == TE_BLOOD || msg->data[1] == TE_SPLASH ||
-            msg->data[1] == TE_GUNSHOT || msg->data[1] == TE_BULLET_SPARKS ||
-            msg->data[1] == TE_SHOTGUN) {
+        if (msg_data(msg)[1] == TE_BLOOD || msg_data(msg)[1] == TE_SPLASH ||
+            msg_data(msg)[1] == TE_GUNSHOT || msg_data(msg)[1] == TE_BULLET_SPARKS ||
+            msg_data(msg)[1] == TE_SHOTGUN) {
             continue;
         }
         write_msg(client, msg, maxsize);
@@ -697,7 +974,7 @@ static void repack_unreliables(client_t *client, size_t maxsize)
 
     // then positioned sounds
     FOR_EACH_MSG_SAFE(&client->msg_unreliable_list) {
-        if (msg->cursize && msg->data[0] == svc_sound) {
+        if (msg->cursize && msg_data(msg)[0] == svc_sound) {
             write_msg(client, msg, maxsize);
         }
     }
@@ -716,42 +993,34 @@ static void repack_unreliables(client_t *client, size_t maxsize)
 
 static void write_datagram_old(client_t *client)
 {
-    message_packet_t *msg;
+    const byte *zdata;
     size_t maxsize, cursize;
+    int zlen;
 
-    // determine how much space is left for unreliable data
-    maxsize = client->netchan.maxpacketlen;
-    if (client->netchan.reliable_length) {
-        // there is still unacked reliable message pending
-        maxsize -= client->netchan.reliable_length;
-    } else {
-        // find at least one reliable message to send
-        // and make sure to reserve space for it
-        if (!LIST_EMPTY(&client->msg_reliable_list)) {
-            msg = MSG_FIRST(&client->msg_reliable_list);
-            maxsize -= msg->cursize;
-        }
-    }
-    Q_assert(maxsize <= client->netchan.maxpacketlen);
+    maxsize = frame_space_old(client);
 
     // send over all the relevant entity_state_t
     // and the player_state_t
-    client->WriteFrame(client);
+    zlen = write_frame(client, &zdata);
     if (msg_write.cursize > maxsize) {
         size_t size = msg_write.cursize;
         int len = 0;
 
         // try to compress if it has a chance to fit
         // assume it can be compressed by at least 20%
-        if (size - size / 5 < maxsize)
-            len = compress_message(client);
+        if (zdata) {
+            len = zlen;
+        } else if (size - size / 5 < maxsize) {
+            len = compress_message(client, false);
+            zdata = get_compressed_data();
+        }
 
         SZ_Clear(&msg_write);
 
         if (len > 0 && len <= maxsize) {
             SV_DPrintf(0, "Frame %d compressed for %s: %zu into %d\n",
                        client->framenum, client->name, size, len);
-            SZ_Write(&msg_write, get_compressed_data(), len);
+            SZ_Write(&msg_write, zdata, len);
         } else {
             SV_DPrintf(0, "Frame %d overflowed for %s: %zu > %zu (comp %d)\n",
                        client->framenum, client->name, size, maxsize, len);
@@ -808,6 +1077,7 @@ static void add_message_new(client_t *client, byte *data,
     if (reliable) {
         // don't packetize, netchan level will do fragmentation as needed
         SZ_Write(&client->netchan.message, data, len);
+        svs.msg_bytes_copied += len;
     } else {
         // still have to packetize, relative sounds need special processing
         add_msg_packet(client, data, len, false);
@@ -816,11 +1086,12 @@ static void add_message_new(client_t *client, byte *data,
 
 static void write_datagram_new(client_t *client)
 {
+    const byte *zdata;
     size_t cursize;
 
     // send over all the relevant entity_state_t
     // and the player_state_t
-    client->WriteFrame(client);
+    write_frame(client, &zdata);
 
     if (msg_write.overflowed) {
         // should never really happen
@@ -894,18 +1165,59 @@ static void check_key_sync(client_t *client)
 }
 #endif
 
+static client_t *frame_queue[MAX_CLIENTS];
+static int frame_queued;
+
+// build and write frames for queued clients, in order
+static void flush_frame_queue(void)
+{
+    client_t    *client;
+    int         i;
+
+    if (!frame_queued)
+        return;
+
+    SV_BuildClientFrames(frame_queue, frame_queued);
+
+    for (i = 0; i < frame_queued; i++) {
+        client = frame_queue[i];
+        if (SV_BuiltFrameOverflowed(client)) {
+            SV_DropClient(client, "frame overflowed");
+            SV_ClearEntityIndex();
+            continue;
+        }
+        client->WriteDatagram(client);
+        client->framenum++;
+        finish_frame(client);
+    }
+
+    frame_queued = 0;
+}
+
 /*
 =======================
 SV_SendClientMessages
 
 Called each game frame, sends svc_frame messages to spawned clients only.
 Clients in earlier connection state are handled in SV_SendAsyncPackets.
+
+With sv_parallel_frames enabled, frames are built and encoded on worker
+threads. Anything that may change game state for other clients (dropping a
+client) flushes the queue first to keep the output identical.
 =======================
 */
 void SV_SendClientMessages(void)
 {
     client_t    *client;
     size_t      cursize;
+    uint64_t    start;
+    bool        parallel = sv_parallel_frames->integer > 0;
+
+    // entities were moved by the game since last time
+    SV_ClearEntityIndex();
+
+    // queue datagrams and send them all at once
+    NET_BeginBatch();
 
     // send a message to each connected client
     FOR_EACH_CLIENT(client) {
@@ -923,8 +1235,10 @@ void SV_SendClientMessages(void)
         // if the reliable message overflowed,
         // drop the client (should never happen)
         if (client->netchan.message.overflowed) {
+            flush_frame_queue();
             SZ_Clear(&client->netchan.message);
             SV_DropClient(client, "reliable message overflowed");
+            SV_ClearEntityIndex();
             goto finish;
         }
 
@@ -940,8 +1254,17 @@ void SV_SendClientMessages(void)
             goto advance;
         }
 
+        // build the new frame and write it later
+        if (parallel && client->edict->client) {
+            frame_queue[frame_queued++] = client;
+            continue;
+        }
+
         // build the new frame and write it
+        flush_frame_queue();
+        start = SV_ProfileBegin();
         SV_BuildClientFrame(client);
+        SV_ProfileEndClient(PROF_BUILD, client, start);
         client->WriteDatagram(client);
 
 advance:
@@ -952,6 +1275,58 @@ finish:
         // clear all unreliable messages still left
         finish_frame(client);
     }
+
+    flush_frame_queue();
+
+    NET_EndBatch();
+
+    svs.msg_frames++;
+}
+
+/*
+=================
+SV_MsgStats_f
+
+Shows how much message data is copied into client queues per frame, how
+much more would have been copied without sharing multicast data, and how
+many packet entities were reused for clients with the same view. Also shows
+how much time was spent compressing messages and saved by reusing
+compressed reliable messages.
+=================
+*/
+void SV_MsgStats_f(void)
+{
+    unsigned frames = max(svs.msg_frames, 1);
+
+    Com_Printf("%u frames\n"
+               "%"PRIu64" bytes/frame copied\n"
+               "%"PRIu64" bytes/frame shared\n"
+               "%"PRIu64" bytes/frame would be copied without sharing\n",
+               svs.msg_frames, svs.msg_bytes_copied / frames,
+               svs.msg_bytes_shared / frames,
+               (svs.msg_bytes_copied + svs.msg_bytes_shared) / frames);
+    Com_Printf("%u packet entities encoded, %u reused for same view\n",
+               svs.pe_encoded, svs.pe_shared);
+    Com_Printf("%u message data blocks taken from pool, %u slabs allocated\n",
+               svs.msg_ref_allocs, svs.msg_ref_slabs);
+#if USE_ZLIB
+    Com_Printf("%u messages compressed in %"PRIu64" usec\n"
+               "%u compressed messages reused, saving %"PRIu64" usec\n"
+               "%u frames compressed on worker threads\n",
+               svs.z_messages, svs.z_usec, svs.z_cache_hits,
+               svs.z_saved_usec, svs.z_frames);
+#endif
+
+    if (!strcmp(Cmd_Argv(1), "reset")) {
+        svs.msg_bytes_copied = svs.msg_bytes_shared = 0;
+        svs.msg_frames = 0;
+        svs.pe_encoded = svs.pe_shared = 0;
+        svs.msg_ref_allocs = 0;
+#if USE_ZLIB
+        svs.z_usec = svs.z_saved_usec = 0;
+        svs.z_messages = svs.z_cache_hits = svs.z_frames = 0;
+#endif
+    }
 }
 
 static void write_pending_download(client_t *client)
@@ -1061,7 +1436,7 @@ void SV_InitClientSend(client_t *newcl)
     List_Init(&newcl->msg_unreliable_list);
     List_Init(&newcl->msg_reliable_list);
 
-    newcl->msg_pool = SV_Malloc(sizeof(newcl->msg_pool[0]) * MSG_POOLSIZE);
+    newcl->msg_pool = svs.msg_pool + (newcl - svs.client_pool) * MSG_POOLSIZE;
     for (i = 0; i < MSG_POOLSIZE; i++) {
         List_Append(&newcl->msg_free_list, &newcl->msg_pool[i].entry);
     }
@@ -1080,7 +1455,7 @@ void SV_ShutdownClientSend(client_t *client)
 {
     free_all_messages(client);
 
-    Z_Freep((void**)&client->msg_pool);
+    client->msg_pool = NULL;
     List_Init(&client->msg_free_list);
 }
 
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shared/list.h"
 #include "shared/game.h"
 
+#include "common/async.h"
 #include "common/bsp.h"
 #include "common/cmd.h"
 #include "common/cmodel.h"
@@ -110,11 +111,18 @@ typedef struct {
     byte        areabits[MAX_MAP_AREA_BYTES];  // portalarea visibility bits
     unsigned    sentTime;                   // for ping calculations
     int         latency;
+    uint64_t    hash;                       // of entity states, 0 if unknown
 } client_frame_t;
 
 typedef struct {
     int         solid32;
 
+    // fields traces depend on that the game may change without relinking,
+    // as last seen by the trace cache
+    edict_t     *trace_owner;
+    int         trace_solid;
+    int         trace_svflags;
+
 #if USE_FPS
 
 // must be > MAX_FRAMEDIV
@@ -230,11 +238,26 @@ typedef enum {
 
 #define MAX_SOUND_PACKET   14
 
+// data of messages larger than MSG_TRESHOLD is allocated from server-wide
+// pool in power of two size classes, starting from 64 bytes
+#define MSG_REF_SHIFT       6
+#define MSG_REF_CLASSES     12
+#define MSG_SLAB_SIZE       0x10000
+
+// data of messages larger than MSG_TRESHOLD, shared by all clients
+// receiving the same multicast
+typedef struct {
+    unsigned            refcount;
+    unsigned            sizeclass;
+    uint8_t             data[1];
+} message_ref_t;
+
 typedef struct {
     list_t              entry;
     uint16_t            cursize;    // zero means sound packet
     union {
         uint8_t         data[MSG_TRESHOLD];
+        message_ref_t   *ref;       // cursize > MSG_TRESHOLD
         struct {
             uint16_t    index;
             uint16_t    sendchan;
@@ -354,8 +377,14 @@ typedef struct client_s {
     unsigned            msg_unreliable_bytes;   // total size of unreliable datagram
     unsigned            msg_dynamic_bytes;      // total size of dynamic memory allocated
 
+    // leaf containing edict origin, cached for multicasts
+    mleaf_t             *leaf;
+    vec3_t              leaf_origin;
+    int                 leaf_spawncount;
+
     // per-client baseline chunks
     entity_packed_t     *baselines[SV_BASELINES_CHUNKS];
+    uint64_t            baselines_hash;
 
     // server state pointers (hack for MVD channels implementation)
     configstring_t      *configstrings;
@@ -372,6 +401,9 @@ typedef struct client_s {
     void            (*WriteFrame)(struct client_s *);
     void            (*WriteDatagram)(struct client_s *);
 
+    // frame built by SV_BuildClientFrames, pending write
+    struct frame_build_s    *frame_build;
+
     // netchan
     netchan_t       netchan;
     int             numpackets; // for that nasty packetdup hack
@@ -484,6 +516,13 @@ typedef struct server_static_s {
     z_stream        z;  // for compressing messages at once
     byte            *z_buffer;
     size_t          z_buffer_size;
+
+    // compression statistics
+    uint64_t        z_usec;         // time spent compressing on main thread
+    uint64_t        z_saved_usec;   // time saved by compressed message cache
+    unsigned        z_messages;     // compressed on main thread
+    unsigned        z_cache_hits;
+    unsigned        z_frames;       // compressed on worker threads
 #endif
 
     cs_remap_t      csr;
@@ -498,6 +537,22 @@ typedef struct server_static_s {
     ratelimit_t     ratelimit_rcon;
 
     challenge_t     challenges[MAX_CHALLENGES]; // to prevent invalid IPs from connecting
+
+    // message data copied into and shared between client queues
+    uint64_t        msg_bytes_copied;
+    uint64_t        msg_bytes_shared;
+    unsigned        msg_frames;
+
+    // packet entities blocks encoded and reused for clients with same view
+    unsigned        pe_encoded;
+    unsigned        pe_shared;
+
+    // message packets of all clients, MSG_POOLSIZE per client
+    message_packet_t    *msg_pool;
+
+    // message data blocks taken from pool and slabs allocated for them
+    unsigned        msg_ref_allocs;
+    unsigned        msg_ref_slabs;
 } server_static_t;
 
 //=============================================================================
@@ -542,6 +597,12 @@ extern cvar_t       *sv_calcpings_method;
 extern cvar_t       *sv_changemapcmd;
 extern cvar_t       *sv_max_download_size;
 extern cvar_t       *sv_max_packet_entities;
+extern cvar_t       *sv_parallel_frames;
+#if USE_ZLIB
+extern cvar_t       *sv_compress_level;
+#endif
+extern cvar_t       *sv_entity_index;
+extern cvar_t       *sv_share_entities;
 
 extern cvar_t       *sv_strafejump_hack;
 #if USE_PACKETDUP
@@ -598,6 +659,8 @@ int SV_CountClients(void);
 #if USE_ZLIB
 voidpf SV_zalloc(voidpf opaque, uInt items, uInt size);
 void SV_zfree(voidpf opaque, voidpf address);
+void SV_InitDeflate(z_stream *z);
+int SV_CompressMessage(z_stream *z, byte *out, size_t size, const byte *in, size_t len);
 #endif
 
 void sv_sec_timeout_changed(cvar_t *self);
@@ -636,8 +699,13 @@ void SV_BroadcastPrintf(int level, const char *fmt, ...) q_printf(2, 3);
 void SV_ClientCommand(client_t *cl, const char *fmt, ...) q_printf(2, 3);
 void SV_BroadcastCommand(const char *fmt, ...) q_printf(1, 2);
 void SV_ClientAddMessage(client_t *client, int flags);
+void SV_MsgStats_f(void);
+void SV_ClearCompressCache(void);
+size_t SV_FrameCompressLimit(client_t *client);
 void SV_ShutdownClientSend(client_t *client);
 void SV_InitClientSend(client_t *newcl);
+void SV_InitMessagePool(void);
+void SV_FreeMessagePool(void);
 
 //
 // sv_mvd.c
@@ -760,6 +828,23 @@ void SV_PrintMiscInfo(void);
 void SV_BuildClientFrame(client_t *client);
 void SV_WriteFrameToClient_Default(client_t *client);
 void SV_WriteFrameToClient_Enhanced(client_t *client);
+void SV_BuildClientFrames(client_t **clients, int count);
+bool SV_BuiltFrameOverflowed(client_t *client);
+int SV_WriteBuiltFrame(client_t *client, const byte **zdata);
+void SV_FreeFrameBuilds(void);
+void SV_ClearEntityIndex(void);
+uint64_t SV_HashEntities(uint64_t hash, const entity_packed_t *ents, int count);
+
+typedef struct {
+    unsigned    views;
+    unsigned    entities;
+    unsigned    mismatches;
+    unsigned    scan_msec;
+    unsigned    index_msec;
+} sv_visbench_t;
+
+void SV_BenchEntityIndex(sv_visbench_t *bench, const game_export_t *ge, cm_t *cm,
+                         const cs_remap_t *csr, player_state_t **views, int numviews, int repeat);
 
 //
 // sv_game.c
@@ -783,12 +868,55 @@ void SV_CheckForEnhancedSavegames(void);
 void SV_RegisterSavegames(void);
 bool SV_NoSaveGames(void);
 
+//
+// profile.c
+//
+typedef enum {
+    PROF_TICK,      // whole game frame
+    PROF_PACKETS,   // reading packets
+    PROF_ASYNC,     // anticheat, MVD clients, connecting clients
+    PROF_GAME,      // ge->RunFrame
+    PROF_MVD,       // MVD recording
+    PROF_SEND,      // sending frames to all clients
+    PROF_BUILD,     // building one client frame
+    PROF_ENCODE,    // encoding one client frame
+
+    PROF_NUM_STAGES
+} sv_profstage_t;
+
+extern bool sv_profiling;
+
+void SV_ProfileSample(sv_profstage_t stage, int client, uint64_t start, uint64_t end);
+void SV_RegisterProfile(void);
+
+static inline uint64_t SV_ProfileBegin(void)
+{
+    return sv_profiling ? Sys_Microseconds() : 0;
+}
+
+static inline void SV_ProfileEnd(sv_profstage_t stage, uint64_t start)
+{
+    if (start)
+        SV_ProfileSample(stage, -1, start, Sys_Microseconds());
+}
+
+static inline void SV_ProfileEndClient(sv_profstage_t stage, const client_t *client, uint64_t start)
+{
+    if (start)
+        SV_ProfileSample(stage, client->number, start, Sys_Microseconds());
+}
+
 //============================================================
 
 //
 // high level object sorting to reduce interaction tests
 //
 
+void SV_RegisterWorld(void);
+void SV_FreeWorld(void);
+void SV_SetBroadphase(bool bvh);
+void SV_InvalidateTraceCache(void);
+
 void SV_ClearWorld(void);
 // called after the world model has been loaded, before linking any entities
 
@@ -834,3 +962,6 @@ trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
 
+void SV_TraceBatch(const trace_request_t *requests, trace_t *results, int count);
+// runs independent traces sorted for BSP locality, results are in request order
+
@@ -87,6 +87,16 @@ static void SV_CreateBaselines(void)
             base->solid = sv.entities[i].solid32;
         }
     }
+
+    // clients with identical baselines can share packet entities
+    sv_client->baselines_hash = 0;
+    for (i = 0; i < SV_BASELINES_CHUNKS; i++) {
+        base = sv_client->baselines[i];
+        if (base) {
+            sv_client->baselines_hash = SV_HashEntities(sv_client->baselines_hash ^ i,
+                                                        base, SV_BASELINES_PER_CHUNK);
+        }
+    }
 }
 
 static void maybe_flush_msg(size_t size)
@@ -47,6 +47,8 @@ static edict_t      **area_list;
 static int          area_count, area_maxcount;
 static int          area_type;
 
+static void SV_CheckTraceDeps(edict_t *ent);
+
 /*
 ===============
 SV_CreateAreaNode
@@ -93,17 +95,416 @@ static areanode_t *SV_CreateAreaNode(int depth, const vec3_t mins, const vec3_t
 }
 
 /*
-===============
-SV_ClearWorld
+===============================================================================
 
-===============
+DYNAMIC AABB TREE
+
+Alternative to the areanode tree, selected by sv_broadphase. Each linked
+entity is a leaf holding its absolute box fattened by AREA_BVH_MARGIN, so
+small moves don't change the tree. Leaves are inserted next to the sibling
+that increases total surface area the least, and the tree is kept balanced
+with rotations. Unlike the areanode tree, large entities don't end up in a
+single list that every query has to walk.
+===============================================================================
 */
-void SV_ClearWorld(void)
-{
-    mmodel_t *cm;
+
+#define AREA_BVH_MARGIN     8.0f
+#define AREA_BVH_NULL       -1
+#define AREA_BVH_STACK      128
+
+typedef struct {
+    vec3_t  mins, maxs;
+    int     parent;         // next free node if free
+    int     children[2];    // AREA_BVH_NULL if leaf
+    int     height;         // 0 if leaf, -1 if free
     edict_t *ent;
+} areabvhnode_t;
+
+typedef struct {
+    areabvhnode_t   *nodes;
+    int             numnodes;
+    int             freenode;
+    int             root;
+} areabvh_t;
+
+static cvar_t       *sv_broadphase;
+static bool         sv_areabvh_enabled;
+static areabvh_t    sv_areabvh[2];      // solid and trigger edicts
+static list_t       sv_areabvh_edicts;  // only marks edicts as linked
+
+static struct {
+    int     leaf;       // leaf node + 1, 0 if not in tree
+    int     tree;
+} sv_areabvh_links[MAX_EDICTS];
+
+static inline float bvh_area(const vec3_t mins, const vec3_t maxs)
+{
+    float dx = maxs[0] - mins[0];
+    float dy = maxs[1] - mins[1];
+    float dz = maxs[2] - mins[2];
+
+    return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline void bvh_union_bounds(const areabvhnode_t *a, const areabvhnode_t *b, vec3_t mins, vec3_t maxs)
+{
+    for (int i = 0; i < 3; i++) {
+        mins[i] = min(a->mins[i], b->mins[i]);
+        maxs[i] = max(a->maxs[i], b->maxs[i]);
+    }
+}
+
+static inline float bvh_union_area(const areabvhnode_t *a, const areabvhnode_t *b)
+{
+    vec3_t mins, maxs;
+
+    bvh_union_bounds(a, b, mins, maxs);
+    return bvh_area(mins, maxs);
+}
+
+static inline void bvh_union(areabvhnode_t *node, const areabvhnode_t *a, const areabvhnode_t *b)
+{
+    bvh_union_bounds(a, b, node->mins, node->maxs);
+}
+
+static void bvh_clear(areabvh_t *tree)
+{
+    Z_Free(tree->nodes);
+    memset(tree, 0, sizeof(*tree));
+    tree->freenode = AREA_BVH_NULL;
+    tree->root = AREA_BVH_NULL;
+}
+
+static int bvh_alloc_node(areabvh_t *tree)
+{
+    areabvhnode_t *node;
+    int i, index;
+
+    if (tree->freenode == AREA_BVH_NULL) {
+        int oldnum = tree->numnodes;
+
+        tree->numnodes = max(oldnum * 2, 64);
+        if (tree->nodes)
+            tree->nodes = Z_Realloc(tree->nodes, sizeof(tree->nodes[0]) * tree->numnodes);
+        else
+            tree->nodes = SV_Malloc(sizeof(tree->nodes[0]) * tree->numnodes);
+        for (i = oldnum; i < tree->numnodes; i++) {
+            tree->nodes[i].parent = i + 1 < tree->numnodes ? i + 1 : AREA_BVH_NULL;
+            tree->nodes[i].height = -1;
+        }
+        tree->freenode = oldnum;
+    }
+
+    index = tree->freenode;
+    node = &tree->nodes[index];
+    tree->freenode = node->parent;
+    node->parent = AREA_BVH_NULL;
+    node->children[0] = node->children[1] = AREA_BVH_NULL;
+    node->height = 0;
+    node->ent = NULL;
+    return index;
+}
+
+static void bvh_free_node(areabvh_t *tree, int index)
+{
+    areabvhnode_t *node = &tree->nodes[index];
+
+    node->parent = tree->freenode;
+    node->height = -1;
+    tree->freenode = index;
+}
+
+// performs a left or right rotation if node A is imbalanced, returns new subtree root
+static int bvh_balance(areabvh_t *tree, int iA)
+{
+    areabvhnode_t *n = tree->nodes;
+    areabvhnode_t *A = &n[iA];
+    int iB, iC, iF, iG, side, balance;
+
+    if (A->height < 2)
+        return iA;
+
+    iB = A->children[0];
+    iC = A->children[1];
+    balance = n[iC].height - n[iB].height;
+
+    if (balance > 1) {
+        // rotate C up
+        side = 1;
+    } else if (balance < -1) {
+        // rotate B up
+        side = 0;
+        iC = iB;
+        iB = A->children[1];
+    } else {
+        return iA;
+    }
+
+    // C goes up, A becomes its child, the taller child of C stays with it
+    areabvhnode_t *B = &n[iB];
+    areabvhnode_t *C = &n[iC];
+
+    iF = C->children[0];
+    iG = C->children[1];
+
+    C->children[0] = iA;
+    C->parent = A->parent;
+    A->parent = iC;
+
+    if (C->parent != AREA_BVH_NULL) {
+        areabvhnode_t *P = &n[C->parent];
+        if (P->children[0] == iA)
+            P->children[0] = iC;
+        else
+            P->children[1] = iC;
+    } else {
+        tree->root = iC;
+    }
+
+    if (n[iF].height < n[iG].height) {
+        int t = iF;
+        iF = iG;
+        iG = t;
+    }
+
+    C->children[1] = iF;
+    A->children[side] = iG;
+    n[iG].parent = iA;
+
+    bvh_union(A, B, &n[iG]);
+    bvh_union(C, A, &n[iF]);
+    A->height = 1 + max(B->height, n[iG].height);
+    C->height = 1 + max(A->height, n[iF].height);
+
+    return iC;
+}
+
+// refits boxes and heights from index up to the root
+static void bvh_refit(areabvh_t *tree, int index)
+{
+    areabvhnode_t *n = tree->nodes;
+
+    while (index != AREA_BVH_NULL) {
+        index = bvh_balance(tree, index);
+
+        areabvhnode_t *node = &n[index];
+        areabvhnode_t *c0 = &n[node->children[0]];
+        areabvhnode_t *c1 = &n[node->children[1]];
+
+        node->height = 1 + max(c0->height, c1->height);
+        bvh_union(node, c0, c1);
+
+        index = node->parent;
+    }
+}
+
+static void bvh_insert_leaf(areabvh_t *tree, int leaf)
+{
+    areabvhnode_t *n, *node, *c0, *c1;
+    int index, sibling, oldparent, newparent;
+    float area, combined, cost, inherit, cost0, cost1;
+
+    if (tree->root == AREA_BVH_NULL) {
+        tree->root = leaf;
+        tree->nodes[leaf].parent = AREA_BVH_NULL;
+        return;
+    }
+
+    // find the best sibling by surface area heuristic
+    n = tree->nodes;
+    index = tree->root;
+    while (n[index].height > 0) {
+        node = &n[index];
+        c0 = &n[node->children[0]];
+        c1 = &n[node->children[1]];
+
+        area = bvh_area(node->mins, node->maxs);
+        combined = bvh_union_area(node, &n[leaf]);
+
+        // cost of creating a new parent for this node and the new leaf
+        cost = 2 * combined;
+
+        // minimum cost of pushing the leaf further down the tree
+        inherit = 2 * (combined - area);
+
+        cost0 = bvh_union_area(&n[leaf], c0) + inherit;
+        if (c0->height > 0)
+            cost0 -= bvh_area(c0->mins, c0->maxs);
+
+        cost1 = bvh_union_area(&n[leaf], c1) + inherit;
+        if (c1->height > 0)
+            cost1 -= bvh_area(c1->mins, c1->maxs);
+
+        if (cost < cost0 && cost < cost1)
+            break;
+
+        index = cost0 < cost1 ? node->children[0] : node->children[1];
+    }
+
+    sibling = index;
+
+    // create a new parent, may reallocate nodes
+    newparent = bvh_alloc_node(tree);
+    n = tree->nodes;
+
+    oldparent = n[sibling].parent;
+    n[newparent].parent = oldparent;
+    n[newparent].height = n[sibling].height + 1;
+    n[newparent].children[0] = sibling;
+    n[newparent].children[1] = leaf;
+    bvh_union(&n[newparent], &n[sibling], &n[leaf]);
+    n[sibling].parent = newparent;
+    n[leaf].parent = newparent;
+
+    if (oldparent != AREA_BVH_NULL) {
+        if (n[oldparent].children[0] == sibling)
+            n[oldparent].children[0] = newparent;
+        else
+            n[oldparent].children[1] = newparent;
+    } else {
+        tree->root = newparent;
+    }
+
+    bvh_refit(tree, oldparent);
+}
+
+static void bvh_remove_leaf(areabvh_t *tree, int leaf)
+{
+    areabvhnode_t *n = tree->nodes;
+    int parent, grandparent, sibling;
+
+    if (leaf == tree->root) {
+        tree->root = AREA_BVH_NULL;
+        return;
+    }
+
+    parent = n[leaf].parent;
+    grandparent = n[parent].parent;
+    sibling = n[parent].children[0] == leaf ? n[parent].children[1] : n[parent].children[0];
+
+    // replace parent with sibling
+    if (grandparent != AREA_BVH_NULL) {
+        if (n[grandparent].children[0] == parent)
+            n[grandparent].children[0] = sibling;
+        else
+            n[grandparent].children[1] = sibling;
+        n[sibling].parent = grandparent;
+        bvh_free_node(tree, parent);
+        bvh_refit(tree, grandparent);
+    } else {
+        tree->root = sibling;
+        n[sibling].parent = AREA_BVH_NULL;
+        bvh_free_node(tree, parent);
+    }
+}
+
+static void SV_UnlinkAreaBVH(edict_t *ent)
+{
+    int entnum = NUM_FOR_EDICT(ent);
+    int leaf = sv_areabvh_links[entnum].leaf - 1;
+    areabvh_t *tree = &sv_areabvh[sv_areabvh_links[entnum].tree];
+
+    if (leaf < 0)
+        return;
+
+    bvh_remove_leaf(tree, leaf);
+    bvh_free_node(tree, leaf);
+    sv_areabvh_links[entnum].leaf = 0;
+}
+
+static void SV_LinkAreaBVH(edict_t *ent)
+{
+    int entnum = NUM_FOR_EDICT(ent);
+    int type = ent->solid == SOLID_TRIGGER;
+    int leaf = sv_areabvh_links[entnum].leaf - 1;
+    areabvh_t *tree = &sv_areabvh[type];
+    areabvhnode_t *node;
     int i;
 
+    // still fits in the old fattened box?
+    if (leaf >= 0 && sv_areabvh_links[entnum].tree == type) {
+        node = &tree->nodes[leaf];
+        for (i = 0; i < 3; i++)
+            if (ent->absmin[i] < node->mins[i] || ent->absmax[i] > node->maxs[i])
+                break;
+        if (i == 3)
+            return;
+    }
+
+    SV_UnlinkAreaBVH(ent);
+
+    leaf = bvh_alloc_node(tree);
+    node = &tree->nodes[leaf];
+    node->ent = ent;
+    for (i = 0; i < 3; i++) {
+        node->mins[i] = ent->absmin[i] - AREA_BVH_MARGIN;
+        node->maxs[i] = ent->absmax[i] + AREA_BVH_MARGIN;
+    }
+
+    bvh_insert_leaf(tree, leaf);
+    sv_areabvh_links[entnum].leaf = leaf + 1;
+    sv_areabvh_links[entnum].tree = type;
+}
+
+static void SV_AreaEdictsBVH(void)
+{
+    const areabvh_t *tree = &sv_areabvh[area_type != AREA_SOLID];
+    const areabvhnode_t *node;
+    int stack[AREA_BVH_STACK];
+    int depth = 0;
+    edict_t *check;
+
+    if (tree->root == AREA_BVH_NULL)
+        return;
+
+    stack[depth++] = tree->root;
+    while (depth) {
+        node = &tree->nodes[stack[--depth]];
+
+        if (node->mins[0] > area_maxs[0]
+            || node->mins[1] > area_maxs[1]
+            || node->mins[2] > area_maxs[2]
+            || node->maxs[0] < area_mins[0]
+            || node->maxs[1] < area_mins[1]
+            || node->maxs[2] < area_mins[2])
+            continue;
+
+        if (node->height > 0) {
+            if (depth + 2 > AREA_BVH_STACK) {
+                Com_WPrintf("SV_AreaEdicts: stack overflow\n");
+                return;
+            }
+            stack[depth++] = node->children[1];
+            stack[depth++] = node->children[0];
+            continue;
+        }
+
+        check = node->ent;
+        SV_CheckTraceDeps(check);
+        if (check->solid == SOLID_NOT)
+            continue;        // deactivated
+        if (check->absmin[0] > area_maxs[0]
+            || check->absmin[1] > area_maxs[1]
+            || check->absmin[2] > area_maxs[2]
+            || check->absmax[0] < area_mins[0]
+            || check->absmax[1] < area_mins[1]
+            || check->absmax[2] < area_mins[2])
+            continue;        // not touching
+
+        if (area_count == area_maxcount) {
+            Com_WPrintf("SV_AreaEdicts: MAXCOUNT\n");
+            return;
+        }
+
+        area_list[area_count] = check;
+        area_count++;
+    }
+}
+
+static void SV_ClearAreas(void)
+{
+    mmodel_t *cm;
+
     memset(sv_areanodes, 0, sizeof(sv_areanodes));
     sv_numareanodes = 0;
 
@@ -112,6 +513,202 @@ void SV_ClearWorld(void)
         SV_CreateAreaNode(0, cm->mins, cm->maxs);
     }
 
+    bvh_clear(&sv_areabvh[0]);
+    bvh_clear(&sv_areabvh[1]);
+    memset(sv_areabvh_links, 0, sizeof(sv_areabvh_links));
+    List_Init(&sv_areabvh_edicts);
+}
+
+/*
+===============================================================================
+
+TRACE CACHE
+
+Remembers results of traces and point contents queries made by the game,
+until the next server frame or until any entity is linked or unlinked.
+Lookups are hashed by quantized arguments, but arguments must match exactly
+for a hit.
+
+Traces also depend on owner, solid and svflags of entities, which the game
+may change without relinking. These are remembered per entity when it is
+linked, and the cache is flushed when an area query comes across an entity
+whose fields changed, or when a cached trace hit such an entity. A cached
+result can still be stale if the game changed an entity that the trace
+passed by, and no query has come across it since.
+
+===============================================================================
+*/
+
+#define TRACE_CACHE_SIZE    1024    // must be power of two
+#define POINT_CACHE_SIZE    1024    // must be power of two
+
+typedef struct {
+    unsigned    generation;
+    int         contentmask;
+    edict_t     *passedict;
+    edict_t     *passowner;
+    vec3_t      start, end;
+    vec3_t      mins, maxs;
+    trace_t     trace;
+} tracecache_t;
+
+typedef struct {
+    unsigned    generation;
+    int         contents;
+    vec3_t      point;
+} pointcache_t;
+
+static cvar_t       *sv_tracecache;
+static bool         sv_tracecache_enabled;
+static unsigned     sv_tracecache_generation = 1;
+static tracecache_t *sv_tracecache_traces;
+static pointcache_t *sv_tracecache_points;
+
+static struct {
+    uint64_t    tracehits, tracemisses;
+    uint64_t    pointhits, pointmisses;
+    unsigned    invalidations;
+} sv_tracecache_stats;
+
+static void SV_SaveTraceDeps(edict_t *ent)
+{
+    server_entity_t *sent = &sv.entities[NUM_FOR_EDICT(ent)];
+
+    sent->trace_owner = ent->owner;
+    sent->trace_solid = ent->solid;
+    sent->trace_svflags = ent->svflags;
+}
+
+static bool SV_TraceDepsChanged(edict_t *ent)
+{
+    server_entity_t *sent = &sv.entities[NUM_FOR_EDICT(ent)];
+
+    return sent->trace_owner != ent->owner ||
+           sent->trace_solid != ent->solid ||
+           sent->trace_svflags != ent->svflags;
+}
+
+// called for every entity area queries come across
+static void SV_CheckTraceDeps(edict_t *ent)
+{
+    if (sv_tracecache_enabled && SV_TraceDepsChanged(ent)) {
+        SV_SaveTraceDeps(ent);
+        SV_InvalidateTraceCache();
+    }
+}
+
+static uint32_t tracecache_hash(const vec_t *v, uint32_t hash)
+{
+    int i;
+
+    // quantize to 1/8 unit, exact comparison is done on lookup
+    for (i = 0; i < 3; i++)
+        hash = (hash ^ (uint32_t)(int)(v[i] * 8)) * 0x01000193;
+
+    return hash;
+}
+
+static tracecache_t *SV_TraceCacheEntry(const vec3_t start, const vec3_t mins,
+                                        const vec3_t maxs, const vec3_t end,
+                                        edict_t *passedict, int contentmask)
+{
+    uint32_t hash = 0x811c9dc5;
+
+    hash = tracecache_hash(start, hash);
+    hash = tracecache_hash(end, hash);
+    hash = tracecache_hash(mins, hash);
+    hash = tracecache_hash(maxs, hash);
+    hash = (hash ^ contentmask) * 0x01000193;
+    hash = (hash ^ (passedict ? NUM_FOR_EDICT(passedict) : -1)) * 0x01000193;
+    hash = (hash ^ (passedict && passedict->owner ? NUM_FOR_EDICT(passedict->owner) : -1)) * 0x01000193;
+
+    return &sv_tracecache_traces[hash & (TRACE_CACHE_SIZE - 1)];
+}
+
+static pointcache_t *SV_PointCacheEntry(const vec3_t p)
+{
+    return &sv_tracecache_points[tracecache_hash(p, 0x811c9dc5) & (POINT_CACHE_SIZE - 1)];
+}
+
+/*
+===============
+SV_InvalidateTraceCache
+
+Called when entities are linked or unlinked and before each game frame.
+===============
+*/
+void SV_InvalidateTraceCache(void)
+{
+    if (!sv_tracecache_enabled)
+        return;
+
+    sv_tracecache_stats.invalidations++;
+    if (++sv_tracecache_generation)
+        return;
+
+    // wrapped around, start over
+    memset(sv_tracecache_traces, 0, sizeof(sv_tracecache_traces[0]) * TRACE_CACHE_SIZE);
+    memset(sv_tracecache_points, 0, sizeof(sv_tracecache_points[0]) * POINT_CACHE_SIZE);
+    sv_tracecache_generation = 1;
+}
+
+static void SV_EnableTraceCache(bool enable)
+{
+    Z_Freep((void **)&sv_tracecache_traces);
+    Z_Freep((void **)&sv_tracecache_points);
+
+    if (enable) {
+        sv_tracecache_traces = SV_Mallocz(sizeof(sv_tracecache_traces[0]) * TRACE_CACHE_SIZE);
+        sv_tracecache_points = SV_Mallocz(sizeof(sv_tracecache_points[0]) * POINT_CACHE_SIZE);
+    }
+
+    sv_tracecache_generation = 1;
+    sv_tracecache_enabled = enable;
+}
+
+static void sv_tracecache_changed(cvar_t *self)
+{
+    SV_EnableTraceCache(self->integer > 0);
+}
+
+static void SV_TraceCache_f(void)
+{
+    uint64_t traces = sv_tracecache_stats.tracehits + sv_tracecache_stats.tracemisses;
+    uint64_t points = sv_tracecache_stats.pointhits + sv_tracecache_stats.pointmisses;
+
+    if (!sv_tracecache_enabled) {
+        Com_Printf("Trace cache is disabled.\n");
+        return;
+    }
+
+    Com_Printf("Traces: %"PRIu64" hits of %"PRIu64" (%.1f%%)\n",
+               sv_tracecache_stats.tracehits, traces,
+               traces ? sv_tracecache_stats.tracehits * 100.0 / traces : 0.0);
+    Com_Printf("Point contents: %"PRIu64" hits of %"PRIu64" (%.1f%%)\n",
+               sv_tracecache_stats.pointhits, points,
+               points ? sv_tracecache_stats.pointhits * 100.0 / points : 0.0);
+    Com_Printf("Invalidations: %u\n", sv_tracecache_stats.invalidations);
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+        memset(&sv_tracecache_stats, 0, sizeof(sv_tracecache_stats));
+}
+
+/*
+===============
+SV_ClearWorld
+
+===============
+*/
+void SV_ClearWorld(void)
+{
+    edict_t *ent;
+    int i;
+
+    sv_areabvh_enabled = sv_broadphase->integer > 0;
+    SV_ClearAreas();
+
+    SV_EnableTraceCache(sv_tracecache->integer > 0);
+
     // make sure all entities are unlinked
     for (i = 0; i < ge->max_edicts; i++) {
         ent = EDICT_NUM(i);
@@ -136,6 +733,8 @@ void SV_LinkEdict(cm_t *cm, edict_t *ent)
     int         area;
     mnode_t     *topnode;
 
+    SV_InvalidateTraceCache();
+
     // set the size
     VectorSubtract(ent->maxs, ent->mins, ent->size);
 
@@ -232,6 +831,72 @@ void PF_UnlinkEdict(edict_t *ent)
         return;        // not linked in anywhere
     List_Remove(&ent->area);
     ent->area.prev = ent->area.next = NULL;
+    if (sv_areabvh_enabled)
+        SV_UnlinkAreaBVH(ent);
+    SV_InvalidateTraceCache();
+}
+
+// links solid entity into the area tree
+static void SV_LinkArea(edict_t *ent)
+{
+    areanode_t *node;
+
+    if (sv_areabvh_enabled) {
+        SV_LinkAreaBVH(ent);
+        List_Append(&sv_areabvh_edicts, &ent->area);
+        return;
+    }
+
+// find the first node that the ent's box crosses
+    node = sv_areanodes;
+    while (1) {
+        if (node->axis == -1)
+            break;
+        if (ent->absmin[node->axis] > node->dist)
+            node = node->children[0];
+        else if (ent->absmax[node->axis] < node->dist)
+            node = node->children[1];
+        else
+            break;        // crosses the node
+    }
+
+    // link it in
+    if (ent->solid == SOLID_TRIGGER)
+        List_Append(&node->trigger_edicts, &ent->area);
+    else
+        List_Append(&node->solid_edicts, &ent->area);
+}
+
+/*
+===============
+SV_SetBroadphase
+
+Moves all linked entities into areanode tree or dynamic AABB tree.
+===============
+*/
+void SV_SetBroadphase(bool bvh)
+{
+    static edict_t *linked[MAX_EDICTS];
+    edict_t *ent;
+    int i, count;
+
+    if (!ge || !ge->edicts || !sv.cm.cache || bvh == sv_areabvh_enabled)
+        return;
+
+    count = 0;
+    for (i = 1; i < ge->num_edicts; i++) {
+        ent = EDICT_NUM(i);
+        if (ent->area.prev) {
+            PF_UnlinkEdict(ent);
+            linked[count++] = ent;
+        }
+    }
+
+    sv_areabvh_enabled = bvh;
+    SV_ClearAreas();
+
+    for (i = 0; i < count; i++)
+        SV_LinkArea(linked[i]);
 }
 
 static uint32_t SV_PackSolid32(edict_t *ent)
@@ -266,7 +931,6 @@ static uint32_t SV_PackSolid32(edict_t *ent)
 
 void PF_LinkEdict(edict_t *ent)
 {
-    areanode_t *node;
     server_entity_t *sent;
     int entnum;
 #if USE_FPS
@@ -276,8 +940,15 @@ void PF_LinkEdict(edict_t *ent)
     if (!ent)
         Com_Error(ERR_DROP, "%s: NULL", __func__);
 
-    if (ent->area.prev)
-        PF_UnlinkEdict(ent);     // unlink from old position
+    if (ent->area.prev) {
+        // keep dynamic tree leaf, it will be reused if the entity didn't move far
+        if (sv_areabvh_enabled && ent->inuse && ent->solid != SOLID_NOT) {
+            List_Remove(&ent->area);
+            ent->area.prev = ent->area.next = NULL;
+        } else {
+            PF_UnlinkEdict(ent);     // unlink from old position
+        }
+    }
 
     if (ent == ge->edicts)
         return;        // don't add the world
@@ -294,6 +965,8 @@ void PF_LinkEdict(edict_t *ent)
     entnum = NUM_FOR_EDICT(ent);
     sent = &sv.entities[entnum];
 
+    SV_SaveTraceDeps(ent);
+
     // encode the size into the entity_state for client prediction
     switch (ent->solid) {
     case SOLID_BBOX:
@@ -338,24 +1011,7 @@ void PF_LinkEdict(edict_t *ent)
     if (ent->solid == SOLID_NOT)
         return;
 
-// find the first node that the ent's box crosses
-    node = sv_areanodes;
-    while (1) {
-        if (node->axis == -1)
-            break;
-        if (ent->absmin[node->axis] > node->dist)
-            node = node->children[0];
-        else if (ent->absmax[node->axis] < node->dist)
-            node = node->children[1];
-        else
-            break;        // crosses the node
-    }
-
-    // link it in
-    if (ent->solid == SOLID_TRIGGER)
-        List_Append(&node->trigger_edicts, &ent->area);
-    else
-        List_Append(&node->solid_edicts, &ent->area);
+    SV_LinkArea(ent);
 }
 
 
@@ -377,6 +1033,7 @@ static void SV_AreaEdicts_r(areanode_t *node)
         start = &node->trigger_edicts;
 
     LIST_FOR_EACH(edict_t, check, start, area) {
+        SV_CheckTraceDeps(check);
         if (check->solid == SOLID_NOT)
             continue;        // deactivated
         if (check->absmin[0] > area_maxs[0]
@@ -421,7 +1078,10 @@ int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs,
     area_maxcount = maxcount;
     area_type = areatype;
 
-    SV_AreaEdicts_r(sv_areanodes);
+    if (sv_areabvh_enabled)
+        SV_AreaEdictsBVH();
+    else
+        SV_AreaEdicts_r(sv_areanodes);
 
     return area_count;
 }
@@ -458,16 +1118,12 @@ static mnode_t *SV_HullForEntity(edict_t *ent)
 SV_PointContents
 =============
 */
-int SV_PointContents(const vec3_t p)
+static int SV_ClipPointContents(const vec3_t p)
 {
     edict_t     *touch[MAX_EDICTS], *hit;
     int         i, num;
     int         contents;
 
-    if (!sv.cm.cache) {
-        Com_Error(ERR_DROP, "%s: no map loaded", __func__);
-    }
-
     // get base contents from world
     contents = CM_PointContents(p, sv.cm.cache->nodes);
 
@@ -485,6 +1141,30 @@ int SV_PointContents(const vec3_t p)
     return contents;
 }
 
+int SV_PointContents(const vec3_t p)
+{
+    pointcache_t *entry;
+
+    if (!sv.cm.cache) {
+        Com_Error(ERR_DROP, "%s: no map loaded", __func__);
+    }
+
+    if (!sv_tracecache_enabled)
+        return SV_ClipPointContents(p);
+
+    entry = SV_PointCacheEntry(p);
+    if (entry->generation == sv_tracecache_generation && VectorCompare(entry->point, p)) {
+        sv_tracecache_stats.pointhits++;
+        return entry->contents;
+    }
+
+    sv_tracecache_stats.pointmisses++;
+    entry->generation = sv_tracecache_generation;
+    entry->contents = SV_ClipPointContents(p);
+    VectorCopy(p, entry->point);
+    return entry->contents;
+}
+
 /*
 ====================
 SV_ClipMoveToEntities
@@ -543,6 +1223,172 @@ static void SV_ClipMoveToEntities(const vec3_t start, const vec3_t mins,
     }
 }
 
+/*
+===============================================================================
+
+TRACE BENCHMARK
+
+Records SV_Trace queries made by the game, then replays them using both the
+areanode tree and the dynamic AABB tree.
+===============================================================================
+*/
+
+typedef struct {
+    vec3_t  start, mins, maxs, end;
+    int     passent;        // -1 if none
+    int     contentmask;
+} tracequery_t;
+
+static tracequery_t *sv_tracequeries;
+static int          sv_numtracequeries;
+static int          sv_maxtracequeries;
+
+static void SV_RecordTrace(const vec3_t start, const vec3_t mins,
+                           const vec3_t maxs, const vec3_t end,
+                           edict_t *passedict, int contentmask)
+{
+    tracequery_t *q = &sv_tracequeries[sv_numtracequeries++];
+
+    VectorCopy(start, q->start);
+    VectorCopy(mins, q->mins);
+    VectorCopy(maxs, q->maxs);
+    VectorCopy(end, q->end);
+    q->passent = passedict ? NUM_FOR_EDICT(passedict) : -1;
+    q->contentmask = contentmask;
+
+    if (sv_numtracequeries == sv_maxtracequeries)
+        Com_Printf("Recorded %d trace queries.\n", sv_numtracequeries);
+}
+
+static void SV_TraceRecord_f(void)
+{
+    int count;
+
+    if (Cmd_Argc() != 2) {
+        Com_Printf("Usage: %s <count>\n", Cmd_Argv(0));
+        return;
+    }
+
+    count = Q_clip(Q_atoi(Cmd_Argv(1)), 0, 1000000);
+
+    Z_Freep((void **)&sv_tracequeries);
+    sv_numtracequeries = sv_maxtracequeries = 0;
+
+    if (!count)
+        return;
+
+    sv_tracequeries = SV_Malloc(sizeof(sv_tracequeries[0]) * count);
+    sv_maxtracequeries = count;
+    Com_Printf("Recording next %d trace queries.\n", count);
+}
+
+static unsigned SV_ReplayTraces(trace_t *results, int repeat)
+{
+    const tracequery_t *q;
+    unsigned start;
+    int i, j;
+
+    start = Sys_Milliseconds();
+    for (j = 0; j < repeat; j++) {
+        for (i = 0, q = sv_tracequeries; i < sv_numtracequeries; i++, q++) {
+            edict_t *pass = q->passent >= 0 && q->passent < ge->num_edicts ? EDICT_NUM(q->passent) : NULL;
+            results[i] = SV_Trace(q->start, q->mins, q->maxs, q->end, pass, q->contentmask);
+        }
+    }
+
+    return Sys_Milliseconds() - start;
+}
+
+static void SV_TraceBench_f(void)
+{
+    trace_t *results[2];
+    unsigned time[2];
+    bool bvh = sv_areabvh_enabled, cache;
+    int i, repeat, maxqueries, mismatches;
+
+    if (!sv.cm.cache || !ge || sv.state != ss_game) {
+        Com_Printf("No game running.\n");
+        return;
+    }
+
+    if (sv_numtracequeries < sv_maxtracequeries || !sv_numtracequeries) {
+        Com_Printf("Use 'tracerecord' to record trace queries first.\n");
+        return;
+    }
+
+    repeat = Cmd_Argc() > 1 ? Q_clip(Q_atoi(Cmd_Argv(1)), 1, 1000) : 10;
+
+    results[0] = SV_Malloc(sizeof(trace_t) * sv_numtracequeries);
+    results[1] = SV_Malloc(sizeof(trace_t) * sv_numtracequeries);
+
+    // don't record or cache replayed traces
+    maxqueries = sv_maxtracequeries;
+    sv_maxtracequeries = 0;
+    cache = sv_tracecache_enabled;
+    sv_tracecache_enabled = false;
+
+    SV_SetBroadphase(false);
+    time[0] = SV_ReplayTraces(results[0], repeat);
+    SV_SetBroadphase(true);
+    time[1] = SV_ReplayTraces(results[1], repeat);
+    SV_SetBroadphase(bvh);
+
+    sv_maxtracequeries = maxqueries;
+    sv_tracecache_enabled = cache;
+    SV_InvalidateTraceCache();
+
+    // entity hit may differ when distances are equal, as order of edicts differs
+    mismatches = 0;
+    for (i = 0; i < sv_numtracequeries; i++) {
+        trace_t *a = &results[0][i], *b = &results[1][i];
+        if (a->fraction != b->fraction || a->allsolid != b->allsolid ||
+            a->startsolid != b->startsolid || !VectorCompare(a->endpos, b->endpos))
+            mismatches++;
+    }
+
+    Com_Printf("%d traces x %d: areanodes %u ms, dynamic tree %u ms\n",
+               sv_numtracequeries, repeat, time[0], time[1]);
+    if (mismatches)
+        Com_WPrintf("%d traces differ!\n", mismatches);
+
+    Z_Free(results[0]);
+    Z_Free(results[1]);
+}
+
+static const cmdreg_t c_world[] = {
+    { "tracerecord", SV_TraceRecord_f },
+    { "tracebench", SV_TraceBench_f },
+    { "tracecache", SV_TraceCache_f },
+
+    { NULL }
+};
+
+static void sv_broadphase_changed(cvar_t *self)
+{
+    SV_SetBroadphase(self->integer > 0);
+}
+
+void SV_RegisterWorld(void)
+{
+    sv_broadphase = Cvar_Get("sv_broadphase", "0", 0);
+    sv_broadphase->changed = sv_broadphase_changed;
+
+    sv_tracecache = Cvar_Get("sv_tracecache", "0", 0);
+    sv_tracecache->changed = sv_tracecache_changed;
+
+    Cmd_Register(c_world);
+}
+
+void SV_FreeWorld(void)
+{
+    bvh_clear(&sv_areabvh[0]);
+    bvh_clear(&sv_areabvh[1]);
+    memset(sv_areabvh_links, 0, sizeof(sv_areabvh_links));
+    Z_Freep((void **)&sv_tracequeries);
+    sv_numtracequeries = sv_maxtracequeries = 0;
+    SV_EnableTraceCache(false);
+}
+
 /*
 ==================
 SV_Trace
@@ -551,11 +1397,30 @@ Moves the given mins/maxs volume through the world from start to end.
 Passedict and edicts owned by passedict are explicitly not checked.
 ==================
 */
+static trace_t SV_ClipTrace(const vec3_t start, const vec3_t mins,
+                            const vec3_t maxs, const vec3_t end,
+                            edict_t *passedict, int contentmask)
+{
+    trace_t     trace;
+
+    // clip to world
+    CM_BoxTrace(&trace, start, end, mins, maxs, sv.cm.cache->nodes, contentmask);
+    trace.ent = ge->edicts;
+    if (trace.fraction == 0) {
+        return trace;   // blocked by the world
+    }
+
+    // clip to other solid entities
+    SV_ClipMoveToEntities(start, mins, maxs, end, passedict, contentmask, &trace);
+    return trace;
+}
+
 trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
                            const vec3_t maxs, const vec3_t end,
                            edict_t *passedict, int contentmask)
 {
-    trace_t     trace;
+    tracecache_t *entry;
+    edict_t *passowner;
 
     if (!sv.cm.cache) {
         Com_Error(ERR_DROP, "%s: no map loaded", __func__);
@@ -566,15 +1431,94 @@ trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
     if (!maxs)
         maxs = vec3_origin;
 
-    // clip to world
-    CM_BoxTrace(&trace, start, end, mins, maxs, sv.cm.cache->nodes, contentmask);
-    trace.ent = ge->edicts;
-    if (trace.fraction == 0) {
-        return trace;   // blocked by the world
+    if (sv_numtracequeries < sv_maxtracequeries)
+        SV_RecordTrace(start, mins, maxs, end, passedict, contentmask);
+
+    if (!sv_tracecache_enabled)
+        return SV_ClipTrace(start, mins, maxs, end, passedict, contentmask);
+
+    passowner = passedict ? passedict->owner : NULL;
+    entry = SV_TraceCacheEntry(start, mins, maxs, end, passedict, contentmask);
+    if (entry->generation == sv_tracecache_generation &&
+        entry->passedict == passedict && entry->passowner == passowner &&
+        entry->contentmask == contentmask &&
+        VectorCompare(entry->start, start) && VectorCompare(entry->end, end) &&
+        VectorCompare(entry->mins, mins) && VectorCompare(entry->maxs, maxs)) {
+        if (entry->trace.ent == ge->edicts || !SV_TraceDepsChanged(entry->trace.ent)) {
+            sv_tracecache_stats.tracehits++;
+            return entry->trace;
+        }
+        SV_CheckTraceDeps(entry->trace.ent);
     }
 
-    // clip to other solid entities
-    SV_ClipMoveToEntities(start, mins, maxs, end, passedict, contentmask, &trace);
-    return trace;
+    sv_tracecache_stats.tracemisses++;
+    entry->generation = sv_tracecache_generation;
+    entry->passedict = passedict;
+    entry->passowner = passowner;
+    entry->contentmask = contentmask;
+    VectorCopy(start, entry->start);
+    VectorCopy(end, entry->end);
+    VectorCopy(mins, entry->mins);
+    VectorCopy(maxs, entry->maxs);
+    entry->trace = SV_ClipTrace(start, mins, maxs, end, passedict, contentmask);
+    return entry->trace;
+}
+
+/*
+==================
+SV_TraceBatch
+
+Runs independent traces from the game. Requests are sorted by world leaf of
+their start point, so traces starting close to each other walk the same BSP
+nodes and brushes back to back.
+==================
+*/
+#define MAX_TRACE_BATCH     256
+
+typedef struct {
+    int     leafnum;
+    int     index;
+} tracesort_t;
+
+static int tracesortcmp(const void *p1, const void *p2)
+{
+    const tracesort_t *a = p1, *b = p2;
+
+    if (a->leafnum != b->leafnum)
+        return a->leafnum - b->leafnum;
+    return a->index - b->index;
+}
+
+void SV_TraceBatch(const trace_request_t *requests, trace_t *results, int count)
+{
+    tracesort_t order[MAX_TRACE_BATCH];
+    const trace_request_t *req;
+    int i, n;
+
+    if (!sv.cm.cache) {
+        Com_Error(ERR_DROP, "%s: no map loaded", __func__);
+    }
+
+    while (count > 0) {
+        n = min(count, MAX_TRACE_BATCH);
+
+        for (i = 0; i < n; i++) {
+            order[i].leafnum = CM_PointLeaf(&sv.cm, requests[i].start) - sv.cm.cache->leafs;
+            order[i].index = i;
+        }
+
+        if (n > 2)
+            qsort(order, n, sizeof(order[0]), tracesortcmp);
+
+        for (i = 0; i < n; i++) {
+            req = &requests[order[i].index];
+            results[order[i].index] = SV_Trace(req->start, req->mins, req->maxs,
+                                               req->end, req->passent, req->contentmask);
+        }
+
+        requests += n;
+        results += n;
+        count -= n;
+    }
 }
 
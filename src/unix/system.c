@@ -80,6 +80,13 @@ unsigned Sys_Milliseconds(void)
     return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000ULL;
+}
+
 /*
 =================
 Sys_Quit
@@ -128,6 +135,12 @@ void Sys_Sleep(int msec)
     nanosleep(&req, NULL);
 }
 
+int Sys_GetNumCPUs(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
 const char *Sys_ErrorString(int err)
 {
     return strerror(err);
@@ -209,6 +222,21 @@ Sys_IsFile(const char *path)
 	return false;
 }
 
+void *Sys_MapFile(FILE *fp, size_t size)
+{
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    return data;
+}
+
+void Sys_UnmapFile(void *data, size_t size)
+{
+    munmap(data, size);
+}
+
 /*
 =================
 Sys_Init
@@ -876,6 +876,14 @@ unsigned Sys_Milliseconds(void)
     return tm.QuadPart * 1000ULL / timer_freq.QuadPart;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    LARGE_INTEGER tm;
+    QueryPerformanceCounter(&tm);
+    return tm.QuadPart / timer_freq.QuadPart * 1000000ULL +
+           tm.QuadPart % timer_freq.QuadPart * 1000000ULL / timer_freq.QuadPart;
+}
+
 void Sys_AddDefaultConfig(void)
 {
 }
@@ -885,6 +893,13 @@ void Sys_Sleep(int msec)
     Sleep(msec);
 }
 
+int Sys_GetNumCPUs(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+}
+
 const char *Sys_ErrorString(int err)
 {
     static char buf[256];
@@ -1171,6 +1186,30 @@ bool Sys_IsFile(const char *path)
 	return (fileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) == 0;
 }
 
+void *Sys_MapFile(FILE *fp, size_t size)
+{
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(fp));
+    HANDLE mapping;
+    void *data;
+
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+        return NULL;
+
+    // view keeps the mapping alive
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+    CloseHandle(mapping);
+    return data;
+}
+
+void Sys_UnmapFile(void *data, size_t size)
+{
+    UnmapViewOfFile(data);
+}
+
 /*
 ========================================================================
 